@@ -0,0 +1,16 @@
+#The shefLM Python module, over libshefLM (see src/shefLM.h).  Build and install the library first, then
+#	python3 setup.py build_ext --inplace
+#or, to use a library that was built but not installed, point it at the build tree:
+#	python3 setup.py build_ext --inplace -L ../build/src/.libs -R ../build/src/.libs
+from setuptools import setup, Extension
+
+setup(
+	name='shefLM',
+	version='1.0',
+	description='Lookups in ngram models written by shefLMStore',
+	license='LGPLv3+',
+	ext_modules=[Extension('shefLM',
+		sources=['shefLMmodule.c'],
+		include_dirs=['../src'],
+		libraries=['shefLM', 'pthread'])],
+)
@@ -0,0 +1,421 @@
+/*
+ *  shefLMmodule.c
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* The shefLM Python module, a Model type over the C interface of libshefLM (shefLM.h).
+ * query_many and score_many take a sequence of str (or bytes) and give back a memoryview of uint64 values or
+ * doubles rather than a list of Python ints, which numpy.frombuffer can use without a copy.  They release the GIL
+ * while they look the keys up and split a large batch over threads, as a handle of libshefLM can be queried by
+ * any number of threads at once.  The threads are a pool that is started the first time a batch needs it and
+ * kept for the later batches, so a batch doesn't pay for starting threads.
+ * This uses the Python C API rather than Boost.Python: the bundled boost_1_42_0 only has the Boost.Python headers,
+ * and that version of Boost.Python does not support Python 3. */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "shefLM.h"
+
+/* a batch is only split for at least this many keys a thread, below that handing a slice over costs more than it saves */
+#define KEYS_PER_THREAD 16384
+#define SENTENCES_PER_THREAD 256
+
+typedef struct {
+	PyObject_HEAD
+	shef_lm *lm;
+} ModelObject;
+
+/* a slice of a batch that one thread does */
+typedef struct {
+	const shef_lm *lm;
+	const char **keys;
+	size_t *lengths;
+	size_t count;
+	uint64_t unique_bigrams;
+	void *results;	/* uint64_t for queries, double for scores */
+} Slice;
+
+/* the slices of a batch queued for the pool */
+typedef struct Task {
+	void *(*work)(void*);
+	Slice *slice;
+	size_t *remaining;	/* the tasks of the batch that are not done yet */
+	struct Task *next;
+} Task;
+
+/* The pool of worker threads, shared by every Model and by the Python threads that run batches at the same time.
+ * The threads are detached and wait for tasks until the process exits.  pool_mutex guards all of it. */
+#define MAX_POOL_THREADS 255
+static pthread_mutex_t pool_mutex=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_work=PTHREAD_COND_INITIALIZER;	/* signalled when tasks are queued */
+static pthread_cond_t pool_done=PTHREAD_COND_INITIALIZER;	/* broadcast when the last task of a batch is done */
+static Task *pool_head=NULL, *pool_tail=NULL;
+static size_t pool_threads=0;
+
+
+static void *query_slice(void *p){
+	Slice *slice=(Slice*)p;
+	shef_lm_query_batch(slice->lm,slice->keys,slice->lengths,slice->count,(uint64_t*)slice->results);
+	return NULL;
+}
+
+static void *score_slice(void *p){
+	Slice *slice=(Slice*)p;
+	double *scores=(double*)slice->results;
+	size_t i;
+	for (i=0; i<slice->count; ++i) scores[i]=shef_lm_score_sentence(slice->lm,slice->keys[i],slice->unique_bigrams,NULL);
+	return NULL;
+}
+
+/* the next queued task, called with pool_mutex locked */
+static Task *pool_take(void){
+	Task *task=pool_head;
+	if (task!=NULL) {
+		pool_head=task->next;
+		if (pool_head==NULL) pool_tail=NULL;
+	}
+	return task;
+}
+
+/* does a task that has been taken from the queue, called and returns with pool_mutex locked */
+static void pool_run(Task *task){
+	pthread_mutex_unlock(&pool_mutex);
+	task->work(task->slice);
+	pthread_mutex_lock(&pool_mutex);
+	if (--*task->remaining==0) pthread_cond_broadcast(&pool_done);
+}
+
+static void *pool_worker(void *unused){
+	(void)unused;
+	pthread_mutex_lock(&pool_mutex);
+	for (;;) {
+		Task *task=pool_take();
+		if (task==NULL) pthread_cond_wait(&pool_work,&pool_mutex);
+		else pool_run(task);
+	}
+	return NULL;
+}
+
+/* starts threads until the pool has wanted of them, called with pool_mutex locked.  If a thread can't be started
+ * the pool stays smaller and the tasks it doesn't take are done by the threads that queue them. */
+static void pool_grow(const size_t wanted){
+	pthread_attr_t attr;
+	if (pool_threads>=wanted || pthread_attr_init(&attr)!=0) return;
+	pthread_attr_setdetachstate(&attr,PTHREAD_CREATE_DETACHED);
+	while (pool_threads<wanted && pool_threads<MAX_POOL_THREADS) {
+		pthread_t id;
+		if (pthread_create(&id,&attr,pool_worker,NULL)!=0) break;
+		++pool_threads;
+	}
+	pthread_attr_destroy(&attr);
+}
+
+/* the threads of the pool are not in a child process, so it starts with an empty pool */
+static void pool_after_fork(void){
+	pthread_mutex_init(&pool_mutex,NULL);
+	pthread_cond_init(&pool_work,NULL);
+	pthread_cond_init(&pool_done,NULL);
+	pool_head=pool_tail=NULL;
+	pool_threads=0;
+}
+
+/* runs work over the keys of whole, whose results are value_size bytes each, with up to threads threads (0 for
+ * one a cpu), called without the GIL */
+static void run_batch(void *(*work)(void*), Slice *whole, const size_t value_size, size_t threads, const size_t per_thread){
+	Slice slices[MAX_POOL_THREADS+1];
+	Task tasks[MAX_POOL_THREADS+1];
+	size_t n, i, remaining, offset=0;
+	if (threads==0) {
+		const long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+		threads=cpus>0?(size_t)cpus:1;
+	}
+	n=(whole->count+per_thread-1)/per_thread;
+	if (n>threads) n=threads;
+	if (n>MAX_POOL_THREADS+1) n=MAX_POOL_THREADS+1;
+	if (n<2) {
+		work(whole);
+		return;
+	}
+	for (i=0; i<n; ++i) {
+		const size_t count=whole->count/n+(i<whole->count%n?1:0);
+		slices[i]=*whole;
+		slices[i].keys=whole->keys+offset;
+		slices[i].lengths=whole->lengths?whole->lengths+offset:NULL;
+		slices[i].count=count;
+		slices[i].results=(char*)whole->results+offset*value_size;
+		offset+=count;
+	}
+	/* slice 0 is done by the calling thread and the others are queued for the pool */
+	remaining=n-1;
+	pthread_mutex_lock(&pool_mutex);
+	pool_grow(n-1);
+	for (i=1; i<n; ++i) {
+		tasks[i].work=work;
+		tasks[i].slice=&slices[i];
+		tasks[i].remaining=&remaining;
+		tasks[i].next=NULL;
+		if (pool_tail) pool_tail->next=&tasks[i];
+		else pool_head=&tasks[i];
+		pool_tail=&tasks[i];
+	}
+	pthread_cond_broadcast(&pool_work);
+	pthread_mutex_unlock(&pool_mutex);
+	work(&slices[0]);
+	/* then it does queued tasks (of this or another batch) rather than wait while there are any */
+	pthread_mutex_lock(&pool_mutex);
+	while (remaining>0) {
+		Task *task=pool_take();
+		if (task==NULL) pthread_cond_wait(&pool_done,&pool_mutex);
+		else pool_run(task);
+	}
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+/* the utf-8 bytes of every str (or bytes) of sequence, which must stay alive (in the returned tuple) while they are used */
+static PyObject *key_pointers(PyObject *sequence, const char ***keys, size_t **lengths, Py_ssize_t *count){
+	Py_ssize_t i;
+	PyObject *items=PySequence_Tuple(sequence);
+	if (items==NULL) return NULL;
+	*count=PyTuple_GET_SIZE(items);
+	*keys=PyMem_Malloc((*count?*count:1)*sizeof(char*));
+	*lengths=PyMem_Malloc((*count?*count:1)*sizeof(size_t));
+	if (*keys==NULL || *lengths==NULL) {
+		PyMem_Free(*keys);
+		PyMem_Free(*lengths);
+		Py_DECREF(items);
+		PyErr_NoMemory();
+		return NULL;
+	}
+	for (i=0; i<*count; ++i) {
+		PyObject *item=PyTuple_GET_ITEM(items,i);
+		Py_ssize_t length;
+		const char *key;
+		if (PyUnicode_Check(item)) {
+			key=PyUnicode_AsUTF8AndSize(item,&length);
+		}else if (PyBytes_Check(item)) {
+			key=PyBytes_AS_STRING(item);
+			length=PyBytes_GET_SIZE(item);
+		}else {
+			PyErr_Format(PyExc_TypeError,"item %zd is a %.200s, not a str or bytes",i,Py_TYPE(item)->tp_name);
+			key=NULL;
+		}
+		if (key==NULL) {
+			PyMem_Free(*keys);
+			PyMem_Free(*lengths);
+			Py_DECREF(items);
+			return NULL;
+		}
+		(*keys)[i]=key;
+		(*lengths)[i]=length;
+	}
+	return items;
+}
+
+/* a memoryview of format ("Q" or "d") over a new bytearray of count values, which the caller fills through data */
+static PyObject *result_buffer(const Py_ssize_t count, const size_t value_size, const char *format, void **data){
+	PyObject *bytes=PyByteArray_FromStringAndSize(NULL,count*value_size);
+	PyObject *view, *typed;
+	if (bytes==NULL) return NULL;
+	*data=PyByteArray_AS_STRING(bytes);
+	view=PyMemoryView_FromObject(bytes);
+	Py_DECREF(bytes);
+	if (view==NULL) return NULL;
+	typed=PyObject_CallMethod(view,"cast","s",format);
+	Py_DECREF(view);
+	return typed;
+}
+
+
+static int Model_init(ModelObject *self, PyObject *args, PyObject *kwds){
+	static char *kwlist[]={"basefilename","shm",NULL};
+	const char *basefilename, *shm=NULL;
+	shef_lm *lm;
+	if (!PyArg_ParseTupleAndKeywords(args,kwds,"s|z",kwlist,&basefilename,&shm)) return -1;
+	if (self->lm) {
+		PyErr_SetString(PyExc_RuntimeError,"the model is already open");
+		return -1;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	lm=shm?shef_lm_open_shared(shm,basefilename):shef_lm_open(basefilename);
+	Py_END_ALLOW_THREADS
+	if (lm==NULL) {
+		PyErr_SetFromErrnoWithFilename(PyExc_OSError,basefilename);
+		return -1;
+	}
+	self->lm=lm;
+	return 0;
+}
+
+static void Model_dealloc(ModelObject *self){
+	shef_lm_close(self->lm);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static int Model_check(ModelObject *self){
+	if (self->lm) return 1;
+	PyErr_SetString(PyExc_ValueError,"the model is not open");
+	return 0;
+}
+
+static PyObject *Model_query(ModelObject *self, PyObject *args){
+	const char *ngram;
+	Py_ssize_t length;
+	if (!Model_check(self) || !PyArg_ParseTuple(args,"s#",&ngram,&length)) return NULL;
+	return PyLong_FromUnsignedLongLong(shef_lm_query(self->lm,ngram,length));
+}
+
+static PyObject *Model_query_many(ModelObject *self, PyObject *args, PyObject *kwds){
+	static char *kwlist[]={"ngrams","threads",NULL};
+	PyObject *sequence, *items, *values;
+	Py_ssize_t threads=0, count;
+	Slice whole;
+	if (!Model_check(self) || !PyArg_ParseTupleAndKeywords(args,kwds,"O|n",kwlist,&sequence,&threads)) return NULL;
+	items=key_pointers(sequence,&whole.keys,&whole.lengths,&count);
+	if (items==NULL) return NULL;
+	values=result_buffer(count,sizeof(uint64_t),"Q",&whole.results);
+	if (values!=NULL) {
+		whole.lm=self->lm;
+		whole.count=count;
+		whole.unique_bigrams=0;
+		Py_BEGIN_ALLOW_THREADS
+		run_batch(query_slice,&whole,sizeof(uint64_t),threads>0?threads:0,KEYS_PER_THREAD);
+		Py_END_ALLOW_THREADS
+	}
+	PyMem_Free(whole.keys);
+	PyMem_Free(whole.lengths);
+	Py_DECREF(items);
+	return values;
+}
+
+static PyObject *Model_score_sentence(ModelObject *self, PyObject *args){
+	const char *sentence;
+	unsigned long long unique_bigrams;
+	size_t words;
+	double score;
+	if (!Model_check(self) || !PyArg_ParseTuple(args,"sK",&sentence,&unique_bigrams)) return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	score=shef_lm_score_sentence(self->lm,sentence,unique_bigrams,&words);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("(dn)",score,(Py_ssize_t)words);
+}
+
+static PyObject *Model_score_many(ModelObject *self, PyObject *args, PyObject *kwds){
+	static char *kwlist[]={"sentences","unique_bigrams","threads",NULL};
+	PyObject *sequence, *items, *scores;
+	unsigned long long unique_bigrams;
+	Py_ssize_t threads=0, count, i;
+	Slice whole;
+	if (!Model_check(self) || !PyArg_ParseTupleAndKeywords(args,kwds,"OK|n",kwlist,&sequence,&unique_bigrams,&threads)) return NULL;
+	items=key_pointers(sequence,&whole.keys,&whole.lengths,&count);
+	if (items==NULL) return NULL;
+	/* the sentences are read up to their terminating nul, so one with a nul in it is refused */
+	for (i=0; i<count; ++i) {
+		if (strlen(whole.keys[i])!=whole.lengths[i]) {
+			PyErr_Format(PyExc_ValueError,"sentence %zd has a nul character in it",i);
+			PyMem_Free(whole.keys);
+			PyMem_Free(whole.lengths);
+			Py_DECREF(items);
+			return NULL;
+		}
+	}
+	scores=result_buffer(count,sizeof(double),"d",&whole.results);
+	if (scores!=NULL) {
+		whole.lm=self->lm;
+		whole.count=count;
+		whole.unique_bigrams=unique_bigrams;
+		Py_BEGIN_ALLOW_THREADS
+		run_batch(score_slice,&whole,sizeof(double),threads>0?threads:0,SENTENCES_PER_THREAD);
+		Py_END_ALLOW_THREADS
+	}
+	PyMem_Free(whole.keys);
+	PyMem_Free(whole.lengths);
+	Py_DECREF(items);
+	return scores;
+}
+
+static Py_ssize_t Model_length(ModelObject *self){
+	if (!Model_check(self)) return -1;
+	return (Py_ssize_t)shef_lm_size(self->lm);
+}
+
+
+static PyMethodDef Model_methods[]={
+	{"query",(PyCFunction)Model_query,METH_VARARGS,
+		"query(ngram) -> int\n\nThe value of the ngram (its words separated by single spaces), 0 if it is not in the model."},
+	{"query_many",(PyCFunction)(void(*)(void))Model_query_many,METH_VARARGS|METH_KEYWORDS,
+		"query_many(ngrams, threads=0) -> memoryview\n\nThe values of a sequence of ngrams as a memoryview of uint64 (format 'Q').  The GIL is released\n"
+		"while they are looked up, with up to threads threads (0 for one a cpu) for a large batch."},
+	{"score_sentence",(PyCFunction)Model_score_sentence,METH_VARARGS,
+		"score_sentence(sentence, unique_bigrams) -> (log2prob, words)\n\nThe sum of the log2 Kneser-Ney trigram probabilities of the words of the sentence, as\n"
+		"shefLMStore -k computes them, and the number of words."},
+	{"score_many",(PyCFunction)(void(*)(void))Model_score_many,METH_VARARGS|METH_KEYWORDS,
+		"score_many(sentences, unique_bigrams, threads=0) -> memoryview\n\nThe score_sentence log2 probability of every sentence of a sequence as a memoryview of double\n"
+		"(format 'd'), computed without the GIL as query_many is."},
+	{NULL}
+};
+
+static PySequenceMethods Model_as_sequence={
+	(lenfunc)Model_length,
+};
+
+static PyTypeObject ModelType={
+	PyVarObject_HEAD_INIT(NULL,0)
+	"shefLM.Model",
+};
+
+static PyModuleDef shefLMmodule={
+	PyModuleDef_HEAD_INIT,
+	"shefLM",
+	"Lookups in ngram models written by shefLMStore -g, through libshefLM.",
+	-1,
+	NULL,
+};
+
+PyMODINIT_FUNC PyInit_shefLM(void){
+	PyObject *module;
+	ModelType.tp_basicsize=sizeof(ModelObject);
+	ModelType.tp_flags=Py_TPFLAGS_DEFAULT;
+	ModelType.tp_doc="Model(basefilename, shm=None)\n\nThe model written by shefLMStore -g with this base file name.  With shm it is the shared memory\n"
+		"segment of that name, made from the files if no process has made it yet, as shefLMStore --shm does.";
+	ModelType.tp_new=PyType_GenericNew;
+	ModelType.tp_init=(initproc)Model_init;
+	ModelType.tp_dealloc=(destructor)Model_dealloc;
+	ModelType.tp_methods=Model_methods;
+	ModelType.tp_as_sequence=&Model_as_sequence;
+	if (PyType_Ready(&ModelType)<0) return NULL;
+	pthread_atfork(NULL,NULL,pool_after_fork);
+	module=PyModule_Create(&shefLMmodule);
+	if (module==NULL) return NULL;
+	Py_INCREF(&ModelType);
+	if (PyModule_AddObject(module,"Model",(PyObject*)&ModelType)<0) {
+		Py_DECREF(&ModelType);
+		Py_DECREF(module);
+		return NULL;
+	}
+	PyModule_AddStringConstant(module,"library_version",shef_lm_version());
+	return module;
+}
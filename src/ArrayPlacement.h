@@ -0,0 +1,213 @@
+/*
+ *  ArrayPlacement.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Where the big arrays of a model live.  Lookups hit the fingerprint bits and the codes at random so with 4 KB pages
+//nearly every query misses the TLB.  MappedArrays is memory for the arrays (see SharedArrays.h) that is backed by
+//2 MB pages: explicit ones (MAP_HUGETLB) if the system has them reserved, else transparent ones asked for with
+//MADV_HUGEPAGE, else normal pages.
+//On a machine with more than one NUMA node the pages can be interleaved over the nodes, or bound to one node so
+//each node can have its own copy of the model (see MPHR::placeArrays).  This uses the mbind system call directly
+//so there is no need for libnuma.
+
+#ifndef ARRAY_PLACEMENT_H
+#define ARRAY_PLACEMENT_H
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <stdint.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+
+enum NumaPlacement {NUMA_LOCAL, NUMA_INTERLEAVE, NUMA_REPLICATE};
+
+inline bool numa_placement_from_name(const std::string &name, NumaPlacement &placement){
+	if (name=="local") placement=NUMA_LOCAL;
+	else if (name=="interleave") placement=NUMA_INTERLEAVE;
+	else if (name=="replicate") placement=NUMA_REPLICATE;
+	else return false;
+	return true;
+}
+
+
+//the NUMA nodes of the machine and the node of every cpu, read once from /sys
+class NumaNodes {
+public:
+	static const NumaNodes & instance(){
+		static NumaNodes nodes;
+		return nodes;
+	}
+	unsigned count() const {return node_ids.size();}
+	unsigned id(const unsigned &i) const {return node_ids[i];}
+	//the index (not the id) of the node of the cpu the calling thread is on
+	unsigned current() const {
+		if (node_ids.size()<2) return 0;
+		const int cpu=sched_getcpu();
+		return (cpu>=0 && static_cast<size_t>(cpu)<cpu_node.size())?cpu_node[cpu]:0;
+	}
+	//sets the policy of the pages of [p,p+bytes) before they are touched: mode is MPOL_INTERLEAVE over every node
+	//or MPOL_BIND to the node with index i.  Returns false (and the kernel default is kept) if the kernel says no.
+	bool bind(void *p, const uint64_t &bytes, const int &mode, const unsigned &i=0) const {
+		std::vector<unsigned long> mask;
+		if (!node_mask(mode,i,mask)) return false;
+		return syscall(SYS_mbind,p,bytes,mode,&mask[0],mask.size()*8*sizeof(unsigned long),0)==0;
+	}
+	//the policy of the memory the calling thread allocates from now on, MPOL_DEFAULT to go back to the local node
+	bool prefer(const int &mode, const unsigned &i=0) const {
+		if (mode==MPOL_DEFAULT) return syscall(SYS_set_mempolicy,MPOL_DEFAULT,NULL,0)==0;
+		std::vector<unsigned long> mask;
+		if (!node_mask(mode,i,mask)) return false;
+		return syscall(SYS_set_mempolicy,mode,&mask[0],mask.size()*8*sizeof(unsigned long))==0;
+	}
+
+private:
+	NumaNodes(){
+		read_list("/sys/devices/system/node/online",node_ids);
+		if (node_ids.empty()) node_ids.push_back(0);
+		for (unsigned i=0; i<node_ids.size(); ++i) {
+			std::vector<unsigned> cpus;
+			char name[64];
+			snprintf(name,sizeof(name),"/sys/devices/system/node/node%u/cpulist",node_ids[i]);
+			read_list(name,cpus);
+			for (size_t c=0; c<cpus.size(); ++c) {
+				if (cpus[c]>=cpu_node.size()) cpu_node.resize(cpus[c]+1,0);
+				cpu_node[cpus[c]]=i;
+			}
+		}
+	}
+	//reads a list such as 0-3,8,10-11
+	static void read_list(const char *fileName, std::vector<unsigned> &values){
+		std::ifstream in(fileName);
+		std::string text;
+		if (!std::getline(in,text)) return;
+		const char *p=text.c_str();
+		while (*p) {
+			char *end;
+			const unsigned long first=strtoul(p,&end,10);
+			if (end==p) break;
+			unsigned long last=first;
+			p=end;
+			if (*p=='-') {
+				last=strtoul(p+1,&end,10);
+				p=end;
+			}
+			for (unsigned long v=first; v<=last; ++v) values.push_back(v);
+			if (*p==',') ++p;
+		}
+	}
+	bool node_mask(const int &mode, const unsigned &i, std::vector<unsigned long> &mask) const {
+		const unsigned bits=8*sizeof(unsigned long);
+		unsigned largest=0;
+		for (size_t n=0; n<node_ids.size(); ++n) largest=std::max(largest,node_ids[n]);
+		mask.assign(largest/bits+1,0);
+		if (mode==MPOL_INTERLEAVE) {
+			for (size_t n=0; n<node_ids.size(); ++n) mask[node_ids[n]/bits]|=1UL<<(node_ids[n]%bits);
+		}else if (i<node_ids.size()) {
+			mask[node_ids[i]/bits]|=1UL<<(node_ids[i]%bits);
+		}else return false;
+		return true;
+	}
+
+	std::vector<unsigned> node_ids;
+	std::vector<unsigned> cpu_node;	//the index of the node of every cpu
+};
+
+
+//anonymous memory for the arrays of a model, unmapped when it is destroyed
+class MappedArrays {
+public:
+	static const uint64_t HUGE_PAGE_BYTES=2*1024*1024;
+
+	MappedArrays(const uint64_t &bytes, const bool &huge_pages);
+	~MappedArrays(){if (base_ptr) munmap(base_ptr,length);}
+	char * base() const {return base_ptr;}
+	uint64_t bytes() const {return length;}
+	//what backs the memory: "huge_pages" (MAP_HUGETLB), "transparent_huge_pages" or "pages"
+	const char * backing() const {return page_kind;}
+	//stops anything writing to the arrays once they are in place
+	void protect(){mprotect(base_ptr,length,PROT_READ);}
+
+	//asks for transparent huge pages for memory that is already mapped, such as shared memory
+	static bool advise_huge_pages(void *p, const uint64_t &bytes){
+#ifdef MADV_HUGEPAGE
+		return madvise(p,bytes,MADV_HUGEPAGE)==0;
+#else
+		return false;
+#endif
+	}
+
+private:
+	MappedArrays(const MappedArrays&); //disallow copy
+	void operator=(const MappedArrays&); //disallow assignment
+
+	char *base_ptr;
+	uint64_t length;
+	const char *page_kind;
+};
+
+inline MappedArrays::MappedArrays(const uint64_t &bytes, const bool &huge_pages):base_ptr(NULL),length(0),page_kind("pages"){
+	const uint64_t size=bytes?bytes:1;
+	void *p=MAP_FAILED;
+	if (huge_pages) {
+		length=(size+HUGE_PAGE_BYTES-1)/HUGE_PAGE_BYTES*HUGE_PAGE_BYTES;
+#ifdef MAP_HUGETLB
+		p=mmap(NULL,length,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+		if (p!=MAP_FAILED) page_kind="huge_pages";
+#endif
+		if (p==MAP_FAILED) {
+			//no huge pages are reserved, so map a huge page more than is needed and keep the part that starts on a huge page
+			p=mmap(NULL,length+HUGE_PAGE_BYTES,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+			if (p!=MAP_FAILED) {
+				char *start=static_cast<char*>(p);
+				char *aligned=reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(start)+HUGE_PAGE_BYTES-1)/HUGE_PAGE_BYTES*HUGE_PAGE_BYTES);
+				if (aligned>start) munmap(start,aligned-start);
+				munmap(aligned+length,start+HUGE_PAGE_BYTES-aligned);
+				p=aligned;
+				if (advise_huge_pages(p,length)) page_kind="transparent_huge_pages";
+				else std::cerr << "Warning: huge pages are not available so the arrays use normal pages"<<std::endl;
+			}
+		}
+	}else {
+		length=size;
+		p=mmap(NULL,length,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+	}
+	if (p==MAP_FAILED) {
+		std::cerr << "Error: can't map "<<length<<" bytes for the arrays of the model: "<<strerror(errno)<<std::endl;
+		exit(1);
+	}
+	base_ptr=static_cast<char*>(p);
+}
+
+
+#endif
@@ -0,0 +1,271 @@
+/*
+ *  Benchmark.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Small helpers shared by the shefLMBench modes: a clock, a seeded random number generator
+//(so runs can be repeated on any machine), a Zipfian sampler, latency percentiles and
+//the one line JSON records the results are written as.
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+
+inline uint64_t bench_now_ns(){
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return static_cast<uint64_t>(ts.tv_sec)*1000000000ULL+ts.tv_nsec;
+}
+
+//the least time between two calls to bench_now_ns, taken off every timed sample
+inline uint64_t bench_timer_overhead_ns(){
+	uint64_t overhead=~0ULL;
+	for (int i=0; i<1000; ++i) {
+		const uint64_t t0=bench_now_ns();
+		const uint64_t t1=bench_now_ns();
+		overhead=std::min(overhead,t1-t0);
+	}
+	return overhead;
+}
+
+
+//splitmix64, the same sequence on every platform for a given seed
+class BenchRandom {
+public:
+	explicit BenchRandom(const uint64_t &seed):state(seed){}
+	uint64_t next(){
+		uint64_t z=(state+=0x9E3779B97F4A7C15ULL);
+		z=(z^(z>>30))*0xBF58476D1CE4E5B9ULL;
+		z=(z^(z>>27))*0x94D049BB133111EBULL;
+		return z^(z>>31);
+	}
+	//uniform in [0,n)
+	uint64_t below(const uint64_t &n){return n?next()%n:0;}
+	//uniform in [0,1)
+	double unit(){return (next()>>11)*(1.0/9007199254740992.0);}
+private:
+	uint64_t state;
+};
+
+
+//Draws ranks 0..n-1 where rank r has probability proportional to 1/(r+1)^s, so rank 0 is the most common.
+//This is the shape of the ranks of ngram counts (most ngrams have the smallest count).
+class ZipfGenerator {
+public:
+	ZipfGenerator(const uint64_t &n, const double &s):cdf(n){
+		double sum=0;
+		for (uint64_t r=0; r<n; ++r) cdf[r]=(sum+=1.0/pow(static_cast<double>(r+1),s));
+		for (uint64_t r=0; r<n; ++r) cdf[r]/=sum;
+	}
+	uint64_t next(BenchRandom &rng) const{
+		const double u=rng.unit();
+		uint64_t r=std::upper_bound(cdf.begin(),cdf.end(),u)-cdf.begin();
+		return r<cdf.size()?r:cdf.size()-1;
+	}
+private:
+	std::vector<double> cdf;
+};
+
+
+//Collects one time per operation and reports percentiles
+class LatencyStats {
+public:
+	LatencyStats():total(0){}
+	void reserve(const size_t &n){samples.reserve(n);}
+	void add(const uint64_t &ns){samples.push_back(ns); total+=ns;}
+	void add(const LatencyStats &other){samples.insert(samples.end(),other.samples.begin(),other.samples.end()); total+=other.total;}
+	size_t size() const {return samples.size();}
+	double mean() const {return samples.empty()?0:static_cast<double>(total)/samples.size();}
+	//p is a fraction, 0.99 for the 99th percentile
+	uint64_t percentile(const double &p){
+		if (samples.empty()) return 0;
+		size_t k=static_cast<size_t>(p*(samples.size()-1)+0.5);
+		std::nth_element(samples.begin(),samples.begin()+k,samples.end());
+		return samples[k];
+	}
+private:
+	std::vector<uint64_t> samples;
+	uint64_t total;
+};
+
+
+//Builds one JSON object a field at a time.  Every result is printed as one of these on its own line
+//so the output can be read by a script (or grep) without a JSON library.
+class JsonRecord {
+public:
+	JsonRecord(){}
+	JsonRecord& add(const std::string &key, const std::string &value){
+		std::string escaped;
+		for (size_t i=0; i<value.size(); ++i) {
+			if (value[i]=='"' || value[i]=='\\') escaped+='\\';
+			escaped+=value[i];
+		}
+		return raw(key,"\""+escaped+"\"");
+	}
+	JsonRecord& add(const std::string &key, const char *value){return add(key,std::string(value));}
+	JsonRecord& add(const std::string &key, const double &value){
+		std::ostringstream s;
+		s.precision(6);
+		s<<std::fixed<<value;
+		return raw(key,s.str());
+	}
+	JsonRecord& add(const std::string &key, const uint64_t &value){
+		std::ostringstream s;
+		s<<value;
+		return raw(key,s.str());
+	}
+	JsonRecord& add(const std::string &key, const bool &value){return raw(key,value?"true":"false");}
+	JsonRecord& add(const std::string &key, const JsonRecord &value){return raw(key,value.str());}
+	//value is written as it is, so it must already be valid JSON
+	JsonRecord& raw(const std::string &key, const std::string &value){
+		if (!body.empty()) body+=",";
+		body+="\""+key+"\":"+value;
+		return *this;
+	}
+	std::string str() const {return "{"+body+"}";}
+private:
+	std::string body;
+};
+
+//mean and percentiles of a set of latencies as a JSON object
+inline JsonRecord latency_record(LatencyStats &stats){
+	JsonRecord r;
+	r.add("count",static_cast<uint64_t>(stats.size()))
+	 .add("mean_ns",stats.mean())
+	 .add("p50_ns",stats.percentile(0.5))
+	 .add("p90_ns",stats.percentile(0.9))
+	 .add("p99_ns",stats.percentile(0.99))
+	 .add("p999_ns",stats.percentile(0.999));
+	return r;
+}
+
+
+
+//Hardware counters (LLC misses, dTLB misses, instructions and branch misses) read with perf_event_open around a phase.
+//Counters the kernel or the machine will not give us (no permission, a VM, not Linux) are left out of the report,
+//so the benchmarks run the same everywhere and only report what they could measure.
+//Threads started while the counters are running are counted too.
+class PerfCounters {
+public:
+	explicit PerfCounters(const bool &enable);
+	~PerfCounters();
+	bool available() const {return !counters.empty();}
+	void start();
+	void stop();
+	//the counts from the last start/stop divided by ops, as a JSON object
+	JsonRecord per_op(const uint64_t &ops) const;
+private:
+	PerfCounters(const PerfCounters&); //disallow copying
+	void operator=(const PerfCounters&); //disallow assignment
+	struct Counter {
+		const char *name;
+		int fd;
+		uint64_t value;
+	};
+	std::vector<Counter> counters;
+#ifdef __linux__
+	void open(const char *name, const uint32_t &type, const uint64_t &config);
+#endif
+};
+
+inline PerfCounters::PerfCounters(const bool &enable){
+	if (!enable) return;
+#ifdef __linux__
+	const uint64_t read_miss=PERF_COUNT_HW_CACHE_OP_READ<<8 | PERF_COUNT_HW_CACHE_RESULT_MISS<<16;
+	open("llc_misses",PERF_TYPE_HW_CACHE,PERF_COUNT_HW_CACHE_LL|read_miss);
+	open("dtlb_misses",PERF_TYPE_HW_CACHE,PERF_COUNT_HW_CACHE_DTLB|read_miss);
+	open("instructions",PERF_TYPE_HARDWARE,PERF_COUNT_HW_INSTRUCTIONS);
+	open("branch_misses",PERF_TYPE_HARDWARE,PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+	if (counters.empty()) std::cerr << "Warning: no hardware performance counters are available (see /proc/sys/kernel/perf_event_paranoid), only times will be reported"<<std::endl;
+}
+
+inline PerfCounters::~PerfCounters(){
+#ifdef __linux__
+	for (size_t i=0; i<counters.size(); ++i) close(counters[i].fd);
+#endif
+}
+
+#ifdef __linux__
+inline void PerfCounters::open(const char *name, const uint32_t &type, const uint64_t &config){
+	perf_event_attr attr;
+	memset(&attr,0,sizeof(attr));
+	attr.size=sizeof(attr);
+	attr.type=type;
+	attr.config=config;
+	attr.disabled=1;
+	attr.inherit=1;
+	attr.exclude_kernel=1;
+	attr.exclude_hv=1;
+	const int fd=syscall(__NR_perf_event_open,&attr,0,-1,-1,0);
+	if (fd==-1) {
+		std::cerr << "Warning: the "<<name<<" counter is not available: "<<strerror(errno)<<std::endl;
+		return;
+	}
+	Counter c={name,fd,0};
+	counters.push_back(c);
+}
+#endif
+
+inline void PerfCounters::start(){
+#ifdef __linux__
+	for (size_t i=0; i<counters.size(); ++i) {
+		ioctl(counters[i].fd,PERF_EVENT_IOC_RESET,0);
+		ioctl(counters[i].fd,PERF_EVENT_IOC_ENABLE,0);
+	}
+#endif
+}
+
+inline void PerfCounters::stop(){
+#ifdef __linux__
+	for (size_t i=0; i<counters.size(); ++i) ioctl(counters[i].fd,PERF_EVENT_IOC_DISABLE,0);
+	for (size_t i=0; i<counters.size(); ++i) {
+		if (read(counters[i].fd,&counters[i].value,sizeof(uint64_t))!=sizeof(uint64_t)) counters[i].value=0;
+	}
+#endif
+}
+
+inline JsonRecord PerfCounters::per_op(const uint64_t &ops) const{
+	JsonRecord r;
+	for (size_t i=0; i<counters.size(); ++i) r.add(counters[i].name,ops?static_cast<double>(counters[i].value)/ops:0.0);
+	return r;
+}
+
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ *  BuildProfiler.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Wall time, CPU time, keys per second and peak RSS for every phase of building (and loading or writing) a model.
+//A phase is timed by a BuildPhase on the stack.  Phases can be nested, the inner one is reported as outer.inner,
+//so the value stores can time their select index without being told about the phase they were built in.
+//The peak RSS of a phase is its own: on Linux the high water mark is reset when a phase starts
+//(through /proc/self/clear_refs), otherwise it is the peak of the process so far.
+//BuildProfiler::print_json() writes everything that has been timed as one JSON object.
+//Nothing is timed until a tool that reports the profile calls BuildProfiler::enable(), and then only the phases
+//of the thread that enabled it, so the library (and the threads of a tool that build in the background) never
+//touch the profiler or the high water mark of the process they are in.
+
+#ifndef BUILD_PROFILER_H
+#define BUILD_PROFILER_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <ctime>
+#include <cstdio>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <pthread.h>
+
+
+class BuildProfiler {
+public:
+	struct Phase {
+		std::string name;
+		uint64_t start_wall_ns, start_cpu_ns;
+		double wall_s, cpu_s;
+		uint64_t keys;
+		uint64_t peak_rss_kb, rss_kb;
+	};
+
+	static BuildProfiler & instance(){
+		static BuildProfiler profiler;
+		return profiler;
+	}
+	//called by the tool before it starts any other thread, times the phases of the thread that calls it
+	static void enable(){
+		BuildProfiler &profiler=instance();
+		profiler.owner=pthread_self();
+		profiler.enabled=true;
+	}
+	//whether the phases of the calling thread are timed
+	static bool profiling(){
+		const BuildProfiler &profiler=instance();
+		return profiler.enabled && pthread_equal(profiler.owner,pthread_self());
+	}
+	void start(const std::string &name);
+	void stop(const uint64_t &keys);
+	//in the order they were started, a phase that is still running has no times yet
+	const std::vector<Phase> & phases() const {return all;}
+	void print_json(std::ostream &out) const;
+
+	static uint64_t wall_ns(){return clock_ns(CLOCK_MONOTONIC);}
+	static uint64_t cpu_ns(){return clock_ns(CLOCK_PROCESS_CPUTIME_ID);}
+	//the peak RSS since the last reset and the current RSS, in kB
+	static void rss_kb(uint64_t &peak, uint64_t &current);
+	//returns false where the high water mark can not be reset
+	static bool reset_peak_rss();
+
+private:
+	BuildProfiler():created_ns(wall_ns()),enabled(false){}
+	static uint64_t clock_ns(const clockid_t &clock){
+		timespec ts;
+		clock_gettime(clock,&ts);
+		return static_cast<uint64_t>(ts.tv_sec)*1000000000ULL+ts.tv_nsec;
+	}
+	//folds the peak so far into every open phase before the high water mark is reset for a new one
+	void update_open_peaks();
+
+	uint64_t created_ns;
+	bool enabled;
+	pthread_t owner;
+	std::vector<Phase> all;
+	std::vector<size_t> open;	//indexes into all of the phases that are running, innermost last
+};
+
+
+//Times the phase it is in scope for, or until stop() is called.  Call keys() with the number of keys the phase went through for keys/sec.
+//Does nothing unless BuildProfiler::profiling() is true for the thread it is made in.
+class BuildPhase {
+public:
+	explicit BuildPhase(const std::string &name):number_of_keys(0),running(BuildProfiler::profiling()){if (running) BuildProfiler::instance().start(name);}
+	~BuildPhase(){stop();}
+	void keys(const uint64_t &n){number_of_keys=n;}
+	void stop(){
+		if (running) BuildProfiler::instance().stop(number_of_keys);
+		running=false;
+	}
+private:
+	BuildPhase(const BuildPhase&); //disallow copying
+	void operator=(const BuildPhase&); //disallow assignment
+	uint64_t number_of_keys;
+	bool running;
+};
+
+
+inline void BuildProfiler::rss_kb(uint64_t &peak, uint64_t &current){
+	peak=current=0;
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status,line)) {
+		if (line.compare(0,6,"VmHWM:")==0) std::istringstream(line.substr(6))>>peak;
+		else if (line.compare(0,6,"VmRSS:")==0) std::istringstream(line.substr(6))>>current;
+	}
+	if (!peak) {
+		rusage usage;
+		if (getrusage(RUSAGE_SELF,&usage)==0) peak=usage.ru_maxrss;
+	}
+}
+
+inline bool BuildProfiler::reset_peak_rss(){
+	FILE *clear_refs=fopen("/proc/self/clear_refs","w");
+	if (!clear_refs) return false;
+	const bool ok=fputs("5",clear_refs)>=0;
+	return fclose(clear_refs)==0 && ok;
+}
+
+inline void BuildProfiler::update_open_peaks(){
+	uint64_t peak, current;
+	rss_kb(peak,current);
+	for (size_t i=0; i<open.size(); ++i) if (peak>all[open[i]].peak_rss_kb) all[open[i]].peak_rss_kb=peak;
+}
+
+inline void BuildProfiler::start(const std::string &name){
+	update_open_peaks();
+	Phase phase;
+	phase.name=open.empty()?name:all[open.back()].name+"."+name;
+	phase.wall_s=phase.cpu_s=0;
+	phase.keys=phase.peak_rss_kb=phase.rss_kb=0;
+	reset_peak_rss();
+	phase.start_wall_ns=wall_ns();
+	phase.start_cpu_ns=cpu_ns();
+	open.push_back(all.size());
+	all.push_back(phase);
+}
+
+inline void BuildProfiler::stop(const uint64_t &keys){
+	if (open.empty()) return;
+	Phase &phase=all[open.back()];
+	open.pop_back();
+	phase.wall_s=(wall_ns()-phase.start_wall_ns)/1e9;
+	phase.cpu_s=(cpu_ns()-phase.start_cpu_ns)/1e9;
+	phase.keys=keys;
+	uint64_t peak;
+	rss_kb(peak,phase.rss_kb);
+	if (peak>phase.peak_rss_kb) phase.peak_rss_kb=peak;
+	//the phase this one was inside saw the same peak
+	if (!open.empty() && phase.peak_rss_kb>all[open.back()].peak_rss_kb) all[open.back()].peak_rss_kb=phase.peak_rss_kb;
+}
+
+inline void BuildProfiler::print_json(std::ostream &out) const{
+	uint64_t peak=0, current;
+	rss_kb(peak,current);
+	for (size_t i=0; i<all.size(); ++i) if (all[i].peak_rss_kb>peak) peak=all[i].peak_rss_kb;
+	std::ostringstream s;
+	s << std::fixed << std::setprecision(6);
+	s << "{\"wall_s\":"<<(wall_ns()-created_ns)/1e9<<",\"cpu_s\":"<<cpu_ns()/1e9<<",\"peak_rss_kb\":"<<peak<<",\"rss_kb\":"<<current<<",\"phases\":[";
+	for (size_t i=0; i<all.size(); ++i) {
+		const Phase &p=all[i];
+		s << (i?",":"") << "{\"phase\":\""<<p.name<<"\",\"wall_s\":"<<p.wall_s<<",\"cpu_s\":"<<p.cpu_s<<",\"keys\":"<<p.keys
+		  << ",\"keys_per_s\":"<<(p.keys && p.wall_s>0?p.keys/p.wall_s:0.0)<<",\"peak_rss_kb\":"<<p.peak_rss_kb<<",\"rss_kb\":"<<p.rss_kb<<"}";
+	}
+	s << "]}\n";
+	out << s.str() << std::flush;
+}
+
+
+#endif
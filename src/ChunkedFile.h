@@ -0,0 +1,526 @@
+/*
+ *  ChunkedFile.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//A file that is written as fixed size chunks that are compressed with zlib independently of each other, so they
+//are compressed and decompressed by a thread for every cpu instead of as one gzip stream.  It is how the .fp_values
+//file of a store is written (see MPHR::writeFpArrayToFile).
+//The file is the magic "SHEFLMC1", then every chunk as a header of four uint32s (its bytes before and after
+//compression, how it is stored and the adler32 of its bytes) followed by the stored bytes, and last an index of the
+//uint64 offset of every chunk followed by the number of chunks, the bytes of the data, the chunk size, the level and
+//the magic "SHEFLMI1".  A chunk that does not get smaller (or every chunk at level 0) is stored as it is.
+//The reader decompresses the chunks ahead of the one that is being read so the data is installed from one chunk
+//while the next ones are decompressed.
+//ChunkedFileSink and ChunkedFileSource make them boost iostreams devices, which is what the archives are read from.
+
+#ifndef CHUNKED_FILE_H
+#define CHUNKED_FILE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/iostreams/categories.hpp>
+
+#include "zlib.h"
+#include "ModelReport.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+
+#define CHUNKED_FILE_MAGIC "SHEFLMC1"
+#define CHUNKED_FILE_INDEX_MAGIC "SHEFLMI1"
+#define CHUNKED_FILE_MAGIC_BYTES 8
+#define CHUNKED_FILE_DEFAULT_LEVEL 6
+#define CHUNKED_FILE_DEFAULT_CHUNK_BYTES (4u<<20)
+
+enum ChunkStorage {
+	CHUNK_STORED=0,
+	CHUNK_ZLIB=1
+};
+
+struct ChunkHeader {
+	uint32_t raw_bytes;
+	uint32_t stored_bytes;
+	uint32_t storage;
+	uint32_t checksum;
+};
+
+struct ChunkedFileTrailer {
+	uint64_t num_chunks;
+	uint64_t raw_bytes;
+	uint32_t chunk_bytes;
+	uint32_t level;
+	char magic[CHUNKED_FILE_MAGIC_BYTES];
+};
+
+inline unsigned chunked_file_threads(){
+	const long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus>0?cpus:1;
+}
+
+
+class ChunkedFileWriter {
+public:
+	//level is the zlib level from 0 (store every chunk raw) to 9
+	ChunkedFileWriter(const string &fileName, const int &level, const unsigned &threads=chunked_file_threads(), const uint32_t &chunk_bytes=CHUNKED_FILE_DEFAULT_CHUNK_BYTES);
+	//closes the file if close() has not been called
+	~ChunkedFileWriter();
+	void write(const char *data, size_t length);
+	//writes the last chunk and the index
+	void close();
+
+private:
+	ChunkedFileWriter(const ChunkedFileWriter&); //disallow copy
+	void operator=(const ChunkedFileWriter&); //disallow assignment
+
+	struct Chunk {
+		std::vector<char> raw;
+		std::vector<char> stored;
+		ChunkHeader header;
+		bool done;
+	};
+	static void *compressThread(void *writer){static_cast<ChunkedFileWriter*>(writer)->compressChunks(); return NULL;}
+	void compressChunks();
+	void compress(Chunk &chunk) const;
+	void submit();
+	//writes the chunks at the front that have been compressed, waiting for all of them with wait_for_all
+	void writeDone(const bool &wait_for_all);
+	void writeBytes(const void *data, const size_t &length);
+
+	const string file_name;
+	FILE *out;
+	const int level;
+	const uint32_t chunk_bytes;
+	const size_t max_chunks;	//the most chunks that are held in memory at once
+	Chunk *current;
+	std::deque<Chunk*> pending;	//in the order they are written
+	std::deque<Chunk*> to_compress;
+	std::vector<uint64_t> offsets;
+	uint64_t offset;
+	uint64_t raw_bytes;
+	bool closed;
+	bool stopping;
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;
+	std::vector<pthread_t> threads;
+};
+
+
+inline ChunkedFileWriter::ChunkedFileWriter(const string &fileName, const int &compressionLevel, const unsigned &numThreads, const uint32_t &chunkBytes)
+:file_name(fileName),level(compressionLevel),chunk_bytes(chunkBytes),max_chunks(2*(numThreads?numThreads:1)),current(NULL),offset(0),raw_bytes(0),closed(false),stopping(false){
+	if (level<0 || level>9) {
+		cerr << "Error: the compression level must be from 0 (none) to 9, not "<<level<<endl;
+		exit(1);
+	}
+	out=fopen(file_name.c_str(),"wb");
+	if (out==NULL) {
+		cerr << "Unable to open fp rank value file: "<<file_name<<": "<<strerror(errno)<<endl;
+		exit(1);
+	}
+	writeBytes(CHUNKED_FILE_MAGIC,CHUNKED_FILE_MAGIC_BYTES);
+	pthread_mutex_init(&mutex,NULL);
+	pthread_cond_init(&changed,NULL);
+	threads.resize(numThreads?numThreads:1);
+	for (size_t i=0; i<threads.size(); ++i) {
+		if (pthread_create(&threads[i],NULL,compressThread,this)!=0) {
+			cerr << "Error: can't start the threads that compress "<<file_name<<endl;
+			exit(1);
+		}
+	}
+}
+
+inline ChunkedFileWriter::~ChunkedFileWriter(){
+	if (!closed) close();
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&mutex);
+}
+
+inline void ChunkedFileWriter::write(const char *data, size_t length){
+	while (length) {
+		if (current==NULL) {
+			current=new Chunk();
+			current->raw.reserve(chunk_bytes);
+		}
+		const size_t n=std::min<size_t>(length,chunk_bytes-current->raw.size());
+		current->raw.insert(current->raw.end(),data,data+n);
+		data+=n;
+		length-=n;
+		if (current->raw.size()==chunk_bytes) submit();
+	}
+}
+
+inline void ChunkedFileWriter::submit(){
+	current->done=false;
+	raw_bytes+=current->raw.size();
+	pthread_mutex_lock(&mutex);
+	pending.push_back(current);
+	to_compress.push_back(current);
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&mutex);
+	current=NULL;
+	writeDone(false);
+}
+
+inline void ChunkedFileWriter::writeDone(const bool &wait_for_all){
+	pthread_mutex_lock(&mutex);
+	while (!pending.empty()) {
+		Chunk *chunk=pending.front();
+		if (!chunk->done) {
+			if (!wait_for_all && pending.size()<max_chunks) break;
+			pthread_cond_wait(&changed,&mutex);
+			continue;
+		}
+		pending.pop_front();
+		pthread_mutex_unlock(&mutex);
+		offsets.push_back(offset);
+		writeBytes(&chunk->header,sizeof(chunk->header));
+		if (chunk->header.storage==CHUNK_STORED) writeBytes(&chunk->raw[0],chunk->raw.size());
+		else writeBytes(&chunk->stored[0],chunk->stored.size());
+		delete chunk;
+		pthread_mutex_lock(&mutex);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+inline void ChunkedFileWriter::compressChunks(){
+	pthread_mutex_lock(&mutex);
+	while (true) {
+		while (!stopping && to_compress.empty()) pthread_cond_wait(&changed,&mutex);
+		if (to_compress.empty()) break;
+		Chunk *chunk=to_compress.front();
+		to_compress.pop_front();
+		pthread_mutex_unlock(&mutex);
+		compress(*chunk);
+		pthread_mutex_lock(&mutex);
+		chunk->done=true;
+		pthread_cond_broadcast(&changed);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+inline void ChunkedFileWriter::compress(Chunk &chunk) const{
+	ChunkHeader &header=chunk.header;
+	header.raw_bytes=chunk.raw.size();
+	header.checksum=adler32(adler32(0L,Z_NULL,0),reinterpret_cast<const Bytef*>(&chunk.raw[0]),chunk.raw.size());
+	header.storage=CHUNK_STORED;
+	header.stored_bytes=header.raw_bytes;
+	if (level==0) return;
+	uLongf stored_bytes=compressBound(chunk.raw.size());
+	chunk.stored.resize(stored_bytes);
+	if (compress2(reinterpret_cast<Bytef*>(&chunk.stored[0]),&stored_bytes,reinterpret_cast<const Bytef*>(&chunk.raw[0]),chunk.raw.size(),level)!=Z_OK) {
+		cerr << "Error: zlib can't compress a chunk of "<<file_name<<endl;
+		exit(1);
+	}
+	if (stored_bytes<chunk.raw.size()) {
+		chunk.stored.resize(stored_bytes);
+		header.storage=CHUNK_ZLIB;
+		header.stored_bytes=stored_bytes;
+		std::vector<char>().swap(chunk.raw);
+	}
+	else std::vector<char>().swap(chunk.stored);
+}
+
+inline void ChunkedFileWriter::writeBytes(const void *data, const size_t &length){
+	if (length && fwrite(data,1,length,out)!=length) {
+		cerr << "Error: can't write to "<<file_name<<": "<<strerror(errno)<<endl;
+		exit(1);
+	}
+	offset+=length;
+}
+
+inline void ChunkedFileWriter::close(){
+	if (current) submit();
+	writeDone(true);
+	pthread_mutex_lock(&mutex);
+	stopping=true;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&mutex);
+	for (size_t i=0; i<threads.size(); ++i) pthread_join(threads[i],NULL);
+
+	ChunkedFileTrailer trailer;
+	trailer.num_chunks=offsets.size();
+	trailer.raw_bytes=raw_bytes;
+	trailer.chunk_bytes=chunk_bytes;
+	trailer.level=level;
+	memcpy(trailer.magic,CHUNKED_FILE_INDEX_MAGIC,CHUNKED_FILE_MAGIC_BYTES);
+	if (!offsets.empty()) writeBytes(&offsets[0],offsets.size()*sizeof(uint64_t));
+	writeBytes(&trailer,sizeof(trailer));
+	if (fclose(out)!=0) {
+		cerr << "Error: can't write to "<<file_name<<": "<<strerror(errno)<<endl;
+		exit(1);
+	}
+	closed=true;
+}
+
+
+class ChunkedFileReader {
+public:
+	ChunkedFileReader(const string &fileName, const unsigned &threads=chunked_file_threads());
+	~ChunkedFileReader();
+	//reads up to length bytes, returns -1 at the end of the data
+	std::streamsize read(char *data, std::streamsize length);
+	uint64_t size() const {return trailer.raw_bytes;}
+	int level() const {return trailer.level;}
+
+	//whether fileName starts with the magic of a chunked file, so the files written before can still be read
+	static bool isChunkedFile(const string &fileName);
+	//the level fileName was written with, or CHUNKED_FILE_DEFAULT_LEVEL if it is not a chunked file
+	static int levelOfFile(const string &fileName);
+
+private:
+	ChunkedFileReader(const ChunkedFileReader&); //disallow copy
+	void operator=(const ChunkedFileReader&); //disallow assignment
+
+	struct Slot {
+		std::vector<char> data;
+		bool ready;
+	};
+	static void *decompressThread(void *reader){static_cast<ChunkedFileReader*>(reader)->decompressChunks(); return NULL;}
+	void decompressChunks();
+	void decompress(const uint64_t &chunk, std::vector<char> &data, std::vector<char> &stored) const;
+	void readBytes(void *data, const size_t &length, const uint64_t &from) const;
+	string chunkName(const uint64_t &chunk) const;
+	//stops and joins the threads and closes the file
+	void stop();
+
+	const string file_name;
+	int fd;
+	ChunkedFileTrailer trailer;
+	std::vector<uint64_t> offsets;
+	uint64_t index_offset;
+	std::vector<Slot> slots;	//chunk i is decompressed into slots[i%slots.size()]
+	uint64_t next_chunk;	//the next chunk a thread decompresses
+	uint64_t reading;	//the chunk read() is in
+	size_t read_offset;
+	bool stopping;
+	bool failed;	//a thread could not decompress a chunk, read() reports failure
+	string failure;
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;
+	std::vector<pthread_t> threads;
+};
+
+
+inline ChunkedFileReader::ChunkedFileReader(const string &fileName, const unsigned &numThreads)
+:file_name(fileName),next_chunk(0),reading(0),read_offset(0),stopping(false),failed(false){
+	fd=open(file_name.c_str(),O_RDONLY);
+	if (fd<0) ModelReport::error("unable to open rank value file: "+file_name+": "+strerror(errno));
+	try {
+		const off_t end=lseek(fd,0,SEEK_END);
+		if (end<static_cast<off_t>(CHUNKED_FILE_MAGIC_BYTES+sizeof(trailer))) ModelReport::error(file_name+" is too short to be a chunked file");
+		readBytes(&trailer,sizeof(trailer),end-sizeof(trailer));
+		index_offset=end-sizeof(trailer)-trailer.num_chunks*sizeof(uint64_t);
+		if (memcmp(trailer.magic,CHUNKED_FILE_INDEX_MAGIC,CHUNKED_FILE_MAGIC_BYTES)!=0 || trailer.num_chunks>static_cast<uint64_t>(end)/sizeof(ChunkHeader) || index_offset<CHUNKED_FILE_MAGIC_BYTES)
+			ModelReport::error("the index of "+file_name+" is missing, the file is not complete");
+		offsets.resize(trailer.num_chunks);
+		if (!offsets.empty()) readBytes(&offsets[0],offsets.size()*sizeof(uint64_t),index_offset);
+	}
+	catch (...) {
+		::close(fd);
+		throw;
+	}
+
+	const unsigned n=numThreads?numThreads:1;
+	slots.resize(std::max<uint64_t>(1,std::min<uint64_t>(2*n,trailer.num_chunks)));
+	for (size_t i=0; i<slots.size(); ++i) slots[i].ready=false;
+	pthread_mutex_init(&mutex,NULL);
+	pthread_cond_init(&changed,NULL);
+	const size_t num_threads=std::min<uint64_t>(n,std::max<uint64_t>(1,trailer.num_chunks));
+	for (size_t i=0; i<num_threads; ++i) {
+		pthread_t thread;
+		if (pthread_create(&thread,NULL,decompressThread,this)!=0) {
+			stop();
+			ModelReport::error("can't start the threads that decompress "+file_name);
+		}
+		threads.push_back(thread);
+	}
+}
+
+inline ChunkedFileReader::~ChunkedFileReader(){
+	stop();
+}
+
+inline void ChunkedFileReader::stop(){
+	pthread_mutex_lock(&mutex);
+	stopping=true;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&mutex);
+	for (size_t i=0; i<threads.size(); ++i) pthread_join(threads[i],NULL);
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&mutex);
+	::close(fd);
+}
+
+inline void ChunkedFileReader::decompressChunks(){
+	std::vector<char> data;
+	std::vector<char> stored;
+	pthread_mutex_lock(&mutex);
+	while (true) {
+		//a chunk is only started once the one before it in its slot has been read
+		while (!stopping && next_chunk<trailer.num_chunks && next_chunk>=reading+slots.size()) pthread_cond_wait(&changed,&mutex);
+		if (stopping || failed || next_chunk>=trailer.num_chunks) break;
+		const uint64_t chunk=next_chunk++;
+		pthread_mutex_unlock(&mutex);
+		try {
+			decompress(chunk,data,stored);
+		}
+		catch (std::exception &e) {
+			//the error can only be thrown to the caller from the thread that reads
+			pthread_mutex_lock(&mutex);
+			if (!failed) failure=e.what();
+			failed=true;
+			pthread_cond_broadcast(&changed);
+			break;
+		}
+		pthread_mutex_lock(&mutex);
+		Slot &slot=slots[chunk%slots.size()];
+		slot.data.swap(data);
+		slot.ready=true;
+		pthread_cond_broadcast(&changed);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+inline void ChunkedFileReader::decompress(const uint64_t &chunk, std::vector<char> &data, std::vector<char> &stored) const{
+	ChunkHeader header;
+	const uint64_t end=chunk+1<offsets.size()?offsets[chunk+1]:index_offset;
+	readBytes(&header,sizeof(header),offsets[chunk]);
+	if (offsets[chunk]+sizeof(header)+header.stored_bytes!=end || header.raw_bytes>trailer.chunk_bytes) ModelReport::error(chunkName(chunk)+" is corrupt");
+	data.resize(header.raw_bytes);
+	if (header.storage==CHUNK_STORED && header.stored_bytes==header.raw_bytes) {
+		if (header.raw_bytes) readBytes(&data[0],header.raw_bytes,offsets[chunk]+sizeof(header));
+	}
+	else if (header.storage==CHUNK_ZLIB) {
+		stored.resize(header.stored_bytes);
+		if (header.stored_bytes) readBytes(&stored[0],header.stored_bytes,offsets[chunk]+sizeof(header));
+		uLongf raw_bytes=header.raw_bytes;
+		if (uncompress(reinterpret_cast<Bytef*>(&data[0]),&raw_bytes,reinterpret_cast<const Bytef*>(&stored[0]),header.stored_bytes)!=Z_OK || raw_bytes!=header.raw_bytes)
+			ModelReport::error("can't decompress "+chunkName(chunk));
+	}
+	else ModelReport::error(chunkName(chunk)+" is corrupt");
+	if (adler32(adler32(0L,Z_NULL,0),reinterpret_cast<const Bytef*>(&data[0]),data.size())!=header.checksum)
+		ModelReport::error("the checksum of "+chunkName(chunk)+" is wrong");
+}
+
+inline string ChunkedFileReader::chunkName(const uint64_t &chunk) const{
+	std::ostringstream name;
+	name << "chunk "<<chunk<<" of "<<file_name;
+	return name.str();
+}
+
+inline std::streamsize ChunkedFileReader::read(char *data, std::streamsize length){
+	std::streamsize copied=0;
+	pthread_mutex_lock(&mutex);
+	while (copied<length && reading<trailer.num_chunks) {
+		Slot &slot=slots[reading%slots.size()];
+		while (!slot.ready && !failed) pthread_cond_wait(&changed,&mutex);
+		if (!slot.ready) {
+			const string message=failure;
+			pthread_mutex_unlock(&mutex);
+			ModelReport::error(message);
+		}
+		pthread_mutex_unlock(&mutex);
+		const size_t n=std::min<size_t>(length-copied,slot.data.size()-read_offset);
+		if (n) memcpy(data+copied,&slot.data[read_offset],n);
+		copied+=n;
+		read_offset+=n;
+		pthread_mutex_lock(&mutex);
+		if (read_offset==slot.data.size()) {
+			slot.ready=false;
+			++reading;
+			read_offset=0;
+			pthread_cond_broadcast(&changed);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+	return copied?copied:-1;
+}
+
+inline void ChunkedFileReader::readBytes(void *data, const size_t &length, const uint64_t &from) const{
+	size_t done=0;
+	while (done<length) {
+		const ssize_t n=pread(fd,static_cast<char*>(data)+done,length-done,from+done);
+		if (n<=0) ModelReport::error("can't read "+file_name+": "+(n<0?strerror(errno):"the file is too short"));
+		done+=n;
+	}
+}
+
+inline bool ChunkedFileReader::isChunkedFile(const string &fileName){
+	char magic[CHUNKED_FILE_MAGIC_BYTES];
+	FILE *in=fopen(fileName.c_str(),"rb");
+	if (in==NULL) return false;
+	const bool chunked=fread(magic,1,CHUNKED_FILE_MAGIC_BYTES,in)==CHUNKED_FILE_MAGIC_BYTES && memcmp(magic,CHUNKED_FILE_MAGIC,CHUNKED_FILE_MAGIC_BYTES)==0;
+	fclose(in);
+	return chunked;
+}
+
+inline int ChunkedFileReader::levelOfFile(const string &fileName){
+	if (!isChunkedFile(fileName)) return CHUNKED_FILE_DEFAULT_LEVEL;
+	ChunkedFileTrailer trailer;
+	FILE *in=fopen(fileName.c_str(),"rb");
+	const bool read=in && fseeko(in,-static_cast<off_t>(sizeof(trailer)),SEEK_END)==0 && fread(&trailer,sizeof(trailer),1,in)==1;
+	if (in) fclose(in);
+	if (!read || memcmp(trailer.magic,CHUNKED_FILE_INDEX_MAGIC,CHUNKED_FILE_MAGIC_BYTES)!=0) return CHUNKED_FILE_DEFAULT_LEVEL;
+	return trailer.level;
+}
+
+
+//The writer and reader as boost iostreams devices, which are copied when they are pushed so they share the file
+class ChunkedFileSink {
+public:
+	typedef char char_type;
+	typedef boost::iostreams::sink_tag category;
+	explicit ChunkedFileSink(const boost::shared_ptr<ChunkedFileWriter> &file):writer(file){}
+	std::streamsize write(const char *data, std::streamsize length){
+		writer->write(data,length);
+		return length;
+	}
+private:
+	boost::shared_ptr<ChunkedFileWriter> writer;
+};
+
+class ChunkedFileSource {
+public:
+	typedef char char_type;
+	typedef boost::iostreams::source_tag category;
+	explicit ChunkedFileSource(const boost::shared_ptr<ChunkedFileReader> &file):reader(file){}
+	std::streamsize read(char *data, std::streamsize length){return reader->read(data,length);}
+private:
+	boost::shared_ptr<ChunkedFileReader> reader;
+};
+
+
+#endif
@@ -38,6 +38,8 @@
 #include <boost/serialization/dynamic_bitset.hpp>
 
 #include "ShefBitArray.h"
+#include "MemoryUsage.h"
+#include "SharedArrays.h"
 
 class CompactStore{
 	typedef boost::dynamic_bitset<> bitarray;
@@ -45,10 +47,11 @@ class CompactStore{
 private:
 	boost::shared_ptr<bitarray> bitArrayPtr;	
 	unsigned bits_per_element;
+	const bitarray::block_type *shared_blocks;	//the bits once they have been moved to shared memory
 public:
-	CompactStore(){}
+	CompactStore():shared_blocks(NULL){}
 	CompactStore(boost::shared_ptr<bitarray> bitArray, const int & element_size) 
-	:bitArrayPtr(bitArray),bits_per_element(element_size){
+	:bitArrayPtr(bitArray),bits_per_element(element_size),shared_blocks(NULL){
 		
 	}
 	
@@ -73,8 +76,12 @@ public:
 		return bits_per_element;
 	}
 	
+	MemoryUsage memory_usage() const{
+		return MemoryUsage().add("bits",bitArrayPtr->num_blocks()*sizeof(bitarray::block_type));
+	}
+	
 	CompactStore& set(const uint64_t &pos,uint64_t value){
-		const uint64_t MASK=1 << (bits_per_element-1);
+		const uint64_t MASK=uint64_t(1) << (bits_per_element-1);
 		const uint64_t offset=pos*bits_per_element;
 		for (unsigned i=0; i<bits_per_element; i++) {
 			setbit(offset+i,(value&MASK?true:false));
@@ -84,8 +91,13 @@ public:
 	}
 	
 	bool getbit(const uint64_t &pos) const{
+		if (shared_blocks) return (shared_blocks[pos/bitarray::bits_per_block]>>(pos%bitarray::bits_per_block))&1;
 		return bitArrayPtr->test(pos);
 	}
+	
+	void share(SharedArrays &arrays){
+		arrays.share(*bitArrayPtr,shared_blocks);
+	}
 	CompactStore& setbit(const uint64_t & pos, const bool &value){
 		//std::cout << "Position to set is:"<<pos<<" value to set is:"<<value<<" size of bitarray is:"<<bitArrayPtr->size()<<" bits per element is:"<<bits_per_element<<std::endl;
 		bitArrayPtr->set(pos,value);
@@ -0,0 +1,112 @@
+/*
+ *  CompactValueStore.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Stores every rank using the same number of bits, packed into 64 bit words.
+//This is the largest of the value stores but a lookup is just a shift and a mask.
+
+#ifndef COMPACT_VALUE_STORE_H
+#define COMPACT_VALUE_STORE_H
+
+#include <vector>
+#include <iostream>
+#include <cstdlib>
+#include <boost/serialization/vector.hpp>
+
+#include "ValueStore.h"
+
+using std::cerr;
+using std::endl;
+
+
+class CompactValueStore : public ValueStore {
+public:
+	CompactValueStore():word_data(NULL){}
+	//bits_per_value of 0 means use as few bits as are needed to hold the largest value
+	template <class T>
+	CompactValueStore(const T &value_array,const uint64_t &num_elements_stored,const std::vector<uint64_t> &rank_counts,const unsigned &bits_per_value=0);
+	uint64_t at(const uint64_t &index) const;
+	uint64_t size_in_bits() const {return 64*words.size()+8*sizeof(num_elements_stored)+8*sizeof(bits_per_element)+8*sizeof(words);}
+	MemoryUsage memory_usage() const {return MemoryUsage().add("words",vector_bytes(words));}
+	void share(SharedArrays &arrays){arrays.share(words,word_data);}
+	unsigned getBitsPerElement() const {return bits_per_element;}
+private:
+	uint64_t num_elements_stored;
+	unsigned bits_per_element;
+	uint64_t mask;
+	std::vector<uint64_t> words;
+	const uint64_t *word_data;	//what at() reads, words or the copy of it in shared memory
+private:
+	friend class boost::serialization::access;
+
+    template<class Archive>
+    void serialize(Archive & ar, const unsigned int version)
+    {
+		ar & num_elements_stored;
+		ar & bits_per_element;
+		ar & words;
+		mask=(bits_per_element==64)?~0ULL:((1ULL<<bits_per_element)-1);
+		word_data=words.empty()?NULL:&words[0];
+	}
+};
+
+template <class T>
+CompactValueStore::CompactValueStore(const T &value_array,const uint64_t &num_elements,const std::vector<uint64_t> &rank_counts,const unsigned &bits_per_value)
+:num_elements_stored(num_elements){
+
+	uint64_t largest_value=rank_counts.empty()?0:rank_counts.size()-1;
+	unsigned bits_needed=1;
+	while (bits_needed<64 && (largest_value>>bits_needed)) ++bits_needed;
+	if (bits_per_value && bits_per_value<bits_needed){
+		cerr << "Error: "<<bits_per_value<<" bits per rank is not enough to store "<<rank_counts.size()<<" distinct values.  At least "<<bits_needed<<" bits are needed"<<endl;
+		exit(1);
+	}
+	bits_per_element=bits_per_value?bits_per_value:bits_needed;
+	if (bits_per_element>64) {cerr << "Error: bits per rank must be 64 bits or less"<<endl; exit(1);}
+	mask=(bits_per_element==64)?~0ULL:((1ULL<<bits_per_element)-1);
+
+	//one extra word so at() can always read the word after the one holding the value
+	words.resize((num_elements_stored*bits_per_element+63)/64+1,0);
+
+	uint64_t pos=0;
+	for (uint64_t i=0; i<num_elements_stored; ++i, pos+=bits_per_element) {
+		uint64_t v=value_array[i]&mask;
+		const unsigned offset=pos&63;
+		words[pos>>6]|=v<<offset;
+		if (offset+bits_per_element>64) words[(pos>>6)+1]|=v>>(64-offset);
+	}
+	word_data=&words[0];
+	cerr << "Stored "<<num_elements_stored<<" ranks using "<<bits_per_element<<" bits each ("<<8*words.size()<<" bytes)"<<endl;
+}
+
+inline uint64_t CompactValueStore::at(const uint64_t &index) const{
+	if (index>=num_elements_stored) return -1;
+	const uint64_t pos=index*bits_per_element;
+	const unsigned offset=pos&63;
+	//the second shift is split in two so an offset of 0 does not shift by 64
+	return ((word_data[pos>>6]>>offset) | ((word_data[(pos>>6)+1]<<1)<<(63-offset))) & mask;
+}
+
+
+
+#endif
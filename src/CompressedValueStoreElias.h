@@ -42,6 +42,8 @@
 //#include "simple_select_half.h"
 //#include "rank9sel.h"
 #include "elias_fano.h"
+#include "ValueStore.h"
+#include "BuildProfiler.h"
 
 using std::cout;
 using std::cerr;
@@ -51,20 +53,36 @@ using std::dec;
 
 typedef elias_fano storage_structure;
 
-class CompressedValueStoreElias {
+class CompressedValueStoreElias : public ValueStore {
 	typedef unsigned char byte;
 public:
-	CompressedValueStoreElias(){}
+	CompressedValueStoreElias():codes(NULL){}
 	template <class T>
 	CompressedValueStoreElias(const T &value_array,const uint64_t &num_elements_stored);
+	//rank_counts[v] is how many elements have value v.  Knowing this up front lets the index be built
+	//while the values stream past, without ever holding the marker bit vector.
+	template <class T>
+	CompressedValueStoreElias(const T &value_array,const uint64_t &num_elements_stored,const std::vector<uint64_t> &rank_counts);
 	uint64_t at(const uint64_t &index) const;
-	uint64_t size_in_bits(){return (ss->bit_count())+8*(sizeof(code_vector) + sizeof(byte) * code_vector.size()) +8*sizeof(num_elements_stored)+8*sizeof(bits_in_code_vector)+8*sizeof(ss);}
+	uint64_t size_in_bits() const {return (ss->bit_count())+8*(sizeof(code_vector) + sizeof(byte) * code_vector.size()) +8*sizeof(num_elements_stored)+8*sizeof(bits_in_code_vector)+8*sizeof(ss);}
+	MemoryUsage memory_usage() const {
+		MemoryUsage usage;
+		usage.add("codes",vector_bytes(code_vector));
+		usage.add("index",ss->memory_usage());
+		return usage;
+	}
+	void share(SharedArrays &arrays){
+		arrays.share(code_vector,codes);
+		ss->share(arrays);
+	}
 private:
 	uint64_t num_elements_stored;
 	uint64_t bits_in_code_vector;
 	std::vector<byte> code_vector;
+	const byte *codes;	//what at() reads, code_vector or its copy in shared memory
 	unsigned maskbit[32];
 	void addToCodeVector(const unsigned &ich, const int &ich_len_in_bits ,std::vector<byte> & code_vector, uint64_t &code_vector_len_in_bits);
+	static unsigned code_length(const uint64_t &v){return static_cast<unsigned>(floor(log2(v+2)));}
 	
 	boost::shared_ptr<storage_structure> ss;
 private:
@@ -78,6 +96,7 @@ private:
 		ar & bits_in_code_vector;
 		ar & maskbit;
 		ar & ss;
+		codes=code_vector.empty()?NULL:&code_vector[0];
 	}
 };
 
@@ -88,53 +107,82 @@ CompressedValueStoreElias::CompressedValueStoreElias(const T &value_array,const
 	uint64_t size_to_reserve=static_cast<uint64_t>(num_elements_stored*0.7518096802161448);  //this is the number of BYTES to reserve
 	
 	code_vector.reserve(size_to_reserve);	
-	std::vector<byte> code_bit_index;  
-	
-	while(size_to_reserve%64) ++size_to_reserve; //make a multiple of 64 so we can pass it as an array of uuint64_t's later
-	code_bit_index.reserve(size_to_reserve);
+	std::vector<uint64_t> code_bit_index;  //a one marks the first bit of every code.  Built as words so it can be handed straight to the index
+	code_bit_index.reserve(size_to_reserve/8+1);
 	
 	for (int j=0;j<32;j++) maskbit[j] = 1 << j;
 	
-	uint64_t num_bits1=0;
-	uint64_t num_bits2=0;
+	uint64_t num_bits=0;
 	for (uint64_t i=0; i< num_elements_stored; ++i) {
 		uint64_t v = value_array[i];
 		unsigned code_len=static_cast<unsigned>(floor(log2(v+2)));
 		
 		uint64_t code_bits=v+2- (1<<code_len);
 		//cerr << "storing code:"<<v<< " with code length:" << code_bits <<endl;
-		addToCodeVector(code_bits, code_len,code_vector,num_bits1);
-		addToCodeVector(1,1,code_bit_index,num_bits2);
-		if (code_len>1) addToCodeVector(0,code_len-1,code_bit_index,num_bits2);
+		while ((num_bits>>6)>=code_bit_index.size()) code_bit_index.push_back(0);
+		code_bit_index[num_bits>>6] |= 1ULL << (num_bits & 63);
+		addToCodeVector(code_bits, code_len,code_vector,num_bits);
 	}
 	cerr << "Number of elements stored " <<num_elements_stored <<endl;
-	cerr << "Code vector is " << num_bits1 << " bits long.  Index vector is "<< num_bits2 <<" bits long" <<endl; //should be 777850484
+	bits_in_code_vector=num_bits;
+	code_bit_index.resize((num_bits+63)/64,0);
+	cerr << "Code vector is " << num_bits << " bits long.  Index vector is "<< 64*code_bit_index.size() <<" bits long" <<endl;
+	
+	cerr << "Store code vector using array of: " << code_vector.size()<<" bytes" <<endl;
+	cerr << "Initial size of code index array is: " << 8*code_bit_index.size()<< " bytes" <<endl;
+	{
+		BuildPhase phase("select_index");
+		phase.keys(num_elements_stored);
+		ss.reset(new storage_structure(&code_bit_index[0], num_bits ));
+	}
 	
-	bits_in_code_vector=num_bits1;
+	uint64_t compressed_index_bitcount=ss->bit_count();
 	
-	//std::vector<byte>(code_vector).swap(code_vector); //trim extra space using the "swap trick"
-	//std::vector<byte>(code_bit_index).swap(code_bit_index); //trim extra space using the "swap trick"
+	cerr << "Index vector compressed to= "<<compressed_index_bitcount <<" bits.  Which is " << compressed_index_bitcount *100.0 /num_bits <<"% of the size of the original index vector."<<endl;
+	cerr << "\nTotal bits used for code and index= " << 8*code_vector.size()+compressed_index_bitcount <<endl;
+	codes=code_vector.empty()?NULL:&code_vector[0];
+}
 
-	//invert bits
-//	for (uint64_t i=0; i<code_bit_index.size(); ++i) {
-//		cout << "Before:" << (int)code_bit_index[i]<<endl;
-//		code_bit_index[i]=~code_bit_index[i];
-//		cout << "After:" << (int)code_bit_index[i]<<endl;
-//
-//	}
+template <class T>
+CompressedValueStoreElias::CompressedValueStoreElias(const T &value_array,const uint64_t & num_elements,const std::vector<uint64_t> &rank_counts)
+:num_elements_stored(num_elements){
 	
-	while(code_bit_index.size()%64) code_bit_index.push_back(0);  //make 64 bits long
+	uint64_t total_bits=0;
+	for (uint64_t v=0; v<rank_counts.size(); ++v) total_bits+=rank_counts[v]*code_length(v);
+	
+	code_vector.reserve((total_bits+7)/8);
+	for (int j=0;j<32;j++) maskbit[j] = 1 << j;
+	
+	ss.reset(new storage_structure(total_bits, num_elements_stored));
+	
+	uint64_t num_bits=0;
+	for (uint64_t i=0; i< num_elements_stored; ++i) {
+		uint64_t v = value_array[i];
+		unsigned code_len=code_length(v);
+		uint64_t code_bits=v+2- (1<<code_len);
+		ss->add(num_bits);
+		addToCodeVector(code_bits, code_len,code_vector,num_bits);
+	}
+	{
+		//the lower and upper bits were filled in as the codes were written, this builds the select inventory over the upper bits
+		BuildPhase phase("select_index");
+		phase.keys(num_elements_stored);
+		ss->finish();
+	}
+	bits_in_code_vector=num_bits;
+	
+	cerr << "Number of elements stored " <<num_elements_stored <<endl;
+	cerr << "Code vector is " << num_bits << " bits long." <<endl;
 	cerr << "Store code vector using array of: " << code_vector.size()<<" bytes" <<endl;
-	cerr << "Initial size of code index array is: " << code_bit_index.size()<< " bytes" <<endl;
-	ss.reset(new storage_structure(reinterpret_cast<uint64_t*>(&code_bit_index[0]), num_bits2 ));	
 	
 	uint64_t compressed_index_bitcount=ss->bit_count();
 	
-	cerr << "Index vector compressed to= "<<compressed_index_bitcount <<" bits.  Which is " << compressed_index_bitcount *100.0 /num_bits2 <<"% of the size of the original index vector."<<endl;
+	cerr << "Index vector compressed to= "<<compressed_index_bitcount <<" bits.  Which is " << compressed_index_bitcount *100.0 /num_bits <<"% of the size of the original index vector."<<endl;
 	cerr << "\nTotal bits used for code and index= " << 8*code_vector.size()+compressed_index_bitcount <<endl;
+	codes=code_vector.empty()?NULL:&code_vector[0];
 }
 
-uint64_t CompressedValueStoreElias::at(const uint64_t &index) const{
+inline uint64_t CompressedValueStoreElias::at(const uint64_t &index) const{
 	if (index>num_elements_stored) return -1;
 	//cerr <<"\n\n\nCompressedValueStore Looking up "<<index<<endl;
 	uint64_t index1=ss->select(index);
@@ -153,7 +201,7 @@ uint64_t CompressedValueStoreElias::at(const uint64_t &index) const{
 		//cerr << "code_vector[block_num] is "<<(int)code_vector[block_num] <<dec <<endl;
 		
 		compressed_code<<=1;
-		if((code_vector[block_num] & maskbit[7 & index1++]) != 0){
+		if((codes[block_num] & maskbit[7 & index1++]) != 0){
 			compressed_code|=1;
 		}
 	}
@@ -161,7 +209,7 @@ uint64_t CompressedValueStoreElias::at(const uint64_t &index) const{
 	return compressed_code + ( 1 << length ) -2;
 }
 
-void CompressedValueStoreElias::addToCodeVector(const unsigned &ich, const int &ich_len_in_bits ,std::vector<byte> & code_vector, uint64_t &code_vector_len_in_bits){
+inline void CompressedValueStoreElias::addToCodeVector(const unsigned &ich, const int &ich_len_in_bits ,std::vector<byte> & code_vector, uint64_t &code_vector_len_in_bits){
 	int m,n;
 	uint64_t nc;
 	if (code_vector.size()==0) code_vector.push_back(0);
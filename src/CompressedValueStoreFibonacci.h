@@ -35,13 +35,14 @@
 #include <sstream>
 #include <fstream>
 #include <boost/dynamic_bitset.hpp>
-#include <boost/unordered_map.hpp>
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/utility.hpp>
 #include <boost/serialization/list.hpp>
 #include <boost/shared_ptr.hpp>
 #include "simple_select11.h"
+#include "ValueStore.h"
+#include "BuildProfiler.h"
 
 using std::cout;
 using std::cerr;
@@ -50,30 +51,57 @@ using std::hex;
 using std::dec;
 
 
-class CompressedValueStoreFibonacci{
+class CompressedValueStoreFibonacci : public ValueStore {
 private:
-    std::vector<unsigned> fibonacci_vec;
+    std::vector<uint64_t> fibonacci_vec;
     uint64_t num_elements_stored;
 	uint64_t bits_in_code_vector;
 	uint64_t maskbit[64];
     void addToCodeVector(const uint64_t &ich, const int &ich_len_in_bits ,std::vector<uint64_t> & code_vector, uint64_t &code_vector_len_in_bits);
     boost::shared_ptr<simple_select11> ss;
     boost::shared_ptr<std::vector<uint64_t> > code_vector_ptr;
+	const uint64_t *codes;	//what at() reads, the code vector or its copy in shared memory
 public:
+    CompressedValueStoreFibonacci():codes(NULL){initMaskBits();}
     template <class T>
     CompressedValueStoreFibonacci(const T &value_array,const uint64_t & num_elements,const uint64_t max_value=900000);
     uint64_t at(const uint64_t &index) const;
-	uint64_t size_in_bits(){return (ss->bit_count())+8*(sizeof(code_vector_ptr) + sizeof(uint64_t) * code_vector_ptr->size()) +8*sizeof(num_elements_stored)+8*sizeof(bits_in_code_vector)+8*sizeof(ss);}
-
+	uint64_t size_in_bits() const {return (ss->bit_count())+8*(sizeof(code_vector_ptr) + sizeof(uint64_t) * code_vector_ptr->size()) +8*sizeof(num_elements_stored)+8*sizeof(bits_in_code_vector)+8*sizeof(ss);}
+	MemoryUsage memory_usage() const {
+		MemoryUsage usage;
+		usage.add("codes",vector_bytes(*code_vector_ptr));
+		usage.add("fibonacci_table",vector_bytes(fibonacci_vec));
+		usage.add("index",ss->memory_usage());
+		return usage;
+	}
+	//fibonacci_vec is a few words so it stays in each process
+	void share(SharedArrays &arrays){
+		arrays.share(*code_vector_ptr,codes);
+		ss->share(arrays,codes);
+	}
+private:
+	void initMaskBits(){for (int j=0;j<64;j++) maskbit[j] = 1ULL << j;}
+
+	friend class boost::serialization::access;
+    template<class Archive>
+    void serialize(Archive & ar, const unsigned int version)
+    {
+		ar & fibonacci_vec;
+		ar & num_elements_stored;
+		ar & bits_in_code_vector;
+		ar & code_vector_ptr;  //simple_select11 holds the same vector so it is only written once
+		ar & ss;
+		codes=code_vector_ptr->empty()?NULL:&(*code_vector_ptr)[0];
+	}
 };
 
 template <class T>
 CompressedValueStoreFibonacci::CompressedValueStoreFibonacci(const T &value_array,const uint64_t & num_elements,const uint64_t max_value):num_elements_stored(num_elements){
-    for (int j=0;j<64;j++) maskbit[j] = 1ULL << j;
-    boost::unordered_map<unsigned,std::pair<unsigned,unsigned> > code_cache; //cache maps numbers to a pair of fibcode and length
+    initMaskBits();
+    std::vector<std::pair<uint64_t,unsigned> > code_cache; //cache maps numbers to a pair of fibcode and length (a length of 0 is not computed yet).  Ranks are dense so a vector is enough
     fibonacci_vec.reserve(28);
     //populate an array with all fibonacci numbers up to the maxvalue
-    int a = 1, b = 1;
+    uint64_t a = 1, b = 1;
     while(b<=max_value){
         fibonacci_vec.push_back(b);
         b+=a;
@@ -112,28 +140,29 @@ a=[fibcode(i) for i in range(1,256)]
     for (uint64_t i=0; i< num_elements_stored; ++i) {
         //Find the largest Fibonacci number equal to or less than v, and create
         //bitarray of that length to store Zeckendorf's representation of v
-        const unsigned v = value_array[i]+1; //ADD ONE TO ALL VALUES SO WE CAN STORE ZEROS!  MUST SUBTRACT ONE IN GETTER METHOD!
+        const uint64_t v = value_array[i]+1; //ADD ONE TO ALL VALUES SO WE CAN STORE ZEROS!  MUST SUBTRACT ONE IN GETTER METHOD!
         //if not yet in cache compute the code
-        if (code_cache.find(v)==code_cache.end()){
-            std::vector<unsigned>::iterator minval_iter = std::upper_bound( fibonacci_vec.begin(), fibonacci_vec.end(), v );
+        if (v>=code_cache.size()) code_cache.resize(v+1,std::make_pair(0ULL,0U));
+        if (code_cache[v].second==0){
+            std::vector<uint64_t>::iterator minval_iter = std::upper_bound( fibonacci_vec.begin(), fibonacci_vec.end(), v );
             if (minval_iter==fibonacci_vec.end()){cerr << "Error creating fibcode, Max value must be too small!!" <<endl;exit(0);}
             if (minval_iter!=fibonacci_vec.begin()) --minval_iter;
             unsigned pos=std::distance(fibonacci_vec.begin(),minval_iter);
             //cerr << "Coding value:"<<v<<" Found max pos:"<<pos<<" which has fib num:"<<fibonacci_vec[pos]<<endl;
             unsigned code_len=pos+2;
-            unsigned code_value=1;
+            uint64_t code_value=1;
             //set the ith bit of number to one if the ith fibonacci num occurs in zeckendorf's representation
-            unsigned val=v;
+            uint64_t val=v;
             for (long j=pos;j>=0;--j){
                 if (fibonacci_vec[j]<=val){
                     val-=fibonacci_vec[j];
-                    code_value|=1<<(pos-j+1);
+                    code_value|=1ULL<<(pos-j+1);
                 }
             }
             code_cache[v]=std::make_pair(code_value,code_len);
         }
-        std::pair<unsigned,unsigned> code_pair=code_cache.at(v);
-        unsigned code=code_pair.first;
+        std::pair<uint64_t,unsigned> code_pair=code_cache[v];
+        uint64_t code=code_pair.first;
         unsigned code_len=code_pair.second;
         //cerr << "Fib code for "<<v<<" is "<<code << " with length " <<code_len<<endl;
         addToCodeVector(code,code_len,*code_vector_ptr,num_bits);
@@ -142,14 +171,19 @@ a=[fibcode(i) for i in range(1,256)]
 	//cerr << "Store code vector using array of: " << code_vector_ptr->size()<<" bytes" <<endl;
     
     bits_in_code_vector=num_bits;
-	ss.reset(new simple_select11(code_vector_ptr, num_bits,num_elements_stored));
+	{
+		BuildPhase phase("select_index");
+		phase.keys(num_elements_stored);
+		ss.reset(new simple_select11(code_vector_ptr, num_bits,num_elements_stored));
+	}
     cerr << "Fibonacci simple_select11 uses:"<<ss->bit_count()<<" bits."<<endl;
+	codes=code_vector_ptr->empty()?NULL:&(*code_vector_ptr)[0];
     
 }
 
 
-uint64_t CompressedValueStoreFibonacci::at(const uint64_t &index) const{
-    if (index>num_elements_stored) return -1;
+inline uint64_t CompressedValueStoreFibonacci::at(const uint64_t &index) const{
+    if (index>=num_elements_stored) return -1;
 	//cerr <<"\n\n\nCompressedValueStore Looking up index:"<<index<<endl;
 	uint64_t index1=ss->select11(index);
 	uint64_t index2=0;
@@ -171,7 +205,7 @@ uint64_t CompressedValueStoreFibonacci::at(const uint64_t &index) const{
 		//cerr << "code_vector[block_num] is "<<(int)code_vector[block_num] <<dec <<endl;
 		
 		compressed_code<<=1;
-		if(((*code_vector_ptr)[block_num] & maskbit[63 & index1++]) != 0){
+		if((codes[block_num] & maskbit[63 & index1++]) != 0){
 			compressed_code|=1;
             //cout<<"1";
             if(length-pos>1) value+=fibonacci_vec[pos];
@@ -186,7 +220,7 @@ uint64_t CompressedValueStoreFibonacci::at(const uint64_t &index) const{
 
 
 
-void CompressedValueStoreFibonacci::addToCodeVector(const uint64_t &ich, const int &ich_len_in_bits ,std::vector<uint64_t> & code_vector, uint64_t &code_vector_len_in_bits){
+inline void CompressedValueStoreFibonacci::addToCodeVector(const uint64_t &ich, const int &ich_len_in_bits ,std::vector<uint64_t> & code_vector, uint64_t &code_vector_len_in_bits){
     int n=ich_len_in_bits;
 	uint64_t block,m;
 	if (code_vector.size()==0) code_vector.push_back(0);
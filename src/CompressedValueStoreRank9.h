@@ -24,6 +24,11 @@
 
 
 
+//Same gamma codes as CompressedValueStoreElias but the marker bits are kept uncompressed and indexed
+//with rank9sel.  This uses more space than the elias fano index but select is quicker.
+//rank9sel only keeps a pointer to the marker bits so the index is rebuilt from them when the store is loaded,
+//or when the marker bits move to shared memory.
+
 #ifndef compressed_value_store_rank9_h
 #define compressed_value_store_rank9_h
 
@@ -37,12 +42,12 @@
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/utility.hpp>
 #include <boost/serialization/list.hpp>
+#include <boost/serialization/split_member.hpp>
 #include <boost/shared_ptr.hpp>
 
-//#include "simple_select.h"
-//#include "simple_select_half.h"
 #include "rank9sel.h"
-#include "elias_fano.h"
+#include "ValueStore.h"
+#include "BuildProfiler.h"
 
 using std::cout;
 using std::cerr;
@@ -50,37 +55,62 @@ using std::endl;
 using std::hex;
 using std::dec;
 
-typedef elias_fano storage_structure;
-//typedef rank9sel storage_structure;
 
-class CompressedValueStoreRank9 {
+class CompressedValueStoreRank9 : public ValueStore {
 	typedef unsigned char byte;
 public:
-	CompressedValueStoreElias(){}
+	CompressedValueStoreRank9():codes(NULL),markers(NULL){initMaskBits();}
 	template <class T>
 	CompressedValueStoreRank9(const T &value_array,const uint64_t &num_elements_stored);
 	uint64_t at(const uint64_t &index) const;
-	uint64_t size_in_bits(){return (ss->bit_count())+8*(sizeof(code_vector) + sizeof(byte) * code_vector.size()) +8*sizeof(num_elements_stored)+8*sizeof(bits_in_code_vector)+8*sizeof(ss);}
+	uint64_t size_in_bits() const {return (ss->bit_count())+64*code_bit_index.size()+8*(sizeof(code_vector) + sizeof(byte) * code_vector.size()) +8*sizeof(num_elements_stored)+8*sizeof(bits_in_code_vector)+8*sizeof(ss);}
+	MemoryUsage memory_usage() const {
+		MemoryUsage usage;
+		usage.add("codes",vector_bytes(code_vector));
+		usage.add("index.marker_bits",vector_bytes(code_bit_index));
+		usage.add("index",ss->memory_usage());
+		return usage;
+	}
+	void share(SharedArrays &arrays){
+		arrays.share(code_vector,codes);
+		arrays.share(code_bit_index,markers);
+		if (arrays.mode()!=SharedArrays::MEASURE) ss.reset(new rank9sel(markers,bits_in_code_vector));
+	}
 private:
 	uint64_t num_elements_stored;
 	uint64_t bits_in_code_vector;
 	std::vector<byte> code_vector;
+	std::vector<uint64_t> code_bit_index;  //a one marks the first bit of every code
+	//what at() and the index read, the vectors or their copies in shared memory
+	const byte *codes;
+	const uint64_t *markers;
 	unsigned maskbit[32];
+	void initMaskBits(){for (int j=0;j<32;j++) maskbit[j] = 1 << j;}
+	void buildIndex();
 	void addToCodeVector(const unsigned &ich, const int &ich_len_in_bits ,std::vector<byte> & code_vector, uint64_t &code_vector_len_in_bits);
 	
-	boost::shared_ptr<storage_structure> ss;
+	boost::shared_ptr<rank9sel> ss;
 private:
 	friend class boost::serialization::access;
 	
-    template<class Archive>
-    void serialize(Archive & ar, const unsigned int version)
-    {
+	template<class Archive>
+	void save(Archive & ar, const unsigned int version) const
+	{
+		ar & num_elements_stored;
+		ar & code_vector;
+		ar & bits_in_code_vector;
+		ar & code_bit_index;
+	}
+	template<class Archive>
+	void load(Archive & ar, const unsigned int version)
+	{
 		ar & num_elements_stored;
 		ar & code_vector;
 		ar & bits_in_code_vector;
-		ar & maskbit;
-		ar & ss;
+		ar & code_bit_index;
+		buildIndex();
 	}
+	BOOST_SERIALIZATION_SPLIT_MEMBER()
 };
 
 template <class T>
@@ -90,80 +120,60 @@ CompressedValueStoreRank9::CompressedValueStoreRank9(const T &value_array,const
 	uint64_t size_to_reserve=static_cast<uint64_t>(num_elements_stored*0.7518096802161448);  //this is the number of BYTES to reserve
 	
 	code_vector.reserve(size_to_reserve);	
-	std::vector<byte> code_bit_index;  
-	
-	while(size_to_reserve%64) ++size_to_reserve; //make a multiple of 64 so we can pass it as an array of uuint64_t's later
-	code_bit_index.reserve(size_to_reserve);
+	code_bit_index.reserve(size_to_reserve/8+1);
 	
-	for (int j=0;j<32;j++) maskbit[j] = 1 << j;
+	initMaskBits();
 	
-	uint64_t num_bits1=0;
-	uint64_t num_bits2=0;
+	uint64_t num_bits=0;
 	for (uint64_t i=0; i< num_elements_stored; ++i) {
 		uint64_t v = value_array[i];
 		unsigned code_len=static_cast<unsigned>(floor(log2(v+2)));
 		
 		uint64_t code_bits=v+2- (1<<code_len);
-		//cerr << "storing code:"<<v<< " with code length:" << code_bits <<endl;
-		addToCodeVector(code_bits, code_len,code_vector,num_bits1);
-		addToCodeVector(1,1,code_bit_index,num_bits2);
-		if (code_len>1) addToCodeVector(0,code_len-1,code_bit_index,num_bits2);
+		while ((num_bits>>6)>=code_bit_index.size()) code_bit_index.push_back(0);
+		code_bit_index[num_bits>>6] |= 1ULL << (num_bits & 63);
+		addToCodeVector(code_bits, code_len,code_vector,num_bits);
 	}
 	cerr << "Number of elements stored " <<num_elements_stored <<endl;
-	cerr << "Code vector is " << num_bits1 << " bits long.  Index vector is "<< num_bits2 <<" bits long" <<endl; //should be 777850484
+	cerr << "Code vector is " << num_bits << " bits long.  Index vector is "<< 64*code_bit_index.size() <<" bits long" <<endl;
 	
-	bits_in_code_vector=num_bits1;
-	
-	//std::vector<byte>(code_vector).swap(code_vector); //trim extra space using the "swap trick"
-	//std::vector<byte>(code_bit_index).swap(code_bit_index); //trim extra space using the "swap trick"
-    
-	//invert bits
-    //	for (uint64_t i=0; i<code_bit_index.size(); ++i) {
-    //		cout << "Before:" << (int)code_bit_index[i]<<endl;
-    //		code_bit_index[i]=~code_bit_index[i];
-    //		cout << "After:" << (int)code_bit_index[i]<<endl;
-    //
-    //	}
-	
-	while(code_bit_index.size()%64) code_bit_index.push_back(0);  //make 64 bits long
+	bits_in_code_vector=num_bits;
 	cerr << "Store code vector using array of: " << code_vector.size()<<" bytes" <<endl;
-	cerr << "Initial size of code index array is: " << code_bit_index.size()<< " bytes" <<endl;
-	ss.reset(new storage_structure(reinterpret_cast<uint64_t*>(&code_bit_index[0]), num_bits2 ));	
+	buildIndex();
 	
-	uint64_t compressed_index_bitcount=ss->bit_count();
-	
-	cerr << "Index vector compressed to= "<<compressed_index_bitcount <<" bits.  Which is " << compressed_index_bitcount *100.0 /num_bits2 <<"% of the size of the original index vector."<<endl;
-	cerr << "\nTotal bits used for code and index= " << 8*code_vector.size()+compressed_index_bitcount <<endl;
+	cerr << "Index vector with rank9sel uses "<<64*code_bit_index.size()+ss->bit_count() <<" bits"<<endl;
+	cerr << "\nTotal bits used for code and index= " << 8*code_vector.size()+64*code_bit_index.size()+ss->bit_count() <<endl;
+}
+
+//rank9sel works on blocks of 8 words so the marker bits are padded out to a whole block
+inline void CompressedValueStoreRank9::buildIndex(){
+	code_bit_index.resize(((bits_in_code_vector+511)/512)*8+8,0);
+	codes=code_vector.empty()?NULL:&code_vector[0];
+	markers=&code_bit_index[0];
+	BuildPhase phase("select_index");
+	phase.keys(num_elements_stored);
+	ss.reset(new rank9sel(markers, bits_in_code_vector));
 }
 
-uint64_t CompressedValueStoreRank9::at(const uint64_t &index) const{
-	if (index>num_elements_stored) return -1;
-	//cerr <<"\n\n\nCompressedValueStore Looking up "<<index<<endl;
+inline uint64_t CompressedValueStoreRank9::at(const uint64_t &index) const{
+	if (index>=num_elements_stored) return -1;
 	uint64_t index1=ss->select(index);
 	uint64_t index2=0;
 	if (index+1<num_elements_stored) index2=ss->select(index+1);
 	else index2=bits_in_code_vector;
 	uint64_t compressed_code=0;
 	uint64_t length=index2-index1;
-	//cerr << "index1 is: " <<index1 << " index2 is: "<< index2 <<endl;
 	while (index1<index2){
-		//cerr << "index1 is: " <<index1 << " index2 is: "<< index2 << " Result is :" << compressed_code <<endl;
-		
 		uint64_t block_num=index1>>3;
-		//cerr << "Block num is " << block_num <<endl;
-		//cerr << "7 & index1 is " << hex <<(7 & index1) << " maskbit[7 & index1]) is: "<< (maskbit[7 & index1]) <<endl;
-		//cerr << "code_vector[block_num] is "<<(int)code_vector[block_num] <<dec <<endl;
-		
 		compressed_code<<=1;
-		if((code_vector[block_num] & maskbit[7 & index1++]) != 0){
+		if((codes[block_num] & maskbit[7 & index1++]) != 0){
 			compressed_code|=1;
 		}
 	}
-	//cerr <<"Compressed code is: "<< compressed_code<<" and length is "<<length<<endl;
 	return compressed_code + ( 1 << length ) -2;
 }
 
-void CompressedValueStoreRank9::addToCodeVector(const unsigned &ich, const int &ich_len_in_bits ,std::vector<byte> & code_vector, uint64_t &code_vector_len_in_bits){
+inline void CompressedValueStoreRank9::addToCodeVector(const unsigned &ich, const int &ich_len_in_bits ,std::vector<byte> & code_vector, uint64_t &code_vector_len_in_bits){
 	int m,n;
 	uint64_t nc;
 	if (code_vector.size()==0) code_vector.push_back(0);
@@ -180,4 +190,3 @@ void CompressedValueStoreRank9::addToCodeVector(const unsigned &ich, const int &
 
 
 #endif
-
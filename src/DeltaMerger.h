@@ -0,0 +1,266 @@
+/*
+ *  DeltaMerger.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Keeps the delta store of a running model (see DeltaStore.h) up to date with its log, reading what has been appended
+//every second, and once merge_keys keys have been added to, merges the delta into a new model in the background.
+//A minimal perfect hash can't list its keys, so the new model is built the usual way from the key file with the
+//counts of the log merged into it.  The key file, the model files and logname.merged are then replaced, and queries
+//go to the new model with a delta of what has been appended to the log since.
+//The model that has been replaced is freed once the queries that were running in it have finished (see QueryEpoch.h).
+//If a merge is stopped between replacing the model files and writing logname.merged the counts of the merge are
+//added again the next time the model is loaded, so the files should not be touched while a merge is running.
+
+#ifndef DELTA_MERGER_H
+#define DELTA_MERGER_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <utility>
+#include <algorithm>
+#include <iostream>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <boost/shared_ptr.hpp>
+
+#include "MPHR.h"
+#include "DeltaStore.h"
+#include "ModelWarmup.h"
+#include "KeyFileMerge.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+
+#define DELTA_MERGING_SUFIX ".merging"
+
+
+class DeltaMerger {
+public:
+	//Gives model a delta store that reads logFileName from where its last merge stopped.  With merge_keys 0 the delta
+	//is never merged and keyFileName and baseFileName are not used.  The arrays of the merged models are placed
+	//like those of the model (huge_pages and numa are what were given to placeArrays), and the arrays of the
+	//model itself are not freed while warmup is still reading them.
+	DeltaMerger(const boost::shared_ptr<MPHR> &model, const string &logFileName, const uint64_t &merge_keys, const char *keyFileName, const char *baseFileName,
+				const bool &huge_pages=false, const NumaPlacement &numa=NUMA_LOCAL, const ModelWarmup *warmup=NULL);
+	//waits for a merge that is running to finish
+	~DeltaMerger();
+
+	//Writes the lines of keyFileName (a key file sorted by value, gzipped if its name ends in .gz) to outFileName with
+	//added summed into the values of its keys and the keys that are not in it added, still sorted by value.
+	//Returns the number of keys written.
+	static uint64_t mergeKeyFile(const string &keyFileName, const std::map<string,uint64_t> &added, const string &outFileName);
+
+private:
+	DeltaMerger(const DeltaMerger&); //disallow copy
+	void operator=(const DeltaMerger&); //disallow assignment
+
+	static void *followThread(void *merger){static_cast<DeltaMerger*>(merger)->follow(); return NULL;}
+	static void *mergeThread(void *merger){static_cast<DeltaMerger*>(merger)->mergeWhenFull(); return NULL;}
+	void follow();
+	void mergeWhenFull();
+	void merge();
+	static void replaceFile(const string &from, const string &to);
+	static string mergingFileName(const string &fileName);
+
+	const boost::shared_ptr<MPHR> root;	//the model that was loaded, which every query starts in
+	std::deque<boost::shared_ptr<MPHR> > generations;	//the models merged since, the last is the one queries go to
+	bool root_released;
+	const string log_file;
+	const uint64_t merge_keys;
+	const string key_file;
+	const string base_file;
+	const bool huge_pages;
+	const NumaPlacement numa;
+	const ModelWarmup *warmup;
+
+	pthread_mutex_t mutex;	//held while the delta is read from the log or replaced
+	pthread_cond_t changed;
+	boost::shared_ptr<DeltaStore> delta;
+	uint64_t delta_start;	//the offset in the log that delta was read from
+	bool merge_wanted;
+	bool stopping;
+	pthread_t follower;
+	pthread_t merger;
+	bool merging_thread;
+};
+
+
+inline DeltaMerger::DeltaMerger(const boost::shared_ptr<MPHR> &model, const string &logFileName, const uint64_t &mergeKeys, const char *keyFileName, const char *baseFileName,
+						 const bool &hugePages, const NumaPlacement &numaPlacement, const ModelWarmup *modelWarmup)
+:root(model),root_released(false),log_file(logFileName),merge_keys(mergeKeys),key_file(keyFileName?keyFileName:""),base_file(baseFileName?baseFileName:""),
+huge_pages(hugePages),numa(numaPlacement),warmup(modelWarmup),merge_wanted(false),stopping(false),merging_thread(false){
+	if (merge_keys && (key_file.empty() || base_file.empty())) {
+		cerr << "Error: merging the delta into the model needs its key file and the base file name of the model"<<endl;
+		exit(1);
+	}
+	delta_start=DeltaStore::mergedOffset(log_file);
+	delta.reset(new DeltaStore(log_file,delta_start));
+	root->setDelta(delta);
+	pthread_mutex_init(&mutex,NULL);
+	pthread_cond_init(&changed,NULL);
+	if (pthread_create(&follower,NULL,followThread,this)!=0 || (merge_keys && pthread_create(&merger,NULL,mergeThread,this)!=0)) {
+		cerr << "Error: can't start the threads that follow the delta log"<<endl;
+		exit(1);
+	}
+	merging_thread=merge_keys!=0;
+}
+
+inline DeltaMerger::~DeltaMerger(){
+	pthread_mutex_lock(&mutex);
+	stopping=true;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&mutex);
+	pthread_join(follower,NULL);
+	if (merging_thread) pthread_join(merger,NULL);
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&mutex);
+}
+
+inline void DeltaMerger::follow(){
+	pthread_mutex_lock(&mutex);
+	while (!stopping) {
+		struct timeval tv;
+		gettimeofday(&tv,NULL);
+		struct timespec until;
+		until.tv_sec=tv.tv_sec+1;
+		until.tv_nsec=tv.tv_usec*1000;
+		pthread_cond_timedwait(&changed,&mutex,&until);
+		if (stopping) break;
+		delta->follow();
+		if (merge_keys && !merge_wanted && delta->size()>=merge_keys) {
+			merge_wanted=true;
+			pthread_cond_broadcast(&changed);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+inline void DeltaMerger::mergeWhenFull(){
+	pthread_mutex_lock(&mutex);
+	while (true) {
+		while (!stopping && !merge_wanted) pthread_cond_wait(&changed,&mutex);
+		if (stopping) break;
+		pthread_mutex_unlock(&mutex);
+		merge();
+		pthread_mutex_lock(&mutex);
+		merge_wanted=false;
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+inline void DeltaMerger::merge(){
+	pthread_mutex_lock(&mutex);
+	const uint64_t start=delta_start;
+	const uint64_t end=delta->logOffset();
+	const uint64_t keys_added=delta->size();
+	pthread_mutex_unlock(&mutex);
+	cerr << "Merging the "<<keys_added<<" keys of the delta log "<<log_file<<" (bytes "<<start<<" to "<<end<<") into the model"<<endl;
+
+	std::map<string,uint64_t> added;
+	DeltaStore::readCounts(log_file,start,end,added);
+	const string merged_key_file=mergingFileName(key_file);
+	mergeKeyFile(key_file,added,merged_key_file);
+
+	const MPHR &old=generations.empty()?*root:*generations.back();
+	const string merging_base=base_file+DELTA_MERGING_SUFIX;
+	const string suffixes[5]={HASH_FILENAME_SUFIX,FP_VALUE_FILENAME_SUFIX,HOT_TIER_FILENAME_SUFIX HASH_FILENAME_SUFIX,HOT_TIER_FILENAME_SUFIX FP_VALUE_FILENAME_SUFIX,HOT_TIER_FILENAME_SUFIX STORE_SLOTS_FILENAME_SUFIX};
+	//MPHR loads the files of a base name that are already there instead of building them
+	for (int i=0; i<5; ++i) unlink((merging_base+suffixes[i]).c_str());
+	boost::shared_ptr<MPHR> model(new MPHR(merged_key_file.c_str(),old.fingerPrintValueStore().fingerPrints().bitsPerFingerprint(),0,merging_base.c_str(),old.valueStoreType()));
+	if (old.hotTier()) {
+		//the query log the hot tier may have been chosen from is not kept so it is chosen by count
+		model->buildHotTier(merged_key_file.c_str(),old.hotTier()->size(),NULL,old.hotTier()->fingerPrintValueStore().fingerPrints().bitsPerFingerprint(),merging_base.c_str());
+	}
+	//the files are written at the level the ones they replace were
+	model->writeMPHRToFilesWithBaseName(merging_base,ChunkedFileReader::levelOfFile(base_file+FP_VALUE_FILENAME_SUFIX));
+	replaceFile(merging_base+HASH_FILENAME_SUFIX,base_file+HASH_FILENAME_SUFIX);
+	replaceFile(merging_base+FP_VALUE_FILENAME_SUFIX,base_file+FP_VALUE_FILENAME_SUFIX);
+	if (model->hotTier()) {
+		replaceFile(merging_base+suffixes[2],base_file+suffixes[2]);
+		replaceFile(merging_base+suffixes[3],base_file+suffixes[3]);
+		replaceFile(merging_base+suffixes[4],base_file+suffixes[4]);
+	}
+	replaceFile(merged_key_file,key_file);
+	DeltaStore::writeMergedOffset(log_file,end);
+	if (huge_pages || numa!=NUMA_LOCAL) model->placeArrays(huge_pages,numa);
+
+	pthread_mutex_lock(&mutex);
+	//what has been appended to the log while the model was built
+	delta.reset(new DeltaStore(log_file,end));
+	delta_start=end;
+	model->setDelta(delta);
+	root->forwardTo(model.get());
+	for (size_t i=0; i<generations.size(); ++i) generations[i]->forwardTo(model.get());
+	generations.push_back(model);
+	pthread_mutex_unlock(&mutex);
+
+	//every query that could still be in a model this one replaces has finished once this returns
+	QueryEpoch::synchronize();
+	while (generations.size()>1) generations.pop_front();
+	if (!root_released && (warmup==NULL || warmup->ready())) {
+		root->releaseArrays();
+		root_released=true;
+	}
+	cerr << "The delta has been merged, the model now has "<<model->size()<<" keys"<<endl;
+}
+
+inline uint64_t DeltaMerger::mergeKeyFile(const string &keyFileName, const std::map<string,uint64_t> &added, const string &outFileName){
+	//the new values of the keys that are in the file, and the keys that are not
+	std::vector<value_key> changed;
+	std::map<string,uint64_t> new_keys(added);
+	KeyFileReader reader(keyFileName);
+	while (reader.next()) {
+		std::map<string,uint64_t>::iterator it=new_keys.find(reader.key());
+		if (it==new_keys.end()) continue;
+		changed.push_back(value_key(reader.value()+it->second,it->first));
+		new_keys.erase(it);
+	}
+	for (std::map<string,uint64_t>::const_iterator it=new_keys.begin(); it!=new_keys.end(); ++it) changed.push_back(value_key(it->second,it->first));
+	std::stable_sort(changed.begin(),changed.end(),smaller_value);
+	return write_merged_key_file(std::vector<string>(1,keyFileName),added,changed,outFileName);
+}
+
+//name.merging, or name.merging.gz for name.gz so it is read the same way
+inline string DeltaMerger::mergingFileName(const string &fileName){
+	if (gzipped_file_name(fileName)) return fileName.substr(0,fileName.size()-3)+DELTA_MERGING_SUFIX+".gz";
+	return fileName+DELTA_MERGING_SUFIX;
+}
+
+inline void DeltaMerger::replaceFile(const string &from, const string &to){
+	if (rename(from.c_str(),to.c_str())!=0) {
+		cerr << "Error: can't replace "<<to<<" with "<<from<<": "<<strerror(errno)<<endl;
+		exit(1);
+	}
+}
+
+
+#endif
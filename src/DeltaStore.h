@@ -0,0 +1,278 @@
+/*
+ *  DeltaStore.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//The counts added to a model since it was built.  New counts are appended to a delta log as keyTABcount lines
+//(the format of the key file) and the store follows the end of the log, adding every count to the key's entry in a
+//small open addressing table that MPHR::query looks in after the model.  A query gets the count in the model plus
+//the counts added since, and a key that is only in the log gets just those.
+//The table keeps a 64 bit fingerprint of each key, whose low bits are also where its probing starts, and its count,
+//16 bytes a slot, and doubles past 3/4 full.  Two keys with the same fingerprint would share an entry.
+//Queries don't lock: the table they read is never changed.  The thread following the log copies it, adds the new
+//counts to the copy and swaps the copy in, and frees the old one once no query can be reading it (see QueryEpoch.h).
+//The log is read from the offset in the file logname.merged, which is how much of it has already been merged into
+//the model (see DeltaMerger.h), so a model and its log always give the same counts whenever they are loaded.
+
+#ifndef DELTA_STORE_H
+#define DELTA_STORE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <iostream>
+#include <fstream>
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "FingerPrintStore.h"
+#include "MemoryUsage.h"
+#include "QueryEpoch.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+
+#define DELTA_MERGED_FILENAME_SUFIX ".merged"
+
+
+class DeltaStore {
+public:
+	//reads the log from startOffset to its end
+	DeltaStore(const string &logFileName, const uint64_t &startOffset);
+	~DeltaStore();
+
+	//the count added to key since the model was built, false if nothing has been
+	bool lookup(const string &key, uint64_t &added) const;
+	//adds the complete lines that have been appended to the log since it was last read and returns how many there were,
+	//only one thread should follow the log
+	uint64_t follow();
+	//the number of keys that have been added to
+	uint64_t size() const {return __atomic_load_n(&num_entries,__ATOMIC_ACQUIRE);}
+	//the end of the last complete line that has been read
+	uint64_t logOffset() const {return __atomic_load_n(&log_offset,__ATOMIC_ACQUIRE);}
+	const string & logFileName() const {return log_file;}
+	MemoryUsage memory_usage() const;
+
+	//how much of logFileName has been merged into the model, 0 if none of it has
+	static uint64_t mergedOffset(const string &logFileName);
+	static void writeMergedOffset(const string &logFileName, const uint64_t &offset);
+	//sums the counts of every key in the lines of logFileName from the byte from up to the byte to
+	static void readCounts(const string &logFileName, const uint64_t &from, const uint64_t &to, std::map<string,uint64_t> &counts);
+	//splits a keyTABcount line, false (with a warning if warn is set) if it is not one
+	static bool parseLine(const char *line, size_t length, size_t &key_length, uint64_t &count, const bool &warn=true);
+
+private:
+	DeltaStore(const DeltaStore&); //disallow copy
+	void operator=(const DeltaStore&); //disallow assignment
+
+	static uint64_t fingerprint(const char *key, const size_t &length){
+		const uint64_t h=(static_cast<uint64_t>(MurmurHash2(key,length,0x9747b28c))<<32)|MurmurHash2(key,length,0x5bd1e995);
+		return h?h:1;
+	}
+	struct Table {
+		std::vector<uint64_t> fingerprints;	//0 is an empty slot
+		std::vector<uint64_t> counts;
+		uint64_t entries;
+		explicit Table(const size_t &slots):fingerprints(slots,0),counts(slots,0),entries(0){}
+		void insert(const uint64_t &fp, const uint64_t &count);
+		//a copy with room for more entries without growing past 3/4 full
+		Table * copy(const uint64_t &more) const;
+	};
+
+	const string log_file;
+	uint64_t log_offset;	//only the thread following the log changes it
+	Table *table;	//what queries read, swapped for a new one by follow()
+	uint64_t num_entries;
+};
+
+
+inline DeltaStore::DeltaStore(const string &logFileName, const uint64_t &startOffset)
+:log_file(logFileName),log_offset(startOffset),table(new Table(1024)),num_entries(0){
+	const uint64_t lines=follow();
+	cerr << "Read "<<lines<<" lines of the delta log "<<log_file<<" from byte "<<startOffset<<", "<<size()<<" keys have been added to"<<endl;
+}
+
+inline DeltaStore::~DeltaStore(){
+	delete table;
+}
+
+inline bool DeltaStore::lookup(const string &key, uint64_t &added) const{
+	//nothing to look for until the first count arrives
+	if (size()==0) return false;
+	const uint64_t fp=fingerprint(key.c_str(),key.length());
+	QueryEpoch::Reader reader;
+	const Table &t=*__atomic_load_n(&table,__ATOMIC_ACQUIRE);
+	const uint64_t mask=t.fingerprints.size()-1;
+	for (uint64_t slot=fp&mask; t.fingerprints[slot]; slot=(slot+1)&mask) {
+		if (t.fingerprints[slot]==fp) {
+			added=t.counts[slot];
+			return true;
+		}
+	}
+	return false;
+}
+
+inline void DeltaStore::Table::insert(const uint64_t &fp, const uint64_t &count){
+	const uint64_t mask=fingerprints.size()-1;
+	uint64_t slot=fp&mask;
+	while (fingerprints[slot] && fingerprints[slot]!=fp) slot=(slot+1)&mask;
+	if (!fingerprints[slot]) {
+		fingerprints[slot]=fp;
+		++entries;
+	}
+	counts[slot]+=count;
+}
+
+inline DeltaStore::Table * DeltaStore::Table::copy(const uint64_t &more) const{
+	size_t slots=fingerprints.size();
+	while (4*(entries+more)>3*slots) slots*=2;
+	if (slots==fingerprints.size()) return new Table(*this);
+	Table *bigger=new Table(slots);
+	for (size_t i=0; i<fingerprints.size(); ++i) {
+		if (fingerprints[i]) bigger->insert(fingerprints[i],counts[i]);
+	}
+	return bigger;
+}
+
+inline MemoryUsage DeltaStore::memory_usage() const{
+	MemoryUsage usage;
+	QueryEpoch::Reader reader;
+	const Table &t=*__atomic_load_n(&table,__ATOMIC_ACQUIRE);
+	usage.add("fingerprints",vector_bytes(t.fingerprints));
+	usage.add("counts",vector_bytes(t.counts));
+	return usage;
+}
+
+inline bool DeltaStore::parseLine(const char *line, size_t length, size_t &key_length, uint64_t &count, const bool &warn){
+	if (length && line[length-1]=='\n') --length;
+	const char *tab=static_cast<const char*>(memchr(line,'\t',length));
+	count=0;
+	if (tab && tab!=line) {
+		const string countstr(tab+1,line+length);
+		char *end=NULL;
+		count=strtoull(countstr.c_str(),&end,10);
+		if (end==countstr.c_str() || *end) count=0;
+	}
+	if (count==0) {
+		if (warn) cerr << "Warning: skipping a line of the delta log that is not keyTABcount: "<<string(line,length).substr(0,100)<<endl;
+		return false;
+	}
+	key_length=tab-line;
+	return true;
+}
+
+inline uint64_t DeltaStore::follow(){
+	FILE *log=fopen(log_file.c_str(),"r");
+	if (log==NULL) {
+		//the log can be made after the model is started
+		if (errno!=ENOENT) cerr << "Warning: can't read the delta log "<<log_file<<": "<<strerror(errno)<<endl;
+		return 0;
+	}
+	uint64_t offset=logOffset();
+	uint64_t lines=0;
+	std::vector<std::pair<uint64_t,uint64_t> > added;	//the fingerprint and count of every line
+	if (fseeko(log,offset,SEEK_SET)==0) {
+		char *line=NULL;
+		size_t capacity=0;
+		ssize_t length;
+		//a last line without its newline is still being written so it is left for the next time
+		while ((length=getline(&line,&capacity,log))>0 && line[length-1]=='\n') {
+			size_t key_length;
+			uint64_t count;
+			if (parseLine(line,length,key_length,count)) added.push_back(std::make_pair(fingerprint(line,key_length),count));
+			offset+=length;
+			++lines;
+		}
+		free(line);
+	}
+	fclose(log);
+	if (!added.empty()) {
+		Table *next=table->copy(added.size());
+		for (size_t i=0; i<added.size(); ++i) next->insert(added[i].first,added[i].second);
+		Table *old=table;
+		__atomic_store_n(&table,next,__ATOMIC_RELEASE);
+		__atomic_store_n(&num_entries,next->entries,__ATOMIC_RELEASE);
+		QueryEpoch::synchronize();
+		delete old;
+	}
+	__atomic_store_n(&log_offset,offset,__ATOMIC_RELEASE);
+	return lines;
+}
+
+inline uint64_t DeltaStore::mergedOffset(const string &logFileName){
+	std::ifstream in((logFileName+DELTA_MERGED_FILENAME_SUFIX).c_str());
+	uint64_t offset=0;
+	if (in && !(in>>offset)) {
+		cerr << "Error: can't read the merged offset of the delta log from: "<<logFileName<<DELTA_MERGED_FILENAME_SUFIX<<endl;
+		exit(1);
+	}
+	return offset;
+}
+
+inline void DeltaStore::writeMergedOffset(const string &logFileName, const uint64_t &offset){
+	const string file_name=logFileName+DELTA_MERGED_FILENAME_SUFIX;
+	const string temporary=file_name+".tmp";
+	{
+		std::ofstream out(temporary.c_str());
+		out << offset << "\n";
+		out.close();
+		if (!out) {
+			cerr << "Error: can't write the merged offset of the delta log to: "<<temporary<<endl;
+			exit(1);
+		}
+	}
+	if (rename(temporary.c_str(),file_name.c_str())!=0) {
+		cerr << "Error: can't replace "<<file_name<<": "<<strerror(errno)<<endl;
+		exit(1);
+	}
+}
+
+inline void DeltaStore::readCounts(const string &logFileName, const uint64_t &from, const uint64_t &to, std::map<string,uint64_t> &counts){
+	FILE *log=fopen(logFileName.c_str(),"r");
+	if (log==NULL || fseeko(log,from,SEEK_SET)!=0) {
+		cerr << "Error: can't read the delta log "<<logFileName<<": "<<strerror(errno)<<endl;
+		exit(1);
+	}
+	char *line=NULL;
+	size_t capacity=0;
+	ssize_t length;
+	uint64_t offset=from;
+	while (offset<to && (length=getline(&line,&capacity,log))>0) {
+		size_t key_length;
+		uint64_t count;
+		//the lines that are not keyTABcount were reported when they were followed
+		if (parseLine(line,length,key_length,count,false)) counts[string(line,key_length)]+=count;
+		offset+=length;
+	}
+	free(line);
+	fclose(log);
+}
+
+
+#endif
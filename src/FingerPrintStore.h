@@ -62,14 +62,20 @@ unsigned int MurmurHash2( const void * key, int len, unsigned int seed=0);
 
 //FingerPrintStore Interface
 class FingerPrintStore {
-	//typedef boost::dynamic_bitset<> bitarray;
-	typedef ShefBitArray bitarray;
+	typedef boost::dynamic_bitset<> bitarray; //must match the bit array used by CompactStore
+	//typedef ShefBitArray bitarray;
 public:
 	FingerPrintStore(){}
 	FingerPrintStore(const uint64_t & numberOfElements, const unsigned &bits_per_fingerprint);
 	
 	FingerPrintStore& storeFP(const uint64_t &index,const string &key);
 	bool checkFP(const uint64_t &index,const string &key) const;
+	//the same check with the fingerprint of the key already computed by fp()
+	bool checkFP(const uint64_t &index,const uint64_t &fingerprint) const;
+	uint64_t fp(const string & key) const;
+	unsigned bitsPerFingerprint() const {return finger_print_size;}
+	MemoryUsage memory_usage() const {return store->memory_usage();}
+	void share(SharedArrays &arrays){store->share(arrays);}
 	
 	
 	
@@ -82,8 +88,6 @@ private:
 
 
 	boost::shared_ptr<CompactStore> store;  //the bit array
-	
-	uint64_t fp(const string & key) const;
 private:	
 	friend class boost::serialization::access;
     template<class Archive>
@@ -123,7 +127,7 @@ inline uint64_t FingerPrintStore::fp(const string & key) const{
 
 
 //Constructor
-FingerPrintStore::FingerPrintStore(const uint64_t & numberOfElements, const unsigned &bits_per_fingerprint)
+inline FingerPrintStore::FingerPrintStore(const uint64_t & numberOfElements, const unsigned &bits_per_fingerprint)
 		:finger_print_size(bits_per_fingerprint),
 		totalNumberOfBits((bits_per_fingerprint)*numberOfElements),
 		totalNumberOfElements(numberOfElements)
@@ -151,12 +155,16 @@ inline FingerPrintStore& FingerPrintStore::storeFP(const uint64_t &index,const s
 }
 
 inline bool FingerPrintStore::checkFP(const uint64_t &index,const string &key) const{
+	return checkFP(index,fp(key));
+}
+
+inline bool FingerPrintStore::checkFP(const uint64_t &index,const uint64_t &fingerprint) const{
 	if (index >= totalNumberOfElements) return false;
 	uint64_t retrievedfp=(*store)[index];
-	//cerr << "*** murmmer hash of new key to lookup is:"<<hex<<fp(key)<<dec<<endl;
+	//cerr << "*** murmmer hash of new key to lookup is:"<<hex<<fingerprint<<dec<<endl;
 	//cerr << "*** fp in store at index:"<<index<<" is hex value:"<< hex<<retrievedfp << dec<<endl;
 		
-	if (retrievedfp == fp(key)){
+	if (retrievedfp == fingerprint){
 		return true;
 	}
 	return false;
@@ -173,7 +181,7 @@ inline bool FingerPrintStore::checkFP(const uint64_t &index,const string &key) c
 
 //This is MurmurHash 2.0 from source file MurmurHash2.cpp by By Austin Appleby
 //available at: http://murmurhash.googlepages.com/
-unsigned int MurmurHash2( const void * key, int len, unsigned int seed){
+inline unsigned int MurmurHash2( const void * key, int len, unsigned int seed){
 	// 'm' and 'r' are mixing constants generated offline.
 	// They're not really 'magic', they just happen to work well.
 	
@@ -22,9 +22,13 @@
  */
 
 
+#ifndef FINGERPRINT_VALUE_STORE_H
+#define FINGERPRINT_VALUE_STORE_H
+
 #include <iostream>
 #include <vector>
 #include <string>
+#include <sstream>
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/utility.hpp>
@@ -36,54 +40,137 @@
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/serialization/version.hpp>
 
+#include "ValueStore.h"
 #include "CompressedValueStoreElias.h"
+#include "CompressedValueStore.h"
+#include "CompressedValueStoreRank9.h"
+#include "CompactValueStore.h"
+#include "CompressedValueStoreFibonacci.h"
+#include "TieredValueStore.h"
 #include "FingerPrintStore.h"
+#include "ModelReport.h"
 
 using std::cerr;
 
 class FingerPrintValueStore{
 public:
-	FingerPrintValueStore(){}
-	FingerPrintValueStore(boost::shared_ptr<FingerPrintStore> fingerprints, boost::shared_ptr<CompressedValueStoreElias> ranks, boost::shared_ptr<std::vector<uint64_t> > values)
+	FingerPrintValueStore():cv_store_type(VALUE_STORE_ELIAS){}
+	FingerPrintValueStore(boost::shared_ptr<FingerPrintStore> fingerprints, ValueStoreType ranks_type, boost::shared_ptr<ValueStore> ranks, boost::shared_ptr<std::vector<uint64_t> > values)
 		:	fp_store(fingerprints),
+			cv_store_type(ranks_type),
 			cv_store(ranks),
 			val_store(values){}
 	uint64_t query(const uint64_t & index, const std::string & key) const;
+	ValueStoreType valueStoreType() const {return cv_store_type;}
+	//the two halves of query, so they can be timed separately
+	const FingerPrintStore & fingerPrints() const {return *fp_store;}
+	uint64_t valueAt(const uint64_t & index) const;
+	//the distinct values the ranks point into
+	const std::vector<uint64_t> & values() const {return *val_store;}
+	//the fingerprints, the ranks and the table of distinct values they point into
+	MemoryUsage memory_usage() const;
+	//the table of distinct values is small and stays in each process
+	void share(SharedArrays &arrays){
+		fp_store->share(arrays);
+		cv_store->share(arrays);
+	}
+
+	//builds the chosen backend from ranks that are read once in index order.  Every backend's constructor only uses
+	//operator[] of value_array and reads it once from 0 up, so it can be a stream such as SlotRankSorter.
+	template <class T>
+	static boost::shared_ptr<ValueStore> buildValueStore(const ValueStoreType &type, const T &value_array, const uint64_t &num_elements_stored, const std::vector<uint64_t> &rank_counts, const unsigned &bits_per_rank=0);
 	
 private:
 	boost::shared_ptr<FingerPrintStore> fp_store;
-	boost::shared_ptr<CompressedValueStoreElias> cv_store;
+	ValueStoreType cv_store_type;
+	boost::shared_ptr<ValueStore> cv_store;
 	boost::shared_ptr<std::vector<uint64_t> > val_store;
 	
+	//the backends are serialized as their own type so the archive does not need to know about ValueStore
+	template<class Store, class Archive>
+	void serializeValueStore(Archive & ar){
+		boost::shared_ptr<Store> store_ptr=boost::dynamic_pointer_cast<Store>(cv_store);
+		ar & store_ptr;
+		cv_store=store_ptr;
+	}
+	
 private:	
 	friend class boost::serialization::access;
     template<class Archive>
     void serialize(Archive & ar, const unsigned int version)
     {
 		ar & fp_store;
-		ar & cv_store;
+		//version 0 files were written before there was a choice of value store and always hold elias fano
+		int type=cv_store_type;
+		if (version>0) ar & type;
+		else type=VALUE_STORE_ELIAS;
+		cv_store_type=static_cast<ValueStoreType>(type);
+		switch (cv_store_type) {
+			case VALUE_STORE_ELIAS: serializeValueStore<CompressedValueStoreElias>(ar); break;
+			case VALUE_STORE_SARRAY: serializeValueStore<CompressedValueStore>(ar); break;
+			case VALUE_STORE_RANK9: serializeValueStore<CompressedValueStoreRank9>(ar); break;
+			case VALUE_STORE_COMPACT: serializeValueStore<CompactValueStore>(ar); break;
+			case VALUE_STORE_FIBONACCI: serializeValueStore<CompressedValueStoreFibonacci>(ar); break;
+			case VALUE_STORE_TIERED: serializeValueStore<TieredValueStore>(ar); break;
+			default: {
+				std::ostringstream message;
+				message << "the fp_values file uses an unknown value store type ("<<type<<").  It may have been written by a newer version of this program";
+				ModelReport::error(message.str());
+			}
+		}
 		ar & val_store;
 	}
 	
 };
 
+BOOST_CLASS_VERSION(FingerPrintValueStore, 1)
+
+
+template <class T>
+boost::shared_ptr<ValueStore> FingerPrintValueStore::buildValueStore(const ValueStoreType &type, const T &value_array, const uint64_t &num_elements_stored, const std::vector<uint64_t> &rank_counts, const unsigned &bits_per_rank){
+	cerr << "Compressing ranks using the "<<value_store_name(type)<<" value store"<<endl;
+	boost::shared_ptr<ValueStore> store_ptr;
+	switch (type) {
+		case VALUE_STORE_ELIAS: store_ptr.reset(new CompressedValueStoreElias(value_array,num_elements_stored,rank_counts)); break;
+		case VALUE_STORE_SARRAY: store_ptr.reset(new CompressedValueStore(value_array,num_elements_stored)); break;
+		case VALUE_STORE_RANK9: store_ptr.reset(new CompressedValueStoreRank9(value_array,num_elements_stored)); break;
+		case VALUE_STORE_COMPACT: store_ptr.reset(new CompactValueStore(value_array,num_elements_stored,rank_counts,bits_per_rank)); break;
+		//the largest fibonacci number kept must be bigger than the largest rank+1 (there is always one between n and 2n)
+		case VALUE_STORE_FIBONACCI: store_ptr.reset(new CompressedValueStoreFibonacci(value_array,num_elements_stored,2*rank_counts.size()+2)); break;
+		case VALUE_STORE_TIERED: store_ptr.reset(new TieredValueStore(value_array,num_elements_stored,rank_counts,bits_per_rank)); break;
+		default:
+			cerr << "Error: unknown value store type "<<type<<endl;
+			exit(1);
+	}
+	return store_ptr;
+}
+
 
 inline uint64_t FingerPrintValueStore::query(const uint64_t & index, const std::string & key) const{
-	bool found=fp_store->checkFP(index,key);
 	//cerr << "Looking up index: "<<index<<" and key:"<<key<<endl;
-	if (found){
-		//cerr << "FP MATCHES" <<endl;
-		uint64_t rank=cv_store->at(index);
-		//cerr << "Rank is:"<<rank <<endl;
+	if (fp_store->checkFP(index,key)) return valueAt(index);
+	return 0;
+}
 
-		if (rank < val_store->size() ){
-			//cerr << "Getting Value" <<endl;
-			return (*val_store)[rank];
+inline MemoryUsage FingerPrintValueStore::memory_usage() const{
+	MemoryUsage usage;
+	usage.add("fingerprints",fp_store->memory_usage());
+	usage.add("ranks",cv_store->memory_usage());
+	usage.add("value_array",vector_bytes(*val_store));
+	return usage;
+}
 
-		}
+//the value stored at index, without checking the fingerprint
+inline uint64_t FingerPrintValueStore::valueAt(const uint64_t & index) const{
+	uint64_t rank=cv_store->at(index);
+	//cerr << "Rank is:"<<rank <<endl;
+	if (rank < val_store->size() ){
+		return (*val_store)[rank];
 	}
 	return 0;
 }
 
 
+#endif
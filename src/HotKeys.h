@@ -0,0 +1,155 @@
+/*
+ *  HotKeys.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Picks the keys that go in the hot tier of an MPHR: a small MPHR that is probed before the full one so the
+//keys that get most of the queries are answered from arrays that stay in cache.
+//The keys are either the ones with the largest counts in the ngram file or the ones that are queried
+//most often in a query log.  Either way they are written out as a key file (sorted by value) for the hot MPHR to be built from.
+
+#ifndef HOT_KEYS_H
+#define HOT_KEYS_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <queue>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+
+
+//a value and its key, so sorting puts the smallest values first
+typedef std::pair<uint64_t,std::string> HotKey;
+
+
+//reads key<TAB>value lines (or plain keys, with a value of 0) from a file that may be gzipped
+class HotKeyReader {
+public:
+	explicit HotKeyReader(const std::string &fileName):fin(fileName.c_str(),std::ios_base::in|std::ios_base::binary){
+		if (!fin) {
+			std::cerr << "Unable to open file: "<<fileName<<std::endl;
+			exit(1);
+		}
+		if (fileName.size()>3 && fileName.compare(fileName.size()-3,3,".gz")==0) in.push(boost::iostreams::gzip_decompressor());
+		in.push(fin);
+	}
+	~HotKeyReader(){in.pop();}
+	bool next(std::string &key, uint64_t &value){
+		while (std::getline(in,text)) {
+			if (text.empty()) continue;
+			const std::string::size_type loc=text.find('\t');
+			value=0;
+			if (loc==std::string::npos) key=text;
+			else {
+				key=text.substr(0,loc);
+				std::istringstream(text.substr(loc+1))>>value;
+			}
+			return true;
+		}
+		return false;
+	}
+private:
+	std::ifstream fin;
+	boost::iostreams::filtering_stream<boost::iostreams::input> in;
+	std::string text;
+};
+
+
+//the k keys with the largest values in an ngram file
+inline void hot_keys_by_count(const std::string &ngramFileName, const uint64_t &k, std::vector<HotKey> &hot){
+	std::priority_queue<HotKey,std::vector<HotKey>,std::greater<HotKey> > smallest_on_top;
+	HotKeyReader reader(ngramFileName);
+	HotKey entry;
+	while (k && reader.next(entry.second,entry.first)) {
+		if (entry.first==0) continue;
+		if (smallest_on_top.size()<k) smallest_on_top.push(entry);
+		else if (entry.first>smallest_on_top.top().first) {
+			smallest_on_top.pop();
+			smallest_on_top.push(entry);
+		}
+	}
+	hot.clear();
+	hot.reserve(smallest_on_top.size());
+	for (; !smallest_on_top.empty(); smallest_on_top.pop()) hot.push_back(smallest_on_top.top());
+}
+
+
+//The k keys queried most often in a query log (one key per line, anything after a tab is ignored).
+//Their values come from store, which must have a lookup(key,value) that returns false for keys it does not hold.
+template <class Store>
+void hot_keys_by_query_log(const std::string &queryLogFileName, const uint64_t &k, const Store &store, std::vector<HotKey> &hot){
+	std::map<std::string,uint64_t> times_queried;
+	HotKeyReader reader(queryLogFileName);
+	std::string key;
+	uint64_t ignored;
+	while (reader.next(key,ignored)) ++times_queried[key];
+
+	std::vector<std::pair<uint64_t,std::string> > by_frequency;
+	by_frequency.reserve(times_queried.size());
+	for (std::map<std::string,uint64_t>::const_iterator it=times_queried.begin(); it!=times_queried.end(); ++it) by_frequency.push_back(std::make_pair(it->second,it->first));
+	std::sort(by_frequency.begin(),by_frequency.end(),std::greater<std::pair<uint64_t,std::string> >());
+
+	hot.clear();
+	for (size_t i=0; i<by_frequency.size() && hot.size()<k; ++i) {
+		uint64_t value=0;
+		if (store.lookup(by_frequency[i].second,value) && value) hot.push_back(std::make_pair(value,by_frequency[i].second));
+	}
+}
+
+
+//Writes the keys sorted by value (as the MPHR builder needs them) to a new temporary file next to prefix and returns its name.
+//The caller removes the file.
+inline std::string write_hot_key_file(std::vector<HotKey> &hot, const std::string &prefix){
+	std::sort(hot.begin(),hot.end());
+	std::vector<char> name(prefix.begin(),prefix.end());
+	const char suffix[]=".hot_keys.XXXXXX";
+	name.insert(name.end(),suffix,suffix+sizeof(suffix));
+	const int fd=mkstemp(&name[0]);
+	if (fd==-1) {
+		std::cerr << "Error: can't create a temporary file for the hot keys at: "<<&name[0]<<std::endl;
+		exit(1);
+	}
+	close(fd);
+	std::ofstream out(&name[0],std::ios_base::out|std::ios_base::binary);
+	for (size_t i=0; i<hot.size(); ++i) out << hot[i].second << '\t' << hot[i].first << '\n';
+	out.close();
+	if (!out) {
+		std::cerr << "Error: can't write the hot keys to: "<<&name[0]<<std::endl;
+		exit(1);
+	}
+	return std::string(&name[0]);
+}
+
+
+#endif
@@ -0,0 +1,369 @@
+/*
+ *  KeyFileMerge.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Reading key files (keyTABvalue lines sorted by value, gzipped if the name ends in .gz) and merging them into one
+//key file that is still sorted by value, which is what the MPHR build needs as it gives every new value the next rank.
+//The merge streams every source once and only holds the entries that are given to it in memory, so it is used both
+//to merge a delta into a key file (DeltaMerger.h) and to merge the key files of several stores (StoreMerger.h).
+//Keys that don't fit in memory are sorted in runs in temporary files (SpillSorter) which are merged the same way.
+
+#ifndef KEY_FILE_MERGE_H
+#define KEY_FILE_MERGE_H
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <stdint.h>
+#include <unistd.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+
+using std::cerr;
+using std::endl;
+using std::string;
+
+typedef std::pair<uint64_t,string> value_key;
+
+inline bool smaller_value(const value_key &a, const value_key &b){
+	return a.first<b.first;
+}
+
+inline bool smaller_key(const value_key &a, const value_key &b){
+	return a.second<b.second;
+}
+
+inline bool gzipped_file_name(const string &fileName){
+	return fileName.size()>3 && fileName.compare(fileName.size()-3,3,".gz")==0;
+}
+
+
+//The keys and values of a key file, a temporary file or memory, read in order.
+class KeyValueSource {
+public:
+	virtual ~KeyValueSource(){}
+	//moves to the next key, false once there are no more
+	virtual bool next()=0;
+	virtual const string & key() const=0;
+	virtual uint64_t value() const=0;
+	//writes the key and value as a line of a key file
+	virtual void write(std::ostream &out) const {out << key() << '\t' << value() << '\n';}
+};
+
+
+//Reads the keys and values of a key file one line at a time.  The lines that are not keyTABvalue with a value
+//above 0 are skipped, as the MPHR build skips them.
+class KeyFileReader : public KeyValueSource {
+public:
+	explicit KeyFileReader(const string &keyFileName);
+	bool next();
+	const string & key() const {return current_key;}
+	uint64_t value() const {return current_value;}
+	//the line the key and value were read from
+	const string & line() const {return text;}
+	void write(std::ostream &out) const {out << text << '\n';}
+private:
+	KeyFileReader(const KeyFileReader&); //disallow copy
+	void operator=(const KeyFileReader&); //disallow assignment
+	std::ifstream keyFIN;
+	boost::iostreams::filtering_stream<boost::iostreams::input> in;
+	string text;
+	string current_key;
+	uint64_t current_value;
+};
+
+inline KeyFileReader::KeyFileReader(const string &keyFileName):keyFIN(keyFileName.c_str(),std::ios_base::in|std::ios_base::binary),current_value(0){
+	if (!keyFIN) {
+		cerr << "Unable to open key value file: "<<keyFileName <<endl;
+		exit(1);
+	}
+	if (gzipped_file_name(keyFileName)) in.push(boost::iostreams::gzip_decompressor());
+	in.push(keyFIN);
+}
+
+inline bool KeyFileReader::next(){
+	while (std::getline(in,text)) {
+		const string::size_type loc=text.find('\t');
+		if (loc==string::npos) continue;
+		current_value=0;
+		std::stringstream(text.substr(loc+1))>>current_value;
+		if (current_value==0) continue;
+		current_key.assign(text,0,loc);
+		return true;
+	}
+	return false;
+}
+
+
+//The keys of another source without those that are in replaced.
+class ReplacedKeySkipper : public KeyValueSource {
+public:
+	ReplacedKeySkipper(const boost::shared_ptr<KeyValueSource> &keys, const std::map<string,uint64_t> &replacedKeys):source(keys),replaced(replacedKeys){}
+	bool next(){
+		while (source->next()) {
+			if (!replaced.count(source->key())) return true;
+		}
+		return false;
+	}
+	const string & key() const {return source->key();}
+	uint64_t value() const {return source->value();}
+	void write(std::ostream &out) const {source->write(out);}
+private:
+	boost::shared_ptr<KeyValueSource> source;
+	const std::map<string,uint64_t> &replaced;
+};
+
+
+//Entries held in memory, which must be sorted as the other sources are.
+class EntrySource : public KeyValueSource {
+public:
+	explicit EntrySource(const std::vector<value_key> &sortedEntries):entries(sortedEntries),next_entry(0){}
+	bool next(){
+		if (next_entry==entries.size()) return false;
+		current=&entries[next_entry++];
+		return true;
+	}
+	const string & key() const {return current->second;}
+	uint64_t value() const {return current->first;}
+private:
+	const std::vector<value_key> &entries;
+	size_t next_entry;
+	const value_key *current;
+};
+
+
+//A temporary file of keys and values that is written once and then read back in the same order.  It is unlinked
+//as soon as it is made so it goes away however the program ends.
+class SpillFile : public KeyValueSource {
+public:
+	//the file is made in directory, which should be on a disk with room for it
+	explicit SpillFile(const string &directory, const size_t &buffer_bytes=(1<<20));
+	~SpillFile();
+	void add(const string &key, const uint64_t &value);
+	//ends the writing and goes back to the start of the file to read it with next()
+	void rewind();
+	bool next();
+	const string & key() const {return current_key;}
+	uint64_t value() const {return current_value;}
+	//the number of keys added
+	uint64_t size() const {return keys;}
+private:
+	SpillFile(const SpillFile&); //disallow copy
+	void operator=(const SpillFile&); //disallow assignment
+	void failed() const;
+	string directory_name;
+	FILE *file;
+	std::vector<char> buffer;
+	uint64_t keys;
+	string current_key;
+	uint64_t current_value;
+};
+
+inline SpillFile::SpillFile(const string &directory, const size_t &buffer_bytes):directory_name(directory),file(NULL),buffer(buffer_bytes),keys(0),current_value(0){
+	const string name=directory+"/.shefLM-spill-XXXXXX";
+	std::vector<char> path(name.begin(),name.end());
+	path.push_back('\0');
+	const int fd=mkstemp(&path[0]);
+	if (fd<0) failed();
+	unlink(&path[0]);
+	file=fdopen(fd,"w+b");
+	if (file==NULL) {
+		close(fd);
+		failed();
+	}
+	setvbuf(file,&buffer[0],_IOFBF,buffer.size());
+}
+
+inline SpillFile::~SpillFile(){
+	if (file) fclose(file);
+}
+
+inline void SpillFile::failed() const{
+	cerr << "Error: can't write a temporary file in "<<directory_name<<", it may be full"<<endl;
+	exit(1);
+}
+
+inline void SpillFile::add(const string &key, const uint64_t &value){
+	const uint32_t length=key.size();
+	if (fwrite(&value,sizeof(value),1,file)!=1 || fwrite(&length,sizeof(length),1,file)!=1 || (length && fwrite(key.data(),length,1,file)!=1)) failed();
+	++keys;
+}
+
+inline void SpillFile::rewind(){
+	if (fflush(file)!=0 || fseeko(file,0,SEEK_SET)!=0) failed();
+}
+
+inline bool SpillFile::next(){
+	uint32_t length;
+	if (fread(&current_value,sizeof(current_value),1,file)!=1) return false;
+	if (fread(&length,sizeof(length),1,file)!=1) failed();
+	current_key.resize(length);
+	if (length && fread(&current_key[0],length,1,file)!=1) failed();
+	return true;
+}
+
+
+//The keys of several SpillFiles one file after the other, which can be read as many times as needed.
+class SpillFileChain : public KeyValueSource {
+public:
+	explicit SpillFileChain(const std::vector<boost::shared_ptr<SpillFile> > &spillFiles):files(spillFiles),current(0){}
+	bool next(){
+		for (; current<files.size(); ++current) if (files[current]->next()) return true;
+		return false;
+	}
+	const string & key() const {return files[current]->key();}
+	uint64_t value() const {return files[current]->value();}
+	//goes back to the start of the first file
+	void rewind(){
+		for (size_t i=0; i<files.size(); ++i) files[i]->rewind();
+		current=0;
+	}
+	uint64_t size() const {
+		uint64_t keys=0;
+		for (size_t i=0; i<files.size(); ++i) keys+=files[i]->size();
+		return keys;
+	}
+private:
+	const std::vector<boost::shared_ptr<SpillFile> > &files;
+	size_t current;
+};
+
+
+//Sorts more keys and values than fit in memory: they are held until there are run_bytes of them, which are sorted
+//and written to a SpillFile, so finish() gives runs that are each sorted and can be merged.
+class SpillSorter {
+public:
+	typedef bool (*Order)(const value_key &a, const value_key &b);
+	SpillSorter(const string &directory, const Order &order, const size_t &run_bytes);
+	void add(const string &key, const uint64_t &value);
+	//sorts and writes the keys that are held and returns every run ready to be read
+	const std::vector<boost::shared_ptr<SpillFile> > & finish();
+private:
+	SpillSorter(const SpillSorter&); //disallow copy
+	void operator=(const SpillSorter&); //disallow assignment
+	void spill();
+	string directory_name;
+	Order sort_order;
+	size_t max_bytes;
+	size_t held_bytes;
+	std::vector<value_key> held;
+	std::vector<boost::shared_ptr<SpillFile> > runs;
+};
+
+inline SpillSorter::SpillSorter(const string &directory, const Order &order, const size_t &run_bytes)
+:directory_name(directory),sort_order(order),max_bytes(run_bytes),held_bytes(0){}
+
+inline void SpillSorter::add(const string &key, const uint64_t &value){
+	held.push_back(value_key(value,key));
+	//the string's own heap block is counted roughly with its header
+	held_bytes+=sizeof(value_key)+key.size()+16;
+	if (held_bytes>=max_bytes) spill();
+}
+
+inline void SpillSorter::spill(){
+	if (held.empty()) return;
+	std::sort(held.begin(),held.end(),sort_order);
+	boost::shared_ptr<SpillFile> run(new SpillFile(directory_name));
+	for (size_t i=0; i<held.size(); ++i) run->add(held[i].second,held[i].first);
+	run->rewind();
+	runs.push_back(run);
+	std::vector<value_key>().swap(held);
+	held_bytes=0;
+}
+
+inline const std::vector<boost::shared_ptr<SpillFile> > & SpillSorter::finish(){
+	spill();
+	return runs;
+}
+
+
+//The directory of a file name, where the temporary files of a merge that writes it are made.
+inline string directory_of(const string &fileName){
+	const string::size_type slash=fileName.rfind('/');
+	if (slash==string::npos) return ".";
+	if (slash==0) return "/";
+	return fileName.substr(0,slash);
+}
+
+
+//Writes the keys of sources, each of which must be sorted by value, to outFileName (gzipped if it ends in .gz)
+//merged by value.  A key that has the same value as keys of later sources is written first.
+//Returns the number of keys written.
+inline uint64_t write_merged_sources(const std::vector<boost::shared_ptr<KeyValueSource> > &sources, const string &outFileName){
+	std::vector<bool> more;
+	for (size_t i=0; i<sources.size(); ++i) more.push_back(sources[i]->next());
+	std::ofstream keyFOUT(outFileName.c_str(),std::ios_base::out|std::ios_base::binary);
+	if (!keyFOUT) {
+		cerr << "Error: can't write the merged key file: "<<outFileName<<endl;
+		exit(1);
+	}
+	uint64_t keys=0;
+	{
+		boost::iostreams::filtering_stream<boost::iostreams::output> out;
+		if (gzipped_file_name(outFileName)) out.push(boost::iostreams::gzip_compressor());
+		out.push(keyFOUT);
+		while (true) {
+			//the source whose next key has the smallest value, there are only ever a few of them
+			size_t smallest=sources.size();
+			for (size_t i=0; i<sources.size(); ++i) {
+				if (more[i] && (smallest==sources.size() || sources[i]->value()<sources[smallest]->value())) smallest=i;
+			}
+			if (smallest==sources.size()) break;
+			sources[smallest]->write(out);
+			++keys;
+			more[smallest]=sources[smallest]->next();
+		}
+	}
+	keyFOUT.close();
+	if (!keyFOUT) {
+		cerr << "Error: can't write the merged key file: "<<outFileName<<endl;
+		exit(1);
+	}
+	return keys;
+}
+
+//Writes the lines of keyFileNames to outFileName (gzipped if it ends in .gz) merged by value, leaving out the
+//keys that are in replaced, with entries (which must be sorted by value) put in among them.
+//Returns the number of keys written.
+inline uint64_t write_merged_key_file(const std::vector<string> &keyFileNames, const std::map<string,uint64_t> &replaced, const std::vector<value_key> &entries, const string &outFileName){
+	std::vector<boost::shared_ptr<KeyValueSource> > sources;
+	//the entries go before the lines of the files with the same value
+	sources.push_back(boost::shared_ptr<KeyValueSource>(new EntrySource(entries)));
+	for (size_t i=0; i<keyFileNames.size(); ++i) {
+		boost::shared_ptr<KeyValueSource> reader(new KeyFileReader(keyFileNames[i]));
+		sources.push_back(boost::shared_ptr<KeyValueSource>(new ReplacedKeySkipper(reader,replaced)));
+	}
+	return write_merged_sources(sources,outFileName);
+}
+
+
+#endif
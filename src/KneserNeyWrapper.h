@@ -47,7 +47,7 @@ private:
 
 
 
-KneserNeyWrapper::KneserNeyWrapper(boost::shared_ptr<MPHR> mphrPtr,uint64_t unique_bigrams)
+inline KneserNeyWrapper::KneserNeyWrapper(boost::shared_ptr<MPHR> mphrPtr,uint64_t unique_bigrams)
 	:mphr(mphrPtr)
 {
 	uniqUnigrams=651930.0;
@@ -60,7 +60,7 @@ inline long double KneserNeyWrapper::ngram_freq(const string &ngram) const{
 }
 
 
-double KneserNeyWrapper::prob(const string &w1, const string &w2, const string &w3) const{
+inline double KneserNeyWrapper::prob(const string &w1, const string &w2, const string &w3) const{
 		//cerr << "Looking up: " <<w1+" "+w2+" "+w3 << ": " <<ngram_freq(w1+" "+w2+" "+w3)<<endl;
 		
 		long double IKNuni=0.0;
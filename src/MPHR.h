@@ -34,7 +34,9 @@
 #include <stdlib.h>
 #include <vector>
 #include <iterator>
+#include <algorithm>
 #include <cmath>
+#include <pthread.h>
 #include <boost/dynamic_bitset.hpp>
 #include <boost/archive/tmpdir.hpp>
 #include <boost/serialization/base_object.hpp>
@@ -55,8 +57,19 @@
 #include "CompactStore.h"
 #include "ShefBitArray.h"
 #include "FingerPrintStore.h"
+#include "SlotRankSorter.h"
+#include "ShardedHash.h"
+#include "KeyFileMerge.h"
 #include "cmph.h"
 #include "cmph_structs.h"
+#include "QueryMetrics.h"
+#include "BuildProfiler.h"
+#include "HotKeys.h"
+#include "ArrayPlacement.h"
+#include "DeltaStore.h"
+#include "QueryEpoch.h"
+#include "ChunkedFile.h"
+#include "ModelReport.h"
 
 using std::string;
 using std::ifstream;
@@ -64,10 +77,16 @@ using std::ofstream;
 
 //Forward declaration of ngram reading function we use for hashing values
 static int ngram_file_read(gzFile, char**, cmph_uint32*);
+//and of the functions of the adapter that hashes the keys of a shard
+static int spill_chain_read(void*, char**, cmph_uint32*);
+static void spill_chain_dispose(void*, char*, cmph_uint32);
+static void spill_chain_rewind(void*);
 
 
 #define HASH_FILENAME_SUFIX ".hash"
 #define FP_VALUE_FILENAME_SUFIX ".fp_values"
+#define HOT_TIER_FILENAME_SUFIX ".hot"
+#define STORE_SLOTS_FILENAME_SUFIX ".slots"
 
 
 
@@ -75,28 +94,254 @@ class MPHR{
 	typedef boost::dynamic_bitset<> bitarray;
 	// typedef ShefBitArray bitarray;
 public:
-	MPHR(const char * pathToNgramFileName, const unsigned &bits_per_fingerprint, const unsigned &bits_per_rank, const char * basefilename);
-	~MPHR();
+	//compressed_rank_runs keeps the sorted runs of ranks in compressed memory instead of temporary files (see SlotRankSorter.h)
+	MPHR(const char * pathToNgramFileName, const unsigned &bits_per_fingerprint, const unsigned &bits_per_rank, const char * basefilename, const ValueStoreType &value_store_type=VALUE_STORE_ELIAS, const bool &compressed_rank_runs=false);
 	explicit MPHR(const string & loadMPHRFromBaseFileName);
-	void writeMPHRToFilesWithBaseName(const string &storeBaseFileName) const;
+	//Builds a model from keys that are already split into shards by ShardedHash::shardOf, shard_keys[s] being the files
+	//of shard s, which is how shefLMMerge builds a merged store (see StoreMerger.h).  values has every value of the keys
+	//in increasing order and may have more.  threads threads take a shard at a time, make its hash and then read its keys
+	//once more for their fingerprints and ranks.  The runs of ranks are sorted in files starting with run_file_prefix.
+	MPHR(const std::vector<std::vector<boost::shared_ptr<SpillFile> > > &shard_keys, const std::vector<uint64_t> &values, const unsigned &bits_per_fingerprint, const unsigned &bits_per_rank, const ValueStoreType &value_store_type, const unsigned &threads, const string &run_file_prefix);
+	//compression_level is the zlib level of the chunks of the .fp_values file (see ChunkedFile.h), 0 stores them raw
+	void writeMPHRToFilesWithBaseName(const string &storeBaseFileName, const int &compression_level=CHUNKED_FILE_DEFAULT_LEVEL) const;
 	uint64_t query(const string & key) const;
+	ValueStoreType valueStoreType() const {return latest().fp_value_store->valueStoreType();}
+	//the stages of query: slot is the minimal perfect hash of the key, then the fingerprint is checked and the value read.
+	//Like the rest of the public accessors they use the model queries are forwarded to (see forwardTo()).
+	uint64_t slot(const string & key) const {return latest().slotHere(key);}
+	const FingerPrintValueStore & fingerPrintValueStore() const {return *latest().fp_value_store;}
+	uint64_t size() const {return latest().num_keys;}
+	//the hash function is counted at its packed size, which is what it takes on disk.
+	//Once the model is in shared memory its arrays are counted once, as the shared segment.
+	MemoryUsage memory_usage() const;
+	//passes the big arrays of the model to arrays (see SharedArrays.h), the hash function first in its packed form
+	void share(SharedArrays &arrays);
+	//Moves the big arrays of the model (and its hot tier) into memory on huge pages if it can get them, with its
+	//pages interleaved over the NUMA nodes or with a copy of the model on every node that query() picks by the cpu
+	//it is running on.  The model can't be written out after this.
+	void placeArrays(const bool &huge_pages, const NumaPlacement &numa);
+	//where the arrays are once they have been moved to shared memory or by placeArrays (nothing if they have not),
+	//as the start and bytes of every array of every copy of the model
+	void mappedArrays(std::vector<std::pair<const char*,uint64_t> > &ranges) const;
 	
+	//Builds a small MPHR of the hot_keys most queried keys (or the ones with the largest counts if queryLogFileName is NULL)
+	//that query() looks in first.  It uses compact ranks and bits_per_fingerprint bits for its fingerprints, which should be
+	//more than the full store uses as every key that is not in the hot tier is also checked against it.  It also keeps
+	//the slot of each of its keys in this store, and only answers for a key that hashes to that slot here.  The hash of
+	//this store is perfect on its keys, so a stored key that is not hot is never given the value of a hot one.
+	void buildHotTier(const char * pathToNgramFileName, const uint64_t &hot_keys, const char * queryLogFileName, const unsigned &bits_per_fingerprint, const char * basefilename=NULL);
+	const MPHR * hotTier() const {return latest().hot_tier.get();}
+	//The value of key in this store without looking in the hot tier or the delta or counting it in the query metrics.
+	//Returns false if the fingerprint does not match.  decode_ns is only given when the query is being timed.
+	bool lookup(const string & key, uint64_t &value, LogHistogram *decode_ns=NULL) const {
+		QueryEpoch::Reader reader;
+		return latest().lookupHere(key,value,decode_ns);
+	}
+
+	//Counts added since the model was built (see DeltaStore.h) that query() adds to the ones in the model
+	void setDelta(const boost::shared_ptr<DeltaStore> &added);
+	const DeltaStore * deltaStore() const {return delta.get();}
+	//Sends every query from now on to model, which is how DeltaMerger swaps in the model it has merged the delta into.
+	//The queries that are already running finish in this one so its arrays are only freed by releaseArrays(),
+	//after QueryEpoch::synchronize() has waited for them.
+	void forwardTo(const MPHR *model){__atomic_store_n(&successor,model,__ATOMIC_RELEASE);}
+	void releaseArrays();
 
 private:
 	void initWithFiles(const string & hashFileName, const string & fpRankValueFileName);
 	void readHashFromFile(const string & hashFileName);
 	void writeHashToFile(const string & hashFileName) const;
 	void readFPArrayFromFile(const string & fpArrayFileName);
-	void writeFpArrayToFile(const string & fpArrayFileName) const;
+	void writeFpArrayToFile(const string & fpArrayFileName, const int &compression_level) const;
+	//slot() and lookup() in this model, whether or not it has been forwarded
+	uint64_t slotHere(const string & key) const {return hash.search(key.c_str(), key.length());}
+	bool lookupHere(const string & key, uint64_t &value, LogHistogram *decode_ns) const {return lookupAt(key,slotHere(key),value,decode_ns);}
+	bool lookupAt(const string & key, const uint64_t &index, uint64_t &value, LogHistogram *decode_ns) const;
+	//lookupHere() in a hot tier for a key whose slot in the full store is store_slot
+	bool lookupHot(const string & key, const uint64_t &store_slot, uint64_t &value, LogHistogram *decode_ns) const;
+	void readStoreSlotsFromFile(const string & storeSlotsFileName);
+	void writeStoreSlotsToFile(const string & storeSlotsFileName) const;
+	struct ShardBuild;
+	static void *buildShardsThread(void *build);
 	
 private:
-	cmph_t * minimal_hash;
+	boost::shared_ptr<void> array_memory;	//keeps the memory the arrays were moved to mapped until the arrays below are freed
+	uint64_t array_memory_bytes;
+	string array_memory_name;
+	const char *array_base;	//the table of the arrays in array_memory
+	const SharedArrayEntry *array_table;
+	uint64_t num_mapped_arrays;
+	std::vector<boost::shared_ptr<MPHR> > numa_replicas;	//a copy for every NUMA node but the first (which is this one)
+	ShardedHash hash;
+	uint64_t num_keys;
 	boost::shared_ptr<FingerPrintValueStore> fp_value_store;
+	boost::shared_ptr<MPHR> hot_tier;
+	boost::shared_ptr<CompactStore> store_slots;	//of a hot tier, the slot of each of its keys in the full store
+	boost::shared_ptr<DeltaStore> delta;
+	const MPHR *successor;	//set by forwardTo()
+	const MPHR & latest() const {
+		const MPHR *next=__atomic_load_n(&successor,__ATOMIC_ACQUIRE);
+		return next?*next:*this;
+	}
+
+	//a model that is read from shared memory starts empty, SharedModel fills it in
+	MPHR():array_memory_bytes(0),array_base(NULL),array_table(NULL),num_mapped_arrays(0),num_keys(0),successor(NULL){}
+	friend class SharedModel;
+	//only what is left once share() has taken the arrays out, which is what SharedModel keeps beside them
+	friend class boost::serialization::access;
+	template<class Archive>
+	void serialize(Archive & ar, const unsigned int version)
+	{
+		ar & num_keys;
+		ar & fp_value_store;
+		ar & hot_tier;
+		ar & store_slots;
+	}
 };
 
-MPHR::MPHR(const string & loadMPHRFromBaseFileName){
+inline MemoryUsage MPHR::memory_usage() const {
+	QueryEpoch::Reader reader;
+	const MPHR *next=__atomic_load_n(&successor,__ATOMIC_ACQUIRE);
+	if (next) return next->memory_usage();
+	MemoryUsage usage;
+	usage.add("hash",hash.bytes());
+	usage.add("",fp_value_store->memory_usage());
+	if (hot_tier) usage.add("hot",hot_tier->memory_usage());
+	if (store_slots) usage.add("store_slots",store_slots->memory_usage());
+	if (array_memory) usage.add(array_memory_name,array_memory_bytes);
+	uint64_t replica_bytes=0;
+	for (size_t i=0; i<numa_replicas.size(); ++i) if (numa_replicas[i]) replica_bytes+=numa_replicas[i]->memory_usage().bytes();
+	if (replica_bytes) usage.add("numa_replicas",replica_bytes);
+	if (delta) usage.add("delta",delta->memory_usage());
+	return usage;
+}
+
+inline void MPHR::setDelta(const boost::shared_ptr<DeltaStore> &added){
+	delta=added;
+	for (size_t i=0; i<numa_replicas.size(); ++i) if (numa_replicas[i]) numa_replicas[i]->delta=added;
+}
+
+inline void MPHR::releaseArrays(){
+	fp_value_store.reset();
+	hot_tier.reset();
+	store_slots.reset();
+	numa_replicas.clear();
+	delta.reset();
+	hash.clear();
+	array_memory.reset();
+	array_memory_bytes=0;
+	array_base=NULL;
+	array_table=NULL;
+	num_mapped_arrays=0;
+}
+
+inline void MPHR::share(SharedArrays &arrays){
+	hash.share(arrays);
+	fp_value_store->share(arrays);
+	if (hot_tier) hot_tier->share(arrays);
+	if (store_slots) store_slots->share(arrays);
+}
+
+inline void MPHR::mappedArrays(std::vector<std::pair<const char*,uint64_t> > &ranges) const{
+	for (uint64_t i=0; i<num_mapped_arrays; ++i) {
+		if (array_table[i].bytes) ranges.push_back(std::make_pair(array_base+array_table[i].offset,array_table[i].bytes));
+	}
+	for (size_t i=0; i<numa_replicas.size(); ++i) if (numa_replicas[i]) numa_replicas[i]->mappedArrays(ranges);
+}
+
+inline void MPHR::placeArrays(const bool &huge_pages, const NumaPlacement &numa){
+	if (array_memory) {
+		cerr << "Error: the arrays of the model have already been moved"<<endl;
+		exit(1);
+	}
+	const NumaNodes &nodes=NumaNodes::instance();
+	const unsigned copies=(numa==NUMA_REPLICATE)?nodes.count():1;
+	BuildPhase phase("place_arrays");
+	phase.keys(num_keys);
+
+	//the replicas are made from the model without its arrays, as SharedModel does
+	SharedArrays measure;
+	share(measure);
+	string skeleton;
+	if (copies>1) {
+		std::ostringstream out(std::ios_base::out|std::ios_base::binary);
+		{
+			boost::archive::binary_oarchive oa(out);
+			oa << *this;
+		}
+		skeleton=out.str();
+	}
+	measure.restore();
+	const uint64_t num_arrays=measure.arrays();
+	const uint64_t first_offset=SharedArrays::aligned(sizeof(SharedArrayEntry)*num_arrays);
+	const uint64_t end_offset=first_offset+measure.bytes();
+
+	const char *first_copy=NULL;
+	if (copies>1) numa_replicas.resize(copies);
+	for (unsigned c=0; c<copies; ++c) {
+		boost::shared_ptr<MappedArrays> memory(new MappedArrays(end_offset,huge_pages));
+		if (numa==NUMA_INTERLEAVE && nodes.count()>1 && !nodes.bind(memory->base(),memory->bytes(),MPOL_INTERLEAVE))
+			cerr << "Warning: the pages of the arrays can't be interleaved over the NUMA nodes: "<<strerror(errno)<<endl;
+		if (copies>1 && !nodes.bind(memory->base(),memory->bytes(),MPOL_BIND,c))
+			cerr << "Warning: the copy of the arrays for NUMA node "<<nodes.id(c)<<" can't be bound to it: "<<strerror(errno)<<endl;
+		SharedArrayEntry *table=reinterpret_cast<SharedArrayEntry*>(memory->base());
+		MPHR *model=this;
+		if (c==0) {
+			SharedArrays arrays(SharedArrays::COPY,memory->base(),table,num_arrays,first_offset,end_offset);
+			share(arrays);
+			first_copy=memory->base();
+		}else {
+			memcpy(memory->base(),first_copy,end_offset);
+			//the small parts of the replica that are not in the arrays go on its node as well
+			nodes.prefer(MPOL_BIND,c);
+			boost::shared_ptr<MPHR> replica(new MPHR());
+			{
+				std::istringstream in(skeleton,std::ios_base::in|std::ios_base::binary);
+				boost::archive::binary_iarchive ia(in);
+				ia >> *replica;
+			}
+			SharedArrays arrays(SharedArrays::ATTACH,memory->base(),table,num_arrays,first_offset,end_offset);
+			replica->share(arrays);
+			nodes.prefer(MPOL_DEFAULT);
+			numa_replicas[c]=replica;
+			model=replica.get();
+		}
+		memory->protect();
+		model->array_memory=memory;
+		model->array_memory_bytes=memory->bytes();
+		model->array_memory_name=memory->backing();
+		model->array_base=memory->base();
+		model->array_table=table;
+		model->num_mapped_arrays=num_arrays;
+	}
+	cerr << "Moved "<<num_arrays<<" arrays ("<<end_offset<<" bytes) to "<<array_memory_name;
+	if (numa==NUMA_INTERLEAVE && nodes.count()>1) cerr << " interleaved over "<<nodes.count()<<" NUMA nodes";
+	if (copies>1) cerr << " with a copy on each of "<<copies<<" NUMA nodes";
+	cerr << endl;
+}
+
+inline MPHR::MPHR(const string & loadMPHRFromBaseFileName):array_memory_bytes(0),array_base(NULL),array_table(NULL),num_mapped_arrays(0),num_keys(0),successor(NULL){
 	string fn=loadMPHRFromBaseFileName;
 	initWithFiles(fn+HASH_FILENAME_SUFIX, fn+FP_VALUE_FILENAME_SUFIX);
+	//the hot tier is optional and is only there if it was built when the structure was written
+	string hot=fn+HOT_TIER_FILENAME_SUFIX;
+	ifstream hot_hash((hot+HASH_FILENAME_SUFIX).c_str(),std::ios_base::in);
+	if (hot_hash) {
+		hot_hash.close();
+		BuildPhase phase("read_hot_tier");
+		hot_tier.reset(new MPHR(hot));
+		phase.keys(hot_tier->size());
+		ifstream slots((hot+STORE_SLOTS_FILENAME_SUFIX).c_str(),std::ios_base::in);
+		if (slots) {
+			slots.close();
+			hot_tier->readStoreSlotsFromFile(hot+STORE_SLOTS_FILENAME_SUFIX);
+			if (ModelReport::verbose()) cerr << "Loaded a hot tier of "<<hot_tier->size()<<" keys"<<endl;
+		}else {
+			//without the slots a stored key can match the fingerprint of a hot one and get its value
+			if (ModelReport::verbose()) cerr << "Warning: the hot tier "<<hot<<" has no "<<STORE_SLOTS_FILENAME_SUFIX<<" file so it is not used.  Build it again with -H"<<endl;
+			hot_tier.reset();
+		}
+	}
 }
 
 
@@ -107,7 +352,8 @@ MPHR::MPHR(const string & loadMPHRFromBaseFileName){
 //2. hash every line in the file
 //3. store ranks and values and then compress them for every line
 //4. store the fingerprints for every line
-MPHR::MPHR(const char * pathToNgramFileName, const unsigned &bits_per_fingerprint, const unsigned &bits_per_rank, const char * basefilename){
+inline MPHR::MPHR(const char * pathToNgramFileName, const unsigned &bits_per_fingerprint, const unsigned &bits_per_rank, const char * basefilename, const ValueStoreType &value_store_type, const bool &compressed_rank_runs)
+:array_memory_bytes(0),array_base(NULL),array_table(NULL),num_mapped_arrays(0),num_keys(0),successor(NULL){
 
 	
 	//check if the hash file or fp_store files exists and if so load them instead of replaceing them
@@ -144,31 +390,34 @@ MPHR::MPHR(const char * pathToNgramFileName, const unsigned &bits_per_fingerprin
 		const cmph_uint32 b=5;  //bucket lambda, how many keys per bucket, this is b option for the cmph command line program.  larger values lead to exponantionaly longer running times.
 		const double m=1.0;  //this is the load factor (i.e. 1/m where m is the size of the array to store hash in) either use 1 or .99//this is c in the command line cmph
 		
+		BuildPhase phase("hash");
 		config = cmph_config_new(source);
 		cmph_config_set_algo(config, CMPH_CHD);
 		cmph_config_set_b(config, b);
 		cmph_config_set_verbosity(config, true);
 		if (m != 0) cmph_config_set_graphsize(config, m);
 		//create the hash
-		minimal_hash = cmph_new(config);
+		hash.add(cmph_new(config));
+		num_keys=hash.size();
 		gzclose(keys_fd);
 		cmph_io_nlfile_adapter_destroy(source);   
 		cmph_config_destroy(config);
-		cerr << "Created a minimal perfect hash for " <<minimal_hash->size<<" keys"<<endl;
+		phase.keys(num_keys);
+		cerr << "Created a minimal perfect hash for " <<num_keys<<" keys"<<endl;
 	}else {
 		cerr << "\n*******\nFound existing hash file at: "<<hash_file_name<<"\n So we will just load that file.  If you do not want to use this hash file either remove it or choose a new name.\n*******\n"<<endl;
 		readHashFromFile(hash_file_name);
 	}
     
-	uint64_t total_number_of_keys_hashed=minimal_hash->size;
+	uint64_t total_number_of_keys_hashed=num_keys;
 	
 	if (buildNewFpRankStore){
-		cerr << "Reading and Storing the rank of every ngram in the file using "<<bits_per_rank<<" bits per rank."<<endl;
+		cerr << "Reading and Storing the rank of every ngram in the file."<<endl;
 		boost::shared_ptr<std::vector<uint64_t> > value_array(new std::vector<uint64_t>());
 		value_array->reserve(771058);//this size is the number of unique values in Google Mixed Ngrams
 
         
-		boost::shared_ptr<CompressedValueStoreElias> cvstore_ptr;
+		boost::shared_ptr<ValueStore> cvstore_ptr;
 		
 		//Go through the key file storing at values at hash position
 		ifstream keyFIN(pathToNgramFileName,std::ios_base::in|std::ios_base::binary);
@@ -182,18 +431,20 @@ MPHR::MPHR(const char * pathToNgramFileName, const unsigned &bits_per_fingerprin
 			in.push(boost::iostreams::gzip_decompressor());
 		}
 		{
+			BuildPhase rank_phase("ranks");
 			in.push(keyFIN);
 
-			//create a compact store to hold the values
-			boost::shared_ptr<bitarray > sbr_ptr(new bitarray(bits_per_rank*total_number_of_keys_hashed));
-			CompactStore ranks_compact_store(sbr_ptr,bits_per_rank);
+			//the ranks are written to sorted runs on disk (next to the store if we are saving one) and merged back in slot order
+			//so we never need a bits_per_rank*N array just to hold them before they are compressed
+			SlotRankSorter ranks_by_slot(total_number_of_keys_hashed, basefilename?basefilename:"", 1<<23, compressed_rank_runs);
 			
-			//store all the values in bitarray
+			//store all the values in sorted runs
 			string text;
 			string key;
 			string valuestr;	
 			uint64_t value=0;
 			uint64_t rank=0;
+			uint64_t keys_read=0;
 			
 			while( std::getline(in,text) ) {
 				string::size_type loc;
@@ -210,19 +461,40 @@ MPHR::MPHR(const char * pathToNgramFileName, const unsigned &bits_per_fingerprin
 						rank=value_array->size(); //get current size of values array
 						value_array->push_back(value);
 					}
-					uint64_t index = cmph_search(minimal_hash, key.c_str(), (cmph_uint32)loc);
-					ranks_compact_store.set(index,rank);
+					uint64_t index = hash.search(key.c_str(), loc);
+					ranks_by_slot.add(index,rank);
+					++keys_read;
 				}
 			}
 			in.pop();
+			rank_phase.keys(keys_read);
+			rank_phase.stop();
+			//give back what the reserve above did not use, it is a lot for a small store such as a hot tier
+			std::vector<uint64_t>(*value_array).swap(*value_array);
 			cerr << "Ranks and values have now been stored.  Compressing them now..."<<endl;
-			//Compress the values
-			cvstore_ptr.reset(new CompressedValueStoreElias(ranks_compact_store,total_number_of_keys_hashed));
+			{
+				BuildPhase sort_phase("sort_ranks");
+				sort_phase.keys(keys_read);
+				ranks_by_slot.finish();
+			}
+			//Compress the values straight from the merged runs (so this includes reading the sorted runs back)
+			BuildPhase encode_phase("encode_ranks");
+			encode_phase.keys(total_number_of_keys_hashed);
+			cvstore_ptr=FingerPrintValueStore::buildValueStore(value_store_type,ranks_by_slot,total_number_of_keys_hashed,ranks_by_slot.rank_counts(),bits_per_rank);
 			cerr << "...Done Compressing Values store"<<endl;
 		}
 		cerr << "Reading and Storing all Fingerprints from ngrams file"<<endl;
 
 		//Last pass to store all the fingerprints
+		BuildPhase fingerprint_phase("fingerprints");
+		fingerprint_phase.keys(total_number_of_keys_hashed);
+		//reading a gzipped file again through the decompressor that has already reached its end loses its last
+		//lines, so the chain is made again for this pass
+		in.reset();
+		if (strcmp((pathToNgramFileName+strlen(pathToNgramFileName)-3),".gz")==0) {
+			in.push(boost::iostreams::gzip_decompressor());
+		}
+		keyFIN.clear();
 		keyFIN.seekg(0);
 		in.push(keyFIN);
 		//create a finger print store
@@ -239,87 +511,337 @@ MPHR::MPHR(const char * pathToNgramFileName, const unsigned &bits_per_fingerprin
 				valuestr=(text.substr(loc+1));
 				std::stringstream(valuestr)>>value;
 				if (value==0) continue;
-				uint64_t index = cmph_search(minimal_hash, key.c_str(), (cmph_uint32)loc);
+				uint64_t index = hash.search(key.c_str(), loc);
 				fp_store->storeFP(index, key);
 			}
 		}
 		in.pop();
 		keyFIN.close();
 			
-		fp_value_store.reset(new FingerPrintValueStore(fp_store,cvstore_ptr,value_array));
+		fp_value_store.reset(new FingerPrintValueStore(fp_store,value_store_type,cvstore_ptr,value_array));
 		cerr << "All Fingerprints have been stored."<<endl;
 	}else {
 		cerr << "\n*******\nFound existing fingerprint rank store file at: "<<fp_store_file_name<<"\n So we will just load that file.  If you do not want to use this fpstore file then either remove it or choose a new name.\n*******\n"<<endl;
 		readFPArrayFromFile(fp_store_file_name);
+		if (fp_value_store->valueStoreType()!=value_store_type) cerr << "Warning: the existing fingerprint rank store uses the "<<value_store_name(fp_value_store->valueStoreType())<<" value store and not the "<<value_store_name(value_store_type)<<" value store that was asked for"<<endl;
 	}
 	cerr << "The MPHR structure is complete"<<endl;
 
 }
 
-void MPHR::initWithFiles(const string & hashFileName, const string & fpRankValueFileName){
+//What the threads of the sharded constructor share.  The fingerprints of a shard are a range of the bits of fp_store
+//whose first and last blocks can also hold those of the shards next to it, so the keys with a fingerprint bit in one
+//of those two blocks are kept in edge_keys and stored once every thread is done.
+struct MPHR::ShardBuild {
+	const std::vector<std::vector<boost::shared_ptr<SpillFile> > > *shard_keys;
+	const std::vector<uint64_t> *values;
+	std::vector<uint64_t> first_slots;
+	std::vector<cmph_t*> hashes;
+	std::vector<boost::shared_ptr<SlotRankSorter> > ranks;
+	std::vector<std::vector<std::pair<uint64_t,string> > > edge_keys;
+	boost::shared_ptr<FingerPrintStore> fp_store;
+	unsigned bits_per_fingerprint;
+	string run_file_prefix;
+	size_t pairs_per_run;
+	size_t next_shard;
+	void buildShard(const size_t &shard);
+};
+
+inline void *MPHR::buildShardsThread(void *build){
+	ShardBuild &shards=*static_cast<ShardBuild*>(build);
+	size_t shard;
+	while ((shard=__atomic_fetch_add(&shards.next_shard,1,__ATOMIC_RELAXED))<shards.hashes.size()) shards.buildShard(shard);
+	return NULL;
+}
+
+inline void MPHR::ShardBuild::buildShard(const size_t &shard){
+	SpillFileChain keys((*shard_keys)[shard]);
+	const uint64_t number_of_keys=keys.size();
+	ranks[shard].reset(new SlotRankSorter(number_of_keys,run_file_prefix,pairs_per_run));
+	if (number_of_keys==0) {
+		ranks[shard]->finish();
+		return;
+	}
+	if (number_of_keys>0xffffffffULL) {
+		cerr << "Error: shard "<<shard<<" has "<<number_of_keys<<" keys, which is more than a hash can have.  Use more shards"<<endl;
+		exit(1);
+	}
+	//the same hash as the one the constructor that reads a key file makes, quietly as other threads are making theirs
+	keys.rewind();
+	cmph_io_adapter_t source;
+	source.data=&keys;
+	source.nkeys=number_of_keys;
+	source.read=spill_chain_read;
+	source.dispose=spill_chain_dispose;
+	source.rewind=spill_chain_rewind;
+	cmph_config_t *config=cmph_config_new(&source);
+	cmph_config_set_algo(config, CMPH_CHD);
+	cmph_config_set_b(config, 5);
+	cmph_config_set_verbosity(config, false);
+	cmph_config_set_graphsize(config, 1.0);
+	cmph_t *shard_hash=cmph_new(config);
+	cmph_config_destroy(config);
+	if (shard_hash==NULL || shard_hash->size!=number_of_keys) {
+		cerr << "Error: can't make the hash of shard "<<shard<<", it may have the same key twice"<<endl;
+		exit(1);
+	}
+	hashes[shard]=shard_hash;
+
+	const uint64_t first=first_slots[shard];
+	const uint64_t block_bits=boost::dynamic_bitset<>::bits_per_block;
+	const uint64_t first_block=first*bits_per_fingerprint/block_bits;
+	const uint64_t last_block=((first+number_of_keys)*bits_per_fingerprint-1)/block_bits;
+	keys.rewind();
+	while (keys.next()) {
+		const string &key=keys.key();
+		const uint64_t slot=first+cmph_search(shard_hash,key.data(),key.length());
+		std::vector<uint64_t>::const_iterator value=std::lower_bound(values->begin(),values->end(),keys.value());
+		if (value==values->end() || *value!=keys.value()) {
+			cerr << "Error: the count "<<keys.value()<<" of "<<key<<" is not one of the values the store is built with"<<endl;
+			exit(1);
+		}
+		ranks[shard]->add(slot-first,value-values->begin());
+		if (slot*bits_per_fingerprint/block_bits==first_block || ((slot+1)*bits_per_fingerprint-1)/block_bits==last_block) edge_keys[shard].push_back(std::make_pair(slot,key));
+		else fp_store->storeFP(slot,key);
+	}
+	ranks[shard]->finish(true);
+}
+
+//1. hash every shard and read its keys again for their ranks and fingerprints, a shard at a time on each thread
+//2. encode the ranks of all the shards in slot order, without the values no key has
+inline MPHR::MPHR(const std::vector<std::vector<boost::shared_ptr<SpillFile> > > &shard_keys, const std::vector<uint64_t> &values, const unsigned &bits_per_fingerprint, const unsigned &bits_per_rank, const ValueStoreType &value_store_type, const unsigned &threads, const string &run_file_prefix)
+:array_memory_bytes(0),array_base(NULL),array_table(NULL),num_mapped_arrays(0),num_keys(0),successor(NULL){
+	const size_t shards=shard_keys.size();
+	ShardBuild build;
+	build.shard_keys=&shard_keys;
+	build.values=&values;
+	uint64_t keys=0;
+	for (size_t i=0; i<shards; ++i) {
+		build.first_slots.push_back(keys);
+		keys+=SpillFileChain(shard_keys[i]).size();
+	}
+	if (keys==0) {
+		cerr << "Error: there are no keys to build the store from"<<endl;
+		exit(1);
+	}
+	build.hashes.assign(shards,NULL);
+	build.ranks.resize(shards);
+	build.edge_keys.resize(shards);
+	build.fp_store.reset(new FingerPrintStore(keys,bits_per_fingerprint));
+	build.bits_per_fingerprint=bits_per_fingerprint;
+	build.run_file_prefix=run_file_prefix;
+	//the ranks of the shards that are being read and of those waiting to be merged take no more memory than the
+	//one run of the constructor that reads a key file
+	build.pairs_per_run=std::max<size_t>((1<<23)/shards,1<<12);
+	build.next_shard=0;
+	{
+		BuildPhase phase("shards");
+		phase.keys(keys);
+		std::vector<pthread_t> workers(std::min<size_t>(std::max(threads,1u),shards));
+		for (size_t i=0; i<workers.size(); ++i) {
+			if (pthread_create(&workers[i],NULL,buildShardsThread,&build)!=0) {
+				cerr << "Error: can't start the threads that build the shards"<<endl;
+				exit(1);
+			}
+		}
+		for (size_t i=0; i<workers.size(); ++i) pthread_join(workers[i],NULL);
+		for (size_t i=0; i<shards; ++i) {
+			hash.add(build.hashes[i]);
+			for (size_t j=0; j<build.edge_keys[i].size(); ++j) build.fp_store->storeFP(build.edge_keys[i][j].first,build.edge_keys[i][j].second);
+		}
+		num_keys=hash.size();
+	}
+	cerr << "Created a minimal perfect hash for " <<num_keys<<" keys in "<<shards<<" shards"<<endl;
+
+	boost::shared_ptr<ValueStore> cvstore_ptr;
+	ShardRankStream ranks(build.ranks,values);
+	{
+		BuildPhase encode_phase("encode_ranks");
+		encode_phase.keys(num_keys);
+		cvstore_ptr=FingerPrintValueStore::buildValueStore(value_store_type,ranks,num_keys,ranks.rank_counts(),bits_per_rank);
+	}
+	fp_value_store.reset(new FingerPrintValueStore(build.fp_store,value_store_type,cvstore_ptr,ranks.values()));
+	cerr << "The MPHR structure is complete"<<endl;
+}
+
+inline void MPHR::initWithFiles(const string & hashFileName, const string & fpRankValueFileName){
 	
-	cerr << "Loading MPHR From Disk"<<endl;
+	if (ModelReport::verbose()) cerr << "Loading MPHR From Disk"<<endl;
 
 	//1. LOAD THE HASH
-	readHashFromFile(hashFileName);
-	
+	{
+		BuildPhase phase("read_hash");
+		readHashFromFile(hashFileName);
+		phase.keys(num_keys);
+	}
 	
 	//2. LOAD THE FINGERPRINTS-RANK-VALUES STRUCTURE
-	readFPArrayFromFile(fpRankValueFileName);
-	
-	cerr << "MPHR Sucessfully Loaded From Disk"<<endl;
+	{
+		BuildPhase phase("read_fp_values");
+		readFPArrayFromFile(fpRankValueFileName);
+		phase.keys(num_keys);
+	}
+	if (ModelReport::verbose()) {
+		cerr << "Ranks are held in the "<<value_store_name(fp_value_store->valueStoreType())<<" value store"<<endl;
+		cerr << "MPHR Sucessfully Loaded From Disk"<<endl;
+	}
 	
 }
 
-MPHR::~MPHR(){
-	cmph_destroy(minimal_hash);
+inline bool MPHR::lookupAt(const string & key, const uint64_t &index, uint64_t &value, LogHistogram *decode_ns) const{
+	if (!fp_value_store->fingerPrints().checkFP(index,key)) return false;
+	const uint64_t decode_start=decode_ns?query_metrics_now_ns():0;
+	value=fp_value_store->valueAt(index);
+	if (decode_ns) decode_ns->add(query_metrics_now_ns()-decode_start);
+	return true;
 }
 
+#ifdef SHEFLM_NO_QUERY_METRICS
 inline uint64_t MPHR::query(const string & key) const{
-	uint64_t index = cmph_search(minimal_hash, key.c_str(), (cmph_uint32)key.length());
-	uint64_t result=fp_value_store->query(index,key);
+	//a merge doesn't free the model or the delta table this reads until it returns
+	QueryEpoch::Reader reader;
+	const MPHR *next=__atomic_load_n(&successor,__ATOMIC_ACQUIRE);
+	if (next) return next->query(key);
+	if (!numa_replicas.empty()) {
+		const MPHR *replica=numa_replicas[NumaNodes::instance().current()].get();
+		if (replica) return replica->query(key);
+	}
+	uint64_t result=0;
+	const uint64_t slot=slotHere(key);
+	if (!(hot_tier && hot_tier->lookupHot(key,slot,result,NULL))) lookupAt(key,slot,result,NULL);
+	uint64_t added;
+	if (delta && delta->lookup(key,added)) result+=added;
+	return result;
+}
+#else
+inline uint64_t MPHR::query(const string & key) const{
+	//a merge doesn't free the model or the delta table this reads until it returns
+	QueryEpoch::Reader reader;
+	const MPHR *next=__atomic_load_n(&successor,__ATOMIC_ACQUIRE);
+	if (next) return next->query(key);
+	if (!numa_replicas.empty()) {
+		const MPHR *replica=numa_replicas[NumaNodes::instance().current()].get();
+		if (replica) return replica->query(key);
+	}
+	QueryThreadMetrics &metrics=QueryMetrics::local();
+	const bool timed=metrics.sample(QueryMetrics::sampleEvery());
+	const uint64_t start=timed?query_metrics_now_ns():0;
+	LogHistogram *decode_ns=timed?&metrics.decode_ns:NULL;
+	uint64_t result=0;
+	++metrics.queries;
+	const uint64_t slot=slotHere(key);
+	if (hot_tier && hot_tier->lookupHot(key,slot,result,decode_ns)) {
+		++metrics.hits;
+		++metrics.hot_hits;
+	}else if (lookupAt(key,slot,result,decode_ns)) {
+		++metrics.hits;
+	}else {
+		++metrics.fingerprint_rejects;
+	}
+	uint64_t added;
+	if (delta && delta->lookup(key,added)) {
+		result+=added;
+		++metrics.delta_hits;
+	}
+	if (timed) metrics.query_ns.add(query_metrics_now_ns()-start);
 	return result;
 }
+#endif
 
-void MPHR::writeMPHRToFilesWithBaseName(const string & storeBaseFileName) const{
+inline void MPHR::buildHotTier(const char * pathToNgramFileName, const uint64_t &hot_keys, const char * queryLogFileName, const unsigned &bits_per_fingerprint, const char * basefilename){
+	BuildPhase phase("hot_tier");
+	hot_tier.reset();
+	std::vector<HotKey> hot;
+	if (queryLogFileName) {
+		cerr << "Choosing the "<<hot_keys<<" keys queried most often in "<<queryLogFileName<<" for the hot tier"<<endl;
+		hot_keys_by_query_log(queryLogFileName,hot_keys,*this,hot);
+	}else {
+		if (pathToNgramFileName==NULL) {
+			cerr << "Error: the hot tier needs either the key file or a query log to choose its keys from"<<endl;
+			exit(1);
+		}
+		cerr << "Choosing the "<<hot_keys<<" keys with the largest counts in "<<pathToNgramFileName<<" for the hot tier"<<endl;
+		hot_keys_by_count(pathToNgramFileName,hot_keys,hot);
+	}
+	phase.keys(hot.size());
+	if (hot.empty()) {
+		cerr << "Warning: no keys were found for the hot tier so it has not been built"<<endl;
+		return;
+	}
+	string prefix;
+	if (basefilename) prefix=basefilename;
+	else {
+		const char * tmpdir=getenv("TMPDIR");
+		prefix=string(tmpdir?tmpdir:"/tmp")+"/shefLM";
+	}
+	const string hotKeyFileName=write_hot_key_file(hot,prefix);
+	hot_tier.reset(new MPHR(hotKeyFileName.c_str(),bits_per_fingerprint,0,NULL,VALUE_STORE_COMPACT));
+	unlink(hotKeyFileName.c_str());
+	const unsigned slot_bits=bits_to_hold(std::max<uint64_t>(num_keys,1)-1);
+	hot_tier->store_slots.reset(new CompactStore(boost::shared_ptr<boost::dynamic_bitset<> >(new boost::dynamic_bitset<>(hot_tier->size()*slot_bits)),slot_bits));
+	for (size_t i=0; i<hot.size(); ++i) hot_tier->store_slots->set(hot_tier->slotHere(hot[i].second),slotHere(hot[i].second));
+	cerr << "The hot tier holds "<<hot_tier->size()<<" keys in "<<hot_tier->memory_usage().bytes()<<" bytes"<<endl;
+}
+
+inline void MPHR::writeMPHRToFilesWithBaseName(const string & storeBaseFileName, const int &compression_level) const{
 	string fn=storeBaseFileName;
+	if (!hash.unpacked()) {
+		cerr << "Error: a model that is in shared memory can't be written out, load it from its files to write it"<<endl;
+		exit(1);
+	}
 	cerr << "Writing MPHR to Disk...."<<endl;
-	writeHashToFile(fn+HASH_FILENAME_SUFIX);
-	writeFpArrayToFile(fn+FP_VALUE_FILENAME_SUFIX);
+	{
+		BuildPhase phase("write_hash");
+		phase.keys(num_keys);
+		writeHashToFile(fn+HASH_FILENAME_SUFIX);
+	}
+	{
+		BuildPhase phase("write_fp_values");
+		phase.keys(num_keys);
+		writeFpArrayToFile(fn+FP_VALUE_FILENAME_SUFIX,compression_level);
+	}
+	if (store_slots) writeStoreSlotsToFile(fn+STORE_SLOTS_FILENAME_SUFIX);
+	if (hot_tier) hot_tier->writeMPHRToFilesWithBaseName(fn+HOT_TIER_FILENAME_SUFIX,compression_level);
 	cerr << "The MPHR structure has successfully been written to disk.  It is stored as two files that begin with the basefilename "<<storeBaseFileName<<" and end with the suffixes "<<HASH_FILENAME_SUFIX<<" and "<<FP_VALUE_FILENAME_SUFIX<<endl;
 }
 
-void MPHR::readHashFromFile(const string & hashFileName){
+inline void MPHR::readHashFromFile(const string & hashFileName){
 	FILE *mphf_fd = fopen(hashFileName.c_str(), "r");
-	if (mphf_fd==NULL){
-		cerr << "Error: can't read hash function file: " << hashFileName <<endl;
-		exit(1);
-	}
-	minimal_hash = cmph_load(mphf_fd);
+	if (mphf_fd==NULL) ModelReport::error("can't read hash function file: "+hashFileName);
+	const bool loaded=hash.load(mphf_fd);
 	fclose(mphf_fd);
+	if (!loaded) ModelReport::error("can't read the hash function in: "+hashFileName);
+	num_keys=hash.size();
 }
 
-void MPHR::writeHashToFile(const string & hashFileName) const{
+inline void MPHR::writeHashToFile(const string & hashFileName) const{
 	//file to write keys
 	FILE* mphf_fd = fopen(hashFileName.c_str(), "w");
 	if (mphf_fd==NULL){
 		cerr << "Error: can't write to hash function file: " << hashFileName <<endl;
 		exit(0);
 	}
-	cmph_dump(minimal_hash, mphf_fd);
+	hash.dump(mphf_fd);
 	fclose(mphf_fd);
 }
 
 
-void MPHR::readFPArrayFromFile(const string & fpRankValueFileName){
+inline void MPHR::readFPArrayFromFile(const string & fpRankValueFileName){
 	boost::shared_ptr<FingerPrintValueStore> fpvs_ptr;
-	ifstream fpRankValueFileStream(fpRankValueFileName.c_str(),std::ios_base::in|std::ios_base::binary);
-	if (!fpRankValueFileStream) {
-		cerr << "Unable to open rank value file: "<<fpRankValueFileName <<endl;
-		exit(1);
+	if (ChunkedFileReader::isChunkedFile(fpRankValueFileName)) {
+		//the chunks are decompressed by a thread for every cpu while the archive is read from the ones before them
+		boost::shared_ptr<ChunkedFileReader> reader(new ChunkedFileReader(fpRankValueFileName));
+		boost::iostreams::filtering_stream<boost::iostreams::input> in;
+		in.push(ChunkedFileSource(reader));
+		boost::archive::binary_iarchive ia(in);
+		ia >> fpvs_ptr;
+		fp_value_store=fpvs_ptr;
+		return;
 	}
+	ifstream fpRankValueFileStream(fpRankValueFileName.c_str(),std::ios_base::in|std::ios_base::binary);
+	if (!fpRankValueFileStream) ModelReport::error("unable to open rank value file: "+fpRankValueFileName);
 	boost::iostreams::filtering_stream<boost::iostreams::input> in;
-	try {  //try to read in the gzipped file (gzip is the format we output)
+	try {  //try to read in the gzipped file (gzip is the format that was written before the chunked files)
 		in.push(boost::iostreams::gzip_decompressor());
 		in.push(fpRankValueFileStream);
 		boost::archive::binary_iarchive ia(in);
@@ -336,24 +858,70 @@ void MPHR::readFPArrayFromFile(const string & fpRankValueFileName){
 	fp_value_store=fpvs_ptr;
 }
 	
-void MPHR::writeFpArrayToFile(const string & fpArrayFileName) const{
-	ofstream FpArrayFileStream(fpArrayFileName.c_str(),std::ios_base::out|std::ios_base::binary);
-	if (!FpArrayFileStream) {
-		cerr << "Unable to open fp rank value file: "<<fpArrayFileName <<endl;
+inline bool MPHR::lookupHot(const string & key, const uint64_t &store_slot, uint64_t &value, LogHistogram *decode_ns) const{
+	const uint64_t index=slotHere(key);
+	if ((*store_slots)[index]!=store_slot) return false;
+	return lookupAt(key,index,value,decode_ns);
+}
+
+inline void MPHR::readStoreSlotsFromFile(const string & storeSlotsFileName){
+	ifstream in(storeSlotsFileName.c_str(),std::ios_base::in|std::ios_base::binary);
+	if (!in) ModelReport::error("unable to open the store slots file: "+storeSlotsFileName);
+	boost::archive::binary_iarchive ia(in);
+	ia >> store_slots;
+}
+
+inline void MPHR::writeStoreSlotsToFile(const string & storeSlotsFileName) const{
+	ofstream out(storeSlotsFileName.c_str(),std::ios_base::out|std::ios_base::binary);
+	{
+		boost::archive::binary_oarchive oa(out);
+		oa << store_slots;
+	}
+	out.close();
+	if (!out) {
+		cerr << "Error: can't write the store slots file: "<<storeSlotsFileName<<endl;
 		exit(1);
 	}
-	boost::iostreams::filtering_stream<boost::iostreams::output> out;
-	out.push(boost::iostreams::gzip_compressor(boost::iostreams::gzip_params(9)));
-	out.push(FpArrayFileStream);
-	boost::archive::binary_oarchive oa(out);
-	oa << fp_value_store;
-	//out.pop();
-	//FpArrayFileStream.close();
 }
 
+inline void MPHR::writeFpArrayToFile(const string & fpArrayFileName, const int &compression_level) const{
+	boost::shared_ptr<ChunkedFileWriter> writer(new ChunkedFileWriter(fpArrayFileName,compression_level));
+	{
+		boost::iostreams::filtering_stream<boost::iostreams::output> out;
+		out.push(ChunkedFileSink(writer));
+		{
+			boost::archive::binary_oarchive oa(out);
+			oa << fp_value_store;
+		}
+		out.flush();
+	}
+	writer->close();
+}
+
+
 
 
 
+//The adapter the sharded constructor hashes the keys of a shard with, its data is the SpillFileChain of the shard
+static int spill_chain_read(void *data, char **key, cmph_uint32 *keylen){
+	SpillFileChain &keys=*static_cast<SpillFileChain*>(data);
+	*key=NULL;
+	*keylen=0;
+	if (!keys.next()) return -1;
+	*keylen=keys.key().length();
+	*key=(char *)malloc(*keylen+1);
+	memcpy(*key,keys.key().data(),*keylen);
+	return (int)(*keylen);
+}
+
+static void spill_chain_dispose(void *data, char *key, cmph_uint32 keylen){
+	free(key);
+}
+
+static void spill_chain_rewind(void *data){
+	static_cast<SpillFileChain*>(data)->rewind();
+}
+
 
 //This file adapter is to be used as a reader with cmph_io_nlfile_adapter
 //it only reads up to a tab char on every line
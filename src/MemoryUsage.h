@@ -0,0 +1,93 @@
+/*
+ *  MemoryUsage.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//The bytes held by each part of a structure.  Every structure has a memory_usage() that returns one of these,
+//and structures made of other structures add their parts under a prefix (e.g. ranks.index.upper.inventory)
+//so a loaded model can be broken down all the way to the select inventories.
+//The memory_usage() of a select or rank index counts only the index, not the bits it is built over (see SharedArrays.h).
+
+#ifndef MEMORY_USAGE_H
+#define MEMORY_USAGE_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdint.h>
+
+
+class MemoryUsage {
+public:
+	MemoryUsage & add(const std::string &component, const uint64_t &bytes){
+		parts.push_back(std::make_pair(component,bytes));
+		return *this;
+	}
+	//adds every part of other with component. in front of its name (or as it is if component is empty)
+	MemoryUsage & add(const std::string &component, const MemoryUsage &other){
+		const std::string prefix=component.empty()?component:component+".";
+		for (size_t i=0; i<other.parts.size(); ++i) add(prefix+other.parts[i].first,other.parts[i].second);
+		return *this;
+	}
+	uint64_t bytes() const{
+		uint64_t total=0;
+		for (size_t i=0; i<parts.size(); ++i) total+=parts[i].second;
+		return total;
+	}
+	size_t size() const {return parts.size();}
+	const std::string & component(const size_t &i) const {return parts[i].first;}
+	uint64_t bytes(const size_t &i) const {return parts[i].second;}
+
+	//a table of bytes, bits per key and share of the total for every part
+	void print(std::ostream &out, const uint64_t &num_keys) const;
+private:
+	std::vector<std::pair<std::string,uint64_t> > parts;
+};
+
+//the memory a vector has allocated, which can be more than it holds
+template <class T>
+inline uint64_t vector_bytes(const std::vector<T> &v){
+	return sizeof(T)*v.capacity();
+}
+
+inline void MemoryUsage::print(std::ostream &out, const uint64_t &num_keys) const{
+	const uint64_t total=bytes();
+	const double keys=num_keys?num_keys:1;
+	size_t width=5;
+	for (size_t i=0; i<parts.size(); ++i) width=std::max(width,parts[i].first.size());
+	out << std::left << std::setw(width) << "component" << std::right << std::setw(16) << "bytes" << std::setw(12) << "bits/key" << std::setw(10) << "percent" << "\n";
+	out << std::fixed << std::setprecision(3);
+	for (size_t i=0; i<parts.size(); ++i) {
+		out << std::left << std::setw(width) << parts[i].first << std::right << std::setw(16) << parts[i].second
+			<< std::setw(12) << 8*parts[i].second/keys
+			<< std::setw(9) << std::setprecision(2) << (total?100.0*parts[i].second/total:0.0) << "%" << std::setprecision(3) << "\n";
+	}
+	out << std::left << std::setw(width) << "total" << std::right << std::setw(16) << total << std::setw(12) << 8*total/keys << std::setw(10) << "100.00%" << "\n";
+	out.unsetf(std::ios_base::floatfield);
+	out << std::setprecision(6);
+}
+
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ *  ModelReport.h
+ *  ShefLMStore
+ *
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//How loading a model reports what it does and what goes wrong.
+//The programs print a model that can't be read on stderr and exit, as they always have.  libshefLM calls
+//setThrowing(true) so the error is thrown as a ModelError instead, which its C interface turns into NULL and errno.
+//The messages that say what is being loaded are only printed when verbose(), which the programs are and the
+//library is not unless it is asked to be.
+
+#ifndef MODEL_REPORT_H
+#define MODEL_REPORT_H
+
+#include <cstdlib>
+#include <string>
+#include <iostream>
+#include <stdexcept>
+
+
+class ModelError : public std::runtime_error {
+public:
+	explicit ModelError(const std::string &message):std::runtime_error(message){}
+};
+
+
+class ModelReport {
+public:
+	static bool verbose(){return verboseFlag();}
+	static void setVerbose(const bool &verbose){verboseFlag()=verbose;}
+	static void setThrowing(const bool &throwing){throwingFlag()=throwing;}
+	//a model that can't be read (or shared), it does not return
+	static void error(const std::string &message);
+
+private:
+	static bool & verboseFlag(){
+		static bool flag=true;
+		return flag;
+	}
+	static bool & throwingFlag(){
+		static bool flag=false;
+		return flag;
+	}
+};
+
+inline void ModelReport::error(const std::string &message){
+	if (throwingFlag()) throw ModelError(message);
+	std::cerr << "Error: "<<message<<std::endl;
+	exit(1);
+}
+
+
+#endif
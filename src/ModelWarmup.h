@@ -0,0 +1,225 @@
+/*
+ *  ModelWarmup.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Faults in every page of the mapped arrays of a model (see MPHR::mappedArrays) with a few threads while the
+//model is already being queried, so the first queries after a start do not each wait for the pages they read.
+//The smallest arrays are done first: they are the hash function and the select inventories that every query reads.
+//A page is faulted in with MADV_POPULATE_READ where the kernel has it and by reading a byte of it where it does not.
+//Progress goes to stderr every second and, if a status file is given, to that file as JSON (replaced atomically)
+//so whatever starts the program can wait for "ready":true before sending it traffic.
+
+#ifndef MODEL_WARMUP_H
+#define MODEL_WARMUP_H
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "MPHR.h"
+
+
+class ModelWarmup {
+public:
+	static const uint64_t CHUNK_BYTES=2*1024*1024;	//the work a thread takes at once, a huge page
+
+	ModelWarmup(const MPHR &model, const unsigned &number_of_threads, const std::string &statusFileName="");
+	//stops the threads, which must be done before the model is destroyed
+	~ModelWarmup();
+	bool ready() const;
+
+private:
+	ModelWarmup(const ModelWarmup&); //disallow copy
+	void operator=(const ModelWarmup&); //disallow assignment
+
+	struct Chunk {
+		const char *start;
+		uint64_t bytes;
+	};
+	static bool smaller(const std::pair<const char*,uint64_t> &a, const std::pair<const char*,uint64_t> &b){return a.second<b.second;}
+	static void *touchThread(void *warmup){static_cast<ModelWarmup*>(warmup)->touch(); return NULL;}
+	static void *reportThread(void *warmup){static_cast<ModelWarmup*>(warmup)->report(); return NULL;}
+	void touch();
+	void report();
+	void touch_pages(const Chunk &chunk);
+	void write_status(const uint64_t &done, const bool &finished) const;
+	static double now(){
+		struct timeval tv;
+		gettimeofday(&tv,NULL);
+		return tv.tv_sec+tv.tv_usec/1e6;
+	}
+
+	std::vector<Chunk> chunks;	//in the order they are warmed
+	uint64_t total_bytes;
+	const std::string status_file;
+	const double started;
+	const uintptr_t page_bytes;
+
+	mutable pthread_mutex_t mutex;
+	pthread_cond_t changed;
+	size_t next_chunk;
+	uint64_t done_bytes;
+	unsigned running;
+	bool stopping;
+	std::vector<pthread_t> threads;
+	pthread_t reporter;
+	bool reporting;
+};
+
+
+inline ModelWarmup::ModelWarmup(const MPHR &model, const unsigned &number_of_threads, const std::string &statusFileName)
+:total_bytes(0),status_file(statusFileName),started(now()),page_bytes(sysconf(_SC_PAGESIZE)),next_chunk(0),done_bytes(0),running(0),stopping(false),reporting(false){
+	std::vector<std::pair<const char*,uint64_t> > ranges;
+	model.mappedArrays(ranges);
+	std::stable_sort(ranges.begin(),ranges.end(),smaller);
+	for (size_t i=0; i<ranges.size(); ++i) {
+		for (uint64_t offset=0; offset<ranges[i].second; offset+=CHUNK_BYTES) {
+			Chunk chunk;
+			chunk.start=ranges[i].first+offset;
+			chunk.bytes=std::min(CHUNK_BYTES,ranges[i].second-offset);
+			chunks.push_back(chunk);
+		}
+		total_bytes+=ranges[i].second;
+	}
+	pthread_mutex_init(&mutex,NULL);
+	pthread_cond_init(&changed,NULL);
+	if (chunks.empty()) {
+		cerr << "Warmup: the arrays of the model were read into memory when it was loaded so there is nothing to warm up"<<endl;
+		write_status(0,true);
+		return;
+	}
+	cerr << "Warmup: faulting in "<<total_bytes<<" bytes of "<<ranges.size()<<" arrays"<<endl;
+	write_status(0,false);
+	const unsigned n=std::max(1u,std::min<unsigned>(number_of_threads,chunks.size()));
+	running=n;
+	for (unsigned i=0; i<n; ++i) {
+		pthread_t thread;
+		if (pthread_create(&thread,NULL,touchThread,this)!=0) {
+			cerr << "Error: can't start the warmup threads"<<endl;
+			exit(1);
+		}
+		threads.push_back(thread);
+	}
+	reporting=pthread_create(&reporter,NULL,reportThread,this)==0;
+}
+
+inline ModelWarmup::~ModelWarmup(){
+	pthread_mutex_lock(&mutex);
+	stopping=true;
+	pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&mutex);
+	for (size_t i=0; i<threads.size(); ++i) pthread_join(threads[i],NULL);
+	if (reporting) pthread_join(reporter,NULL);
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&mutex);
+}
+
+inline bool ModelWarmup::ready() const {
+	pthread_mutex_lock(&mutex);
+	const bool finished=done_bytes==total_bytes;
+	pthread_mutex_unlock(&mutex);
+	return finished;
+}
+
+inline void ModelWarmup::touch(){
+	pthread_mutex_lock(&mutex);
+	while (!stopping && next_chunk<chunks.size()) {
+		const Chunk chunk=chunks[next_chunk++];
+		pthread_mutex_unlock(&mutex);
+		touch_pages(chunk);
+		pthread_mutex_lock(&mutex);
+		done_bytes+=chunk.bytes;
+	}
+	if (--running==0) pthread_cond_broadcast(&changed);
+	pthread_mutex_unlock(&mutex);
+}
+
+inline void ModelWarmup::touch_pages(const Chunk &chunk){
+	const uintptr_t first=reinterpret_cast<uintptr_t>(chunk.start)/page_bytes*page_bytes;
+	const uintptr_t end=reinterpret_cast<uintptr_t>(chunk.start)+chunk.bytes;
+#ifdef MADV_POPULATE_READ
+	if (madvise(reinterpret_cast<void*>(first),end-first,MADV_POPULATE_READ)==0) return;
+#endif
+	//an older kernel, so read a byte of every page
+	volatile char sink=0;
+	for (uintptr_t page=first; page<end; page+=page_bytes) sink+=*reinterpret_cast<const volatile char*>(std::max(page,reinterpret_cast<uintptr_t>(chunk.start)));
+	(void)sink;
+}
+
+inline void ModelWarmup::report(){
+	pthread_mutex_lock(&mutex);
+	bool finished=false;
+	while (!finished) {
+		if (running && !stopping) {
+			struct timeval tv;
+			gettimeofday(&tv,NULL);
+			struct timespec until;
+			until.tv_sec=tv.tv_sec+1;
+			until.tv_nsec=tv.tv_usec*1000;
+			pthread_cond_timedwait(&changed,&mutex,&until);
+		}
+		finished=done_bytes==total_bytes;
+		if (!finished && (stopping || !running)) break;
+		const uint64_t done=done_bytes;
+		pthread_mutex_unlock(&mutex);
+		if (finished) {
+			cerr << "Warmup: done, "<<done<<" bytes in "<<now()-started<<" seconds"<<endl;
+		}else {
+			cerr << "Warmup: "<<100*done/total_bytes<<"% ("<<done<<" of "<<total_bytes<<" bytes)"<<endl;
+		}
+		write_status(done,finished);
+		pthread_mutex_lock(&mutex);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+inline void ModelWarmup::write_status(const uint64_t &done, const bool &finished) const {
+	if (status_file.empty()) return;
+	const std::string temporary=status_file+".tmp";
+	{
+		std::ofstream out(temporary.c_str());
+		out << "{\"ready\":"<<(finished?"true":"false")<<",\"warmed_bytes\":"<<done<<",\"total_bytes\":"<<total_bytes
+			<<",\"seconds\":"<<now()-started<<"}\n";
+		out.close();
+		if (!out) {
+			cerr << "Warning: can't write the warmup status to: "<<temporary<<endl;
+			return;
+		}
+	}
+	if (rename(temporary.c_str(),status_file.c_str())!=0) cerr << "Warning: can't replace the warmup status file "<<status_file<<": "<<strerror(errno)<<endl;
+}
+
+
+#endif
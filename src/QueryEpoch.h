@@ -0,0 +1,150 @@
+/*
+ *  QueryEpoch.h
+ *  ShefLMStore
+ *
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Lets a thread that replaces something queries read (the table of a delta store, a model that a merge has replaced)
+//free the old one once no query can still be reading it, without the queries taking a lock.
+//A query holds a QueryEpoch::Reader, which writes the current epoch to a slot of its thread's own and clears it
+//when the query is done.  synchronize() starts a new epoch and waits until every slot is clear or has the new
+//epoch, so every query that could have seen the old pointer has finished.  Call it after the new pointer has been
+//published and before the old one is freed.
+//The slots are a cache line each so the queries of different threads don't share lines, and the slot of a thread
+//that exits is given to the next new thread.
+
+#ifndef QUERY_EPOCH_H
+#define QUERY_EPOCH_H
+
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+
+class QueryEpoch {
+private:
+	struct Slot {
+		uint64_t epoch;	//the epoch the query of the thread started in, 0 when it is not in one
+		unsigned depth;	//how many Readers the thread holds, only the thread uses it
+		char padding[64-sizeof(uint64_t)-sizeof(unsigned)];
+		Slot():epoch(0),depth(0){}
+	};
+
+public:
+	//held by a query for as long as it reads, a thread can hold several at once
+	class Reader {
+	public:
+		Reader():slot(QueryEpoch::local()){
+			if (slot.depth++==0) {
+				__atomic_store_n(&slot.epoch,__atomic_load_n(&QueryEpoch::instance().current,__ATOMIC_RELAXED),__ATOMIC_RELAXED);
+				//the slot is seen by synchronize() before this thread reads anything it could free
+				__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			}
+		}
+		~Reader(){
+			if (--slot.depth==0) __atomic_store_n(&slot.epoch,0,__ATOMIC_RELEASE);
+		}
+	private:
+		Reader(const Reader&); //disallow copy
+		void operator=(const Reader&); //disallow assignment
+		Slot &slot;
+	};
+
+	//waits until every query that was running when it was called has finished
+	static void synchronize();
+
+private:
+	QueryEpoch():current(1){
+		pthread_mutex_init(&mutex,NULL);
+		pthread_key_create(&thread_key,retireThread);
+	}
+	static QueryEpoch & instance(){
+		static QueryEpoch epochs;
+		return epochs;
+	}
+	static Slot *& threadSlot(){
+		static __thread Slot *slot=0;
+		return slot;
+	}
+	static Slot & local(){
+		Slot *&slot=threadSlot();
+		if (!slot) slot=instance().addThread();
+		return *slot;
+	}
+	Slot * addThread();
+	static void retireThread(void *slot);
+
+	uint64_t current;
+	pthread_mutex_t mutex;
+	pthread_key_t thread_key;
+	std::vector<Slot *> slots;	//every slot that has been made, they are never freed
+	std::vector<Slot *> free_slots;	//left by threads that have exited
+};
+
+inline QueryEpoch::Slot * QueryEpoch::addThread(){
+	Slot *slot;
+	pthread_mutex_lock(&mutex);
+	if (free_slots.empty()) {
+		void *memory;
+		if (posix_memalign(&memory,64,sizeof(Slot))!=0) {
+			pthread_mutex_unlock(&mutex);
+			throw std::bad_alloc();
+		}
+		slot=new (memory) Slot();
+		slots.push_back(slot);
+	}else {
+		slot=free_slots.back();
+		free_slots.pop_back();
+	}
+	pthread_mutex_unlock(&mutex);
+	pthread_setspecific(thread_key,slot);
+	return slot;
+}
+
+inline void QueryEpoch::retireThread(void *slot){
+	QueryEpoch &e=instance();
+	pthread_mutex_lock(&e.mutex);
+	e.free_slots.push_back(static_cast<Slot*>(slot));
+	pthread_mutex_unlock(&e.mutex);
+	threadSlot()=0;
+}
+
+inline void QueryEpoch::synchronize(){
+	QueryEpoch &e=instance();
+	//whatever was unpublished before this is not seen by a query that starts in the new epoch
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	const uint64_t epoch=__atomic_add_fetch(&e.current,1,__ATOMIC_SEQ_CST);
+	pthread_mutex_lock(&e.mutex);
+	const std::vector<Slot *> slots(e.slots);
+	pthread_mutex_unlock(&e.mutex);
+	for (size_t i=0; i<slots.size(); ++i) {
+		while (true) {
+			const uint64_t seen=__atomic_load_n(&slots[i]->epoch,__ATOMIC_ACQUIRE);
+			if (seen==0 || seen>=epoch) break;
+			sched_yield();
+		}
+	}
+}
+
+
+#endif
@@ -0,0 +1,314 @@
+/*
+ *  QueryMetrics.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Counters and latency histograms kept by MPHR::query while the store is serving.
+//Every thread that queries gets its own QueryThreadMetrics which only it writes to, so the query path
+//has no atomics or locks.  QueryMetrics::snapshot() adds them all up when they are read, so a dump taken
+//while queries are running is close to but not exactly a single point in time.  When a thread exits its counts
+//are added to a total for the finished threads and its QueryThreadMetrics is given to the next new thread, so a
+//program that starts a thread for every request doesn't use more memory for each one.
+//Only one query in sample_every() is timed, which keeps the cost of the clock off most queries.
+//The report can be printed at any time with QueryMetrics::dump(), or by sending the process SIGUSR1
+//after QueryMetrics::dumpOnSignal() has been called.
+//Defining SHEFLM_NO_QUERY_METRICS leaves all of this out of MPHR::query.
+
+#ifndef QUERY_METRICS_H
+#define QUERY_METRICS_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <ctime>
+#include <csignal>
+#include <stdint.h>
+#include <pthread.h>
+
+
+inline uint64_t query_metrics_now_ns(){
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return static_cast<uint64_t>(ts.tv_sec)*1000000000ULL+ts.tv_nsec;
+}
+
+
+//Latencies in buckets of powers of two: bucket b holds times in [2^(b-1),2^b) ns and bucket 0 holds 0 ns.
+//Percentiles are reported as the top of the bucket they fall in, so they are within a factor of two.
+class LogHistogram {
+public:
+	static const unsigned NUMBER_OF_BUCKETS=64;
+	LogHistogram(){clear();}
+	void clear(){
+		for (unsigned b=0; b<NUMBER_OF_BUCKETS; ++b) buckets[b]=0;
+		count=total_ns=max_ns=0;
+	}
+	void add(const uint64_t &ns){
+		++buckets[ns?64-__builtin_clzll(ns):0];
+		++count;
+		total_ns+=ns;
+		if (ns>max_ns) max_ns=ns;
+	}
+	void add(const LogHistogram &other){
+		for (unsigned b=0; b<NUMBER_OF_BUCKETS; ++b) buckets[b]+=other.buckets[b];
+		count+=other.count;
+		total_ns+=other.total_ns;
+		if (other.max_ns>max_ns) max_ns=other.max_ns;
+	}
+	uint64_t size() const {return count;}
+	double mean() const {return count?static_cast<double>(total_ns)/count:0;}
+	//p is a fraction, 0.99 for the 99th percentile
+	uint64_t percentile(const double &p) const;
+	uint64_t max() const {return max_ns;}
+	//the largest time that goes in bucket b
+	static uint64_t bucketLimit(const unsigned &b){return b?(b<64?(1ULL<<b)-1:~0ULL):0;}
+	uint64_t bucket(const unsigned &b) const {return buckets[b];}
+private:
+	uint64_t buckets[NUMBER_OF_BUCKETS];
+	uint64_t count, total_ns, max_ns;
+};
+
+inline uint64_t LogHistogram::percentile(const double &p) const{
+	if (!count) return 0;
+	const uint64_t target=static_cast<uint64_t>(p*(count-1))+1;
+	uint64_t seen=0;
+	for (unsigned b=0; b<NUMBER_OF_BUCKETS; ++b) {
+		seen+=buckets[b];
+		if (seen>=target) return std::min(bucketLimit(b),max_ns);
+	}
+	return max_ns;
+}
+
+
+//What one thread has seen.  Only the thread that owns it writes to it.
+struct QueryThreadMetrics {
+	QueryThreadMetrics(){clear();}
+	void clear(){
+		queries=hits=hot_hits=fingerprint_rejects=delta_hits=0;
+		query_ns.clear();
+		decode_ns.clear();
+		until_next_sample=0;
+	}
+	uint64_t queries;
+	uint64_t hits;	//the fingerprint matched and a value was read (this includes the false positives)
+	uint64_t hot_hits;	//the hits that were answered by the hot tier
+	uint64_t fingerprint_rejects;	//the fingerprint did not match so the key is not in the model
+	uint64_t delta_hits;	//counts had been added to the key since the model was built (see DeltaStore.h)
+	LogHistogram query_ns;	//the whole of MPHR::query
+	LogHistogram decode_ns;	//reading the rank from the value store and looking up its value, for hits only
+	unsigned until_next_sample;
+
+	//true for the queries that should be timed
+	bool sample(const unsigned &every){
+		if (!every) return false;
+		if (until_next_sample) {--until_next_sample; return false;}
+		until_next_sample=every-1;
+		return true;
+	}
+	void add(const QueryThreadMetrics &other){
+		queries+=other.queries;
+		hits+=other.hits;
+		hot_hits+=other.hot_hits;
+		fingerprint_rejects+=other.fingerprint_rejects;
+		delta_hits+=other.delta_hits;
+		query_ns.add(other.query_ns);
+		decode_ns.add(other.decode_ns);
+	}
+};
+
+
+class QueryMetrics {
+public:
+	enum Format {TEXT, JSON};
+
+	//the metrics of the calling thread, made the first time a thread asks for them
+	static QueryThreadMetrics & local(){
+		QueryThreadMetrics *&metrics=threadMetrics();
+		if (!metrics) metrics=instance().addThread();
+		return *metrics;
+	}
+	//time one query in every n, 0 turns timing off (the counters are always kept)
+	static void setSampleEvery(const unsigned &n){instance().sample_every_n=n;}
+	static unsigned sampleEvery(){return instance().sample_every_n;}
+
+	//the sum over every thread that has queried, including the ones that have finished
+	static QueryThreadMetrics snapshot();
+	static void dump(std::ostream &out, const Format &format=TEXT);
+	static std::string dump(const Format &format=TEXT){
+		std::ostringstream s;
+		dump(s,format);
+		return s.str();
+	}
+	//Starts a thread that writes the report to stderr every time the process gets signal_number.
+	//The signal is blocked in the calling thread and the threads it starts after this, so call it before starting
+	//any other threads or they could be the one the signal is delivered to.
+	static bool dumpOnSignal(const Format &format=TEXT, const int &signal_number=SIGUSR1);
+
+private:
+	QueryMetrics():sample_every_n(16),start_ns(query_metrics_now_ns()),last_dump_ns(start_ns),queries_at_last_dump(0){
+		pthread_mutex_init(&mutex,NULL);
+		//the destructor is run by every thread that has metrics when it exits
+		pthread_key_create(&thread_key,retireThread);
+	}
+	static QueryMetrics & instance(){
+		static QueryMetrics metrics;
+		return metrics;
+	}
+	static QueryThreadMetrics *& threadMetrics(){
+		static __thread QueryThreadMetrics *metrics=0;
+		return metrics;
+	}
+	QueryThreadMetrics * addThread(){
+		QueryThreadMetrics *metrics;
+		pthread_mutex_lock(&mutex);
+		if (free_slots.empty()) metrics=new QueryThreadMetrics();
+		else {
+			metrics=free_slots.back();
+			free_slots.pop_back();
+		}
+		threads.push_back(metrics);
+		pthread_mutex_unlock(&mutex);
+		pthread_setspecific(thread_key,metrics);
+		return metrics;
+	}
+	static void retireThread(void *slot);
+	static void * signalThread(void *arg);
+
+	pthread_mutex_t mutex;
+	pthread_key_t thread_key;
+	std::vector<QueryThreadMetrics *> threads;	//the threads that are running
+	std::vector<QueryThreadMetrics *> free_slots;	//left by threads that have finished, for new ones to use
+	QueryThreadMetrics retired;	//the sum of the threads that have finished
+	volatile unsigned sample_every_n;
+	uint64_t start_ns, last_dump_ns, queries_at_last_dump;
+	Format signal_format;
+	sigset_t signal_set;
+};
+
+inline QueryThreadMetrics QueryMetrics::snapshot(){
+	QueryMetrics &m=instance();
+	QueryThreadMetrics total;
+	pthread_mutex_lock(&m.mutex);
+	total.add(m.retired);
+	for (size_t i=0; i<m.threads.size(); ++i) total.add(*m.threads[i]);
+	pthread_mutex_unlock(&m.mutex);
+	return total;
+}
+
+inline void QueryMetrics::retireThread(void *slot){
+	QueryMetrics &m=instance();
+	QueryThreadMetrics *metrics=static_cast<QueryThreadMetrics*>(slot);
+	pthread_mutex_lock(&m.mutex);
+	m.retired.add(*metrics);
+	m.threads.erase(std::find(m.threads.begin(),m.threads.end(),metrics));
+	metrics->clear();
+	m.free_slots.push_back(metrics);
+	pthread_mutex_unlock(&m.mutex);
+	//a query in a later thread exit destructor gets a new slot
+	threadMetrics()=0;
+}
+
+inline void QueryMetrics::dump(std::ostream &out, const Format &format){
+	QueryMetrics &m=instance();
+	QueryThreadMetrics total=snapshot();
+	const uint64_t now=query_metrics_now_ns();
+	pthread_mutex_lock(&m.mutex);
+	const double uptime=(now-m.start_ns)/1e9, interval=(now-m.last_dump_ns)/1e9;
+	const uint64_t interval_queries=total.queries-m.queries_at_last_dump;
+	const size_t number_of_threads=m.threads.size();	//the threads that are running, the finished ones are only in the totals
+	m.last_dump_ns=now;
+	m.queries_at_last_dump=total.queries;
+	pthread_mutex_unlock(&m.mutex);
+
+	const double hit_rate=total.queries?static_cast<double>(total.hits)/total.queries:0;
+	const double reject_rate=total.queries?static_cast<double>(total.fingerprint_rejects)/total.queries:0;
+	const double qps=uptime>0?total.queries/uptime:0, interval_qps=interval>0?interval_queries/interval:0;
+	const LogHistogram *histograms[2]={&total.query_ns,&total.decode_ns};
+	const char *names[2]={"query_ns","decode_ns"};
+
+	std::ostringstream s;
+	s << std::fixed << std::setprecision(6);
+	if (format==JSON) {
+		s << "{\"uptime_s\":"<<uptime<<",\"threads\":"<<number_of_threads<<",\"sample_every\":"<<m.sample_every_n
+		  << ",\"queries\":"<<total.queries<<",\"hits\":"<<total.hits<<",\"hot_hits\":"<<total.hot_hits<<",\"fingerprint_rejects\":"<<total.fingerprint_rejects<<",\"delta_hits\":"<<total.delta_hits
+		  << ",\"hit_rate\":"<<hit_rate<<",\"fingerprint_reject_rate\":"<<reject_rate
+		  << ",\"qps\":"<<qps<<",\"interval_s\":"<<interval<<",\"interval_qps\":"<<interval_qps;
+		for (int h=0; h<2; ++h) {
+			const LogHistogram &hist=*histograms[h];
+			s << ",\""<<names[h]<<"\":{\"count\":"<<hist.size()<<",\"mean\":"<<hist.mean()<<",\"p50\":"<<hist.percentile(0.5)
+			  << ",\"p90\":"<<hist.percentile(0.9)<<",\"p99\":"<<hist.percentile(0.99)<<",\"p999\":"<<hist.percentile(0.999)
+			  << ",\"max\":"<<hist.max()<<",\"buckets\":[";
+			bool first=true;
+			for (unsigned b=0; b<LogHistogram::NUMBER_OF_BUCKETS; ++b) {
+				if (!hist.bucket(b)) continue;
+				s << (first?"":",") << "["<<LogHistogram::bucketLimit(b)<<","<<hist.bucket(b)<<"]";
+				first=false;
+			}
+			s << "]}";
+		}
+		s << "}\n";
+	}else {
+		s << "Query metrics after "<<std::setprecision(1)<<uptime<<"s from "<<number_of_threads<<" running threads (timing 1 query in "<<m.sample_every_n<<")\n"
+		  << "  queries: "<<total.queries<<"  hits: "<<total.hits<<" ("<<total.hot_hits<<" from the hot tier)  fingerprint rejects: "<<total.fingerprint_rejects<<"  delta hits: "<<total.delta_hits<<"\n"
+		  << std::setprecision(2) << "  hit rate: "<<100*hit_rate<<"%  reject rate: "<<100*reject_rate<<"%\n"
+		  << std::setprecision(0) << "  queries/s: "<<qps<<" overall, "<<interval_qps<<" over the last "<<std::setprecision(1)<<interval<<"s\n";
+		for (int h=0; h<2; ++h) {
+			const LogHistogram &hist=*histograms[h];
+			s << "  "<<names[h]<<": samples "<<hist.size()<<std::setprecision(1)<<"  mean "<<hist.mean()<<"  p50 <="<<hist.percentile(0.5)
+			  << "  p90 <="<<hist.percentile(0.9)<<"  p99 <="<<hist.percentile(0.99)<<"  p99.9 <="<<hist.percentile(0.999)<<"  max "<<hist.max()<<"\n";
+			for (unsigned b=0; b<LogHistogram::NUMBER_OF_BUCKETS; ++b) {
+				if (!hist.bucket(b)) continue;
+				s << "    <="<<std::setw(12)<<LogHistogram::bucketLimit(b)<<" "<<std::setw(12)<<hist.bucket(b)<<"\n";
+			}
+		}
+	}
+	out << s.str() << std::flush;
+}
+
+inline void * QueryMetrics::signalThread(void *){
+	QueryMetrics &m=instance();
+	for (;;) {
+		int signal_number;
+		if (sigwait(&m.signal_set,&signal_number)==0) dump(std::cerr,m.signal_format);
+	}
+	return NULL;
+}
+
+inline bool QueryMetrics::dumpOnSignal(const Format &format, const int &signal_number){
+	QueryMetrics &m=instance();
+	m.signal_format=format;
+	sigemptyset(&m.signal_set);
+	sigaddset(&m.signal_set,signal_number);
+	pthread_t thread;
+	if (pthread_sigmask(SIG_BLOCK,&m.signal_set,NULL)!=0 || pthread_create(&thread,NULL,signalThread,NULL)!=0) {
+		std::cerr << "Warning: could not start the thread that prints the query metrics on a signal"<<std::endl;
+		return false;
+	}
+	pthread_detach(thread);
+	return true;
+}
+
+
+#endif
@@ -0,0 +1,467 @@
+/*
+ *  QueryServer.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Serves lookups from a loaded MPHR over a Unix domain socket or a localhost TCP port, so a model is loaded once
+//rather than by every process that needs it.
+//
+//A request is a batch of keys: a 32 bit number of keys and then for every key a 32 bit length and its bytes.
+//The reply is a 32 bit number of values and a 64 bit value for every key, in the same order (0 if the key is not stored).
+//All the integers are little endian.  A client can send its next request before the reply to the last one arrives,
+//the replies come back in the order the requests were sent.
+//
+//One thread runs a poll() loop that accepts connections, reads requests and writes replies.  Complete requests go on a
+//queue that a pool of worker threads take from, a worker takes as many waiting requests as fit in batch_keys keys at a time.
+//Each connection has at most one request with the workers, the next one is read from its buffer when the reply is back.
+//A connection whose replies are not being read is given no more requests until they are, and is not read from once
+//the next request is buffered.  A connection that hangs up is closed at once, a reply to it is thrown away.
+
+#ifndef QUERY_SERVER_H
+#define QUERY_SERVER_H
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <map>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <csignal>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <boost/shared_ptr.hpp>
+
+#include "MPHR.h"
+
+
+class QueryServer {
+public:
+	static const uint32_t MAX_KEYS_PER_REQUEST=1<<20;
+	static const uint32_t MAX_KEY_LENGTH=1<<16;
+	static const size_t MAX_REQUEST_BYTES=1<<26;
+	static const size_t READ_AHEAD=1<<16;	//bytes buffered from a connection while the workers have its last request
+	static const size_t MAX_PENDING_REPLY_BYTES=1<<22;	//no more requests are taken from a connection with this many bytes of replies unsent
+
+	QueryServer(const MPHR &store, const unsigned &workers, const size_t &batch_keys);
+	~QueryServer();
+	//address is the path of a Unix socket, or tcp:PORT for a port on 127.0.0.1.  Can be called more than once to listen on several.
+	void listen(const std::string &address);
+	//serves until stop() is called
+	void run();
+	//safe to call from a signal handler
+	void stop();
+
+private:
+	struct Connection {
+		int fd;
+		std::string in;
+		std::string out;
+		size_t out_sent;
+		bool busy;	//a request from this connection is with the workers
+		bool eof;
+		//how much of the request at the front of in has been checked, as it arrives
+		size_t request_bytes;	//the bytes up to the end of the last key whose length has been read
+		uint32_t keys_checked;
+		bool request_ready;	//all of the request is in in
+		size_t pending_reply_bytes() const {return out.size()-out_sent;}
+		explicit Connection(const int &f):fd(f),out_sent(0),busy(false),eof(false),request_bytes(0),keys_checked(0),request_ready(false){}
+	};
+	typedef boost::shared_ptr<Connection> ConnectionPtr;
+	struct Request {
+		ConnectionPtr connection;
+		std::vector<std::string> keys;
+		std::vector<uint64_t> values;
+	};
+
+	QueryServer(const QueryServer&); //disallow copying
+	void operator=(const QueryServer&); //disallow assignment
+
+	static void * workerThread(void *arg);
+	void work();
+	void accept_connections(const int &listen_fd);
+	bool read_from(Connection &c);
+	bool write_to(Connection &c);
+	//checks the request at the front of the connection's buffer as far as it has arrived, false if it is over the limits
+	bool check_request(Connection &c);
+	//moves the next complete request in the connection's buffer to the workers, false if the request is malformed
+	bool next_request(const ConnectionPtr &c);
+	void take_replies();
+	void close_connection(const int &fd);
+
+	static uint32_t get32(const char *p){
+		const unsigned char *u=reinterpret_cast<const unsigned char*>(p);
+		return static_cast<uint32_t>(u[0])|(static_cast<uint32_t>(u[1])<<8)|(static_cast<uint32_t>(u[2])<<16)|(static_cast<uint32_t>(u[3])<<24);
+	}
+	static void put(std::string &out, const uint64_t &v, const unsigned &bytes){
+		for (unsigned i=0; i<bytes; ++i) out.push_back(static_cast<char>((v>>(8*i))&0xFF));
+	}
+	static void set_non_blocking(const int &fd){fcntl(fd,F_SETFL,fcntl(fd,F_GETFL,0)|O_NONBLOCK);}
+
+	const MPHR &store;
+	const size_t batch_keys;
+	std::vector<int> listen_fds;
+	std::vector<std::string> socket_paths;	//unlinked when the server is destroyed
+	std::map<int,ConnectionPtr> connections;
+	int wake[2];	//a pipe written to when replies are ready or the server is stopped
+	volatile sig_atomic_t stopping;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t work_ready;
+	std::deque<Request*> queue;
+	std::vector<Request*> replies;
+	bool workers_done;
+	std::vector<pthread_t> workers;
+};
+
+
+inline QueryServer::QueryServer(const MPHR &s, const unsigned &number_of_workers, const size_t &batch)
+:store(s),batch_keys(batch?batch:1),stopping(0),workers_done(false){
+	if (pipe(wake)!=0) {
+		cerr << "Error: can't create the pipe for the query server: "<<strerror(errno)<<endl;
+		exit(1);
+	}
+	set_non_blocking(wake[0]);
+	set_non_blocking(wake[1]);
+	pthread_mutex_init(&mutex,NULL);
+	pthread_cond_init(&work_ready,NULL);
+	const unsigned n=number_of_workers?number_of_workers:1;
+	for (unsigned i=0; i<n; ++i) {
+		pthread_t thread;
+		if (pthread_create(&thread,NULL,workerThread,this)!=0) {
+			cerr << "Error: can't start the query server worker threads"<<endl;
+			exit(1);
+		}
+		workers.push_back(thread);
+	}
+}
+
+inline QueryServer::~QueryServer(){
+	pthread_mutex_lock(&mutex);
+	workers_done=true;
+	pthread_cond_broadcast(&work_ready);
+	pthread_mutex_unlock(&mutex);
+	for (size_t i=0; i<workers.size(); ++i) pthread_join(workers[i],NULL);
+	for (size_t i=0; i<queue.size(); ++i) delete queue[i];
+	for (size_t i=0; i<replies.size(); ++i) delete replies[i];
+	while (!connections.empty()) close_connection(connections.begin()->first);
+	for (size_t i=0; i<listen_fds.size(); ++i) close(listen_fds[i]);
+	for (size_t i=0; i<socket_paths.size(); ++i) unlink(socket_paths[i].c_str());
+	close(wake[0]);
+	close(wake[1]);
+	pthread_cond_destroy(&work_ready);
+	pthread_mutex_destroy(&mutex);
+}
+
+inline void QueryServer::listen(const std::string &address){
+	int fd;
+	if (address.compare(0,4,"tcp:")==0) {
+		const int port=atoi(address.c_str()+4);
+		if (port<=0 || port>65535) {
+			cerr << "Error: "<<address.substr(4)<<" is not a port to serve on"<<endl;
+			exit(1);
+		}
+		sockaddr_in addr;
+		memset(&addr,0,sizeof(addr));
+		addr.sin_family=AF_INET;
+		addr.sin_port=htons(port);
+		addr.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+		fd=socket(AF_INET,SOCK_STREAM,0);
+		const int on=1;
+		if (fd!=-1) setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on));
+		if (fd==-1 || bind(fd,reinterpret_cast<sockaddr*>(&addr),sizeof(addr))!=0) {
+			cerr << "Error: can't serve on port "<<port<<": "<<strerror(errno)<<endl;
+			exit(1);
+		}
+	}else {
+		sockaddr_un addr;
+		memset(&addr,0,sizeof(addr));
+		addr.sun_family=AF_UNIX;
+		if (address.empty() || address.size()>=sizeof(addr.sun_path)) {
+			cerr << "Error: the socket path must be between 1 and "<<sizeof(addr.sun_path)-1<<" characters: "<<address<<endl;
+			exit(1);
+		}
+		strcpy(addr.sun_path,address.c_str());
+		fd=socket(AF_UNIX,SOCK_STREAM,0);
+		if (fd==-1 || bind(fd,reinterpret_cast<sockaddr*>(&addr),sizeof(addr))!=0) {
+			cerr << "Error: can't serve on the socket "<<address<<": "<<strerror(errno)<<endl;
+			exit(1);
+		}
+		socket_paths.push_back(address);
+	}
+	if (::listen(fd,SOMAXCONN)!=0) {
+		cerr << "Error: can't listen on "<<address<<": "<<strerror(errno)<<endl;
+		exit(1);
+	}
+	set_non_blocking(fd);
+	listen_fds.push_back(fd);
+	cerr << "Serving queries on "<<address<<" with "<<workers.size()<<" worker threads"<<endl;
+}
+
+inline void QueryServer::stop(){
+	stopping=1;
+	const char byte=0;
+	if (write(wake[1],&byte,1)<0) {}	//the loop is already being woken if the pipe is full
+}
+
+inline void * QueryServer::workerThread(void *arg){
+	static_cast<QueryServer*>(arg)->work();
+	return NULL;
+}
+
+inline void QueryServer::work(){
+	std::vector<Request*> batch;
+	for (;;) {
+		pthread_mutex_lock(&mutex);
+		while (queue.empty() && !workers_done) pthread_cond_wait(&work_ready,&mutex);
+		if (workers_done) {
+			pthread_mutex_unlock(&mutex);
+			return;
+		}
+		//coalesce the waiting requests, but always take at least one
+		size_t keys=0;
+		batch.clear();
+		while (!queue.empty() && (batch.empty() || keys+queue.front()->keys.size()<=batch_keys)) {
+			keys+=queue.front()->keys.size();
+			batch.push_back(queue.front());
+			queue.pop_front();
+		}
+		pthread_mutex_unlock(&mutex);
+
+		for (size_t r=0; r<batch.size(); ++r) {
+			Request &request=*batch[r];
+			request.values.resize(request.keys.size());
+			for (size_t i=0; i<request.keys.size(); ++i) request.values[i]=store.query(request.keys[i]);
+		}
+
+		pthread_mutex_lock(&mutex);
+		const bool was_empty=replies.empty();
+		replies.insert(replies.end(),batch.begin(),batch.end());
+		pthread_mutex_unlock(&mutex);
+		if (was_empty) {
+			const char byte=1;
+			if (write(wake[1],&byte,1)<0) {}
+		}
+	}
+}
+
+inline void QueryServer::run(){
+	std::vector<pollfd> fds;
+	//the connection each of fds is for, as its fd can be closed and given to a new connection before its events are handled
+	std::vector<ConnectionPtr> polled;
+	std::vector<char> drain(256);
+	while (!stopping) {
+		fds.clear();
+		polled.clear();
+		pollfd p;
+		p.revents=0;
+		p.fd=wake[0];
+		p.events=POLLIN;
+		fds.push_back(p);
+		for (size_t i=0; i<listen_fds.size(); ++i) {
+			p.fd=listen_fds[i];
+			fds.push_back(p);
+		}
+		for (std::map<int,ConnectionPtr>::const_iterator it=connections.begin(); it!=connections.end(); ++it) {
+			p.fd=it->first;
+			const Connection &c=*it->second;
+			//stop reading from a connection that has a request waiting (with the workers or for its replies to be read) and the next one buffered
+			p.events=(c.eof || ((c.busy || c.request_ready) && c.in.size()>=READ_AHEAD)?0:POLLIN)|(c.out_sent<c.out.size()?POLLOUT:0);
+			//POLLHUP would still be reported for it, the reply it is waiting for wakes the loop
+			if (p.events) {
+				fds.push_back(p);
+				polled.push_back(it->second);
+			}
+		}
+		if (poll(&fds[0],fds.size(),-1)<0) {
+			if (errno==EINTR) continue;
+			cerr << "Error: the query server can't poll its sockets: "<<strerror(errno)<<endl;
+			exit(1);
+		}
+		if (fds[0].revents) {
+			while (read(wake[0],&drain[0],drain.size())>0) {}
+			take_replies();
+		}
+		for (size_t i=1+listen_fds.size(); i<fds.size(); ++i) {
+			if (!fds[i].revents) continue;
+			const ConnectionPtr &c=polled[i-1-listen_fds.size()];
+			//take_replies() may have closed it
+			std::map<int,ConnectionPtr>::iterator it=connections.find(fds[i].fd);
+			if (it==connections.end() || it->second!=c) continue;
+			//the client can't read a reply once it has hung up
+			bool ok=!(fds[i].revents&(POLLHUP|POLLERR|POLLNVAL));
+			if (ok && (fds[i].revents&POLLIN)) ok=read_from(*c) && next_request(c);
+			if (ok && (fds[i].revents&POLLOUT)) ok=write_to(*c) && next_request(c);
+			if (!ok || (c->eof && !c->busy && c->out_sent==c->out.size())) close_connection(c->fd);
+		}
+		//after the events of the connections that were polled, so none of them is taken for a new one with the same fd
+		for (size_t i=1; i<=listen_fds.size(); ++i) if (fds[i].revents) accept_connections(fds[i].fd);
+	}
+}
+
+inline void QueryServer::accept_connections(const int &listen_fd){
+	for (;;) {
+		const int fd=accept(listen_fd,NULL,NULL);
+		if (fd==-1) {
+			if (errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR && errno!=ECONNABORTED) cerr << "Warning: the query server can't accept a connection: "<<strerror(errno)<<endl;
+			if (errno==EINTR || errno==ECONNABORTED) continue;
+			return;
+		}
+		set_non_blocking(fd);
+		const int on=1;
+		setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));	//fails harmlessly on Unix sockets
+		connections[fd].reset(new Connection(fd));
+	}
+}
+
+inline bool QueryServer::read_from(Connection &c){
+	char buffer[65536];
+	for (;;) {
+		const ssize_t n=recv(c.fd,buffer,sizeof(buffer),0);
+		if (n>0) {
+			c.in.append(buffer,n);
+			if (c.busy || c.request_ready) {
+				if (c.in.size()>=READ_AHEAD) return true;
+				continue;
+			}
+			//the limits are checked as the request arrives so a client can't make the server buffer more than them
+			if (!check_request(c)) return false;
+			if (c.request_ready) return true;
+			continue;
+		}
+		if (n==0) {
+			c.eof=true;
+			return true;
+		}
+		if (errno==EINTR) continue;
+		return errno==EAGAIN || errno==EWOULDBLOCK;
+	}
+}
+
+inline bool QueryServer::write_to(Connection &c){
+	while (c.out_sent<c.out.size()) {
+		const ssize_t n=send(c.fd,c.out.data()+c.out_sent,c.out.size()-c.out_sent,MSG_NOSIGNAL);
+		if (n>0) {
+			c.out_sent+=n;
+			continue;
+		}
+		if (n<0 && errno==EINTR) continue;
+		return n<0 && (errno==EAGAIN || errno==EWOULDBLOCK);
+	}
+	c.out.clear();
+	c.out_sent=0;
+	return true;
+}
+
+inline bool QueryServer::check_request(Connection &c){
+	if (c.request_ready || c.in.size()<4) return true;
+	const char *data=c.in.data();
+	const uint32_t number_of_keys=get32(data);
+	if (number_of_keys>MAX_KEYS_PER_REQUEST) {
+		cerr << "Warning: closing a connection that sent a request of "<<number_of_keys<<" keys (the most is "<<MAX_KEYS_PER_REQUEST<<")"<<endl;
+		return false;
+	}
+	if (c.request_bytes==0) c.request_bytes=4;
+	while (c.keys_checked<number_of_keys && c.in.size()>=c.request_bytes+4) {
+		const uint32_t length=get32(data+c.request_bytes);
+		if (length>MAX_KEY_LENGTH) {
+			cerr << "Warning: closing a connection that sent a key of "<<length<<" bytes (the most is "<<MAX_KEY_LENGTH<<")"<<endl;
+			return false;
+		}
+		c.request_bytes+=4+length;
+		++c.keys_checked;
+		if (c.request_bytes>MAX_REQUEST_BYTES) {
+			cerr << "Warning: closing a connection that sent a request of more than "<<MAX_REQUEST_BYTES<<" bytes"<<endl;
+			return false;
+		}
+	}
+	c.request_ready=c.keys_checked==number_of_keys && c.in.size()>=c.request_bytes;
+	return true;
+}
+
+inline bool QueryServer::next_request(const ConnectionPtr &c){
+	if (c->busy || c->pending_reply_bytes()>=MAX_PENDING_REPLY_BYTES) return true;
+	if (!check_request(*c)) return false;
+	if (!c->request_ready) return true;
+	const char *data=c->in.data();
+	const uint32_t number_of_keys=get32(data);
+	size_t pos;
+	Request *request=new Request;
+	request->connection=c;
+	request->keys.resize(number_of_keys);
+	pos=4;
+	for (uint32_t i=0; i<number_of_keys; ++i) {
+		const uint32_t length=get32(data+pos);
+		request->keys[i].assign(data+pos+4,length);
+		pos+=4+length;
+	}
+	c->in.erase(0,pos);
+	c->request_bytes=0;
+	c->keys_checked=0;
+	c->request_ready=false;
+	c->busy=true;
+	pthread_mutex_lock(&mutex);
+	queue.push_back(request);
+	pthread_cond_signal(&work_ready);
+	pthread_mutex_unlock(&mutex);
+	return true;
+}
+
+inline void QueryServer::take_replies(){
+	std::vector<Request*> ready;
+	pthread_mutex_lock(&mutex);
+	ready.swap(replies);
+	pthread_mutex_unlock(&mutex);
+	for (size_t r=0; r<ready.size(); ++r) {
+		ConnectionPtr c=ready[r]->connection;
+		const std::vector<uint64_t> &values=ready[r]->values;
+		c->busy=false;
+		if (c->fd!=-1) {
+			c->out.reserve(c->out.size()+4+8*values.size());
+			put(c->out,values.size(),4);
+			for (size_t i=0; i<values.size(); ++i) put(c->out,values[i],8);
+			const bool ok=write_to(*c) && next_request(c);
+			if (!ok || (c->eof && !c->busy && c->out_sent==c->out.size())) close_connection(c->fd);
+		}
+		delete ready[r];
+	}
+}
+
+inline void QueryServer::close_connection(const int &fd){
+	std::map<int,ConnectionPtr>::iterator it=connections.find(fd);
+	if (it==connections.end()) return;
+	close(fd);
+	it->second->fd=-1;	//a request still with the workers sees the connection has gone
+	connections.erase(it);
+}
+
+
+#endif
@@ -45,8 +45,13 @@
 #include <boost/serialization/list.hpp>
 #include <boost/serialization/shared_ptr.hpp>
 #include <boost/serialization/dynamic_bitset.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/version.hpp>
 #include "CompactStore.h"
 #include "ShefBitArray.h"
+#include "macros.h"
+#include "MemoryUsage.h"
+#include "SharedArrays.h"
 
 using std::vector;
 using std::cout;
@@ -82,37 +87,105 @@ unsigned long totalbits( const vector<T>& vec ) {
 
 class DArray{
 public:
-	DArray(){}
-	DArray(boost::shared_ptr<boost::dynamic_bitset<> > bit_array_to_index);
+	DArray():bits_data(NULL),s_long_data(NULL),s_short_data(NULL),pvec_data(NULL),first_one_data(NULL){}
+	//bits_to_index holds num_bits bits, 64 to a word with the first bit in the low bit of the first word
+	DArray(boost::shared_ptr<vector<uint64_t> > bits_to_index, const uint64_t &num_bits);
 	uint64_t select(uint64_t) const;
 	uint64_t bit_count() const;
+	MemoryUsage memory_usage() const;
+	void share(SharedArrays &arrays);
 	
 private:
-	boost::shared_ptr<boost::dynamic_bitset<> > bit_array;
+	boost::shared_ptr<vector<uint64_t> > bits;
+	uint64_t num_bits;
 	vector<uint64_t> s_long;
 	vector<uint16_t> s_short;
 	vector<int64_t> pvec;
 	vector<uint64_t> lp_first_one_in_block;
-	static const unsigned ones_per_block; //L
-	static const unsigned log_ones_per_block; //logL
-	static const unsigned max_block_length; //LL
-	static const unsigned spacing;	//LLL
-	static const unsigned log_spacing;	//LLL
+	//what select() reads, the vectors or their copies in shared memory
+	const uint64_t *bits_data, *s_long_data;
+	const uint16_t *s_short_data;
+	const int64_t *pvec_data;
+	const uint64_t *first_one_data;
+	void set_views();
+	static const unsigned ones_per_block=1<<10; //L
+	static const unsigned log_ones_per_block=10; //logL
+	static const unsigned max_block_length=1<<16; //LL
+	static const unsigned spacing=1<<6;	//LLL
+	static const unsigned log_spacing=6;	//LLL
+
+	void addBlock(vector<uint64_t> &block_positions);
+
+	/** Counts the number of bits in x. */
+	__inline static int count( const uint64_t x ) {
+		register uint64_t byte_sums = x - ( ( x & 0xa * ONES_STEP_4 ) >> 1 );
+		byte_sums = ( byte_sums & 3 * ONES_STEP_4 ) + ( ( byte_sums >> 2 ) & 3 * ONES_STEP_4 );
+		byte_sums = ( byte_sums + ( byte_sums >> 4 ) ) & 0x0f * ONES_STEP_8;
+		return byte_sums * ONES_STEP_8 >> 56;
+	}
+
+	/* Selects the k-th (k>=0) bit in x.  k must be less than count( x ). */
+	__inline static int select_in_word( const uint64_t x, const int k ) {
+		// Phase 1: sums by byte
+		register uint64_t byte_sums = x - ( ( x & 0xa * ONES_STEP_4 ) >> 1 );
+		byte_sums = ( byte_sums & 3 * ONES_STEP_4 ) + ( ( byte_sums >> 2 ) & 3 * ONES_STEP_4 );
+		byte_sums = ( byte_sums + ( byte_sums >> 4 ) ) & 0x0f * ONES_STEP_8;
+		byte_sums *= ONES_STEP_8;
+
+		// Phase 2: compare each byte sum with k
+		const uint64_t k_step_8 = k * ONES_STEP_8;
+		const uint64_t place = ( LEQ_STEP_8( byte_sums, k_step_8 ) * ONES_STEP_8 >> 53 ) & ~0x7;
+
+		// Phase 3: Locate the relevant byte and make 8 copies with incrental masks
+		const int byte_rank = k - ( ( ( byte_sums << 8 ) >> place ) & 0xFF );
+
+		const uint64_t spread_bits = ( x >> place & 0xFF ) * ONES_STEP_8 & INCR_STEP_8;
+		const uint64_t bit_sums = ZCOMPARE_STEP_8( spread_bits ) * ONES_STEP_8;
+
+		// Compute the inside-byte location and return the sum
+		const uint64_t byte_rank_step_8 = byte_rank * ONES_STEP_8;
+
+		return place + ( LEQ_STEP_8( bit_sums, byte_rank_step_8 ) * ONES_STEP_8 >> 56 );
+	}
 
 private:
 	friend class boost::serialization::access;
 	
-    template<class Archive>
-    void serialize(Archive & ar, const unsigned int version)
-    {
+	template<class Archive>
+	void save(Archive & ar, const unsigned int version) const
+	{
 		ar & s_long;
 		ar & s_short;
 		ar & pvec;
 		ar & lp_first_one_in_block;
-		ar & bit_array;
+		ar & bits;
+		ar & num_bits;
+	}
+	template<class Archive>
+	void load(Archive & ar, const unsigned int version)
+	{
+		ar & s_long;
+		ar & s_short;
+		ar & pvec;
+		ar & lp_first_one_in_block;
+		if (version>0) {
+			ar & bits;
+			ar & num_bits;
+		}else {
+			//version 0 kept the bits in a dynamic_bitset
+			boost::shared_ptr<boost::dynamic_bitset<> > bit_array;
+			ar & bit_array;
+			num_bits=bit_array->size();
+			bits.reset(new vector<uint64_t>((num_bits+63)/64+1,0));
+			for (uint64_t i=bit_array->find_first(); i!=boost::dynamic_bitset<>::npos; i=bit_array->find_next(i)) (*bits)[i>>6] |= 1ULL<<(i&63);
+		}
+		set_views();
 	}
+	BOOST_SERIALIZATION_SPLIT_MEMBER()
 };
 
+BOOST_CLASS_VERSION(DArray, 1)
+
 //const unsigned DArray::max_block_length=1<<16; //LL we use 16 so we can store offsets to each block as a uint16_t (normally know as unsigned short)
 //const unsigned DArray::log_spacing=5;	//logLLL
 //const unsigned DArray::spacing=1<<5;	//LLL
@@ -120,230 +193,270 @@ private:
 //const unsigned DArray::log_ones_per_block=10; //logL
 
 
-const unsigned DArray::max_block_length=1<<16; //LL 
-const unsigned DArray::log_spacing=6;	//logLLL
-const unsigned DArray::spacing=1<<6;	//LLL
-const unsigned DArray::ones_per_block=1<<10; //L
-const unsigned DArray::log_ones_per_block=10; //logL
-
-
-DArray::DArray(boost::shared_ptr<boost::dynamic_bitset<> > bit_array_to_index)
-:bit_array(bit_array_to_index){
-	uint64_t n=bit_array->size();
+//The positions of the ones are read straight out of the words and only one block of them is held at a time
+inline DArray::DArray(boost::shared_ptr<vector<uint64_t> > bits_to_index, const uint64_t &number_of_bits)
+:bits(bits_to_index),num_bits(number_of_bits){
+	const uint64_t num_words=(num_bits+63)/64;
+	//select reads one word past the last one it needs, so make sure there always is one
+	if (bits->size()<num_words+1) bits->resize(num_words+1,0);
+	if (num_bits&63) (*bits)[num_words-1] &= (1ULL<<(num_bits&63))-1;
+	
 	uint64_t num_ones = 0;
-	for (uint64_t i=0; i<n; i++) num_ones += bit_array->test(i);
+	for (uint64_t i=0; i<num_words; i++) num_ones += count((*bits)[i]);
 	
-	fprintf(stderr,"Size of D array to compress=%llu \n number of ones=%llu \n Density of DArray=%.2f%% \n",n,num_ones, 100.0 * num_ones/n);
+	fprintf(stderr,"Size of D array to compress=%llu \n number of ones=%llu \n Density of DArray=%.2f%% \n",static_cast<unsigned long long>(num_bits),static_cast<unsigned long long>(num_ones), 100.0 * num_ones/num_bits);
 
+	uint64_t total_blocks = (num_ones+ones_per_block-1) / ones_per_block;
+	lp_first_one_in_block.reserve(total_blocks+1);
+	pvec.reserve(total_blocks+1);
 	
-	
-	std::vector<uint64_t> S_position_vec(num_ones); // holds the position of every one
-	
-	num_ones = 0;
-	for (uint64_t i=0; i<n; i++) {
-		if (bit_array->test(i)) {
-			S_position_vec[num_ones++] = i;
+	vector<uint64_t> block_positions;
+	block_positions.reserve(ones_per_block);
+	for (uint64_t i=0; i<num_words; i++) {
+		for (uint64_t word=(*bits)[i]; word!=0; word&=word-1) {
+			block_positions.push_back(i*64+__builtin_ctzll(word));
+			if (block_positions.size()==ones_per_block) addBlock(block_positions);
 		}
 	}
-
-	uint64_t total_blocks = (num_ones-1) / ones_per_block + 1;
-	
-	lp_first_one_in_block.resize(total_blocks+1);
-	pvec.resize(total_blocks+1);
+	if (!block_positions.empty()) addBlock(block_positions);
+	lp_first_one_in_block.push_back(0);
+	pvec.push_back(0);
 	
+	uint64_t long_block_counter=s_long.size()/ones_per_block;
+	uint64_t short_block_counter=s_short.size()/(ones_per_block/spacing);
+	s_long.push_back(0);
+	s_short.push_back(0);
+	set_views();
+	cerr <<"Darray number of short blocks is:"<<short_block_counter<<" number of long (exact blocks) is:"<<long_block_counter<<endl;
+}
+
+inline void DArray::set_views(){
+	bits_data=(bits && !bits->empty())?&(*bits)[0]:NULL;
+	s_long_data=s_long.empty()?NULL:&s_long[0];
+	s_short_data=s_short.empty()?NULL:&s_short[0];
+	pvec_data=pvec.empty()?NULL:&pvec[0];
+	first_one_data=lp_first_one_in_block.empty()?NULL:&lp_first_one_in_block[0];
+}
+
+inline void DArray::share(SharedArrays &arrays){
+	arrays.share(*bits,bits_data);
+	arrays.share(s_long,s_long_data);
+	arrays.share(s_short,s_short_data);
+	arrays.share(pvec,pvec_data);
+	arrays.share(lp_first_one_in_block,first_one_data);
+}
+
+//block_positions holds the absolute positions of the ones in the next block (the last block may be partial) and is cleared
+inline void DArray::addBlock(vector<uint64_t> &block_positions){
+	const uint64_t pos_of_first_one_in_block = block_positions.front();
+	const uint64_t position_of_last_one_in_block = block_positions.back();
+	lp_first_one_in_block.push_back(pos_of_first_one_in_block);
 	
-	for (unsigned r = 0; r < 2; r++) {
-		uint64_t long_block_counter = 0;
-		uint64_t short_block_counter = 0;
-		
-		for (uint64_t block_number = 0; block_number < total_blocks; block_number++) {
-			uint64_t beginingOfBlock=block_number*ones_per_block;
-			uint64_t pos_of_first_one_in_block = S_position_vec[beginingOfBlock]; //absolute position of the first one in the block
-			lp_first_one_in_block[block_number] = pos_of_first_one_in_block;
-			uint64_t i = std::min((block_number+1)*ones_per_block-1,num_ones-1);  
-			uint64_t position_of_last_one_in_block = S_position_vec[i]; //aboslute position of last one in the block
-			
-			if (position_of_last_one_in_block - pos_of_first_one_in_block >= max_block_length) { //then it is a long block
-				if (r == 1) {
-					for (uint64_t bit_number = 0; bit_number < ones_per_block; bit_number++) {
-						if (beginingOfBlock+bit_number >= num_ones) break;
-						s_long[long_block_counter*ones_per_block+bit_number] = S_position_vec[beginingOfBlock+bit_number];  //s_long stores the absolute position of every one that occurs in a small block
-					}
-				}
-				//in pvec store the 1+ the index in the long block array as a negative number (same as long_block_counter*ones_per_block + 1 )
-				pvec[block_number] = -((long_block_counter<<log_ones_per_block)+1); 
-				long_block_counter++;
-			} else { //else it is a short block
-				if (r == 1) {
-					for (uint64_t bit_number = 0; bit_number < ones_per_block/spacing; bit_number++) { //store position of every spacingTH one with respect to first one in block
-						if (beginingOfBlock+bit_number*spacing >= num_ones) break;
-						s_short[short_block_counter*(ones_per_block/spacing)+bit_number] = S_position_vec[beginingOfBlock+bit_number*spacing] - pos_of_first_one_in_block;
-					    //cout <<"s_short["<<short_block_counter*(ones_per_block/spacing)+bit_number<<"] = "<<S_position_vec[beginingOfBlock+bit_number*spacing] - pos_of_first_one_in_block <<endl;;
-					}
-				}
-				pvec[block_number] = short_block_counter << (log_ones_per_block-log_spacing); //in pvec store the begining of the short blocks for these ones
-			    //cout << "pvec["<<block_number<<"] = "<< (short_block_counter << (log_ones_per_block-log_spacing)) <<endl
-				;
-				short_block_counter++;
-			}
-		}
-		if (r == 0) {
-			s_long.resize(long_block_counter*ones_per_block+1);
-			s_short.resize(short_block_counter*(ones_per_block/spacing)+1);
-			cerr <<"Darray number of short blocks is:"<<short_block_counter<<" number of long (exact blocks) is:"<<long_block_counter<<endl;
+	if (position_of_last_one_in_block - pos_of_first_one_in_block >= max_block_length) { //then it is a long block
+		//in pvec store the 1+ the index in the long block array as a negative number (same as long_block_counter*ones_per_block + 1 )
+		pvec.push_back(-static_cast<int64_t>(s_long.size()+1));
+		//s_long stores the absolute position of every one that occurs in a long block
+		s_long.insert(s_long.end(),block_positions.begin(),block_positions.end());
+		s_long.resize(s_long.size()+ones_per_block-block_positions.size(),0);
+	} else { //else it is a short block
+		//in pvec store the begining of the short blocks for these ones
+		pvec.push_back(s_short.size());
+		//store position of every spacingTH one with respect to first one in block
+		for (uint64_t bit_number = 0; bit_number < ones_per_block/spacing; bit_number++) {
+			s_short.push_back(bit_number*spacing<block_positions.size() ? block_positions[bit_number*spacing] - pos_of_first_one_in_block : 0);
 		}
 	}
+	block_positions.clear();
 }
 
-uint64_t DArray::select(uint64_t index) const{
-
-    //cout <<"Darray looking up index:" <<index <<endl;
+inline uint64_t DArray::select(uint64_t index) const{
 	
 	if (index==0) return -1;
 	
 	--index; //now we decrement the index because first one is stored at index zero
 
-	
-	uint64_t p =0;
-	long il = pvec[index>>log_ones_per_block];
+	long il = pvec_data[index>>log_ones_per_block];
 	if (il < 0) {  //this is a long block so just lookup the position of the one
 		il = -il-1;
-	    //cout << "It is a long block and il is:"<<il<<endl;
-	    //cout <<"s_long["<<il+(index & (ones_per_block-1))<<"]"<<endl;
-		p= s_long[il+(index & (ones_per_block-1))];
-	} else { //else is was a short block so be need to find the one
-
-		p = lp_first_one_in_block[index>>log_ones_per_block];
-		
-	    //cout <<"index is now:" <<index <<endl;
-
-		
-	    //cout << "\n\nIt is a short block.  Found a block begining at (il):"<<il<<" in s_short array.  First one in block is at position:"<<p <<endl;
-	    //cout << "s_short["<<il+((index & (ones_per_block-1))>>log_spacing)<<"]="<< (uint64_t)s_short[il+((index & (max_block_length-1))>>log_spacing)] <<endl;
-		
-		p += s_short[il+((index & (ones_per_block-1))>>log_spacing)]; //same as (beginingshortblockindex+ index/spacing)
-		
-	    //cout << "Added short aray index of index/spacing " << il+((index & (ones_per_block-1))>>log_spacing)<< " new p is:"<<p <<endl;
-		//if (p>0)--p;
-		int ones_to_target=((index) & (spacing-1));//((index)%(spacing-1));//
-		//if (ones_to_target<0 &&p>0)--p;
-	    //cout <<"ones to target is:"<<ones_to_target <<endl;
-		
-		for (int i=0; i<ones_to_target; ++i) {
-			p=bit_array->find_next(p);
-		}
+		return s_long_data[il+(index & (ones_per_block-1))];
+	}
+	
+	//else is was a short block so be need to find the one
+	uint64_t p = first_one_data[index>>log_ones_per_block];
+	p += s_short_data[il+((index & (ones_per_block-1))>>log_spacing)]; //same as (beginingshortblockindex+ index/spacing)
+	
+	//p is a one, we want the ones_to_target-th one after it.  Skip whole words by their popcount and then select in the last word
+	int ones_to_target=((index) & (spacing-1));
+	uint64_t word_index=p>>6;
+	uint64_t word=bits_data[word_index] & (-1ULL << (p&63));
+	int ones_in_word;
+	while (ones_to_target >= (ones_in_word=count(word))) {
+		ones_to_target-=ones_in_word;
+		word=bits_data[++word_index];
 	}
-    //cout <<"Darray total number of ones is:"<<bit_array->count() << "  bit array size"<<bit_array->size()<<endl;
-    //cout <<"Darray is returning p of:"<<p <<endl;
-	return p;
+	return word_index*64+select_in_word(word,ones_to_target);
+}
+
+inline uint64_t DArray::bit_count() const{
+	return num_bits+totalbits(lp_first_one_in_block)+totalbits(s_long)+totalbits(s_short)+totalbits(pvec);
 }
 
-uint64_t DArray::bit_count() const{
-	return bit_array->size()+totalbits(lp_first_one_in_block)+totalbits(s_long)+totalbits(s_short)+totalbits(pvec);
+//the bits are counted here as well as the index as the DArray is the only thing left holding them once it is built
+inline MemoryUsage DArray::memory_usage() const{
+	MemoryUsage usage;
+	usage.add("bits",vector_bytes(*bits));
+	usage.add("first_one_in_block",vector_bytes(lp_first_one_in_block));
+	usage.add("long_spill",vector_bytes(s_long));
+	usage.add("short_spill",vector_bytes(s_short));
+	usage.add("pvec",vector_bytes(pvec));
+	return usage;
 }
 
 
 class SArray{
 	typedef unsigned char byte;
 public:
-	SArray(){};
+	SArray():low_data(NULL){};
 	SArray(const vector<byte> &bitvec);
+	//bits holds num_bits bits, 64 to a word with the first bit in the low bit of the first word
+	SArray(const uint64_t * bits, const uint64_t &num_bits);
 	uint64_t select(const uint64_t &index) const;
 	uint64_t bit_count() const;
+	MemoryUsage memory_usage() const;
+	void share(SharedArrays &arrays){
+		arrays.share(low_bits,low_data);
+		darray->share(arrays);
+	}
 private:
-	boost::shared_ptr<CompactStore> low_ptr;
+	vector<uint64_t> low_bits; //the low number_of_low_bits bits of every position packed into words
+	const uint64_t *low_data;	//what low() reads, low_bits or its copy in shared memory
 	boost::shared_ptr<DArray> darray;
 	uint64_t number_of_low_bits;
+	uint64_t low_mask;
+
+	void init(const uint64_t * bits, const uint64_t &num_bits);
+	uint64_t low(const uint64_t &index) const{
+		if (number_of_low_bits==0) return 0;
+		const uint64_t pos=index*number_of_low_bits;
+		//the second shift is split in two so a bit offset of 0 does not shift by 64
+		return ((low_data[pos>>6]>>(pos&63)) | ((low_data[(pos>>6)+1]<<1)<<(63-(pos&63)))) & low_mask;
+	}
 
 private:
 	friend class boost::serialization::access;
 	
-    template<class Archive>
-    void serialize(Archive & ar, const unsigned int version)
-    {
-		ar & low_ptr;
+	template<class Archive>
+	void save(Archive & ar, const unsigned int version) const
+	{
+		ar & low_bits;
 		ar & darray;
 		ar & number_of_low_bits;
 	}
+	template<class Archive>
+	void load(Archive & ar, const unsigned int version)
+	{
+		if (version>0) {
+			ar & low_bits;
+			ar & darray;
+			ar & number_of_low_bits;
+		}else {
+			//version 0 kept the low bits in a CompactStore
+			boost::shared_ptr<CompactStore> low_ptr;
+			ar & low_ptr;
+			ar & darray;
+			ar & number_of_low_bits;
+			const uint64_t num_ones=number_of_low_bits?low_ptr->getBitArrayPointer()->size()/number_of_low_bits:0;
+			low_bits.assign((num_ones*number_of_low_bits+63)/64+1,0);
+			for (uint64_t i=0; i<num_ones; ++i) {
+				const uint64_t v=low_ptr->at(i), pos=i*number_of_low_bits;
+				low_bits[pos>>6] |= v<<(pos&63);
+				if ((pos&63)+number_of_low_bits>64) low_bits[(pos>>6)+1] |= v>>(64-(pos&63));
+			}
+		}
+		low_mask=(1ULL<<number_of_low_bits)-1;
+		low_data=low_bits.empty()?NULL:&low_bits[0];
+	}
+	BOOST_SERIALIZATION_SPLIT_MEMBER()
 };
 
-bool getbit(const vector<unsigned char> &bitvec, uint64_t pos)
-{
-	return (bitvec[pos >>3] & (1<<(7&pos))) !=0;
-}
+BOOST_CLASS_VERSION(SArray, 1)
 
 
+inline SArray::SArray(const vector<byte> &bitvec){
+	vector<uint64_t> words((bitvec.size()+7)/8,0);
+	for (uint64_t i=0; i<bitvec.size(); i++) words[i>>3] |= static_cast<uint64_t>(bitvec[i])<<(8*(i&7));
+	init(words.empty()?NULL:&words[0],8*bitvec.size());
+}
 
-SArray::SArray(const vector<byte> &bitvec){
+inline SArray::SArray(const uint64_t * bits, const uint64_t &num_bits){
+	init(bits,num_bits);
+}
 
-	const uint64_t n=8*bitvec.size();
+inline void SArray::init(const uint64_t * bits, const uint64_t &n){
+	const uint64_t num_words=(n+63)/64;
+	const uint64_t last_word_mask=(n&63)?(1ULL<<(n&63))-1:-1ULL;
 	uint64_t num_ones = 0;
-	for (uint64_t i=0; i<n; i++) num_ones += getbit(bitvec,i);
+	for (uint64_t i=0; i<num_words; i++) num_ones += __builtin_popcountll(i+1<num_words?bits[i]:bits[i]&last_word_mask);
 	
 	if (num_ones == n){
 		cerr << "Error: Trying to create a Sarray index of a bitset. It contains all ones!"<<endl;
 		exit(1);
 	}
 	
-//	uint64_t mm = num_ones;
-//	number_of_low_bits = 0;
-//	while (mm < n) {
-//		mm <<= 1;
-//		number_of_low_bits++;
-//	}
-//	
-//	boost::shared_ptr<boost::dynamic_bitset<> > hi_ptr(new boost::dynamic_bitset<>(2*num_ones));
-//	boost::shared_ptr<boost::dynamic_bitset<> > sba_low_ptr(new boost::dynamic_bitset<>(number_of_low_bits*num_ones));
-//	low_ptr.reset( new CompactStore(sba_low_ptr,number_of_low_bits));
-
-	
 	number_of_low_bits = static_cast<uint64_t>(floor(log2(n/num_ones)));
+	low_mask=(1ULL<<number_of_low_bits)-1;
 
-	boost::shared_ptr<boost::dynamic_bitset<> > hi_ptr(new boost::dynamic_bitset<>(num_ones+(n>>number_of_low_bits)));
-	boost::shared_ptr<boost::dynamic_bitset<> > sba_low_ptr(new boost::dynamic_bitset<>(number_of_low_bits*num_ones));
-	low_ptr.reset( new CompactStore(sba_low_ptr,number_of_low_bits));
-	
-	
+	const uint64_t hi_size=num_ones+(n>>number_of_low_bits);
+	boost::shared_ptr<vector<uint64_t> > hi_ptr(new vector<uint64_t>((hi_size+63)/64+1,0));
+	low_bits.assign((number_of_low_bits*num_ones+63)/64+1,0);
 	
 	fprintf(stderr,"\n\nSize of bit array to compress as SArray=%llu \n number of ones=%llu \n Density of SArray=%.2f%% \n numner of low bits to use=%llu\n",n,num_ones, 100.0 * num_ones/n,number_of_low_bits);
 
-
 	uint64_t one_counter=0;
-	for (uint64_t i=0; i<n; i++) {
-		if (getbit(bitvec,i)) {
-			hi_ptr->set((i>>number_of_low_bits)+one_counter,1);
-			low_ptr->set(one_counter,i & ((1<<number_of_low_bits)-1));
-			++one_counter;
+	for (uint64_t w=0; w<num_words; w++) {
+		for (uint64_t word=(w+1<num_words?bits[w]:bits[w]&last_word_mask); word!=0; word&=word-1, ++one_counter) {
+			const uint64_t i=w*64+__builtin_ctzll(word);
+			const uint64_t hi=(i>>number_of_low_bits)+one_counter;
+			(*hi_ptr)[hi>>6] |= 1ULL<<(hi&63);
+			if (number_of_low_bits) {
+				const uint64_t v=i&low_mask, pos=one_counter*number_of_low_bits;
+				low_bits[pos>>6] |= v<<(pos&63);
+				if ((pos&63)+number_of_low_bits>64) low_bits[(pos>>6)+1] |= v>>(64-(pos&63));
+			}
 		}
 	}
 	
-	darray.reset(new DArray(hi_ptr));
+	darray.reset(new DArray(hi_ptr,hi_size));
+	low_data=low_bits.empty()?NULL:&low_bits[0];
 	
-	cerr << "Size of Low BitArray:"<<low_ptr->getBitArrayPointer()->size() <<"\nSize of Upper DArray:"<<darray->bit_count()<<endl;
+	cerr << "Size of Low BitArray:"<<64*low_bits.size() <<"\nSize of Upper DArray:"<<darray->bit_count()<<endl;
 
 }
 
 
 
 
-uint64_t SArray::select(const uint64_t &idx) const{
-    //cout <<"lowptr total number of ones is:"<<low_ptr->getBitArrayPointer()->count() <<endl;
+inline uint64_t SArray::select(const uint64_t &idx) const{
 	uint64_t index = idx+1;
 	
 	if (index == 0) return -1;
 	uint64_t result = darray->select(index) - (index-1);
 	result <<= number_of_low_bits;
-    //cout << "sarray result after shift:"<<result<<endl;
-    //cout <<"adding:"<<low_ptr->at(index-1)<<endl;
-	result += low_ptr->at(index-1);
-    //cout << "sarray is returning:"<<result<<endl;
+	result += low(index-1);
 	return result;	
 
 }
 
 
-uint64_t SArray::bit_count() const{
-	return low_ptr->getBitArrayPointer()->size()+darray->bit_count()+8*sizeof(number_of_low_bits);
+inline uint64_t SArray::bit_count() const{
+	return 64*low_bits.size()+darray->bit_count()+8*sizeof(number_of_low_bits);
+}
+
+inline MemoryUsage SArray::memory_usage() const{
+	MemoryUsage usage;
+	usage.add("low_bits",vector_bytes(low_bits));
+	usage.add("upper",darray->memory_usage());
+	return usage;
 }
 
 
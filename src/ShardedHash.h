@@ -0,0 +1,197 @@
+/*
+ *  ShardedHash.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//The minimal perfect hash of an MPHR.  It is one cmph CHD hash, or one for each shard of the keys if it was built in
+//shards (see the sharded MPHR constructor): the shard of a key is chosen by a MurmurHash2 of its own, and the slots of
+//a shard come after those of the shards before it, so the slots are still 0 to size()-1.  The hashes of the shards are
+//made at the same time by a thread each, and no one of them needs more than the 2^32 keys cmph can hash.
+//On disk a hash of one shard is the cmph dump it always was.  A sharded one starts with SHARDED_HASH_MAGIC and the
+//number of shards, then has the number of keys of each shard and its cmph dump (nothing for a shard with no keys).
+//Packed, for shared memory and huge pages, it starts with the number of shards and a table of where the packed cmph
+//hash of each shard is and its first slot, then has the packed hashes.
+
+#ifndef SHARDED_HASH_H
+#define SHARDED_HASH_H
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+#include "cmph.h"
+#include "cmph_structs.h"
+#include "FingerPrintStore.h"
+#include "SharedArrays.h"
+#include "MemoryUsage.h"
+
+#define SHARDED_HASH_MAGIC "SHEFLMSH"
+
+
+class ShardedHash {
+public:
+	ShardedHash():total_slots(0),view(NULL){}
+	~ShardedHash(){clear();}
+
+	//the shard of a key in a hash of number_of_shards shards
+	static unsigned shardOf(const char *key, const unsigned &length, const uint64_t &number_of_shards){
+		return number_of_shards==1?0:MurmurHash2(key,length,SHARD_SEED)%number_of_shards;
+	}
+	//adds the hash of the next shard, which is destroyed with this.  It is NULL for a shard with no keys.
+	void add(cmph_t *hash);
+	//false once the hash is only in its packed form
+	bool unpacked() const {return !hashes.empty();}
+	uint64_t size() const {return total_slots;}
+	uint64_t search(const char *key, const unsigned &length) const;
+	//the hash counted at its packed size, which is about what it takes on disk
+	uint64_t bytes() const;
+	//passes the packed hash to arrays (see SharedArrays.h), the unpacked one is freed once it has been copied
+	void share(SharedArrays &arrays);
+	//false if the file does not hold a hash
+	bool load(FILE *file);
+	void dump(FILE *file) const;
+	void clear();
+
+private:
+	ShardedHash(const ShardedHash&); //disallow copy
+	void operator=(const ShardedHash&); //disallow assignment
+	static const unsigned SHARD_SEED=0x2c1b3c6d;	//not the seed of the fingerprints, so the keys of a shard have all of them
+
+	std::vector<cmph_t*> hashes;
+	std::vector<uint64_t> first_slots;
+	uint64_t total_slots;
+	std::vector<char> packed;
+	const char *view;	//what search() reads when it is set, packed or its copy in shared memory
+};
+
+
+inline void ShardedHash::add(cmph_t *hash){
+	first_slots.push_back(total_slots);
+	hashes.push_back(hash);
+	if (hash) total_slots+=hash->size;
+}
+
+inline uint64_t ShardedHash::search(const char *key, const unsigned &length) const{
+	if (view) {
+		const uint64_t *table=reinterpret_cast<const uint64_t*>(view);
+		const unsigned shard=shardOf(key,length,table[0]);
+		//a key that is not stored can fall in a shard with no keys, its first slot is as good as any
+		if (!table[1+2*shard]) return table[2+2*shard];
+		return table[2+2*shard]+cmph_search_packed(const_cast<char*>(view+table[1+2*shard]),key,length);
+	}
+	if (hashes.size()==1) return cmph_search(hashes[0],key,length);
+	const unsigned shard=shardOf(key,length,hashes.size());
+	if (!hashes[shard]) return first_slots[shard];
+	return first_slots[shard]+cmph_search(hashes[shard],key,length);
+}
+
+inline uint64_t ShardedHash::bytes() const{
+	if (!unpacked()) return vector_bytes(packed);
+	uint64_t total=0;
+	for (size_t i=0; i<hashes.size(); ++i) if (hashes[i]) total+=cmph_packed_size(hashes[i]);
+	return total;
+}
+
+inline void ShardedHash::share(SharedArrays &arrays){
+	if (unpacked() && packed.empty()) {
+		//the table, then every packed hash on an 8 byte boundary
+		const uint64_t table_bytes=8*(1+2*hashes.size());
+		std::vector<uint64_t> table(1+2*hashes.size());
+		table[0]=hashes.size();
+		uint64_t end=table_bytes;
+		for (size_t i=0; i<hashes.size(); ++i) {
+			table[1+2*i]=hashes[i]?end:0;
+			table[2+2*i]=first_slots[i];
+			if (hashes[i]) end+=(cmph_packed_size(hashes[i])+7)/8*8;
+		}
+		packed.assign(end,0);
+		memcpy(&packed[0],&table[0],table_bytes);
+		for (size_t i=0; i<hashes.size(); ++i) if (hashes[i]) cmph_pack(hashes[i],&packed[table[1+2*i]]);
+	}
+	arrays.share(packed,view);
+	if (arrays.mode()!=SharedArrays::MEASURE && unpacked()) {
+		for (size_t i=0; i<hashes.size(); ++i) if (hashes[i]) cmph_destroy(hashes[i]);
+		hashes.clear();
+	}
+}
+
+inline bool ShardedHash::load(FILE *file){
+	clear();
+	char magic[8];
+	if (fread(magic,8,1,file)!=1 || memcmp(magic,SHARDED_HASH_MAGIC,8)!=0) {
+		//a hash of one shard, as every hash was before there were shards
+		rewind(file);
+		cmph_t *hash=cmph_load(file);
+		if (hash==NULL) return false;
+		add(hash);
+		return true;
+	}
+	uint32_t number_of_shards;
+	if (fread(&number_of_shards,sizeof(number_of_shards),1,file)!=1 || number_of_shards==0) return false;
+	for (uint32_t i=0; i<number_of_shards; ++i) {
+		uint64_t keys;
+		if (fread(&keys,sizeof(keys),1,file)!=1) {
+			clear();
+			return false;
+		}
+		cmph_t *hash=NULL;
+		if (keys) {
+			hash=cmph_load(file);
+			if (hash==NULL || hash->size!=keys) {
+				if (hash) cmph_destroy(hash);
+				clear();
+				return false;
+			}
+		}
+		add(hash);
+	}
+	return true;
+}
+
+inline void ShardedHash::dump(FILE *file) const{
+	if (hashes.size()==1 && hashes[0]) {
+		cmph_dump(hashes[0],file);
+		return;
+	}
+	fwrite(SHARDED_HASH_MAGIC,8,1,file);
+	const uint32_t number_of_shards=hashes.size();
+	fwrite(&number_of_shards,sizeof(number_of_shards),1,file);
+	for (size_t i=0; i<hashes.size(); ++i) {
+		const uint64_t keys=hashes[i]?hashes[i]->size:0;
+		fwrite(&keys,sizeof(keys),1,file);
+		if (hashes[i]) cmph_dump(hashes[i],file);
+	}
+}
+
+inline void ShardedHash::clear(){
+	for (size_t i=0; i<hashes.size(); ++i) if (hashes[i]) cmph_destroy(hashes[i]);
+	hashes.clear();
+	first_slots.clear();
+	total_slots=0;
+	std::vector<char>().swap(packed);
+	view=NULL;
+}
+
+
+#endif
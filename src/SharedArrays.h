@@ -0,0 +1,155 @@
+/*
+ *  SharedArrays.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Moves the big arrays of a structure into memory that other processes map (see SharedModel.h).
+//Every structure that can be shared has a share(SharedArrays&) that passes each of its big arrays, always in the same
+//order, with the pointer its lookups read that array through.  What is left of the structure once the arrays are out
+//is small and is serialised as usual.
+//A select or rank index (rank9, simple_select and the rest) owns only its index: the bits it is built over belong to
+//the structure that holds them, which shares them itself (and passes their new place to the index where it has to).
+//	MEASURE	takes the arrays out of their vectors (so the rest can be serialised without them) and counts the bytes
+//			they need, until restore() puts them back.  The pointers are not touched.
+//	COPY	copies every array into the shared memory, frees the vector and points the structure at the copy.
+//	ATTACH	frees the vector and points the structure at the copy of the array that COPY left in the shared memory.
+
+#ifndef SHARED_ARRAYS_H
+#define SHARED_ARRAYS_H
+
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/dynamic_bitset.hpp>
+
+#include "ModelReport.h"
+
+
+//where an array is in the shared memory, the table of these is written to the shared memory as well
+struct SharedArrayEntry {
+	uint64_t offset;	//from the start of the shared memory
+	uint64_t bytes;
+	uint64_t element_size;
+};
+
+
+class SharedArrays {
+public:
+	enum Mode {MEASURE, COPY, ATTACH};
+	static const uint64_t ALIGNMENT=64;	//every array starts on a cache line
+
+	SharedArrays():which(MEASURE),base(NULL),table(NULL),max_entries(0),used(0),end(0),count(0){}
+	//base is the start of the shared memory, the table has room for number_of_entries and the arrays go from first_offset to end
+	SharedArrays(const Mode &mode, char *shared_base, SharedArrayEntry *entries, const uint64_t &number_of_entries, const uint64_t &first_offset, const uint64_t &end_offset)
+	:which(mode),base(shared_base),table(entries),max_entries(number_of_entries),used(first_offset),end(end_offset),count(0){}
+
+	Mode mode() const {return which;}
+	template <class T>
+	void share(std::vector<T> &v, const T *&view);
+	template <class Block>
+	void share(boost::dynamic_bitset<Block> &bits, const Block *&view);
+	//puts back the arrays MEASURE took out
+	void restore(){
+		for (size_t i=0; i<held.size(); ++i) held[i]->restore();
+		held.clear();
+	}
+	uint64_t arrays() const {return count;}
+	//MEASURE: the bytes the arrays take, with the padding that aligns them
+	uint64_t bytes() const {return used;}
+
+	static uint64_t aligned(const uint64_t &offset){return (offset+ALIGNMENT-1)/ALIGNMENT*ALIGNMENT;}
+
+private:
+	struct Held {
+		virtual ~Held(){}
+		virtual void restore()=0;
+	};
+	template <class Container>
+	struct HeldArray : public Held {
+		Container &owner;
+		Container contents;
+		explicit HeldArray(Container &c):owner(c){owner.swap(contents);}
+		void restore(){owner.swap(contents);}
+	};
+
+	//the next place in the shared memory for an array of bytes bytes, or exits if it is not what was shared there
+	const char * place(const uint64_t &bytes, const uint64_t &element_size);
+
+	Mode which;
+	char *base;
+	SharedArrayEntry *table;
+	uint64_t max_entries;
+	uint64_t used, end;
+	uint64_t count;
+	std::vector<boost::shared_ptr<Held> > held;
+};
+
+
+inline const char * SharedArrays::place(const uint64_t &bytes, const uint64_t &element_size){
+	if (count>=max_entries) ModelReport::error("the structure has more arrays than the shared memory was made for");
+	SharedArrayEntry &entry=table[count++];
+	if (which==COPY) {
+		used=aligned(used);
+		if (used+bytes>end) ModelReport::error("the arrays of the structure do not fit in the shared memory");
+		entry.offset=used;
+		entry.bytes=bytes;
+		entry.element_size=element_size;
+		used+=bytes;
+	}else if (entry.element_size!=element_size || entry.offset+entry.bytes>end || entry.offset%ALIGNMENT)
+		ModelReport::error("the shared memory does not hold the arrays this structure expects");
+	return base+entry.offset;
+}
+
+template <class T>
+void SharedArrays::share(std::vector<T> &v, const T *&view){
+	if (which==MEASURE) {
+		used=aligned(used)+sizeof(T)*v.size();
+		++count;
+		held.push_back(boost::shared_ptr<Held>(new HeldArray<std::vector<T> >(v)));
+		return;
+	}
+	const char *p=place(sizeof(T)*v.size(),sizeof(T));
+	if (which==COPY && !v.empty()) memcpy(const_cast<char*>(p),&v[0],sizeof(T)*v.size());
+	const uint64_t bytes=table[count-1].bytes;
+	std::vector<T>().swap(v);
+	view=bytes?reinterpret_cast<const T*>(p):NULL;
+}
+
+template <class Block>
+void SharedArrays::share(boost::dynamic_bitset<Block> &bits, const Block *&view){
+	if (which==MEASURE) {
+		used=aligned(used)+sizeof(Block)*bits.num_blocks();
+		++count;
+		held.push_back(boost::shared_ptr<Held>(new HeldArray<boost::dynamic_bitset<Block> >(bits)));
+		return;
+	}
+	const char *p=place(sizeof(Block)*bits.num_blocks(),sizeof(Block));
+	if (which==COPY) boost::to_block_range(bits,reinterpret_cast<Block*>(const_cast<char*>(p)));
+	const uint64_t bytes=table[count-1].bytes;
+	boost::dynamic_bitset<Block>().swap(bits);
+	view=bytes?reinterpret_cast<const Block*>(p):NULL;
+}
+
+
+#endif
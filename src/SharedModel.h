@@ -0,0 +1,370 @@
+/*
+ *  SharedModel.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//A model that is loaded once into shared memory and then used read only by every process that opens it,
+//so N processes on a machine hold one copy of the model and not N.
+//The segment is a POSIX shared memory object (a name such as /3gmstore) or, if the name is a path with a
+//directory in it, a file that is mapped shared (such as a file on a hugetlbfs mount).  It holds:
+//	a header		that says which model files it was made from, and whether it is ready
+//	a table			of where every array is (see SharedArrays.h)
+//	the skeleton	the MPHR with its arrays taken out, serialised as usual
+//	the arrays		each on a cache line, the lookups read them where they are
+//Opening and making the segment is done under an flock on a lock object of its own (the name with .lock on the
+//end, which --shm-remove removes if no process holds it), so no process can see a segment that is still being made.
+//A process looks for a ready segment holding the lock shared, and if there is none takes it exclusively, looks again,
+//and makes the segment.  A segment that was made from other files, or that was left unready by a creator that died,
+//is then removed and made again.  The processes that have it mapped keep using the old one until they exit.
+//Every process that has the segment mapped holds a shared flock on it, which --shm-remove uses to say so.
+//The creator can ask for transparent huge pages for the segment (a file on hugetlbfs has them anyway) and for its
+//pages to be interleaved over the NUMA nodes, see ArrayPlacement.h.
+
+#ifndef SHARED_MODEL_H
+#define SHARED_MODEL_H
+
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/vfs.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+#include "MPHR.h"
+#include "SharedArrays.h"
+#include "ModelReport.h"
+
+
+class SharedModel {
+public:
+	//The model with the files basefilename.* in the segment name, made from the files if it is not there yet.
+	//The model keeps the segment mapped for as long as it is used.
+	static boost::shared_ptr<MPHR> open(const std::string &name, const std::string &basefilename, const bool &huge_pages=false, const NumaPlacement &numa=NUMA_LOCAL);
+	//removes the segment name, and says if a process still has it mapped
+	static void remove(const std::string &name);
+
+	~SharedModel();
+
+private:
+	static const uint64_t LAYOUT_VERSION=3;	//2: the packed hash starts with the table of its shards (see ShardedHash.h), 3: a hot tier has its store slots
+	static const unsigned SOURCE_FILES=5;	//the hash and fp_values files of the model and of its hot tier, and the store slots of the hot tier
+
+	//where the model came from, a file that is not there is all zeros
+	struct SourceFile {
+		uint64_t device, inode, size, mtime;
+	};
+	struct Header {
+		char magic[8];
+		uint64_t layout_version;
+		uint64_t ready;
+		uint64_t total_bytes;
+		SourceFile sources[SOURCE_FILES];
+		uint64_t num_arrays;
+		uint64_t table_offset;
+		uint64_t skeleton_offset, skeleton_bytes;
+		uint64_t arrays_offset;
+	};
+
+	SharedModel(const std::string &name, const int &fd):name(name),fd(fd),base(NULL),length(0){}
+	SharedModel(const SharedModel&); //disallow copy
+	void operator=(const SharedModel&); //disallow assignment
+
+	static bool is_file(const std::string &name){return name.find('/',1)!=std::string::npos;}
+	static std::string shm_name(const std::string &name){return (name.empty() || name[0]!='/')?"/"+name:name;}
+	static int open_segment(const std::string &name, const int &flags);
+	static int unlink_segment(const std::string &name);
+	static std::string lock_name(const std::string &name){return name+".lock";}
+	//opens the lock object, making it if it isn't there, and flocks it with operation
+	static int lock_segment(const std::string &name, const int &operation);
+	static void source_files(const std::string &basefilename, SourceFile *sources);
+	//attaches to the segment if it is a ready copy of the files in sources, or removes it if remove_stale
+	static bool attach_existing(const std::string &name, const SourceFile *sources, const bool &remove_stale, boost::shared_ptr<MPHR> &model);
+	static void make(const std::string &name, const std::string &basefilename, const SourceFile *sources, const bool &huge_pages, const NumaPlacement &numa, boost::shared_ptr<MPHR> &model);
+
+	void create(const std::string &basefilename, boost::shared_ptr<MPHR> &model, const bool &huge_pages, const NumaPlacement &numa);
+	//false if the segment is not a ready copy of the files in sources
+	bool attach(const SourceFile *sources, boost::shared_ptr<MPHR> &model);
+	void map(const uint64_t &bytes, const int &protection);
+	void set_table(MPHR &model) const {
+		const Header &header=*reinterpret_cast<const Header*>(base);
+		model.array_base=base;
+		model.array_table=reinterpret_cast<const SharedArrayEntry*>(base+header.table_offset);
+		model.num_mapped_arrays=header.num_arrays;
+	}
+
+	std::string name;
+	int fd;	//held open for the flock, which is dropped when it is closed
+	char *base;
+	uint64_t length;
+};
+
+
+inline int SharedModel::open_segment(const std::string &name, const int &flags){
+	if (is_file(name)) return ::open(name.c_str(),flags,0644);
+	return shm_open(shm_name(name).c_str(),flags,0644);
+}
+
+inline int SharedModel::unlink_segment(const std::string &name){
+	if (is_file(name)) return unlink(name.c_str());
+	return shm_unlink(shm_name(name).c_str());
+}
+
+inline void SharedModel::source_files(const std::string &basefilename, SourceFile *sources){
+	const std::string names[SOURCE_FILES]={
+		basefilename+HASH_FILENAME_SUFIX, basefilename+FP_VALUE_FILENAME_SUFIX,
+		basefilename+HOT_TIER_FILENAME_SUFIX+HASH_FILENAME_SUFIX, basefilename+HOT_TIER_FILENAME_SUFIX+FP_VALUE_FILENAME_SUFIX,
+		basefilename+HOT_TIER_FILENAME_SUFIX+STORE_SLOTS_FILENAME_SUFIX
+	};
+	memset(sources,0,sizeof(SourceFile)*SOURCE_FILES);
+	for (unsigned i=0; i<SOURCE_FILES; ++i) {
+		struct stat info;
+		if (stat(names[i].c_str(),&info)!=0) {
+			if (i<2) ModelReport::error("can't read the model file: "+names[i]);
+			continue;
+		}
+		sources[i].device=info.st_dev;
+		sources[i].inode=info.st_ino;
+		sources[i].size=info.st_size;
+		sources[i].mtime=info.st_mtime;
+	}
+}
+
+inline void SharedModel::map(const uint64_t &bytes, const int &protection){
+	void *p=mmap(NULL,bytes,protection,MAP_SHARED,fd,0);
+	if (p==MAP_FAILED) {
+		std::ostringstream message;
+		message << "can't map the shared memory "<<name<<" ("<<bytes<<" bytes): "<<strerror(errno);
+		ModelReport::error(message.str());
+	}
+	base=static_cast<char*>(p);
+	length=bytes;
+}
+
+inline SharedModel::~SharedModel(){
+	if (base) munmap(base,length);
+	if (fd!=-1) close(fd);
+}
+
+inline boost::shared_ptr<MPHR> SharedModel::open(const std::string &name, const std::string &basefilename, const bool &huge_pages, const NumaPlacement &numa){
+	if (numa==NUMA_REPLICATE) ModelReport::error("a model in shared memory can be interleaved over the NUMA nodes but not copied to each of them");
+	SourceFile sources[SOURCE_FILES];
+	source_files(basefilename,sources);
+	int lock=lock_segment(name,LOCK_SH);	//waits for a creator to finish
+	boost::shared_ptr<MPHR> model;
+	try {
+		if (!attach_existing(name,sources,false,model)) {
+			close(lock);
+			lock=-1;
+			lock=lock_segment(name,LOCK_EX);
+			//another process can have made it while the lock was let go to take it exclusively
+			if (!attach_existing(name,sources,true,model)) make(name,basefilename,sources,huge_pages,numa,model);
+		}
+	}
+	catch (...) {
+		if (lock!=-1) close(lock);
+		throw;
+	}
+	close(lock);
+	return model;
+}
+
+inline int SharedModel::lock_segment(const std::string &name, const int &operation){
+	for (;;) {
+		const int lock=open_segment(lock_name(name),O_RDONLY|O_CREAT);
+		if (lock==-1) ModelReport::error("can't open the lock of the shared memory "+name+": "+strerror(errno));
+		flock(lock,operation);
+		//--shm-remove can have removed the lock object while this waited for it, then the lock is on one no one else sees
+		struct stat held, current;
+		const int now=open_segment(lock_name(name),O_RDONLY);
+		const bool same=now!=-1 && fstat(lock,&held)==0 && fstat(now,&current)==0 && held.st_dev==current.st_dev && held.st_ino==current.st_ino;
+		if (now!=-1) close(now);
+		if (same) return lock;
+		close(lock);
+	}
+}
+
+inline bool SharedModel::attach_existing(const std::string &name, const SourceFile *sources, const bool &remove_stale, boost::shared_ptr<MPHR> &model){
+	const int fd=open_segment(name,O_RDONLY);
+	if (fd==-1) {
+		if (errno!=ENOENT) ModelReport::error("can't open the shared memory "+name+": "+strerror(errno));
+		return false;
+	}
+	boost::shared_ptr<SharedModel> segment(new SharedModel(name,fd));
+	flock(fd,LOCK_SH);
+	if (!segment->attach(sources,model)) {
+		if (remove_stale) {
+			if (ModelReport::verbose()) std::cerr << "The shared memory "<<name<<" does not hold a ready copy of the model files so it is being made again"<<std::endl;
+			unlink_segment(name);
+		}
+		return false;
+	}
+	model->array_memory=segment;
+	model->array_memory_bytes=segment->length;
+	model->array_memory_name="shared_memory";
+	segment->set_table(*model);
+	if (ModelReport::verbose()) std::cerr << "Attached to the model in shared memory "<<name<<" ("<<segment->length<<" bytes)"<<std::endl;
+	return true;
+}
+
+inline void SharedModel::make(const std::string &name, const std::string &basefilename, const SourceFile *sources, const bool &huge_pages, const NumaPlacement &numa, boost::shared_ptr<MPHR> &model){
+	const int fd=open_segment(name,O_RDWR|O_CREAT|O_EXCL);
+	if (fd==-1) ModelReport::error("can't create the shared memory "+name+": "+strerror(errno));
+	boost::shared_ptr<SharedModel> segment(new SharedModel(name,fd));
+	flock(fd,LOCK_SH);
+	try {
+		segment->create(basefilename,model,huge_pages,numa);
+	}
+	catch (...) {
+		//the unready segment would only be made again by the next process to open it
+		unlink_segment(name);
+		throw;
+	}
+	memcpy(reinterpret_cast<Header*>(segment->base)->sources,sources,sizeof(SourceFile)*SOURCE_FILES);
+	reinterpret_cast<Header*>(segment->base)->ready=1;
+	mprotect(segment->base,segment->length,PROT_READ);
+	model->array_memory=segment;
+	model->array_memory_bytes=segment->length;
+	model->array_memory_name="shared_memory";
+	segment->set_table(*model);
+	if (ModelReport::verbose()) std::cerr << "Loaded the model into shared memory "<<name<<" ("<<segment->length<<" bytes)"<<std::endl;
+}
+
+//loads the model from its files and moves its arrays into the new segment, the model then reads them from there
+inline void SharedModel::create(const std::string &basefilename, boost::shared_ptr<MPHR> &model, const bool &huge_pages, const NumaPlacement &numa){
+	model.reset(new MPHR(basefilename));
+
+	std::string skeleton;
+	SharedArrays measure;
+	model->share(measure);
+	{
+		std::ostringstream out(std::ios_base::out|std::ios_base::binary);
+		{
+			boost::archive::binary_oarchive oa(out);
+			oa << *model;
+		}
+		skeleton=out.str();
+	}
+	measure.restore();
+
+	Header header;
+	memset(&header,0,sizeof(header));
+	memcpy(header.magic,"SHEFLMSM",8);
+	header.layout_version=LAYOUT_VERSION;
+	header.num_arrays=measure.arrays();
+	header.table_offset=SharedArrays::aligned(sizeof(Header));
+	header.skeleton_offset=header.table_offset+sizeof(SharedArrayEntry)*header.num_arrays;
+	header.skeleton_bytes=skeleton.size();
+	header.arrays_offset=SharedArrays::aligned(header.skeleton_offset+header.skeleton_bytes);
+	header.total_bytes=header.arrays_offset+measure.bytes();
+
+	//a file on hugetlbfs has to be a whole number of its pages
+	uint64_t bytes=header.total_bytes;
+	struct statfs fs;
+	if (is_file(name) && fstatfs(fd,&fs)==0 && fs.f_bsize>0) bytes=(bytes+fs.f_bsize-1)/fs.f_bsize*fs.f_bsize;
+	if (ftruncate(fd,bytes)!=0) {
+		std::ostringstream message;
+		message << "can't make the shared memory "<<name<<" "<<bytes<<" bytes long: "<<strerror(errno);
+		unlink_segment(name);
+		ModelReport::error(message.str());
+	}
+	map(bytes,PROT_READ|PROT_WRITE);
+	//both only work before the pages are touched
+	if (huge_pages && !is_file(name) && !MappedArrays::advise_huge_pages(base,length))
+		std::cerr << "Warning: transparent huge pages can't be used for the shared memory "<<name<<std::endl;
+	const NumaNodes &nodes=NumaNodes::instance();
+	if (numa==NUMA_INTERLEAVE && nodes.count()>1 && !nodes.bind(base,length,MPOL_INTERLEAVE))
+		std::cerr << "Warning: the pages of the shared memory "<<name<<" can't be interleaved over the NUMA nodes: "<<strerror(errno)<<std::endl;
+	memcpy(base,&header,sizeof(header));
+
+	SharedArrays copy(SharedArrays::COPY,base,reinterpret_cast<SharedArrayEntry*>(base+header.table_offset),header.num_arrays,header.arrays_offset,header.total_bytes);
+	model->share(copy);
+	if (copy.arrays()!=header.num_arrays) {
+		std::ostringstream message;
+		message << "the model shared "<<copy.arrays()<<" arrays and not the "<<header.num_arrays<<" it measured";
+		unlink_segment(name);
+		ModelReport::error(message.str());
+	}
+	memcpy(base+header.skeleton_offset,skeleton.data(),skeleton.size());
+}
+
+inline bool SharedModel::attach(const SourceFile *sources, boost::shared_ptr<MPHR> &model){
+	struct stat info;
+	if (fstat(fd,&info)!=0 || static_cast<uint64_t>(info.st_size)<sizeof(Header)) return false;
+	map(info.st_size,PROT_READ);
+	const Header &header=*reinterpret_cast<const Header*>(base);
+	if (memcmp(header.magic,"SHEFLMSM",8)!=0 || header.layout_version!=LAYOUT_VERSION || !header.ready) return false;
+	if (memcmp(header.sources,sources,sizeof(SourceFile)*SOURCE_FILES)!=0) return false;
+	if (header.total_bytes>length || header.arrays_offset>header.total_bytes || header.skeleton_offset+header.skeleton_bytes>header.arrays_offset
+		|| header.table_offset+sizeof(SharedArrayEntry)*header.num_arrays>header.skeleton_offset)
+		ModelReport::error("the shared memory "+name+" is damaged, remove it with --shm-remove");
+
+	model.reset(new MPHR());
+	{
+		std::istringstream in(std::string(base+header.skeleton_offset,header.skeleton_bytes),std::ios_base::in|std::ios_base::binary);
+		boost::archive::binary_iarchive ia(in);
+		ia >> *model;
+	}
+	//the table is only read, COPY is the only mode that writes to it
+	SharedArrays arrays(SharedArrays::ATTACH,base,const_cast<SharedArrayEntry*>(reinterpret_cast<const SharedArrayEntry*>(base+header.table_offset)),header.num_arrays,header.arrays_offset,header.total_bytes);
+	model->share(arrays);
+	if (arrays.arrays()!=header.num_arrays) {
+		std::ostringstream message;
+		message << "the shared memory "<<name<<" holds "<<header.num_arrays<<" arrays and the model has "<<arrays.arrays();
+		ModelReport::error(message.str());
+	}
+	return true;
+}
+
+inline void SharedModel::remove(const std::string &name){
+	const int fd=open_segment(name,O_RDONLY);
+	if (fd==-1) {
+		std::cerr << "Error: there is no shared memory "<<name<<std::endl;
+		exit(1);
+	}
+	const bool in_use=flock(fd,LOCK_EX|LOCK_NB)!=0;
+	//the lock object is only removed if no process is opening the shared memory under it
+	const int lock=open_segment(lock_name(name),O_RDONLY);
+	const bool lock_free=lock!=-1 && flock(lock,LOCK_EX|LOCK_NB)==0;
+	if (unlink_segment(name)!=0) {
+		std::cerr << "Error: can't remove the shared memory "<<name<<": "<<strerror(errno)<<std::endl;
+		exit(1);
+	}
+	if (lock_free) unlink_segment(lock_name(name));
+	if (lock!=-1) close(lock);
+	close(fd);
+	std::cerr << "Removed the shared memory "<<name;
+	if (in_use) std::cerr << ", the processes that have it mapped keep it until they exit";
+	std::cerr << std::endl;
+}
+
+
+#endif
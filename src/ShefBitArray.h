@@ -28,6 +28,10 @@
 #include <zlib.h>
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <stdint.h>
+#include <pthread.h>
 #include <boost/shared_array.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/serialization/base_object.hpp>
@@ -39,6 +43,8 @@
 #include <boost/serialization/split_member.hpp>
 #include <boost/serialization/dynamic_bitset.hpp>
 
+#include "MemoryUsage.h"
+
 using std::cout;
 using std::cerr;
 using std::endl;
@@ -136,145 +142,230 @@ private:
 
 
 
+//A block of a ShefCompressedBitArray.  It is held zlib compressed and is decompressed into its words while it is
+//in the cache.  A block that has never been written has neither and reads as zeros.
 class CompressedBlock{
 public:
-	size_t compressed_size;
-	const size_t uncompressed_size;
-	void * compressed_data;
-	void * uncompressed_data;
+	CompressedBlock():dirty(false),pins(0),last_used(0){}
+	bool cached() const {return !words.empty();}
+	void decompress(const size_t &number_of_words);
+	//compresses the words again if they have changed
+	void writeBack(const int &level);
+	//writes the block back and frees its words
+	void evict(const int &level);
+
+	std::vector<char> compressed;
+	std::vector<uint64_t> words;
 	bool dirty;
-public:
-	explicit CompressedBlock(size_t block_size)
-		:uncompressed_size(block_size){
-		compressed_size=0;
-		compressed_data=NULL;
-		uncompressed_data=NULL;
-		dirty=false;
-	}
-	~CompressedBlock(){
-		//it is safe to free null pointer so this is ok
-		free(compressed_data);
-		free(uncompressed_data);
-	}
-	void setDirty(){
-		dirty=true;
-	}
-	void compress(){
-		if (uncompressed_data==NULL && compressed_data==NULL){
-			cerr << "Error there is no data to compress";
-			exit(0);
-		}
-		if (compressed_data==NULL||dirty) {
-			free(compressed_data);
-			//cerr << "COMPRESSING bytes:"<<uncompressed_size<<endl;
-			//this is the minimum zlib allows
-			compressed_size=uncompressed_size+static_cast<size_t>(uncompressed_size*0.1+12.0);
-			compressed_data = malloc(compressed_size);
-			int r=compress2((Bytef*)compressed_data, (uLongf*)&compressed_size,
-					  (const Bytef*)uncompressed_data, (uLongf)uncompressed_size, Z_BEST_COMPRESSION);//this could be Z_BEST_COMPRESSION or Z_BEST_SPEED
-			if (r!=Z_OK){
-				cerr << "error compressing!!! error:"<< r<<endl;
-				exit(0);
-			}
-			compressed_data=realloc(compressed_data, compressed_size);
-		}
-		free(uncompressed_data);
-		uncompressed_data=NULL;
-	}
-	
-	void decompress(){
-		if (uncompressed_data!=NULL){
-			return;
-		} 
+	unsigned pins;
+	uint64_t last_used;
+};
 
-		uncompressed_data=malloc(uncompressed_size);
-	
-		if (compressed_data!=NULL){
-			//cerr << "DECOMPRESSING need to malloc bytes:" << uncompressed_size <<std::flush <<endl;
-			int r=uncompress((Bytef*)uncompressed_data,(uLongf*) &uncompressed_size, (const Bytef*)compressed_data,(uLongf)compressed_size);
-				if (r!=Z_OK){
-					cerr << "error compressing!!! error:"<< r<<endl;
-					exit(0);
-				}
-			dirty=false;
-		}
-		
-		return;
+inline void CompressedBlock::decompress(const size_t &number_of_words){
+	words.assign(number_of_words,0);
+	if (compressed.empty()) return;
+	uLongf bytes=number_of_words*sizeof(uint64_t);
+	const int r=uncompress(reinterpret_cast<Bytef*>(&words[0]),&bytes,reinterpret_cast<const Bytef*>(&compressed[0]),compressed.size());
+	if (r!=Z_OK || bytes!=number_of_words*sizeof(uint64_t)) {
+		cerr << "Error: can't decompress a block of a compressed bit array, zlib error: "<<r<<endl;
+		exit(1);
 	}
-	
-	size_t * getData(){
-		if (uncompressed_data!=NULL)
-			return static_cast<size_t*> (uncompressed_data);
-		cerr <<"ERROR NO uncompressed data";
-		return NULL;
+}
+
+inline void CompressedBlock::writeBack(const int &level){
+	if (!dirty) return;
+	const uLong bytes=words.size()*sizeof(uint64_t);
+	uLongf compressed_bytes=compressBound(bytes);
+	std::vector<char> out(compressed_bytes);
+	const int r=compress2(reinterpret_cast<Bytef*>(&out[0]),&compressed_bytes,reinterpret_cast<const Bytef*>(&words[0]),bytes,level);
+	if (r!=Z_OK) {
+		cerr << "Error: can't compress a block of a compressed bit array, zlib error: "<<r<<endl;
+		exit(1);
 	}
-	
-}; 
-
-
+	std::vector<char>(out.begin(),out.begin()+compressed_bytes).swap(compressed);
+	dirty=false;
+}
+
+inline void CompressedBlock::evict(const int &level){
+	writeBack(level);
+	std::vector<uint64_t>().swap(words);
+}
+
+
+//A bit array, or an array of packed ints with set_range and get_range, that is kept zlib compressed in blocks of
+//block_bytes, with at most cache_blocks of them decompressed at once.  The block that is needed is decompressed
+//into the cache, and when the cache is full the block that was used longest ago is compressed again (if it has been
+//written) and freed.  So it takes little more than its compressed size as long as it is read and written a few
+//blocks at a time, such as in order, but every access that misses the cache decompresses a block.
+//Every access locks the array so it can be used from several threads.  A thread can also pin a block, which keeps
+//it in the cache and gives its words to be used without the lock until it is unpinned.  The cache grows past
+//cache_blocks while every block in it is pinned.
 class ShefCompressedBitArray {
+public:
+	explicit ShefCompressedBitArray(const uint64_t &number_of_bits, const size_t &cache_blocks=64, const size_t &block_bytes=(1<<16), const int &level=Z_BEST_SPEED);
+	~ShefCompressedBitArray();
+
+	ShefCompressedBitArray& set(const uint64_t &pos, const bool &val);
+	bool test(const uint64_t &pos) const;
+	//the length bit int at index start (so at bit start*length), length is at most 64
+	ShefCompressedBitArray& set_range(const uint64_t &value, const uint64_t &start, const unsigned &length);
+	uint64_t get_range(const uint64_t &start, const unsigned &length) const;
+	uint64_t size() const {return number_of_bits;}
+
+	uint64_t wordsPerBlock() const {return words_per_block;}
+	uint64_t numberOfBlocks() const {return blocks.size();}
+	//Keeps block in the cache and returns its words, which can be read and written without locking the array
+	//until it is unpinned (threads that share a block have to keep apart themselves).  Give dirty to unpin if
+	//any of them were written, so they are compressed again.  A block can be pinned more than once.
+	uint64_t * pin(const uint64_t &block);
+	void unpin(const uint64_t &block, const bool &dirty);
+	//compresses the blocks in the cache that have been written and frees the ones that are not pinned
+	void flush();
+	MemoryUsage memory_usage() const;
+
 private:
-	CompressedBlock** pointerArr;
-	size_t words_per_block;
-	int open_block;
 	ShefCompressedBitArray(const ShefCompressedBitArray&); //disallow copy
 	void operator=(const ShefCompressedBitArray&); //disallow assignment
-public:
-	explicit ShefCompressedBitArray(const size_t & size,const size_t & num_blocks=1024){
-		const size_t total_words=size/bits_per_word + (size%bits_per_word?1:0);
-		words_per_block= total_words/num_blocks +(total_words%num_blocks?1:0);
-		
-		cerr << "total size " << size <<endl;
-		cerr << "total blocks " << num_blocks <<endl;
-		cerr << "total_words " << total_words <<endl;
-		cerr << "total words_per_block " << words_per_block <<endl;
-		open_block=-1;
-		pointerArr=new CompressedBlock*[num_blocks];
-		for (size_t i=0; i<num_blocks; ++i) {
-			pointerArr[i]=new CompressedBlock(words_per_block*bits_per_word/8);
-		}
-		
-	}
-	ShefCompressedBitArray(){
-		delete[] pointerArr;
-	}
-	ShefCompressedBitArray& set(const size_t & pos, const bool &val)
-	{	
-		openCorrectBlock(pos);
-		size_t * m_bits=pointerArr[open_block]->getData();
-		//cerr << "SETTING pos:"<<pos<<" with value:"<<val<<endl;
-		//cerr << "Accessing word:"<<word_index(pos)%words_per_block<<endl;
-		//cerr << "USING BITMASK:"<<hex<<bit_mask(pos)<<dec<<endl;
-		if (val)
-			m_bits[word_index(pos)%words_per_block] |= bit_mask(pos);
-		else
-			m_bits[word_index(pos)%words_per_block] &= ~bit_mask(pos);
-		
-		pointerArr[open_block]->setDirty();
-		return *this;
+
+	//the word at index, with the array locked
+	uint64_t & word(const uint64_t &index, const bool &dirty) const;
+	uint64_t * cachedWords(const uint64_t &block) const;
+	bool evictOne() const;
+
+	const uint64_t number_of_bits;
+	uint64_t words_per_block;
+	const size_t cache_blocks;
+	const int level;
+	mutable std::vector<CompressedBlock> blocks;
+	mutable std::vector<uint64_t> cached;	//the blocks that are decompressed
+	mutable uint64_t clock;
+	mutable pthread_mutex_t mutex;
+};
+
+
+inline ShefCompressedBitArray::ShefCompressedBitArray(const uint64_t &numberOfBits, const size_t &cacheBlocks, const size_t &block_bytes, const int &compressionLevel)
+:number_of_bits(numberOfBits),words_per_block(std::max<size_t>(1,block_bytes/sizeof(uint64_t))),cache_blocks(std::max<size_t>(1,cacheBlocks)),level(compressionLevel),clock(0){
+	const uint64_t words=number_of_bits/64+(number_of_bits%64?1:0);
+	blocks.resize(words/words_per_block+(words%words_per_block?1:0));
+	pthread_mutex_init(&mutex,NULL);
+}
+
+inline ShefCompressedBitArray::~ShefCompressedBitArray(){
+	pthread_mutex_destroy(&mutex);
+}
+
+inline uint64_t * ShefCompressedBitArray::cachedWords(const uint64_t &block) const{
+	CompressedBlock &b=blocks[block];
+	b.last_used=++clock;
+	if (!b.cached()) {
+		while (cached.size()>=cache_blocks && evictOne()) ;
+		b.decompress(words_per_block);
+		cached.push_back(block);
 	}
-	
-	bool test(const size_t & pos)
-	{
-		openCorrectBlock(pos);
-		size_t * m_bits=pointerArr[open_block]->getData();
-		//cerr << "GETTING pos:"<<pos<<" with value:"<<((m_bits[word_index(pos)%words_per_block] & bit_mask(pos)) != 0)<<endl;
-		//cerr << "Accessing word:"<<word_index(pos)%words_per_block<<endl;
-		//cerr << "USING BITMASK:"<<hex<<bit_mask(pos)<<dec<<endl;
-		return ((m_bits[word_index(pos)%words_per_block] & bit_mask(pos)) != 0);
+	return &b.words[0];
+}
+
+//evicts the block in the cache that was used longest ago and is not pinned, false if they all are
+inline bool ShefCompressedBitArray::evictOne() const{
+	size_t oldest=cached.size();
+	for (size_t i=0; i<cached.size(); ++i) {
+		const CompressedBlock &b=blocks[cached[i]];
+		if (!b.pins && (oldest==cached.size() || b.last_used<blocks[cached[oldest]].last_used)) oldest=i;
 	}
-	
-private:
-	void openCorrectBlock(const size_t &pos){
-		size_t block_index = pos/bits_per_word/words_per_block;
-		if (block_index!=static_cast<size_t>(open_block) && (open_block != -1)){
-			pointerArr[open_block]->compress();
-		}
-		open_block=block_index;
-		//cerr <<"Accessing block:"<<block_index<<endl;
-		pointerArr[open_block]->decompress();
+	if (oldest==cached.size()) return false;
+	blocks[cached[oldest]].evict(level);
+	cached[oldest]=cached.back();
+	cached.pop_back();
+	return true;
+}
+
+inline uint64_t & ShefCompressedBitArray::word(const uint64_t &index, const bool &dirty) const{
+	const uint64_t block=index/words_per_block;
+	uint64_t *words=cachedWords(block);
+	if (dirty) blocks[block].dirty=true;
+	return words[index%words_per_block];
+}
+
+inline ShefCompressedBitArray& ShefCompressedBitArray::set(const uint64_t &pos, const bool &val){
+	pthread_mutex_lock(&mutex);
+	uint64_t &w=word(pos/64,true);
+	if (val) w|=uint64_t(1)<<(pos%64);
+	else w&=~(uint64_t(1)<<(pos%64));
+	pthread_mutex_unlock(&mutex);
+	return *this;
+}
+
+inline bool ShefCompressedBitArray::test(const uint64_t &pos) const{
+	pthread_mutex_lock(&mutex);
+	const bool val=(word(pos/64,false)>>(pos%64))&1;
+	pthread_mutex_unlock(&mutex);
+	return val;
+}
+
+inline ShefCompressedBitArray& ShefCompressedBitArray::set_range(const uint64_t &value, const uint64_t &start, const unsigned &length){
+	const uint64_t pos=start*length;
+	const unsigned shift=pos%64;
+	const uint64_t mask=length>=64?~uint64_t(0):(uint64_t(1)<<length)-1;
+	pthread_mutex_lock(&mutex);
+	uint64_t &low=word(pos/64,true);
+	low=(low&~(mask<<shift))|((value&mask)<<shift);
+	//the int goes over into the next word, which can be in the next block
+	if (shift+length>64) {
+		uint64_t &high=word(pos/64+1,true);
+		const uint64_t high_mask=(uint64_t(1)<<(shift+length-64))-1;
+		high=(high&~high_mask)|((value&mask)>>(64-shift));
 	}
-};
+	pthread_mutex_unlock(&mutex);
+	return *this;
+}
+
+inline uint64_t ShefCompressedBitArray::get_range(const uint64_t &start, const unsigned &length) const{
+	const uint64_t pos=start*length;
+	const unsigned shift=pos%64;
+	const uint64_t mask=length>=64?~uint64_t(0):(uint64_t(1)<<length)-1;
+	pthread_mutex_lock(&mutex);
+	uint64_t value=word(pos/64,false)>>shift;
+	if (shift+length>64) value|=word(pos/64+1,false)<<(64-shift);
+	pthread_mutex_unlock(&mutex);
+	return value&mask;
+}
+
+inline uint64_t * ShefCompressedBitArray::pin(const uint64_t &block){
+	pthread_mutex_lock(&mutex);
+	uint64_t *words=cachedWords(block);
+	++blocks[block].pins;
+	pthread_mutex_unlock(&mutex);
+	return words;
+}
+
+inline void ShefCompressedBitArray::unpin(const uint64_t &block, const bool &dirty){
+	pthread_mutex_lock(&mutex);
+	CompressedBlock &b=blocks[block];
+	if (b.pins) --b.pins;
+	if (dirty) b.dirty=true;
+	//the cache may have grown while everything in it was pinned
+	while (cached.size()>cache_blocks && evictOne()) ;
+	pthread_mutex_unlock(&mutex);
+}
+
+inline void ShefCompressedBitArray::flush(){
+	pthread_mutex_lock(&mutex);
+	for (size_t i=0; i<cached.size(); ++i) blocks[cached[i]].writeBack(level);
+	while (evictOne()) ;
+	pthread_mutex_unlock(&mutex);
+}
+
+inline MemoryUsage ShefCompressedBitArray::memory_usage() const{
+	uint64_t compressed_bytes=0;
+	pthread_mutex_lock(&mutex);
+	for (size_t i=0; i<blocks.size(); ++i) compressed_bytes+=vector_bytes(blocks[i].compressed);
+	const uint64_t cache_bytes=cached.size()*words_per_block*sizeof(uint64_t);
+	pthread_mutex_unlock(&mutex);
+	MemoryUsage usage;
+	usage.add("blocks",compressed_bytes+blocks.size()*sizeof(CompressedBlock));
+	usage.add("cache",cache_bytes);
+	return usage;
+}
 
 #endif
 
@@ -0,0 +1,428 @@
+/*
+ *  SlotRankSorter.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//The ranks of the ngrams arrive in file order but the value stores have to be built in hash (slot) order.
+//Instead of holding every rank in a bits_per_rank*N bit array we write (slot,rank) pairs to sorted
+//runs on disk and merge them back in slot order.  The merged stream looks like a read once array
+//so it can be handed straight to the value store constructors (they all read value_array[i] for i=0..N-1).
+//With compressed_runs the runs are kept in memory instead, in ShefCompressedBitArrays of the gaps between their slots
+//and of their ranks, for machines with no disk to spare.  A run is written and read in order so each of them only
+//needs a block or two decompressed at once.
+//A slot that was added more than once (the same ngram twice in the file) keeps its smallest rank.  finish() merges the
+//runs once to count the ranks the way the stream will give them, so the value stores can be sized before reading it.
+
+#ifndef SLOT_RANK_SORTER_H
+#define SLOT_RANK_SORTER_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <queue>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <stdint.h>
+#include <unistd.h>
+#include <boost/shared_ptr.hpp>
+
+#include "ShefBitArray.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+
+
+class SlotRankSorter{
+	typedef std::pair<uint64_t,uint64_t> slot_rank;
+	typedef std::pair<slot_rank,size_t> heap_entry; //the pair and the run it came from
+public:
+	explicit SlotRankSorter(const uint64_t &number_of_slots, const string &run_file_prefix="", const size_t &pairs_per_run=(1<<23), const bool &compressed_runs=false);
+	~SlotRankSorter();
+
+	void add(const uint64_t &slot, const uint64_t &rank);
+	//one_run merges the runs on disk into one, for sorters that are read one after the other (see ShardRankStream)
+	//so only one of their files is open at a time
+	void finish(const bool &one_run=false);
+
+	//Sequential access only.  Slots must be read once in increasing order starting at 0 (after finish has been called).
+	//Slots that were never added have a rank of 0.
+	uint64_t operator[](const uint64_t &slot) const;
+	uint64_t size() const {return number_of_slots;}
+	uint64_t number_of_runs() const {return compressed ? memory_runs.size() : runs.size();}
+	//rank_counts()[r] is the number of slots operator[] gives rank r (empty slots are counted as rank 0), after finish.
+	//This lets the value stores size their structures before the one pass over the merged runs.
+	std::vector<uint64_t> rank_counts() const;
+
+private:
+	SlotRankSorter(const SlotRankSorter&); //disallow copying
+	void operator=(const SlotRankSorter&); //disallow assignment
+
+	FILE *newRunFile() const;
+	void writeRun();
+	void writeMemoryRun();
+	void mergeRuns();
+	bool readPair(const size_t &run, slot_rank &p) const;
+	bool nextPair(slot_rank &p) const;
+	//puts every run back at its start and the first pair of each on the heap
+	void startMerge();
+	//counts the ranks of the merged pairs, keeping the first pair of each slot as operator[] does
+	void countRanks();
+
+	uint64_t number_of_slots;
+	string prefix;
+	size_t max_pairs_in_memory;
+	bool compressed;
+	bool finished;
+
+	std::vector<slot_rank> buffer;
+	std::vector<FILE *> runs;
+	struct MemoryRun {
+		boost::shared_ptr<ShefCompressedBitArray> gaps;	//between the slots, the first from 0
+		boost::shared_ptr<ShefCompressedBitArray> ranks;
+		unsigned gap_bits;
+		unsigned rank_bits;
+		uint64_t size;
+		uint64_t next;	//the next pair readPair returns
+		uint64_t slot;	//the slot of the last pair read
+	};
+	mutable std::vector<MemoryRun> memory_runs;
+	std::vector<uint64_t> counts;
+	uint64_t slots_added;	//the slots that were added at least once
+	bool counted;	//the memory runs are freed as they are merged once the ranks have been counted
+
+	//merge state
+	mutable std::priority_queue<heap_entry, std::vector<heap_entry>, std::greater<heap_entry> > heap;
+	mutable size_t buffer_pos;
+	mutable slot_rank current;
+	mutable bool have_current;
+	mutable uint64_t next_slot;
+	mutable uint64_t duplicate_slots;
+};
+
+
+
+inline SlotRankSorter::SlotRankSorter(const uint64_t &number_of_slots, const string &run_file_prefix, const size_t &pairs_per_run, const bool &compressed_runs)
+	:number_of_slots(number_of_slots),
+	prefix(run_file_prefix),
+	max_pairs_in_memory(pairs_per_run),
+	compressed(compressed_runs),
+	finished(false),
+	slots_added(0),
+	counted(false),
+	buffer_pos(0),
+	have_current(false),
+	next_slot(0),
+	duplicate_slots(0)
+{
+	if (prefix.empty()){
+		const char * tmpdir=getenv("TMPDIR");
+		prefix=string(tmpdir?tmpdir:"/tmp")+"/shefLM";
+	}
+	buffer.reserve(std::min<uint64_t>(max_pairs_in_memory,number_of_slots));
+}
+
+inline SlotRankSorter::~SlotRankSorter(){
+	for (size_t i=0; i<runs.size(); ++i) fclose(runs[i]);
+}
+
+inline void SlotRankSorter::add(const uint64_t &slot, const uint64_t &rank){
+	if (slot>=number_of_slots){
+		cerr << "Error: slot "<<slot<<" is outside of the "<<number_of_slots<<" slots in the rank sorter"<<endl;
+		exit(1);
+	}
+	buffer.push_back(std::make_pair(slot,rank));
+	if (buffer.size()>=max_pairs_in_memory) writeRun();
+}
+
+//sort the pairs held in memory and write them to an unlinked temporary file
+inline void SlotRankSorter::writeRun(){
+	std::sort(buffer.begin(),buffer.end());
+	if (compressed) {
+		writeMemoryRun();
+		return;
+	}
+	FILE * run=newRunFile();
+	if (fwrite(&buffer[0],sizeof(slot_rank),buffer.size(),run)!=buffer.size()){
+		cerr << "Error: unable to write temporary rank run file (is the disk full?)"<<endl;
+		exit(1);
+	}
+	runs.push_back(run);
+	cerr << "Wrote sorted rank run "<<runs.size()<<" with "<<buffer.size()<<" entries"<<endl;
+	buffer.clear();
+}
+
+//an unlinked temporary file
+inline FILE *SlotRankSorter::newRunFile() const{
+	string fn=prefix+".rankrun.XXXXXX";
+	std::vector<char> name(fn.begin(),fn.end());
+	name.push_back('\0');
+	int fd=mkstemp(&name[0]);
+	if (fd==-1){
+		cerr << "Error: unable to create temporary rank run file: "<<&name[0]<<endl;
+		exit(1);
+	}
+	unlink(&name[0]); //the file is removed as soon as we close it
+	FILE * run=fdopen(fd,"w+b");
+	setvbuf(run,NULL,_IOFBF,1<<20); //large buffers keep the merge sequential when there are many runs
+	return run;
+}
+
+inline void SlotRankSorter::mergeRuns(){
+	FILE * merged=newRunFile();
+	startMerge();
+	slot_rank p;
+	while (nextPair(p)) {
+		if (fwrite(&p,sizeof(slot_rank),1,merged)!=1){
+			cerr << "Error: unable to write temporary rank run file (is the disk full?)"<<endl;
+			exit(1);
+		}
+	}
+	for (size_t i=0; i<runs.size(); ++i) fclose(runs[i]);
+	runs.assign(1,merged);
+}
+
+//the bits a packed int needs to hold value
+inline unsigned bits_to_hold(uint64_t value){
+	unsigned bits=1;
+	while (value>>=1) ++bits;
+	return bits;
+}
+
+//the sorted pairs as packed gaps and ranks, which compress well as the slots are close together
+inline void SlotRankSorter::writeMemoryRun(){
+	MemoryRun run;
+	uint64_t max_gap=0;
+	uint64_t max_rank=0;
+	uint64_t slot=0;
+	for (size_t i=0; i<buffer.size(); ++i) {
+		max_gap=std::max(max_gap,buffer[i].first-slot);
+		max_rank=std::max(max_rank,buffer[i].second);
+		slot=buffer[i].first;
+	}
+	run.gap_bits=bits_to_hold(max_gap);
+	run.rank_bits=bits_to_hold(max_rank);
+	run.size=buffer.size();
+	run.next=0;
+	run.slot=0;
+	run.gaps.reset(new ShefCompressedBitArray(run.size*run.gap_bits,2));
+	run.ranks.reset(new ShefCompressedBitArray(run.size*run.rank_bits,2));
+	slot=0;
+	for (size_t i=0; i<buffer.size(); ++i) {
+		run.gaps->set_range(buffer[i].first-slot,i,run.gap_bits);
+		run.ranks->set_range(buffer[i].second,i,run.rank_bits);
+		slot=buffer[i].first;
+	}
+	run.gaps->flush();
+	run.ranks->flush();
+	memory_runs.push_back(run);
+	cerr << "Compressed sorted rank run "<<memory_runs.size()<<" with "<<buffer.size()<<" entries into "<<run.gaps->memory_usage().bytes()+run.ranks->memory_usage().bytes()<<" bytes"<<endl;
+	buffer.clear();
+}
+
+inline void SlotRankSorter::finish(const bool &one_run){
+	if (finished) return;
+	finished=true;
+	if (number_of_runs()==0){
+		//everything fit in memory so there is nothing to merge
+		std::sort(buffer.begin(),buffer.end());
+		countRanks();
+		buffer_pos=0;
+		return;
+	}
+	if (!buffer.empty()) writeRun();
+	std::vector<slot_rank>().swap(buffer); //free the buffer before the merge
+	if (one_run && !compressed && runs.size()>1) mergeRuns();
+	startMerge();
+	countRanks();
+	startMerge();
+	cerr << "Merging "<<number_of_runs()<<" sorted rank runs"<<endl;
+}
+
+inline void SlotRankSorter::startMerge(){
+	heap=std::priority_queue<heap_entry, std::vector<heap_entry>, std::greater<heap_entry> >();
+	for (size_t i=0; i<number_of_runs(); ++i) {
+		if (compressed) memory_runs[i].next=memory_runs[i].slot=0;
+		else rewind(runs[i]);
+		slot_rank p;
+		if (readPair(i,p)) heap.push(std::make_pair(p,i));
+	}
+}
+
+inline void SlotRankSorter::countRanks(){
+	counts.assign(1,0);
+	slots_added=0;
+	slot_rank p;
+	bool first=true;
+	uint64_t last_slot=0;
+	while (nextPair(p)) {
+		if (!first && p.first==last_slot) continue;
+		first=false;
+		last_slot=p.first;
+		if (p.second>=counts.size()) counts.resize(p.second+1,0);
+		++counts[p.second];
+		++slots_added;
+	}
+	counted=true;
+}
+
+inline std::vector<uint64_t> SlotRankSorter::rank_counts() const{
+	if (!counted){
+		cerr << "Error: the rank counts are only known once the rank sorter has been finished"<<endl;
+		exit(1);
+	}
+	std::vector<uint64_t> c(counts);
+	c[0]+=number_of_slots-slots_added;
+	return c;
+}
+
+inline bool SlotRankSorter::readPair(const size_t &run, slot_rank &p) const{
+	if (compressed) {
+		MemoryRun &r=memory_runs[run];
+		if (r.next==r.size) {
+			//the run has been merged, it is read twice: once to count the ranks and once for operator[]
+			if (counted) {
+				r.gaps.reset();
+				r.ranks.reset();
+			}
+			return false;
+		}
+		r.slot+=r.gaps->get_range(r.next,r.gap_bits);
+		p=std::make_pair(r.slot,r.ranks->get_range(r.next,r.rank_bits));
+		++r.next;
+		return true;
+	}
+	return fread(&p,sizeof(slot_rank),1,runs[run])==1;
+}
+
+inline bool SlotRankSorter::nextPair(slot_rank &p) const{
+	if (number_of_runs()==0){
+		if (buffer_pos>=buffer.size()) return false;
+		p=buffer[buffer_pos++];
+		return true;
+	}
+	if (heap.empty()) return false;
+	heap_entry top=heap.top();
+	heap.pop();
+	p=top.first;
+	slot_rank n;
+	if (readPair(top.second,n)) heap.push(std::make_pair(n,top.second));
+	return true;
+}
+
+inline uint64_t SlotRankSorter::operator[](const uint64_t &slot) const{
+	if (!finished || slot!=next_slot){
+		cerr << "Error: the rank sorter can only be read once in slot order"<<endl;
+		exit(1);
+	}
+	++next_slot;
+	while (true) {
+		if (!have_current) {
+			have_current=nextPair(current);
+			if (!have_current) break;
+		}
+		if (current.first>=slot) break;
+		//this slot has already been returned so the same ngram must have appeared twice in the file
+		++duplicate_slots;
+		have_current=false;
+	}
+	uint64_t rank=0;
+	if (have_current && current.first==slot){
+		rank=current.second;
+		have_current=false;
+	}
+	if (next_slot==number_of_slots && duplicate_slots) cerr << "Warning: "<<duplicate_slots<<" ngrams hashed to a slot that was already used.  Only one of them was stored"<<endl;
+	return rank;
+}
+
+
+//The ranks of the shards of a sharded MPHR, a SlotRankSorter each, read as one stream over the slots of all of them.
+//The ranks index a table of values that can have values no key has (such as the values of the stores a merged store
+//is built from), so they are numbered again without those and values() is the table that is left.
+class ShardRankStream{
+public:
+	//every sorter must have been finished, and all_values has a value for every rank added to them
+	ShardRankStream(const std::vector<boost::shared_ptr<SlotRankSorter> > &shard_ranks, const std::vector<uint64_t> &all_values);
+
+	//Sequential access only, as for SlotRankSorter
+	uint64_t operator[](const uint64_t &slot) const;
+	uint64_t size() const {return number_of_slots;}
+	const std::vector<uint64_t> & rank_counts() const {return counts;}
+	boost::shared_ptr<std::vector<uint64_t> > values() const {return kept_values;}
+
+private:
+	ShardRankStream(const ShardRankStream&); //disallow copying
+	void operator=(const ShardRankStream&); //disallow assignment
+
+	const std::vector<boost::shared_ptr<SlotRankSorter> > &shards;
+	std::vector<uint64_t> new_rank;	//of every rank that is used
+	std::vector<uint64_t> counts;
+	boost::shared_ptr<std::vector<uint64_t> > kept_values;
+	uint64_t number_of_slots;
+	mutable size_t shard;
+	mutable uint64_t first_slot;	//of shard
+};
+
+inline ShardRankStream::ShardRankStream(const std::vector<boost::shared_ptr<SlotRankSorter> > &shard_ranks, const std::vector<uint64_t> &all_values)
+	:shards(shard_ranks),
+	kept_values(new std::vector<uint64_t>()),
+	number_of_slots(0),
+	shard(0),
+	first_slot(0)
+{
+	std::vector<uint64_t> all_counts;
+	for (size_t i=0; i<shards.size(); ++i) {
+		const std::vector<uint64_t> c=shards[i]->rank_counts();
+		if (c.size()>all_counts.size()) all_counts.resize(c.size(),0);
+		for (size_t r=0; r<c.size(); ++r) all_counts[r]+=c[r];
+		number_of_slots+=shards[i]->size();
+	}
+	if (all_counts.size()>all_values.size()) {
+		cerr << "Error: a shard has a rank with no value"<<endl;
+		exit(1);
+	}
+	new_rank.assign(all_counts.size(),0);
+	for (size_t r=0; r<all_counts.size(); ++r) {
+		if (!all_counts[r]) continue;
+		new_rank[r]=counts.size();
+		counts.push_back(all_counts[r]);
+		kept_values->push_back(all_values[r]);
+	}
+	if (counts.empty()) counts.push_back(0);
+}
+
+inline uint64_t ShardRankStream::operator[](const uint64_t &slot) const{
+	while (shard<shards.size() && slot>=first_slot+shards[shard]->size()) first_slot+=shards[shard++]->size();
+	if (shard==shards.size()){
+		cerr << "Error: slot "<<slot<<" is outside of the "<<number_of_slots<<" slots of the shards"<<endl;
+		exit(1);
+	}
+	return new_rank[(*shards[shard])[slot-first_slot]];
+}
+
+
+
+#endif
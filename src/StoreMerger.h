@@ -0,0 +1,267 @@
+/*
+ *  StoreMerger.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Merges several stores and the key files they were built from into the shards of keys the merged store is built from
+//(see the sharded MPHR constructor) and the merged key file, with the counts of the keys that are in more than one of
+//them summed, without sorting or hashing the keys of all of them together.
+//Every key file is read once by its own thread, which asks the stores of the other files whether they have each key.
+//A store always has the keys it was built from, so a key none of the others has is only in its own file.  It is
+//written to the file of its shard and to a temporary file that is still sorted by value.  The few keys that another
+//store says it has (the shared ones and the fingerprint false positives) are sorted by key in temporary files and
+//summed, and the sums go to the files of their shards and are sorted by value.  The merged key file is the keys no
+//other store has merged by value with the sums (see KeyFileMerge.h), which a thread writes while the store is built
+//from the shards.  So only a run of keys being sorted is held in memory, and the values of the merged store are
+//those of the value arrays of the stores and the sums.
+
+#ifndef STORE_MERGER_H
+#define STORE_MERGER_H
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <iostream>
+#include <stdint.h>
+#include <pthread.h>
+#include <boost/shared_ptr.hpp>
+
+#include "MPHR.h"
+#include "ShardedHash.h"
+#include "KeyFileMerge.h"
+#include "BuildProfiler.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+
+
+class StoreMerger {
+public:
+	//the most memory the keys being sorted into a run by each thread take
+	static const size_t SPILL_RUN_BYTES=1<<26;
+	//the buffer of each file of a shard, there is one for every shard of every store
+	static const size_t SHARD_BUFFER_BYTES=1<<16;
+	//stores with fewer keys than this for every shard are merged into fewer shards, so a shard is worth a thread
+	static const uint64_t MIN_SHARD_KEYS=1<<16;
+
+	//stores[i] must have been built from keyFileNames[i], the temporary files are made in directory
+	StoreMerger(const std::vector<boost::shared_ptr<MPHR> > &stores, const std::vector<string> &keyFileNames, const unsigned &shards, const string &directory);
+	//reads the key files into the shards, after which the stores are no longer needed
+	void split();
+	//the files of every shard and every value the merged store can have, in increasing order, once split() has been called
+	const std::vector<std::vector<boost::shared_ptr<SpillFile> > > & shardKeys() const {return shard_keys;}
+	const std::vector<uint64_t> & values() const {return merged_values;}
+	//starts a thread that writes the merged key file, once split() has been called
+	void startKeyFile(const string &outFileName);
+	//waits for it and returns the number of keys in it
+	uint64_t finishKeyFile();
+	//the number of keys whose counts were added to those of the same key in another store, once split() has been called
+	uint64_t sharedKeys() const {return shared_keys;}
+
+private:
+	StoreMerger(const StoreMerger&); //disallow copy
+	void operator=(const StoreMerger&); //disallow assignment
+
+	struct Input {
+		StoreMerger *merger;
+		size_t index;
+		boost::shared_ptr<SpillFile> kept;	//the keys of this file no other store has, in the order of the file
+		boost::shared_ptr<SpillSorter> candidates;	//the keys of this file that another store says it has, by key
+		uint64_t keys;
+	};
+	static void *findCandidatesThread(void *input){
+		Input &in=*static_cast<Input*>(input);
+		in.merger->findCandidates(in);
+		return NULL;
+	}
+	void findCandidates(Input &input) const;
+	//sums the counts of the same key in the runs, which are sorted by key, and adds the sums to summed and to their shards
+	void sumCandidates(const std::vector<boost::shared_ptr<SpillFile> > &runs, SpillSorter &summed, std::set<uint64_t> &sums);
+	static void *writeKeyFileThread(void *merger){
+		StoreMerger &m=*static_cast<StoreMerger*>(merger);
+		m.merged_keys=m.writeKeyFile();
+		return NULL;
+	}
+	uint64_t writeKeyFile();
+	//the file of shard of the keys of input (the sums are the input after the last store)
+	SpillFile & shardFile(const string &key, const size_t &input) const {
+		return *shard_keys[ShardedHash::shardOf(key.data(),key.length(),shard_keys.size())][input];
+	}
+
+	const std::vector<boost::shared_ptr<MPHR> > &stores;
+	const std::vector<string> &key_files;
+	const string directory;
+	std::vector<std::vector<boost::shared_ptr<SpillFile> > > shard_keys;
+	std::vector<uint64_t> merged_values;
+	std::vector<boost::shared_ptr<SpillFile> > kept;
+	boost::shared_ptr<SpillSorter> summed;
+	string out_file_name;
+	pthread_t writer;
+	uint64_t merged_keys;
+	uint64_t shared_keys;
+};
+
+
+inline StoreMerger::StoreMerger(const std::vector<boost::shared_ptr<MPHR> > &storesToMerge, const std::vector<string> &keyFileNames, const unsigned &shards, const string &temporaryDirectory)
+:stores(storesToMerge),key_files(keyFileNames),directory(temporaryDirectory),shard_keys(std::max(shards,1u)),merged_keys(0),shared_keys(0){
+	if (stores.size()!=key_files.size()) {
+		cerr << "Error: every store to merge needs the key file it was built from"<<endl;
+		exit(1);
+	}
+	for (size_t i=0; i<shard_keys.size(); ++i) {
+		for (size_t j=0; j<=stores.size(); ++j) shard_keys[i].push_back(boost::shared_ptr<SpillFile>(new SpillFile(directory,size_t(SHARD_BUFFER_BYTES))));
+	}
+}
+
+inline void StoreMerger::findCandidates(Input &input) const{
+	KeyFileReader reader(key_files[input.index]);
+	uint64_t value;
+	while (reader.next()) {
+		++input.keys;
+		bool candidate=false;
+		for (size_t j=0; j<stores.size() && !candidate; ++j) {
+			candidate=j!=input.index && stores[j]->lookup(reader.key(),value);
+		}
+		if (candidate) input.candidates->add(reader.key(),reader.value());
+		else {
+			input.kept->add(reader.key(),reader.value());
+			shardFile(reader.key(),input.index).add(reader.key(),reader.value());
+		}
+	}
+	input.kept->rewind();
+	input.candidates->finish();
+}
+
+inline void StoreMerger::sumCandidates(const std::vector<boost::shared_ptr<SpillFile> > &runs, SpillSorter &summed, std::set<uint64_t> &sums){
+	std::vector<bool> more;
+	for (size_t i=0; i<runs.size(); ++i) more.push_back(runs[i]->next());
+	string key;
+	while (true) {
+		size_t smallest=runs.size();
+		for (size_t i=0; i<runs.size(); ++i) {
+			if (more[i] && (smallest==runs.size() || runs[i]->key()<runs[smallest]->key())) smallest=i;
+		}
+		if (smallest==runs.size()) break;
+		//a key is only once in a key file, so every run after the first that has it is another store that has it
+		key=runs[smallest]->key();
+		uint64_t value=0;
+		uint64_t files=0;
+		for (size_t i=0; i<runs.size(); ++i) {
+			while (more[i] && runs[i]->key()==key) {
+				value+=runs[i]->value();
+				++files;
+				more[i]=runs[i]->next();
+			}
+		}
+		shared_keys+=files-1;
+		summed.add(key,value);
+		shardFile(key,stores.size()).add(key,value);
+		if (files>1) sums.insert(value);
+	}
+}
+
+inline void StoreMerger::split(){
+	//1. the keys of every file split into those no other store has and those that might be in another one, with a thread for every file
+	std::vector<Input> inputs(stores.size());
+	{
+		BuildPhase phase("find_shared_keys");
+		std::vector<pthread_t> threads(inputs.size());
+		for (size_t i=0; i<inputs.size(); ++i) {
+			inputs[i].merger=this;
+			inputs[i].index=i;
+			inputs[i].kept.reset(new SpillFile(directory));
+			inputs[i].candidates.reset(new SpillSorter(directory,smaller_key,SPILL_RUN_BYTES));
+			inputs[i].keys=0;
+			if (pthread_create(&threads[i],NULL,findCandidatesThread,&inputs[i])!=0) {
+				cerr << "Error: can't start the threads that read the key files"<<endl;
+				exit(1);
+			}
+		}
+		uint64_t keys=0;
+		for (size_t i=0; i<inputs.size(); ++i) {
+			pthread_join(threads[i],NULL);
+			if (inputs[i].keys!=stores[i]->size()) {
+				cerr << "Error: the key file "<<key_files[i]<<" has "<<inputs[i].keys<<" keys but its store has "<<stores[i]->size()<<", so the store was not built from it"<<endl;
+				exit(1);
+			}
+			keys+=inputs[i].keys;
+			kept.push_back(inputs[i].kept);
+		}
+		phase.keys(keys);
+	}
+
+	//2. the candidates summed over the files, a key that turns out to be in only one file keeps its value
+	summed.reset(new SpillSorter(directory,smaller_value,SPILL_RUN_BYTES));
+	std::set<uint64_t> sums;
+	{
+		BuildPhase phase("sum_shared_keys");
+		std::vector<boost::shared_ptr<SpillFile> > runs;
+		uint64_t candidates=0;
+		for (size_t i=0; i<inputs.size(); ++i) {
+			const std::vector<boost::shared_ptr<SpillFile> > &input_runs=inputs[i].candidates->finish();
+			for (size_t j=0; j<input_runs.size(); ++j) candidates+=input_runs[j]->size();
+			runs.insert(runs.end(),input_runs.begin(),input_runs.end());
+			inputs[i].candidates.reset();
+		}
+		sumCandidates(runs,*summed,sums);
+		phase.keys(candidates);
+	}
+
+	//the values of the stores are the counts of their keys, so with the sums they are every count of the merged keys
+	merged_values.assign(sums.begin(),sums.end());
+	for (size_t i=0; i<stores.size(); ++i) {
+		const std::vector<uint64_t> &store_values=stores[i]->fingerPrintValueStore().values();
+		merged_values.insert(merged_values.end(),store_values.begin(),store_values.end());
+	}
+	std::sort(merged_values.begin(),merged_values.end());
+	merged_values.erase(std::unique(merged_values.begin(),merged_values.end()),merged_values.end());
+	for (size_t i=0; i<shard_keys.size(); ++i) {
+		for (size_t j=0; j<shard_keys[i].size(); ++j) shard_keys[i][j]->rewind();
+	}
+}
+
+inline void StoreMerger::startKeyFile(const string &outFileName){
+	out_file_name=outFileName;
+	if (pthread_create(&writer,NULL,writeKeyFileThread,this)!=0) {
+		cerr << "Error: can't start the thread that writes the merged key file"<<endl;
+		exit(1);
+	}
+}
+
+inline uint64_t StoreMerger::finishKeyFile(){
+	pthread_join(writer,NULL);
+	return merged_keys;
+}
+
+//3. the keys no other store has merged by value with the summed ones
+inline uint64_t StoreMerger::writeKeyFile(){
+	std::vector<boost::shared_ptr<KeyValueSource> > sources(kept.begin(),kept.end());
+	const std::vector<boost::shared_ptr<SpillFile> > &summed_runs=summed->finish();
+	sources.insert(sources.end(),summed_runs.begin(),summed_runs.end());
+	return write_merged_sources(sources,out_file_name);
+}
+
+
+#endif
@@ -0,0 +1,218 @@
+/*
+ *  TieredValueStore.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Ranks in two tiers.  Every slot has a few bits in a fixed width primary array, which is enough for the common
+//(small) ranks.  The largest value of the primary width is an escape: the rank of an escaped slot is in a second
+//fixed width array that only has an entry for the escaped slots, in slot order.
+//The entry of an escaped slot is found from the number of escapes before its block (kept for every block of
+//ESCAPE_BLOCK slots as 16 bits on top of a full count every ESCAPE_SUPERBLOCK slots) plus the escapes in its block
+//before it, which are counted by reading the block.  Only escaped slots pay for that count, so most
+//lookups are one read from the primary array, as with CompactValueStore, while the size is close to the gamma codes.
+//This grew out of the 8 bit testTiered experiment in main-testRankStorage-new.cpp.
+
+#ifndef TIERED_VALUE_STORE_H
+#define TIERED_VALUE_STORE_H
+
+#include <vector>
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+#include <boost/serialization/vector.hpp>
+
+#include "ValueStore.h"
+
+using std::cerr;
+using std::endl;
+
+
+class TieredValueStore : public ValueStore {
+public:
+	static const unsigned ESCAPE_BLOCK=64;	//slots per 16 bit escape count
+	static const unsigned ESCAPE_SUPERBLOCK=65536;	//slots per 64 bit escape count
+	static const unsigned ESCAPE_LIMIT=16;
+
+	TieredValueStore():primary_data(NULL),superblock_data(NULL),block_data(NULL),overflow_data(NULL){}
+	//bits_per_primary of 0 means choose the width that makes the store smallest without escaping more than
+	//1 slot in ESCAPE_LIMIT, as every escaped lookup reads up to a block of the primary array
+	template <class T>
+	TieredValueStore(const T &value_array,const uint64_t &num_elements_stored,const std::vector<uint64_t> &rank_counts,const unsigned &bits_per_primary=0);
+	uint64_t at(const uint64_t &index) const;
+	uint64_t size_in_bits() const {return 64*(primary.size()+overflow.size()+escapes_before_superblock.size())+16*escapes_before_block.size()+8*sizeof(*this);}
+	MemoryUsage memory_usage() const {
+		MemoryUsage usage;
+		usage.add("primary",vector_bytes(primary));
+		usage.add("escape_counts",vector_bytes(escapes_before_block)+vector_bytes(escapes_before_superblock));
+		usage.add("overflow",vector_bytes(overflow));
+		return usage;
+	}
+	void share(SharedArrays &arrays){
+		arrays.share(primary,primary_data);
+		arrays.share(escapes_before_superblock,superblock_data);
+		arrays.share(escapes_before_block,block_data);
+		arrays.share(overflow,overflow_data);
+	}
+	unsigned primaryBits() const {return primary_bits;}
+	uint64_t escapedElements() const {return num_escaped;}
+
+	//the bits the store would take with a primary width of bits, given how many slots have each rank
+	static uint64_t bits_for_width(const unsigned &bits, const uint64_t &num_elements, const std::vector<uint64_t> &rank_counts, uint64_t &escaped, unsigned &overflow_bits);
+
+private:
+	uint64_t num_elements_stored;
+	uint64_t num_escaped;
+	unsigned primary_bits, overflow_bits;
+	uint64_t escape;	//the primary value that marks an escaped slot, and the smallest rank that is escaped
+	std::vector<uint64_t> primary;
+	std::vector<uint64_t> escapes_before_superblock;
+	std::vector<uint16_t> escapes_before_block;	//since the start of the superblock
+	std::vector<uint64_t> overflow;	//rank-escape of every escaped slot
+	//what at() reads, the vectors or their copies in shared memory
+	const uint64_t *primary_data, *superblock_data;
+	const uint16_t *block_data;
+	const uint64_t *overflow_data;
+	void set_views(){
+		primary_data=primary.empty()?NULL:&primary[0];
+		superblock_data=escapes_before_superblock.empty()?NULL:&escapes_before_superblock[0];
+		block_data=escapes_before_block.empty()?NULL:&escapes_before_block[0];
+		overflow_data=overflow.empty()?NULL:&overflow[0];
+	}
+
+	static uint64_t get(const uint64_t *words, const unsigned &width, const uint64_t &index){
+		if (!width) return 0;
+		const uint64_t pos=index*width;
+		const unsigned offset=pos&63;
+		const uint64_t mask=(width==64)?~0ULL:((1ULL<<width)-1);
+		//the second shift is split in two so an offset of 0 does not shift by 64
+		return ((words[pos>>6]>>offset) | ((words[(pos>>6)+1]<<1)<<(63-offset))) & mask;
+	}
+	static void set(std::vector<uint64_t> &words, const unsigned &width, const uint64_t &index, const uint64_t &v){
+		if (!width) return;
+		const uint64_t pos=index*width;
+		const unsigned offset=pos&63;
+		words[pos>>6]|=v<<offset;
+		if (offset+width>64) words[(pos>>6)+1]|=v>>(64-offset);
+	}
+	static unsigned bits_to_hold(const uint64_t &v){
+		unsigned bits=0;
+		while (bits<64 && (v>>bits)) ++bits;
+		return bits;
+	}
+
+private:
+	friend class boost::serialization::access;
+
+    template<class Archive>
+    void serialize(Archive & ar, const unsigned int version)
+    {
+		ar & num_elements_stored;
+		ar & num_escaped;
+		ar & primary_bits;
+		ar & overflow_bits;
+		ar & escape;
+		ar & primary;
+		ar & escapes_before_superblock;
+		ar & escapes_before_block;
+		ar & overflow;
+		set_views();
+	}
+};
+
+
+inline uint64_t TieredValueStore::bits_for_width(const unsigned &bits, const uint64_t &num_elements, const std::vector<uint64_t> &rank_counts, uint64_t &escaped, unsigned &overflow_bits){
+	const uint64_t largest_rank=rank_counts.empty()?0:rank_counts.size()-1;
+	escaped=0;
+	overflow_bits=0;
+	if (bits>=64 || (largest_rank>>bits)==0) return bits*num_elements;	//everything fits, no escape is needed
+	const uint64_t escape=(1ULL<<bits)-1;
+	for (uint64_t r=escape; r<rank_counts.size(); ++r) escaped+=rank_counts[r];
+	overflow_bits=bits_to_hold(largest_rank-escape);
+	return bits*num_elements+16*((num_elements+ESCAPE_BLOCK-1)/ESCAPE_BLOCK)+64*((num_elements+ESCAPE_SUPERBLOCK-1)/ESCAPE_SUPERBLOCK)+overflow_bits*escaped;
+}
+
+
+template <class T>
+TieredValueStore::TieredValueStore(const T &value_array,const uint64_t &num_elements,const std::vector<uint64_t> &rank_counts,const unsigned &bits_per_primary)
+:num_elements_stored(num_elements){
+
+	const unsigned bits_needed=std::max(1u,bits_to_hold(rank_counts.empty()?0:rank_counts.size()-1));
+	if (bits_per_primary>64) {cerr << "Error: bits per rank must be 64 bits or less"<<endl; exit(1);}
+	primary_bits=bits_per_primary;
+	if (!primary_bits) {
+		uint64_t smallest=0;
+		for (unsigned bits=1; bits<=bits_needed; ++bits) {
+			uint64_t escaped;
+			unsigned ob;
+			const uint64_t size=bits_for_width(bits,num_elements_stored,rank_counts,escaped,ob);
+			if (escaped>num_elements_stored/ESCAPE_LIMIT) continue;	//bits_needed never escapes, so a width is always chosen
+			if (!primary_bits || size<smallest) {
+				smallest=size;
+				primary_bits=bits;
+			}
+		}
+	}
+	bits_for_width(primary_bits,num_elements_stored,rank_counts,num_escaped,overflow_bits);
+	escape=num_escaped?(1ULL<<primary_bits)-1:~0ULL;
+
+	//one extra word so get() can always read the word after the one holding the value
+	primary.resize((num_elements_stored*primary_bits+63)/64+1,0);
+	overflow.resize((num_escaped*overflow_bits+63)/64+1,0);
+	if (num_escaped) {
+		escapes_before_superblock.reserve((num_elements_stored+ESCAPE_SUPERBLOCK-1)/ESCAPE_SUPERBLOCK);
+		escapes_before_block.reserve((num_elements_stored+ESCAPE_BLOCK-1)/ESCAPE_BLOCK);
+	}
+
+	uint64_t escaped_so_far=0;
+	for (uint64_t i=0; i<num_elements_stored; ++i) {
+		if (num_escaped && i%ESCAPE_SUPERBLOCK==0) escapes_before_superblock.push_back(escaped_so_far);
+		if (num_escaped && i%ESCAPE_BLOCK==0) escapes_before_block.push_back(static_cast<uint16_t>(escaped_so_far-escapes_before_superblock.back()));
+		const uint64_t v=value_array[i];
+		if (v>=escape) {
+			set(primary,primary_bits,i,escape);
+			set(overflow,overflow_bits,escaped_so_far++,v-escape);
+		}else {
+			set(primary,primary_bits,i,v);
+		}
+	}
+	if (escaped_so_far!=num_escaped) {
+		cerr << "Error: the rank counts given to the tiered value store do not match the ranks"<<endl;
+		exit(1);
+	}
+	set_views();
+	cerr << "Stored "<<num_elements_stored<<" ranks using "<<primary_bits<<" bits each, "<<num_escaped<<" ("<<(num_elements_stored?100.0*num_escaped/num_elements_stored:0)
+		<<"%) of them escaped to "<<overflow_bits<<" more bits ("<<size_in_bits()/8<<" bytes)"<<endl;
+}
+
+inline uint64_t TieredValueStore::at(const uint64_t &index) const{
+	if (index>=num_elements_stored) return -1;
+	const uint64_t v=get(primary_data,primary_bits,index);
+	if (v!=escape) return v;
+	const uint64_t block=index/ESCAPE_BLOCK;
+	uint64_t entry=superblock_data[index/ESCAPE_SUPERBLOCK]+block_data[block];
+	for (uint64_t i=block*ESCAPE_BLOCK; i<index; ++i) if (get(primary_data,primary_bits,i)==escape) ++entry;
+	return escape+get(overflow_data,overflow_bits,entry);
+}
+
+
+
+#endif
@@ -0,0 +1,85 @@
+/*
+ *  ValueStore.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Interface shared by all the structures that can hold the rank of every ngram.
+//The backends trade space for speed, so which one is used is chosen when the MPHR is built
+//and the choice is written into the fp_values file so it can be loaded again.
+
+#ifndef VALUE_STORE_H
+#define VALUE_STORE_H
+
+#include <string>
+#include <stdint.h>
+#include "MemoryUsage.h"
+#include "SharedArrays.h"
+
+
+//The numbers are written to disk so only ever add new backends to the end
+enum ValueStoreType {
+	VALUE_STORE_ELIAS=0,	//gamma codes indexed with elias fano (smallest)
+	VALUE_STORE_SARRAY=1,	//gamma codes indexed with an sarray
+	VALUE_STORE_RANK9=2,	//gamma codes indexed with rank9sel over the plain marker bits
+	VALUE_STORE_COMPACT=3,	//fixed width ranks (fastest)
+	VALUE_STORE_FIBONACCI=4,	//fibonacci codes indexed by their "11" terminators
+	VALUE_STORE_TIERED=5,	//a few fixed width bits per rank with the large ranks escaped to a second array
+	NUMBER_OF_VALUE_STORE_TYPES
+};
+
+
+class ValueStore {
+public:
+	virtual ~ValueStore(){}
+	virtual uint64_t at(const uint64_t &index) const=0;
+	virtual uint64_t size_in_bits() const=0;
+	virtual MemoryUsage memory_usage() const=0;
+	//moves the arrays at() reads into shared memory, see SharedArrays.h
+	virtual void share(SharedArrays &arrays)=0;
+};
+
+
+inline const char * value_store_name(const ValueStoreType &type){
+	switch (type) {
+		case VALUE_STORE_ELIAS: return "elias";
+		case VALUE_STORE_SARRAY: return "sarray";
+		case VALUE_STORE_RANK9: return "rank9";
+		case VALUE_STORE_COMPACT: return "compact";
+		case VALUE_STORE_FIBONACCI: return "fibonacci";
+		case VALUE_STORE_TIERED: return "tiered";
+		default: return "unknown";
+	}
+}
+
+//returns false if name is not one of the backends
+inline bool value_store_type_from_name(const std::string &name, ValueStoreType &type){
+	for (int t=0; t<NUMBER_OF_VALUE_STORE_TYPES; ++t) {
+		if (name==value_store_name(static_cast<ValueStoreType>(t))) {
+			type=static_cast<ValueStoreType>(t);
+			return true;
+		}
+	}
+	return false;
+}
+
+
+#endif
@@ -19,11 +19,16 @@
  *
  */
 
+//for PRIu64 in C++
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
 #include <cstdio>
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
 #include <climits>
+#include <inttypes.h>
 #include <algorithm>
 #include "elias_fano.h"
 
@@ -32,7 +37,23 @@ elias_fano::elias_fano( const uint64_t * const bits, const uint64_t num_bits ) {
 	const uint64_t num_words = ( num_bits + 63 ) / 64;
 	uint64_t m = 0;
 	for( uint64_t i = num_words; i-- != 0; ) m += count( bits[ i ] );
-	num_ones = m;
+
+	init( num_bits, m );
+
+	// Jump from one to one instead of testing every bit.
+	for( uint64_t i = 0; i < num_words; i++ )
+		for( uint64_t word = bits[ i ]; word != 0; word &= word - 1 )
+			add( i * 64 + __builtin_ctzll( word ) );
+
+	finish();
+}
+
+elias_fano::elias_fano( const uint64_t num_bits, const uint64_t num_ones ) {
+	init( num_bits, num_ones );
+}
+
+void elias_fano::init( const uint64_t num_bits, const uint64_t num_ones ) {
+	this->num_ones = num_ones;
 	this->num_bits = num_bits;
 	l = num_ones == 0 ? 0 : std::max( 0, msb( num_bits / num_ones ) );
 
@@ -41,28 +62,61 @@ elias_fano::elias_fano( const uint64_t * const bits, const uint64_t num_bits ) {
 	fprintf(stderr, "Upper bits: %lld\n", num_ones + ( num_bits >> l ) + 1 );
 	fprintf(stderr,"Lower bits: %lld\n", num_ones * l );
 
-	const uint64_t lower_bits_mask = ( 1ULL << l ) - 1;
-
 	lower_bits.insert(lower_bits.begin(), (num_ones * l + 63  ) / 64 + 2 * ( l == 0 ),0);
 	
 	upper_bits.reset(new std::vector<uint64_t>((( num_ones + ( num_bits >> l ) + 1 ) + 63 ) / 64,0));//((( num_ones + ( num_bits >> l ) + 1 ) + 63 ) / 64),0);
 
-	uint64_t pos = 0;
-	for( uint64_t i = 0; i < num_bits; i++ ) {
-		if ( bits[ i / 64 ] & ( 1ULL << i % 64 ) ) {
-			if ( l != 0 ) set_bits( &lower_bits[0], pos * l, l, i & lower_bits_mask );
-			set( (&(*upper_bits)[0]), ( i >> l ) + pos );
-			pos++;
+	// The select inventory over the upper bits is filled in as the ones arrive.
+	select_upper = new simple_select_half( upper_bits, num_ones + ( num_bits >> l ), num_ones );
+	//selectz_upper = new simple_select_zero_half( upper_bits, num_ones + ( num_bits >> l ) );
+
+	lower_l_bits_mask = ( 1ULL << l ) - 1;
+	ones_added = 0;
+	last_position = 0;
+	lower_word = 0;
+	lower_accumulator = 0;
+	lower_fill = 0;
+}
+
+void elias_fano::add( const uint64_t pos ) {
+	if ( ones_added >= num_ones || pos >= num_bits || ( ones_added != 0 && pos <= last_position ) ) {
+		fprintf(stderr, "Error: elias_fano positions must be increasing and below %" PRIu64 " (got %" PRIu64 " after %" PRIu64 ")\n", num_bits, pos, last_position );
+		exit( 1 );
+	}
+
+	// The lower l bits are packed into a word and only written when it is full.
+	if ( l != 0 ) {
+		const uint64_t low = pos & lower_l_bits_mask;
+		lower_accumulator |= low << lower_fill;
+		lower_fill += l;
+		if ( lower_fill >= 64 ) {
+			lower_bits[ lower_word++ ] = lower_accumulator;
+			lower_fill -= 64;
+			lower_accumulator = lower_fill == 0 ? 0 : low >> ( l - lower_fill );
 		}
 	}
 
+	const uint64_t upper_pos = ( pos >> l ) + ones_added;
+	set( &(*upper_bits)[0], upper_pos );
+	select_upper->add( upper_pos );
+
+	last_position = pos;
+	ones_added++;
+}
+
+void elias_fano::finish() {
+	if ( ones_added != num_ones ) {
+		fprintf(stderr, "Error: elias_fano was told to expect %" PRIu64 " ones but %" PRIu64 " were added\n", num_ones, ones_added );
+		exit( 1 );
+	}
+	if ( lower_fill != 0 ) lower_bits[ lower_word ] = lower_accumulator;
+	lower_data = lower_bits.empty() ? NULL : &lower_bits[0];
+	select_upper->finish();
 
 #ifdef DEBUG
 	fprintf(stderr,"First lower: %016llx %016llx %016llx %016llx\n", lower_bits[ 0 ], lower_bits[ 1 ], lower_bits[ 2 ], lower_bits[ 3 ] );
 	fprintf(stderr,"First upper: %016llx %016llx %016llx %016llx\n", upper_bits[ 0 ], upper_bits[ 1 ], upper_bits[ 2 ], upper_bits[ 3 ] );
 #endif
-	select_upper = new simple_select_half( upper_bits, num_ones + ( num_bits >> l ) );
-	//selectz_upper = new simple_select_zero_half( upper_bits, num_ones + ( num_bits >> l ) );
 
 	block_size = 0;
 	while( ++block_size * l + block_size <= 64 && block_size <= l );
@@ -79,8 +133,6 @@ elias_fano::elias_fano( const uint64_t * const bits, const uint64_t num_bits ) {
 
 	compressor = 0;
 	for( int i = 0; i < block_size; i++) compressor |= 1ULL << ( l - 1 ) * i + block_size;
-	
-	lower_l_bits_mask = ( 1ULL << l ) - 1;
 /*
 #ifndef NDEBUG
 	uint64_t r, t;
@@ -203,11 +255,27 @@ uint64_t elias_fano::select( const uint64_t rank ) {
 #ifdef DEBUG
 	fprintf(stderr,"Returning %lld = %llx << %d | %llx\n", ( select_upper->select( rank ) - rank ) << l | get_bits( lower_bits, rank * l, l ), select_upper->select( rank ) - rank , l, get_bits( lower_bits, rank * l, l ) );
 #endif
-	return ( select_upper->select( rank ) - rank ) << l | get_bits( &lower_bits[0], rank * l, l );
+	return ( select_upper->select( rank ) - rank ) << l | get_bits( lower_data, rank * l, l );
 }
 
 uint64_t elias_fano::bit_count() {
 	return num_ones * l + num_ones + ( num_bits >> l ) + select_upper->bit_count();// + selectz_upper->bit_count();
 }
 
+MemoryUsage elias_fano::memory_usage() const {
+	MemoryUsage usage;
+	usage.add("lower_bits",vector_bytes(lower_bits));
+	usage.add("upper_bits",vector_bytes(*upper_bits));
+	usage.add("upper_select",select_upper->memory_usage());
+	return usage;
+}
+
+void elias_fano::share( SharedArrays &arrays ) {
+	arrays.share( lower_bits, lower_data );
+	// The select inventory reads the upper bits as well, so it is told where they went
+	const uint64_t *upper_data = NULL;
+	arrays.share( *upper_bits, upper_data );
+	select_upper->share( arrays, upper_data );
+}
+
 void elias_fano::print_counts() {}
@@ -25,6 +25,8 @@
 #include <vector>
 #include "simple_select_half.h"
 #include "simple_select_zero_half.h"
+#include "MemoryUsage.h"
+#include "SharedArrays.h"
 #include <boost/shared_ptr.hpp>
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/vector.hpp>
@@ -41,6 +43,7 @@ using std::vector;
 class elias_fano {
 private:
 	vector<uint64_t> lower_bits;
+	const uint64_t *lower_data;	// What select() reads: lower_bits, or its copy in shared memory
 	boost::shared_ptr<vector<uint64_t> > upper_bits;
 	simple_select_half *select_upper;
 	//simple_select_zero_half *selectz_upper;
@@ -54,6 +57,11 @@ private:
 	uint64_t msbs_step_l;
 	uint64_t compressor;
 
+	//only used while the structure is being built from a stream of positions
+	uint64_t ones_added, last_position, lower_word, lower_accumulator;
+	int lower_fill;
+	void init( const uint64_t num_bits, const uint64_t num_ones );
+
 	__inline static int msb( uint64_t x ) {
 		if ( x == 0 ) return -1;
 		
@@ -130,14 +138,21 @@ private:
 	}
 
 public:
-	elias_fano(){}
+	elias_fano():lower_data(NULL),select_upper(NULL){}
 	elias_fano( const uint64_t * const bits, const uint64_t num_bits );
+	// Streaming construction: give the size of the bit vector and the number of ones in it, then add()
+	// the position of every one in increasing order and call finish().  The bit vector itself is never built.
+	elias_fano( const uint64_t num_bits, const uint64_t num_ones );
+	void add( const uint64_t pos );
+	void finish();
 	~elias_fano();
 	//uint64_t rank( const uint64_t pos );
 	uint64_t select( const uint64_t rank );
 	// Just for analysis purposes
 	void print_counts();
 	uint64_t bit_count();
+	MemoryUsage memory_usage() const;
+	void share( SharedArrays &arrays );
 private:
 	elias_fano(const elias_fano&); //disallow copy
 	void operator=(const elias_fano&); //disallow assignment
@@ -161,6 +176,7 @@ private:
 		ar & compressor;
 		ar & select_upper;
 		//ar & selectz_upper;
+		lower_data = lower_bits.empty() ? NULL : &lower_bits[0];
 
 	}
 };
@@ -0,0 +1,902 @@
+/*
+ *  main-bench.cpp
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/dynamic_bitset.hpp>
+
+#include "Benchmark.h"
+#include "ValueStore.h"
+#include "CompressedValueStoreElias.h"
+#include "CompressedValueStore.h"
+#include "CompressedValueStoreRank9.h"
+#include "CompressedValueStoreFibonacci.h"
+#include "CompactValueStore.h"
+#include "TieredValueStore.h"
+#include "CompactStore.h"
+#include "SArray.h"
+#include "simple_select.h"
+#include "simple_select_half.h"
+#include "simple_select_zero_half.h"
+#include "simple_select11.h"
+#include "rank9.h"
+#include "rank9sel.h"
+#include "MPHR.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+
+
+struct BenchSettings {
+	uint64_t num_elements;
+	uint64_t unique_values;
+	double zipf_exponent;
+	uint64_t seed;
+	uint64_t num_queries;
+	string stores;
+	//select mode
+	uint64_t num_bits;
+	string densities;
+	string patterns;
+	uint64_t batch_size;
+	//mphr mode
+	string key_file;
+	string load_base;
+	unsigned bits_per_fingerprint;
+	double hit_ratio;
+	uint64_t hot_keys;
+	string threads;
+	bool perf_counters;
+};
+
+
+void print_usage(const char *prg_name){
+	cerr<< "\nUsage: " << prg_name <<" [-h] [-m mode] [-n num_elements] [-u unique_values] [-z zipf_exponent] [-S seed] [-q num_queries] [-v stores] [-p patterns] [-d densities] [-B batch_size] [-l inputBaseFileName] [-f bits_per_fp] [-H hot_keys] [-r hit_ratio] [-t threads] [-P] [keyTABvalueFile]"
+		<< "\n\n\tBenchmarks the structures used by shefLMStore on synthetic data.  Every result is written to stdout as one JSON object per line.\n"
+		<< "\tThe data only depends on the options (and the seed) so runs on different machines or builds can be compared.\n\n"
+		<< "\t-h print this help\n"
+		<< "\t-m what to benchmark, default is values\n"
+		<< "\t\tvalues: build every value store over Zipfian ranks and time at()\n"
+		<< "\t\tselect: build every select (and rank) structure over bit vectors of different densities and time select()\n"
+		<< "\t\tmphr: build (or load with -l) the whole store for keyTABvalueFile and replay a mix of stored and missing ngrams\n"
+		<< "\t-n number of ranks to store, default is 10000000 (in select mode the number of bits, default is 134217728)\n"
+		<< "\t-u number of distinct ranks, default is 771058 (the number of distinct counts in the Google ngrams)\n"
+		<< "\t-z Zipf exponent of the ranks, default is 1.0\n"
+		<< "\t-S random seed, default is 1\n"
+		<< "\t-q number of lookups to time for each access pattern, default is 1000000\n"
+		<< "\t-v comma separated list of value stores (or select structures) to benchmark, default is all of them\n"
+		<< "\t\tvalues: elias, sarray, rank9, fibonacci, compact, tiered and compactstore (the bit by bit CompactStore)\n"
+		<< "\t\tselect: simple_select, simple_select_half, simple_select_zero_half, simple_select11, rank9sel, darray and rank9 (rank only)\n"
+		<< "\t-p comma separated list of bit patterns for select mode, default is uniform,zipf,gamma\n"
+		<< "\t\tuniform: each bit is a one with the given density\n"
+		<< "\t\tzipf: Zipf distributed gaps between the ones, with a mean gap of about 1/density\n"
+		<< "\t\tgamma: the code start markers of gamma coded Zipfian ranks (-u and -z), as indexed by the elias value store\n"
+		<< "\t-d comma separated list of densities for select mode, default is 0.01,0.1,0.5,0.9\n"
+		<< "\t-B number of queries sorted together in the batched access pattern, default is 64\n"
+		<< "\t-l load the MPHR from the files starting with this name (written by shefLMStore -g) instead of building it in mphr mode\n"
+		<< "\t-f number of bits to use for each fingerprint when building in mphr mode, default is 12\n"
+		<< "\t-H build a hot tier of this many keys with the largest counts in mphr mode, as shefLMStore -H does.  With a\n"
+		<< "\t\thot tier every ngram of the file is also queried once and the ones that get the wrong count are reported\n"
+		<< "\t\tas incorrect (the exit status is 1 if there are any)\n"
+		<< "\t-r fraction of the mphr queries that are ngrams in the file, default is 0.9\n"
+		<< "\t-t comma separated list of thread counts to run the mphr queries with, default is 1 and the number of processors\n"
+		<< "\tIn mphr mode -v is the one value store to build the MPHR with (default is elias)\n"
+		<< "\t-P also report hardware counters per operation (LLC misses, dTLB misses, instructions and branch misses) for the untimed loops.\n"
+		<< "\t\tCounters the kernel does not allow (see /proc/sys/kernel/perf_event_paranoid) are left out\n"
+		<< "\n"
+		<< "Example: " << prg_name <<" -m values -n 1000000 -v elias,compact > values.json\n"
+		<< "Example: " << prg_name <<" -m select -p gamma,uniform -d 0.05 -v simple_select,darray > select.json\n"
+		<< "Example: " << prg_name <<" -m mphr -l 3gmstore -r 0.5 -t 1,8 3gm.txt.gz > mphr.json\n"
+		<<endl;
+}
+
+
+std::vector<string> split_list(const string &list){
+	std::vector<string> items;
+	size_t start=0;
+	for (size_t comma; (comma=list.find(',',start))!=string::npos; start=comma+1) items.push_back(list.substr(start,comma-start));
+	items.push_back(list.substr(start));
+	return items;
+}
+
+//true if name is in the comma separated list (or the list is empty)
+bool selected(const string &list, const string &name){
+	if (list.empty()) return true;
+	return (","+list+",").find(","+name+",")!=string::npos;
+}
+
+
+//size of the plain CompactStore, which does not know about ValueStore
+uint64_t store_size_in_bits(const CompactStore &store){
+	return const_cast<CompactStore &>(store).getBitArrayPointer()->size()+8*sizeof(unsigned);
+}
+uint64_t store_size_in_bits(const ValueStore &store){
+	return store.size_in_bits();
+}
+
+
+//Times at() on one at a time (for the percentiles) and in an untimed loop (for the throughput) and checks every answer
+template <class Store>
+JsonRecord time_lookups(const Store &store, const std::vector<uint64_t> &ranks, const std::vector<uint64_t> &indexes, PerfCounters &perf, bool &correct){
+	const uint64_t timer_overhead=bench_timer_overhead_ns();
+
+	LatencyStats stats;
+	stats.reserve(indexes.size());
+	for (size_t i=0; i<indexes.size(); ++i) {
+		const uint64_t t0=bench_now_ns();
+		const uint64_t value=store.at(indexes[i]);
+		const uint64_t t1=bench_now_ns();
+		stats.add(t1-t0>timer_overhead?t1-t0-timer_overhead:0);
+		if (value!=ranks[indexes[i]]) correct=false;
+	}
+
+	volatile uint64_t checksum=0;
+	perf.start();
+	const uint64_t start=bench_now_ns();
+	for (size_t i=0; i<indexes.size(); ++i) checksum+=store.at(indexes[i]);
+	const uint64_t elapsed=bench_now_ns()-start;
+	perf.stop();
+
+	JsonRecord r=latency_record(stats);
+	r.add("loop_ns_per_op",indexes.empty()?0.0:static_cast<double>(elapsed)/indexes.size());
+	if (perf.available()) r.add("counters_per_op",perf.per_op(indexes.size()));
+	return r;
+}
+
+template <class Store>
+void report_value_store(const string &name, const Store &store, const double &build_seconds, const std::vector<uint64_t> &ranks, const std::vector<uint64_t> &random_indexes, const std::vector<uint64_t> &sequential_indexes, const BenchSettings &settings, PerfCounters &perf){
+	bool correct=true;
+	JsonRecord random_record=time_lookups(store,ranks,random_indexes,perf,correct);
+	JsonRecord sequential_record=time_lookups(store,ranks,sequential_indexes,perf,correct);
+	const uint64_t bits=store_size_in_bits(store);
+	JsonRecord r;
+	r.add("bench","values")
+	 .add("store",name)
+	 .add("num_elements",settings.num_elements)
+	 .add("unique_values",settings.unique_values)
+	 .add("zipf_exponent",settings.zipf_exponent)
+	 .add("seed",settings.seed)
+	 .add("size_in_bits",bits)
+	 .add("bits_per_element",static_cast<double>(bits)/settings.num_elements)
+	 .add("build_seconds",build_seconds)
+	 .add("random",random_record)
+	 .add("sequential",sequential_record)
+	 .add("correct",correct);
+	cout << r.str() <<endl;
+	if (!correct) cerr << "Error: the "<<name<<" value store returned a wrong rank"<<endl;
+}
+
+
+int bench_values(const BenchSettings &settings){
+	PerfCounters perf(settings.perf_counters);
+	cerr << "Generating "<<settings.num_elements<<" Zipfian ranks"<<endl;
+	BenchRandom rng(settings.seed);
+	ZipfGenerator zipf(settings.unique_values,settings.zipf_exponent);
+	std::vector<uint64_t> ranks(settings.num_elements);
+	for (uint64_t i=0; i<settings.num_elements; ++i) ranks[i]=zipf.next(rng);
+
+	std::vector<uint64_t> rank_counts;
+	for (uint64_t i=0; i<settings.num_elements; ++i) {
+		if (ranks[i]>=rank_counts.size()) rank_counts.resize(ranks[i]+1,0);
+		++rank_counts[ranks[i]];
+	}
+
+	const uint64_t num_queries=std::min(settings.num_queries,settings.num_elements);
+	std::vector<uint64_t> random_indexes(num_queries), sequential_indexes(num_queries);
+	for (uint64_t i=0; i<num_queries; ++i) {
+		random_indexes[i]=rng.below(settings.num_elements);
+		sequential_indexes[i]=i;
+	}
+
+	if (selected(settings.stores,"elias")) {
+		uint64_t t=bench_now_ns();
+		CompressedValueStoreElias store(ranks,settings.num_elements,rank_counts);
+		double build_seconds=(bench_now_ns()-t)/1e9;
+		report_value_store("elias",store,build_seconds,ranks,random_indexes,sequential_indexes,settings,perf);
+	}
+	if (selected(settings.stores,"sarray")) {
+		uint64_t t=bench_now_ns();
+		CompressedValueStore store(ranks,settings.num_elements);
+		double build_seconds=(bench_now_ns()-t)/1e9;
+		report_value_store("sarray",store,build_seconds,ranks,random_indexes,sequential_indexes,settings,perf);
+	}
+	if (selected(settings.stores,"rank9")) {
+		uint64_t t=bench_now_ns();
+		CompressedValueStoreRank9 store(ranks,settings.num_elements);
+		double build_seconds=(bench_now_ns()-t)/1e9;
+		report_value_store("rank9",store,build_seconds,ranks,random_indexes,sequential_indexes,settings,perf);
+	}
+	if (selected(settings.stores,"fibonacci")) {
+		uint64_t t=bench_now_ns();
+		CompressedValueStoreFibonacci store(ranks,settings.num_elements,2*rank_counts.size()+2);
+		double build_seconds=(bench_now_ns()-t)/1e9;
+		report_value_store("fibonacci",store,build_seconds,ranks,random_indexes,sequential_indexes,settings,perf);
+	}
+	if (selected(settings.stores,"compact")) {
+		uint64_t t=bench_now_ns();
+		CompactValueStore store(ranks,settings.num_elements,rank_counts);
+		double build_seconds=(bench_now_ns()-t)/1e9;
+		report_value_store("compact",store,build_seconds,ranks,random_indexes,sequential_indexes,settings,perf);
+	}
+	if (selected(settings.stores,"tiered")) {
+		uint64_t t=bench_now_ns();
+		TieredValueStore store(ranks,settings.num_elements,rank_counts);
+		double build_seconds=(bench_now_ns()-t)/1e9;
+		report_value_store("tiered",store,build_seconds,ranks,random_indexes,sequential_indexes,settings,perf);
+	}
+	if (selected(settings.stores,"compactstore")) {
+		uint64_t t=bench_now_ns();
+		unsigned bits_per_rank=1;
+		while (bits_per_rank<64 && ((rank_counts.size()-1)>>bits_per_rank)) ++bits_per_rank;
+		boost::shared_ptr<boost::dynamic_bitset<> > bit_array(new boost::dynamic_bitset<>(bits_per_rank*settings.num_elements));
+		CompactStore store(bit_array,bits_per_rank);
+		for (uint64_t i=0; i<settings.num_elements; ++i) store.set(i,ranks[i]);
+		double build_seconds=(bench_now_ns()-t)/1e9;
+		report_value_store("compactstore",store,build_seconds,ranks,random_indexes,sequential_indexes,settings,perf);
+	}
+	return 0;
+}
+
+
+//One bit vector with the shape being benchmarked.  The vector has one zero word after the last one.
+struct SelectPattern {
+	string name;
+	double requested_density;
+	boost::shared_ptr<std::vector<uint64_t> > bits;
+	uint64_t num_bits;
+	uint64_t num_ones;
+	//cumulative ones before each word, used to check the answers
+	std::vector<uint64_t> ones_before;
+
+	void set(const uint64_t &pos){(*bits)[pos>>6]|=1ULL<<(pos&63);}
+	void finish(){
+		const uint64_t num_words=num_bits/64;
+		ones_before.assign(num_words+1,0);
+		for (uint64_t i=0; i<num_words; ++i) ones_before[i+1]=ones_before[i]+__builtin_popcountll((*bits)[i]);
+		num_ones=ones_before[num_words];
+	}
+	//the obvious (slow) select and rank that every structure is checked against
+	uint64_t select(const uint64_t &rank) const{
+		const uint64_t w=std::upper_bound(ones_before.begin(),ones_before.end(),rank)-ones_before.begin()-1;
+		uint64_t word=(*bits)[w];
+		for (uint64_t r=ones_before[w]; r<rank; ++r) word&=word-1;
+		return w*64+__builtin_ctzll(word);
+	}
+	uint64_t rank(const uint64_t &pos) const{
+		const uint64_t bit=pos&63;
+		return ones_before[pos>>6]+(bit?__builtin_popcountll((*bits)[pos>>6]<<(64-bit)):0);
+	}
+};
+
+
+//mean of the gaps drawn by a ZipfGenerator(max_gap,s)+1
+double zipf_mean_gap(const uint64_t &max_gap, const double &s){
+	double sum=0, weighted=0;
+	for (uint64_t r=1; r<=max_gap; ++r) {
+		const double p=1.0/pow(static_cast<double>(r),s);
+		sum+=p;
+		weighted+=p*r;
+	}
+	return weighted/sum;
+}
+
+//pattern is one of
+//	uniform: every bit is a one with probability density
+//	zipf: the gaps between ones follow a Zipf distribution (long runs of close ones with the odd big gap) with a mean of about 1/density
+//	gamma: a one at the start of the gamma code of every rank, the marker bits CompressedValueStoreElias indexes (density is ignored)
+void generate_pattern(SelectPattern &p, const string &pattern, const double &density, const BenchSettings &settings, BenchRandom &rng){
+	p.name=pattern;
+	p.requested_density=density;
+	p.num_bits=(settings.num_bits+63)&~63ULL;
+	p.bits.reset(new std::vector<uint64_t>(p.num_bits/64+1,0));
+	if (pattern=="uniform") {
+		for (uint64_t i=0; i<p.num_bits; ++i) if (rng.unit()<density) p.set(i);
+	}
+	else if (pattern=="zipf") {
+		//find the largest gap that gives the density we asked for
+		uint64_t max_gap=1;
+		while (max_gap<(1ULL<<24) && zipf_mean_gap(max_gap,settings.zipf_exponent)<1.0/density) max_gap*=2;
+		uint64_t low=max_gap/2+1, high=max_gap;
+		while (low<high) {
+			const uint64_t mid=(low+high)/2;
+			if (zipf_mean_gap(mid,settings.zipf_exponent)<1.0/density) low=mid+1; else high=mid;
+		}
+		ZipfGenerator gaps(std::max<uint64_t>(high,1),settings.zipf_exponent);
+		for (uint64_t pos=gaps.next(rng); pos<p.num_bits; pos+=gaps.next(rng)+1) p.set(pos);
+	}
+	else if (pattern=="gamma") {
+		ZipfGenerator ranks(settings.unique_values,settings.zipf_exponent);
+		for (uint64_t pos=0; pos<p.num_bits; ) {
+			p.set(pos);
+			const uint64_t value=ranks.next(rng)+1;
+			unsigned log2=0;
+			while (value>>(log2+1)) ++log2;
+			pos+=2*log2+1;
+		}
+	}
+	else {
+		cerr << "Error: "<<pattern<<" is not a bit pattern, use uniform, zipf or gamma"<<endl;
+		exit(1);
+	}
+	p.finish();
+	cerr << "Generated "<<pattern<<" pattern with "<<p.num_ones<<" ones in "<<p.num_bits<<" bits"<<endl;
+}
+
+
+//Every structure answers with the position of a one in the pattern, however it is built
+inline uint64_t do_select(simple_select &s, const uint64_t &rank){return s.select(rank);}
+inline uint64_t do_select(simple_select_half &s, const uint64_t &rank){return s.select(rank);}
+//built over the complement of the pattern
+inline uint64_t do_select(simple_select_zero_half &s, const uint64_t &rank){return s.select_zero(rank);}
+//built over the pattern with every one replaced by "11".  select11(i+1) is the bit after the end of pair i, which is at its position+i+1
+inline uint64_t do_select(simple_select11 &s, const uint64_t &rank){return s.select11(rank+1)-rank-2;}
+inline uint64_t do_select(rank9sel &s, const uint64_t &rank){return s.select(rank);}
+//DArray counts its ones from 1
+inline uint64_t do_select(DArray &s, const uint64_t &rank){return s.select(rank+1);}
+
+
+//The ranks asked for by each access pattern
+struct SelectQueries {
+	std::vector<uint64_t> random, sequential, batched;
+	std::vector<uint64_t> random_answers;
+};
+
+//batched is random ranks sorted within each batch, like looking up a batch of keys together
+void generate_queries(SelectQueries &q, const SelectPattern &p, const BenchSettings &settings, BenchRandom &rng){
+	const uint64_t n=p.num_ones?settings.num_queries:0;
+	q.random.resize(n);
+	q.sequential.resize(n);
+	q.batched.resize(n);
+	q.random_answers.resize(n);
+	for (uint64_t i=0; i<n; ++i) {
+		q.random[i]=rng.below(p.num_ones);
+		q.sequential[i]=i%p.num_ones;
+		q.batched[i]=rng.below(p.num_ones);
+		q.random_answers[i]=p.select(q.random[i]);
+	}
+	const uint64_t batch=std::max<uint64_t>(settings.batch_size,1);
+	for (uint64_t i=0; i<n; i+=batch) std::sort(q.batched.begin()+i,q.batched.begin()+std::min(i+batch,n));
+}
+
+//adds access_ns (and access_counters if there are any) to r
+template <class Select>
+void time_select_loop(Select &s, const std::vector<uint64_t> &ranks, const string &access, PerfCounters &perf, JsonRecord &r){
+	volatile uint64_t checksum=0;
+	perf.start();
+	const uint64_t start=bench_now_ns();
+	for (size_t i=0; i<ranks.size(); ++i) checksum+=do_select(s,ranks[i]);
+	const uint64_t elapsed=bench_now_ns()-start;
+	perf.stop();
+	r.add(access+"_ns",ranks.empty()?0.0:static_cast<double>(elapsed)/ranks.size());
+	if (perf.available()) r.add(access+"_counters",perf.per_op(ranks.size()));
+}
+
+template <class Select>
+void report_select(const string &name, Select &s, const uint64_t &index_bits, const double &build_seconds, const SelectPattern &p, const SelectQueries &q, PerfCounters &perf){
+	bool correct=true;
+	for (size_t i=0; i<q.random.size(); ++i) if (do_select(s,q.random[i])!=q.random_answers[i]) correct=false;
+	JsonRecord r;
+	r.add("bench","select")
+	 .add("structure",name)
+	 .add("pattern",p.name)
+	 .add("requested_density",p.requested_density)
+	 .add("density",static_cast<double>(p.num_ones)/p.num_bits)
+	 .add("num_bits",p.num_bits)
+	 .add("num_ones",p.num_ones)
+	 .add("index_bits",index_bits)
+	 .add("overhead",static_cast<double>(index_bits)/p.num_bits)
+	 .add("build_seconds",build_seconds);
+	time_select_loop(s,q.random,"random",perf,r);
+	time_select_loop(s,q.sequential,"sequential",perf,r);
+	time_select_loop(s,q.batched,"batched",perf,r);
+	r.add("correct",correct);
+	cout << r.str() <<endl;
+	if (!correct) cerr << "Error: "<<name<<" returned a wrong position on the "<<p.name<<" pattern"<<endl;
+}
+
+//rank is only offered by rank9 (rank9sel uses the same counts), so it is timed over random positions
+void report_rank(rank9 &s, const uint64_t &index_bits, const double &build_seconds, const SelectPattern &p, const BenchSettings &settings, BenchRandom &rng, PerfCounters &perf){
+	std::vector<uint64_t> positions(settings.num_queries);
+	for (size_t i=0; i<positions.size(); ++i) positions[i]=rng.below(p.num_bits);
+	bool correct=true;
+	for (size_t i=0; i<positions.size(); ++i) if (s.rank(positions[i])!=p.rank(positions[i])) correct=false;
+	volatile uint64_t checksum=0;
+	perf.start();
+	const uint64_t start=bench_now_ns();
+	for (size_t i=0; i<positions.size(); ++i) checksum+=s.rank(positions[i]);
+	const uint64_t elapsed=bench_now_ns()-start;
+	perf.stop();
+	JsonRecord r;
+	r.add("bench","rank")
+	 .add("structure","rank9")
+	 .add("pattern",p.name)
+	 .add("requested_density",p.requested_density)
+	 .add("density",static_cast<double>(p.num_ones)/p.num_bits)
+	 .add("num_bits",p.num_bits)
+	 .add("num_ones",p.num_ones)
+	 .add("index_bits",index_bits)
+	 .add("overhead",static_cast<double>(index_bits)/p.num_bits)
+	 .add("build_seconds",build_seconds)
+	 .add("random_ns",positions.empty()?0.0:static_cast<double>(elapsed)/positions.size());
+	if (perf.available()) r.add("random_counters",perf.per_op(positions.size()));
+	r.add("correct",correct);
+	cout << r.str() <<endl;
+	if (!correct) cerr << "Error: rank9 returned a wrong rank on the "<<p.name<<" pattern"<<endl;
+}
+
+void bench_select_pattern(const SelectPattern &p, const BenchSettings &settings, BenchRandom &rng, PerfCounters &perf){
+	SelectQueries q;
+	generate_queries(q,p,settings,rng);
+	const uint64_t *words=&(*p.bits)[0];
+
+	if (selected(settings.stores,"simple_select")) {
+		uint64_t t=bench_now_ns();
+		simple_select s(words,p.num_bits);
+		double build_seconds=(bench_now_ns()-t)/1e9;
+		report_select("simple_select",s,s.bit_count(),build_seconds,p,q,perf);
+	}
+	if (selected(settings.stores,"simple_select_half")) {
+		uint64_t t=bench_now_ns();
+		simple_select_half s(p.bits,p.num_bits);
+		double build_seconds=(bench_now_ns()-t)/1e9;
+		report_select("simple_select_half",s,s.bit_count(),build_seconds,p,q,perf);
+	}
+	if (selected(settings.stores,"simple_select_zero_half")) {
+		boost::shared_ptr<std::vector<uint64_t> > complement(new std::vector<uint64_t>(*p.bits));
+		for (size_t i=0; i+1<complement->size(); ++i) (*complement)[i]=~(*complement)[i];
+		uint64_t t=bench_now_ns();
+		simple_select_zero_half s(complement,p.num_bits);
+		double build_seconds=(bench_now_ns()-t)/1e9;
+		report_select("simple_select_zero_half",s,s.bit_count(),build_seconds,p,q,perf);
+	}
+	if (selected(settings.stores,"simple_select11")) {
+		const uint64_t num_bits11=p.num_bits+p.num_ones;
+		boost::shared_ptr<std::vector<uint64_t> > doubled(new std::vector<uint64_t>((num_bits11+63)/64+1,0));
+		for (uint64_t i=0, pos=0; i<p.num_bits; ++i, ++pos) {
+			if ((*p.bits)[i>>6]&(1ULL<<(i&63))) {
+				(*doubled)[pos>>6]|=1ULL<<(pos&63);
+				++pos;
+				(*doubled)[pos>>6]|=1ULL<<(pos&63);
+			}
+		}
+		uint64_t t=bench_now_ns();
+		simple_select11 s(doubled,num_bits11,p.num_ones);
+		double build_seconds=(bench_now_ns()-t)/1e9;
+		report_select("simple_select11",s,s.bit_count(),build_seconds,p,q,perf);
+	}
+	if (selected(settings.stores,"rank9sel")) {
+		uint64_t t=bench_now_ns();
+		rank9sel s(words,p.num_bits);
+		double build_seconds=(bench_now_ns()-t)/1e9;
+		report_select("rank9sel",s,s.bit_count(),build_seconds,p,q,perf);
+	}
+	if (selected(settings.stores,"darray")) {
+		uint64_t t=bench_now_ns();
+		DArray s(p.bits,p.num_bits);
+		double build_seconds=(bench_now_ns()-t)/1e9;
+		report_select("darray",s,s.bit_count(),build_seconds,p,q,perf);
+	}
+	if (selected(settings.stores,"rank9")) {
+		uint64_t t=bench_now_ns();
+		rank9 s(words,p.num_bits);
+		double build_seconds=(bench_now_ns()-t)/1e9;
+		report_rank(s,s.bit_count(),build_seconds,p,settings,rng,perf);
+	}
+}
+
+int bench_select(const BenchSettings &settings){
+	PerfCounters perf(settings.perf_counters);
+	BenchRandom rng(settings.seed);
+	const std::vector<string> patterns=split_list(settings.patterns);
+	const std::vector<string> densities=split_list(settings.densities);
+	for (size_t i=0; i<patterns.size(); ++i) {
+		//the gamma markers have the density the ranks give them
+		const size_t num_densities=(patterns[i]=="gamma")?1:densities.size();
+		for (size_t d=0; d<num_densities; ++d) {
+			const double density=(patterns[i]=="gamma")?0:atof(densities[d].c_str());
+			if (patterns[i]!="gamma" && (density<=0 || density>1)) {
+				cerr << "Error: "<<densities[d]<<" is not a density between 0 and 1"<<endl;
+				return 1;
+			}
+			SelectPattern p;
+			generate_pattern(p,patterns[i],density,settings,rng);
+			bench_select_pattern(p,settings,rng,perf);
+		}
+	}
+	return 0;
+}
+
+
+//A query for the MPHR mode.  count is the count in the ngram file, or 0 for a key that is not stored.
+struct BenchQuery {
+	string key;
+	uint64_t count;
+};
+
+//Keeps max_keys lines of the ngram file chosen uniformly from the whole file (reservoir sampling) so big files do not have to fit in memory
+uint64_t sample_ngrams(const string &file_name, const uint64_t &max_keys, BenchRandom &rng, std::vector<BenchQuery> &sample){
+	std::ifstream fin(file_name.c_str(),std::ios_base::in|std::ios_base::binary);
+	if (!fin) {
+		cerr << "Error: unable to open the ngram file: "<<file_name<<endl;
+		exit(1);
+	}
+	boost::iostreams::filtering_stream<boost::iostreams::input> in;
+	if (file_name.size()>3 && file_name.compare(file_name.size()-3,3,".gz")==0) in.push(boost::iostreams::gzip_decompressor());
+	in.push(fin);
+	uint64_t lines=0;
+	string text;
+	while (std::getline(in,text)) {
+		string::size_type loc=text.find('\t');
+		if (loc==string::npos) continue;
+		BenchQuery q;
+		q.key=text.substr(0,loc);
+		std::stringstream(text.substr(loc+1))>>q.count;
+		if (q.count==0) continue;
+		++lines;
+		if (sample.size()<max_keys) sample.push_back(q);
+		else {
+			const uint64_t r=rng.below(lines);
+			if (r<max_keys) sample[r]=q;
+		}
+	}
+	in.pop();
+	return lines;
+}
+
+//hit_ratio of the queries are keys from the file.  The rest are keys from the file with a tab and a number added,
+//keys cannot contain a tab so these are never stored and anything found for them is a false positive.
+void generate_mphr_queries(const std::vector<BenchQuery> &sample, const BenchSettings &settings, BenchRandom &rng, std::vector<BenchQuery> &queries){
+	queries.resize(settings.num_queries);
+	for (uint64_t i=0; i<settings.num_queries; ++i) {
+		queries[i]=sample[rng.below(sample.size())];
+		if (rng.unit()>=settings.hit_ratio) {
+			std::ostringstream miss;
+			miss<<queries[i].key<<'\t'<<i;
+			queries[i].key=miss.str();
+			queries[i].count=0;
+		}
+	}
+}
+
+
+//One thread's share of the queries
+struct MPHRWorker {
+	const MPHR *mphr;
+	const std::vector<BenchQuery> *queries;
+	size_t begin, end;
+	bool timed;
+	uint64_t timer_overhead;
+	LatencyStats stats;
+	uint64_t hits, hit_errors, misses, false_positives;
+	uint64_t checksum;
+};
+
+void *run_mphr_worker(void *arg){
+	MPHRWorker &w=*static_cast<MPHRWorker *>(arg);
+	//counted in locals so the threads do not share cache lines while they run
+	uint64_t hits=0, hit_errors=0, misses=0, false_positives=0, checksum=0;
+	LatencyStats stats;
+	if (w.timed) stats.reserve(w.end-w.begin);
+	for (size_t i=w.begin; i<w.end; ++i) {
+		const BenchQuery &q=(*w.queries)[i];
+		uint64_t value;
+		if (w.timed) {
+			const uint64_t t0=bench_now_ns();
+			value=w.mphr->query(q.key);
+			const uint64_t t1=bench_now_ns();
+			stats.add(t1-t0>w.timer_overhead?t1-t0-w.timer_overhead:0);
+		}
+		else value=w.mphr->query(q.key);
+		checksum+=value;
+		if (q.count) {
+			++hits;
+			if (value!=q.count) ++hit_errors;
+		}
+		else {
+			++misses;
+			if (value) ++false_positives;
+		}
+	}
+	w.hits=hits;
+	w.hit_errors=hit_errors;
+	w.misses=misses;
+	w.false_positives=false_positives;
+	w.checksum=checksum;
+	w.stats=stats;
+	return NULL;
+}
+
+//runs the queries split between num_threads threads and returns the wall clock time
+uint64_t run_mphr_threads(const MPHR &mphr, const std::vector<BenchQuery> &queries, const unsigned &num_threads, const bool &timed, std::vector<MPHRWorker> &workers){
+	workers.assign(num_threads,MPHRWorker());
+	const uint64_t timer_overhead=bench_timer_overhead_ns();
+	for (unsigned t=0; t<num_threads; ++t) {
+		workers[t].mphr=&mphr;
+		workers[t].queries=&queries;
+		workers[t].begin=queries.size()*t/num_threads;
+		workers[t].end=queries.size()*(t+1)/num_threads;
+		workers[t].timed=timed;
+		workers[t].timer_overhead=timer_overhead;
+	}
+	std::vector<pthread_t> ids(num_threads);
+	const uint64_t start=bench_now_ns();
+	for (unsigned t=0; t<num_threads; ++t) {
+		if (pthread_create(&ids[t],NULL,run_mphr_worker,&workers[t])!=0) {
+			cerr << "Error: unable to start benchmark thread "<<t<<endl;
+			exit(1);
+		}
+	}
+	for (unsigned t=0; t<num_threads; ++t) pthread_join(ids[t],NULL);
+	return bench_now_ns()-start;
+}
+
+//Times the stages of MPHR::query one at a time on a single thread:
+//cmph_search (the minimal perfect hash), hash (the fingerprint of the key), checkFP and at (the rank and value lookup, only for keys that pass checkFP)
+JsonRecord time_mphr_stages(const MPHR &mphr, const std::vector<BenchQuery> &queries){
+	const FingerPrintValueStore &store=mphr.fingerPrintValueStore();
+	const FingerPrintStore &fingerprints=store.fingerPrints();
+	const uint64_t timer_overhead=bench_timer_overhead_ns();
+	uint64_t slot_ns=0, hash_ns=0, check_ns=0, at_ns=0, at_calls=0;
+	volatile uint64_t checksum=0;
+	for (size_t i=0; i<queries.size(); ++i) {
+		const string &key=queries[i].key;
+		const uint64_t t0=bench_now_ns();
+		const uint64_t index=mphr.slot(key);
+		const uint64_t t1=bench_now_ns();
+		const uint64_t fingerprint=fingerprints.fp(key);
+		const uint64_t t2=bench_now_ns();
+		const bool found=fingerprints.checkFP(index,fingerprint);
+		const uint64_t t3=bench_now_ns();
+		slot_ns+=t1-t0;
+		hash_ns+=t2-t1;
+		check_ns+=t3-t2;
+		if (found) {
+			const uint64_t t4=bench_now_ns();
+			checksum+=store.valueAt(index);
+			at_ns+=bench_now_ns()-t4;
+			++at_calls;
+		}
+	}
+	const double n=queries.empty()?1:queries.size();
+	const double overhead=timer_overhead;
+	JsonRecord r;
+	r.add("cmph_search_ns",std::max(0.0,slot_ns/n-overhead))
+	 .add("hash_ns",std::max(0.0,hash_ns/n-overhead))
+	 .add("checkFP_ns",std::max(0.0,check_ns/n-overhead))
+	 .add("at_ns",at_calls?std::max(0.0,static_cast<double>(at_ns)/at_calls-overhead):0.0)
+	 .add("at_calls",at_calls);
+	return r;
+}
+
+//the number of ngrams in the file that query() gives a count other than their own, which a hot tier must not add to
+uint64_t check_every_ngram(const MPHR &mphr, const string &keyFileName){
+	HotKeyReader reader(keyFileName);
+	string key;
+	uint64_t count;
+	uint64_t incorrect=0;
+	while (reader.next(key,count)) {
+		if (count && mphr.query(key)!=count) ++incorrect;
+	}
+	return incorrect;
+}
+
+int bench_mphr(const BenchSettings &settings){
+	if (settings.key_file.empty()) {
+		cerr << "Error: mphr mode needs an ngram file (key<tab>count lines) to take the queries from"<<endl;
+		return 1;
+	}
+	if (settings.hit_ratio<0 || settings.hit_ratio>1) {
+		cerr << "Error: the hit ratio must be between 0 and 1"<<endl;
+		return 1;
+	}
+	ValueStoreType value_store_type=VALUE_STORE_ELIAS;
+	if (!settings.stores.empty() && !value_store_type_from_name(settings.stores,value_store_type)) {
+		cerr << "Error: "<<settings.stores<<" is not a value store.  Use one of elias, sarray, rank9, compact, fibonacci or tiered"<<endl;
+		return 1;
+	}
+
+	PerfCounters perf(settings.perf_counters);
+	double build_seconds=0;
+	boost::shared_ptr<MPHR> mphr;
+	uint64_t t=bench_now_ns();
+	if (!settings.load_base.empty()) mphr.reset(new MPHR(settings.load_base));
+	else mphr.reset(new MPHR(settings.key_file.c_str(),settings.bits_per_fingerprint,0,NULL,value_store_type));
+	if (settings.hot_keys) mphr->buildHotTier(settings.key_file.c_str(),settings.hot_keys,NULL,std::min(settings.bits_per_fingerprint+8,30u));
+	build_seconds=(bench_now_ns()-t)/1e9;
+
+	BenchRandom rng(settings.seed);
+	std::vector<BenchQuery> sample, queries;
+	const uint64_t lines=sample_ngrams(settings.key_file,settings.num_queries,rng,sample);
+	if (sample.empty()) {
+		cerr << "Error: there are no key<tab>count lines in "<<settings.key_file<<endl;
+		return 1;
+	}
+	generate_mphr_queries(sample,settings,rng,queries);
+	cerr << "Replaying "<<queries.size()<<" queries made from "<<sample.size()<<" of the "<<lines<<" ngrams"<<endl;
+
+	JsonRecord common;
+	common.add("store",value_store_name(mphr->valueStoreType()))
+	 .add("keys",mphr->size())
+	 .add(settings.load_base.empty()?"build_seconds":"load_seconds",build_seconds)
+	 .add("queries",static_cast<uint64_t>(queries.size()))
+	 .add("hit_ratio",settings.hit_ratio)
+	 .add("seed",settings.seed);
+
+	JsonRecord stages;
+	stages.add("bench","mphr_stages").raw("setup",common.str()).add("stages",time_mphr_stages(*mphr,queries));
+	cout << stages.str() <<endl;
+
+	const std::vector<string> thread_counts=split_list(settings.threads);
+	for (size_t i=0; i<thread_counts.size(); ++i) {
+		const unsigned num_threads=std::max(1,atoi(thread_counts[i].c_str()));
+		std::vector<MPHRWorker> workers;
+		//one untimed pass for the throughput (and counters) and one with every query timed for the latencies
+		perf.start();
+		const uint64_t elapsed=run_mphr_threads(*mphr,queries,num_threads,false,workers);
+		perf.stop();
+		JsonRecord counters=perf.per_op(queries.size());
+		run_mphr_threads(*mphr,queries,num_threads,true,workers);
+		LatencyStats stats;
+		uint64_t hits=0, hit_errors=0, misses=0, false_positives=0;
+		for (unsigned w=0; w<num_threads; ++w) {
+			stats.add(workers[w].stats);
+			hits+=workers[w].hits;
+			hit_errors+=workers[w].hit_errors;
+			misses+=workers[w].misses;
+			false_positives+=workers[w].false_positives;
+		}
+		JsonRecord r;
+		r.add("bench","mphr")
+		 .raw("setup",common.str())
+		 .add("threads",static_cast<uint64_t>(num_threads))
+		 .add("qps",elapsed?queries.size()*1e9/elapsed:0.0)
+		 .add("latency",latency_record(stats))
+		 .add("hits",hits)
+		 .add("hit_errors",hit_errors)
+		 .add("misses",misses)
+		 .add("false_positives",false_positives)
+		 .add("fp_rate",misses?static_cast<double>(false_positives)/misses:0.0);
+		if (perf.available()) r.add("counters_per_query",counters);
+		cout << r.str() <<endl;
+		if (hit_errors) cerr << "Warning: "<<hit_errors<<" stored ngrams returned the wrong count (is the same ngram in the file twice?)"<<endl;
+	}
+	if (mphr->hotTier()) {
+		const uint64_t incorrect=check_every_ngram(*mphr,settings.key_file);
+		JsonRecord r;
+		r.add("bench","mphr_check").raw("setup",common.str()).add("hot_keys",mphr->hotTier()->size()).add("incorrect",incorrect);
+		cout << r.str() <<endl;
+		if (incorrect) {
+			cerr << "Error: "<<incorrect<<" stored ngrams got the wrong count with the hot tier"<<endl;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+int main(int argc, char **argv){
+	BenchSettings settings;
+	settings.num_elements=10000000;
+	settings.unique_values=771058;
+	settings.zipf_exponent=1.0;
+	settings.seed=1;
+	settings.num_queries=1000000;
+	settings.num_bits=1ULL<<27;
+	settings.densities="0.01,0.1,0.5,0.9";
+	settings.patterns="uniform,zipf,gamma";
+	settings.batch_size=64;
+	settings.bits_per_fingerprint=12;
+	settings.hit_ratio=0.9;
+	settings.hot_keys=0;
+	settings.perf_counters=false;
+	const long processors=sysconf(_SC_NPROCESSORS_ONLN);
+	std::ostringstream threads;
+	threads<<1;
+	if (processors>1) threads<<","<<processors;
+	settings.threads=threads.str();
+	string mode="values";
+
+	int c;
+	while ((c = getopt (argc, argv, "hm:n:u:z:S:q:v:p:d:B:l:f:H:r:t:P")) != -1){
+		switch (c){
+			case 'h':
+				print_usage(argv[0]);
+				return 0;
+			case 'm':
+				mode=optarg;
+				break;
+			case 'n':
+				settings.num_elements=settings.num_bits=strtoull(optarg,NULL,10);
+				break;
+			case 'u':
+				settings.unique_values=strtoull(optarg,NULL,10);
+				break;
+			case 'z':
+				settings.zipf_exponent=atof(optarg);
+				break;
+			case 'S':
+				settings.seed=strtoull(optarg,NULL,10);
+				break;
+			case 'q':
+				settings.num_queries=strtoull(optarg,NULL,10);
+				break;
+			case 'v':
+				settings.stores=optarg;
+				break;
+			case 'p':
+				settings.patterns=optarg;
+				break;
+			case 'd':
+				settings.densities=optarg;
+				break;
+			case 'B':
+				settings.batch_size=strtoull(optarg,NULL,10);
+				break;
+			case 'l':
+				settings.load_base=optarg;
+				break;
+			case 'f':
+				settings.bits_per_fingerprint=atoi(optarg);
+				break;
+			case 'H':
+				settings.hot_keys=strtoull(optarg,NULL,10);
+				break;
+			case 'r':
+				settings.hit_ratio=atof(optarg);
+				break;
+			case 't':
+				settings.threads=optarg;
+				break;
+			case 'P':
+				settings.perf_counters=true;
+				break;
+			default:
+				cerr << " That is not a valid option to the program\n\n";
+				print_usage(argv[0]);
+				return 1;
+		}
+	}
+	//non getopt arg is the ngram file for mphr mode
+	if (optind < argc) settings.key_file=argv[optind];
+	if (settings.num_elements==0 || settings.unique_values==0) {
+		cerr << "Error: -n and -u must be greater than 0"<<endl;
+		return 1;
+	}
+
+	if (mode=="values") return bench_values(settings);
+	if (mode=="select") return bench_select(settings);
+	if (mode=="mphr") return bench_mphr(settings);
+
+	cerr << "Error: "<<mode<<" is not a benchmark mode"<<endl;
+	print_usage(argv[0]);
+	return 1;
+}
@@ -0,0 +1,329 @@
+/*
+ *  main-gen.cpp
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Writes synthetic ngram<tab>count files that look like the Google ngrams, so builds can be tested at scale without real data.
+//
+//Words are drawn from a Zipfian vocabulary and every ngram is only written once.
+//Counts follow a power law over about 771058 distinct values (the number of distinct counts in the Google ngrams)
+//and the lines come out grouped by count, smallest (and most common) count first, which is the order shefLMStore
+//expects when it gives each new count the next rank.  Nothing is sorted, so billions of lines can be written:
+//the number of ngrams with each count is worked out up front and only a bloom filter of the ngrams is kept in memory.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <stdlib.h>
+#include <getopt.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+
+#include "Benchmark.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+
+
+struct GenSettings {
+	uint64_t num_keys;
+	unsigned order;
+	uint64_t vocabulary_size;
+	double word_exponent;
+	uint64_t distinct_counts;
+	double count_exponent;
+	uint64_t min_count;
+	uint64_t max_count;
+	uint64_t seed;
+	unsigned shards;
+	bool gzip;
+	unsigned bloom_bits_per_key;
+};
+
+
+void print_usage(const char *prg_name){
+	cerr<< "\nUsage: " << prg_name <<" [-h] [-n num_keys] [-o order] [-V vocabulary_size] [-w word_exponent] [-u distinct_counts] [-z count_exponent] [-c min_count] [-C max_count] [-S seed] [-k shards] [-g] [-b bloom_bits_per_key] [outputPrefix]"
+		<< "\n\n\tWrites a synthetic file of unique ngrams and their counts (ngram<tab>count on each line) that can be given to shefLMStore or shefLMBench.\n"
+		<< "\tThe output only depends on the options, so the same seed always gives the same file.\n"
+		<< "\tThe lines are grouped by count from the smallest count up.  Without an outputPrefix the lines are written to stdout.\n\n"
+		<< "\t-h print this help\n"
+		<< "\t-n number of ngrams to write, default is 1000000\n"
+		<< "\t-o number of words in each ngram, default is 3\n"
+		<< "\t-V number of words in the vocabulary, default is 1000000\n"
+		<< "\t-w Zipf exponent of the word frequencies, default is 1.0\n"
+		<< "\t-u number of distinct counts, default is 771058 (as in the Google ngrams).  Smaller files will not use all of them\n"
+		<< "\t-z power law exponent of the counts, default is 1.0\n"
+		<< "\t-c smallest count, default is 40 (the cut off used for the Google ngrams)\n"
+		<< "\t-C largest count, default is 10000000000\n"
+		<< "\t-S random seed, default is 1\n"
+		<< "\t-k split the output into this many files, outputPrefix-00000 onwards, default is 1.  Reading the files in order gives the whole file\n"
+		<< "\t-g gzip the output files (the .gz suffix is added)\n"
+		<< "\t-b bits per ngram in the bloom filter used to make every ngram unique, default is 12 (1.5GB for a billion ngrams)\n"
+		<< "\n"
+		<< "Example: " << prg_name <<" -n 100000000 -o 5 -k 10 -g 5gm\n"
+		<< "Example: " << prg_name <<" -n 1000000 1m.txt && shefLMStore -g 1mstore 1m.txt\n"
+		<<endl;
+}
+
+
+//the word with frequency rank r.  Frequent words are short, like real text: a, b, ... z, aa, ab ...
+string word_for_rank(uint64_t r){
+	string w;
+	do {
+		w+=static_cast<char>('a'+r%26);
+		r=r/26;
+	} while (r--);
+	return string(w.rbegin(),w.rend());
+}
+
+
+//Remembers which ngrams have been written.  It can say an ngram was written when it was not,
+//in which case we just draw another one, but it never misses one so no ngram is written twice.
+class NgramBloomFilter {
+public:
+	NgramBloomFilter(const uint64_t &num_keys, const unsigned &bits_per_key)
+	:num_bits(std::max<uint64_t>(64,num_keys*bits_per_key)),
+	num_probes(std::max(1,static_cast<int>(bits_per_key*0.69+0.5))),
+	bits((num_bits+63)/64,0){}
+
+	//returns false if hash was (probably) added before
+	bool add(const uint64_t &hash){
+		const uint64_t step=(hash>>32)|1;
+		uint64_t h=hash;
+		bool added=false;
+		for (unsigned i=0; i<num_probes; ++i, h+=step) {
+			const uint64_t b=h%num_bits;
+			if (!(bits[b>>6]&(1ULL<<(b&63)))) {
+				bits[b>>6]|=1ULL<<(b&63);
+				added=true;
+			}
+		}
+		return added;
+	}
+	uint64_t size_in_bits() const {return 64*bits.size();}
+private:
+	uint64_t num_bits;
+	unsigned num_probes;
+	std::vector<uint64_t> bits;
+};
+
+
+//The count given to count rank r.  Small counts are all used (40, 41, 42 ...) and the gaps grow towards max_count
+uint64_t count_for_rank(const uint64_t &r, const GenSettings &settings){
+	const double x=settings.distinct_counts>1?static_cast<double>(r)/(settings.distinct_counts-1):0;
+	return settings.min_count+r+static_cast<uint64_t>((settings.max_count-settings.min_count-(settings.distinct_counts-1))*x*x*x);
+}
+
+
+//Writes the lines to stdout or to a list of (optionally gzipped) shards
+class ShardWriter {
+public:
+	ShardWriter(const string &prefix, const GenSettings &settings)
+	:prefix(prefix),gzip(settings.gzip),shards(settings.shards),keys_per_shard((settings.num_keys+settings.shards-1)/settings.shards),shard(0),written(0){
+		if (!prefix.empty()) open();
+	}
+	~ShardWriter(){close();}
+	std::ostream & next_line(){
+		if (!prefix.empty() && written==keys_per_shard*(shard+1) && shard+1<shards) {
+			close();
+			++shard;
+			open();
+		}
+		++written;
+		return prefix.empty()?cout:out;
+	}
+private:
+	void open(){
+		std::ostringstream name;
+		name<<prefix;
+		if (shards>1) name<<"-"<<std::setw(5)<<std::setfill('0')<<shard;
+		if (gzip) name<<".gz";
+		file.reset(new std::ofstream(name.str().c_str(),std::ios_base::out|std::ios_base::binary));
+		if (!*file) {
+			cerr << "Error: unable to open output file: "<<name.str()<<endl;
+			exit(1);
+		}
+		if (gzip) out.push(boost::iostreams::gzip_compressor());
+		out.push(*file);
+		cerr << "Writing "<<name.str()<<endl;
+	}
+	void close(){
+		if (out.empty()) return;
+		out.reset(); //flushes and finishes the gzip stream
+		file.reset();
+	}
+	string prefix;
+	bool gzip;
+	unsigned shards;
+	uint64_t keys_per_shard;
+	unsigned shard;
+	uint64_t written;
+	boost::shared_ptr<std::ofstream> file;
+	boost::iostreams::filtering_stream<boost::iostreams::output> out;
+};
+
+
+int generate(const GenSettings &settings, const string &prefix){
+	//there have to be enough different ngrams to choose from
+	if (settings.order*log(static_cast<double>(settings.vocabulary_size)) < log(2.0*settings.num_keys)) {
+		cerr << "Error: a vocabulary of "<<settings.vocabulary_size<<" words does not make enough different "<<settings.order<<"-grams for "<<settings.num_keys<<" keys"<<endl;
+		return 1;
+	}
+	cerr << "Generating "<<settings.num_keys<<" "<<settings.order<<"-grams over "<<settings.vocabulary_size<<" words"<<endl;
+
+	BenchRandom rng(settings.seed);
+	ZipfGenerator words(settings.vocabulary_size,settings.word_exponent);
+	std::vector<string> vocabulary(settings.vocabulary_size);
+	for (uint64_t r=0; r<settings.vocabulary_size; ++r) vocabulary[r]=word_for_rank(r);
+	NgramBloomFilter seen(settings.num_keys,settings.bloom_bits_per_key);
+	cerr << "Bloom filter uses "<<seen.size_in_bits()/8<<" bytes"<<endl;
+
+	//the share of the keys that get count rank r follows a power law, rank 0 (the smallest count) is the most common
+	std::vector<double> count_cdf(settings.distinct_counts);
+	double sum=0;
+	for (uint64_t r=0; r<settings.distinct_counts; ++r) count_cdf[r]=(sum+=1.0/pow(static_cast<double>(r+1),settings.count_exponent));
+
+	ShardWriter writer(prefix,settings);
+	std::vector<uint64_t> ngram(settings.order);
+	uint64_t keys_written=0, distinct_counts_used=0, rejected=0;
+	for (uint64_t r=0; r<settings.distinct_counts; ++r) {
+		//rounding the running total makes the keys add up to exactly num_keys
+		const uint64_t keys_up_to_r=(r+1==settings.distinct_counts)?settings.num_keys:static_cast<uint64_t>(settings.num_keys*(count_cdf[r]/sum));
+		if (keys_up_to_r<=keys_written) continue;
+		const uint64_t count=count_for_rank(r,settings);
+		++distinct_counts_used;
+		for (; keys_written<keys_up_to_r; ++keys_written) {
+			unsigned tries=0;
+			while (true) {
+				uint64_t hash=settings.seed;
+				for (unsigned i=0; i<settings.order; ++i) {
+					ngram[i]=words.next(rng);
+					hash=(hash^ngram[i])*0x9E3779B97F4A7C15ULL;
+					hash^=hash>>29;
+				}
+				if (seen.add(hash)) break;
+				++rejected;
+				if (++tries==100000) {
+					cerr << "Error: unable to find a new ngram after "<<tries<<" tries.  Use a larger vocabulary (-V) or a smaller word exponent (-w)"<<endl;
+					return 1;
+				}
+			}
+			std::ostream &out=writer.next_line();
+			out<<vocabulary[ngram[0]];
+			for (unsigned i=1; i<settings.order; ++i) out<<' '<<vocabulary[ngram[i]];
+			out<<'\t'<<count<<'\n';
+			if ((keys_written&((1<<24)-1))==0 && keys_written) cerr << "Written "<<keys_written<<" ngrams"<<endl;
+		}
+	}
+	cerr << "Wrote "<<keys_written<<" ngrams with "<<distinct_counts_used<<" distinct counts ("<<rejected<<" repeated ngrams were drawn again)"<<endl;
+	return 0;
+}
+
+
+int main(int argc, char **argv){
+	GenSettings settings;
+	settings.num_keys=1000000;
+	settings.order=3;
+	settings.vocabulary_size=1000000;
+	settings.word_exponent=1.0;
+	settings.distinct_counts=771058;
+	settings.count_exponent=1.0;
+	settings.min_count=40;
+	settings.max_count=10000000000ULL;
+	settings.seed=1;
+	settings.shards=1;
+	settings.gzip=false;
+	settings.bloom_bits_per_key=12;
+
+	int c;
+	while ((c = getopt (argc, argv, "hn:o:V:w:u:z:c:C:S:k:gb:")) != -1){
+		switch (c){
+			case 'h':
+				print_usage(argv[0]);
+				return 0;
+			case 'n':
+				settings.num_keys=strtoull(optarg,NULL,10);
+				break;
+			case 'o':
+				settings.order=atoi(optarg);
+				break;
+			case 'V':
+				settings.vocabulary_size=strtoull(optarg,NULL,10);
+				break;
+			case 'w':
+				settings.word_exponent=atof(optarg);
+				break;
+			case 'u':
+				settings.distinct_counts=strtoull(optarg,NULL,10);
+				break;
+			case 'z':
+				settings.count_exponent=atof(optarg);
+				break;
+			case 'c':
+				settings.min_count=strtoull(optarg,NULL,10);
+				break;
+			case 'C':
+				settings.max_count=strtoull(optarg,NULL,10);
+				break;
+			case 'S':
+				settings.seed=strtoull(optarg,NULL,10);
+				break;
+			case 'k':
+				settings.shards=atoi(optarg);
+				break;
+			case 'g':
+				settings.gzip=true;
+				break;
+			case 'b':
+				settings.bloom_bits_per_key=atoi(optarg);
+				break;
+			default:
+				cerr << " That is not a valid option to the program\n\n";
+				print_usage(argv[0]);
+				return 1;
+		}
+	}
+	//non getopt arg is the output prefix
+	string prefix;
+	if (optind < argc) prefix=argv[optind];
+
+	if (settings.num_keys==0 || settings.order==0 || settings.vocabulary_size==0 || settings.distinct_counts==0 || settings.shards==0 || settings.bloom_bits_per_key==0) {
+		cerr << "Error: -n, -o, -V, -u, -k and -b must all be greater than 0"<<endl;
+		return 1;
+	}
+	if (settings.min_count==0 || settings.max_count<settings.min_count+settings.distinct_counts) {
+		cerr << "Error: counts must start above 0 and -C must leave room for "<<settings.distinct_counts<<" distinct counts above -c"<<endl;
+		return 1;
+	}
+	if (prefix.empty() && (settings.shards>1 || settings.gzip)) {
+		cerr << "Error: -k and -g need an outputPrefix"<<endl;
+		return 1;
+	}
+	return generate(settings,prefix);
+}
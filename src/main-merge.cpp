@@ -0,0 +1,203 @@
+/*
+ *  main-merge.cpp
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//Merges stores written by shefLMStore -g, and the key files they were built from, into one store with the counts of
+//the ngrams that are in more than one of them summed (see StoreMerger.h).  The merged store is built in shards by a
+//thread for every cpu (see the sharded MPHR constructor) while its key file is written.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <boost/shared_ptr.hpp>
+
+#include "MPHR.h"
+#include "StoreMerger.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+
+
+void print_usage(const char *prg_name){
+	cerr<< "\nUsage: " << prg_name <<" [-h] -g outputBaseFileName [-o mergedKeyFile] [-f bits_per_fp] [-v value_store] [-b bits_per_rank] [-H hot_keys] [-z level] [-w workers] [-P profile.json] -l inputBaseFileName keyTABvalueFile -l inputBaseFileName keyTABvalueFile ..."
+		<< "\n\n\tMerges stores written with shefLMStore -g into one store that has every ngram of them, with the counts of the\n"
+		<< "\tngrams that are in more than one of them added up.  Every store is given with -l and the key file it was built\n"
+		<< "\tfrom, the key files in the same order as the -l options.  The key files are read by a thread each and the stores\n"
+		<< "\tare used to find the ngrams they share, which are sorted and summed in temporary files next to the merged key\n"
+		<< "\tfile, so every key file is read once and only a run of the keys being sorted is held in memory.  The keys are\n"
+		<< "\tsplit into shards as they are read, and the merged store is built a shard at a time on each thread from them\n"
+		<< "\tand the values of the stores while the merged key file is written.\n\n"
+		<< "\t-h print this help\n"
+		<< "\t-g write the merged store using this filename prefix, as shefLMStore -g does\n"
+		<< "\t-o write the merged key file here, default is outputBaseFileName.keys (gzipped if it ends in .gz).\n"
+		<< "\t\tIt is kept as it is the key file of the merged store\n"
+		<< "\t-l load a store to merge using the filename prefix specified\n"
+		<< "\t-f number of bits to use for each fingerprint, default is that of the first store\n"
+		<< "\t-v the structure used to store the rank of every ngram (as for shefLMStore), default is that of the first store\n"
+		<< "\t-b number of bits to use for each rank with -v compact or tiered, default is as for shefLMStore\n"
+		<< "\t-H build a hot tier of this many keys with the largest counts, as shefLMStore -H does\n"
+		<< "\t-z the zlib level (0 to 9, 0 is not compressed) of the .fp_values file, default is 6\n"
+		<< "\t-w number of threads building the shards of the merged store, default is the number of cpus.  There is a\n"
+		<< "\t\tshard for every thread, or fewer if the stores are small\n"
+		<< "\t-P write the wall time, cpu time, keys/sec and peak memory of every phase to the file given as JSON (use - for stderr)\n"
+		<< "\n"
+		<< "Example: " << prg_name <<" -g both -l 2009store 2009ngrams.txt.gz -l 2010store 2010ngrams.txt.gz\n"
+		<<endl;
+}
+
+
+int main(int argc, char **argv){
+	const char *outputBaseFileName=NULL;
+	string mergedKeyFileName;
+	std::vector<string> inputBaseFileNames;
+	unsigned bits_per_fingerprint=0;
+	unsigned bits_per_rank=0;
+	bool valueStoreGiven=false;
+	ValueStoreType value_store_type=VALUE_STORE_ELIAS;
+	uint64_t hot_keys=0;
+	int compression_level=CHUNKED_FILE_DEFAULT_LEVEL;
+	const char *profileFileName=NULL;
+	long workers=sysconf(_SC_NPROCESSORS_ONLN);
+
+	int c;
+	while ((c = getopt (argc, argv, "hg:o:l:f:v:b:H:z:w:P:")) != -1){
+		switch (c){
+			case 'h':
+				print_usage(argv[0]);
+				return 0;
+			case 'g':
+				outputBaseFileName=optarg;
+				break;
+			case 'o':
+				mergedKeyFileName=optarg;
+				break;
+			case 'l':
+				inputBaseFileNames.push_back(optarg);
+				break;
+			case 'f':
+				bits_per_fingerprint=atoi(optarg);
+				break;
+			case 'v':
+				if (!value_store_type_from_name(optarg,value_store_type)){
+					cerr << "\nError: "<<optarg<<" is not a value store.  Use one of elias, sarray, rank9, compact, fibonacci or tiered\n";
+					print_usage(argv[0]);
+					return 1;
+				}
+				valueStoreGiven=true;
+				break;
+			case 'b':
+				bits_per_rank=atoi(optarg);
+				break;
+			case 'H':
+				hot_keys=strtoull(optarg,NULL,10);
+				break;
+			case 'z':
+				compression_level=atoi(optarg);
+				if (compression_level<0 || compression_level>9 || !isdigit(optarg[0])){
+					cerr << "\nError: the compression level must be from 0 (none) to 9\n";
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'w':
+				workers=atol(optarg);
+				break;
+			case 'P':
+				profileFileName=optarg;
+				BuildProfiler::enable();
+				break;
+			default:
+				cerr << " That is not a valid option to the program\n\n";
+				print_usage(argv[0]);
+				return 1;
+		}
+	}
+	//non getopt args are the key files of the stores
+	std::vector<string> keyFileNames;
+	for (; optind < argc; ++optind) keyFileNames.push_back(argv[optind]);
+	if (outputBaseFileName==NULL || inputBaseFileNames.size()<2 || keyFileNames.size()!=inputBaseFileNames.size()) {
+		cerr << "\nError: give -g and at least two stores with -l, and the key file of every store in the same order." <<endl;
+		print_usage(argv[0]);
+		return 1;
+	}
+	if (mergedKeyFileName.empty()) mergedKeyFileName=string(outputBaseFileName)+".keys";
+	for (size_t i=0; i<keyFileNames.size(); ++i) {
+		if (keyFileNames[i]==mergedKeyFileName) {
+			cerr << "Error: the merged key file would replace the key file "<<keyFileNames[i]<<endl;
+			return 1;
+		}
+	}
+
+	if (workers<1) workers=1;
+
+	std::vector<boost::shared_ptr<MPHR> > stores;
+	uint64_t store_keys=0;
+	for (size_t i=0; i<inputBaseFileNames.size(); ++i) {
+		stores.push_back(boost::shared_ptr<MPHR>(new MPHR(inputBaseFileNames[i])));
+		store_keys+=stores.back()->size();
+	}
+	if (!bits_per_fingerprint) bits_per_fingerprint=stores[0]->fingerPrintValueStore().fingerPrints().bitsPerFingerprint();
+	if (!valueStoreGiven) value_store_type=stores[0]->valueStoreType();
+	const unsigned shards=std::max<uint64_t>(1,std::min<uint64_t>(workers,store_keys/StoreMerger::MIN_SHARD_KEYS));
+	cerr << "Merging the key files of "<<stores.size()<<" stores into "<<shards<<" shards"<<endl;
+	StoreMerger merger(stores,keyFileNames,shards,directory_of(mergedKeyFileName));
+	merger.split();
+	cerr << "The counts of "<<merger.sharedKeys()<<" keys were added to those of the same key in another store"<<endl;
+	//the stores are freed before the merged one is built
+	stores.clear();
+
+	//a hot tier left by an earlier store of the same name would be loaded with the merged one
+	const string suffixes[5]={HASH_FILENAME_SUFIX,FP_VALUE_FILENAME_SUFIX,HOT_TIER_FILENAME_SUFIX HASH_FILENAME_SUFIX,HOT_TIER_FILENAME_SUFIX FP_VALUE_FILENAME_SUFIX,HOT_TIER_FILENAME_SUFIX STORE_SLOTS_FILENAME_SUFIX};
+	for (int i=0; i<5; ++i) unlink((string(outputBaseFileName)+suffixes[i]).c_str());
+	cerr << "Writing the merged key file "<<mergedKeyFileName<<" while the merged store is built"<<endl;
+	merger.startKeyFile(mergedKeyFileName);
+	MPHR merged(merger.shardKeys(),merger.values(),bits_per_fingerprint,bits_per_rank,value_store_type,workers,outputBaseFileName);
+	const uint64_t keys=merger.finishKeyFile();
+	if (keys!=merged.size()) {
+		cerr << "Error: the merged key file has "<<keys<<" keys but the merged store has "<<merged.size()<<endl;
+		return 1;
+	}
+	cerr << "The merged key file has "<<keys<<" keys"<<endl;
+	if (hot_keys) merged.buildHotTier(mergedKeyFileName.c_str(),hot_keys,NULL,std::min(bits_per_fingerprint+8,30u),outputBaseFileName);
+	merged.writeMPHRToFilesWithBaseName(outputBaseFileName,compression_level);
+
+	if (profileFileName){
+		if (strcmp(profileFileName,"-")==0) BuildProfiler::instance().print_json(cerr);
+		else {
+			std::ofstream profile(profileFileName);
+			if (!profile) {
+				cerr << "Error: can't write the build profile to: "<<profileFileName<<endl;
+				return 1;
+			}
+			BuildProfiler::instance().print_json(profile);
+		}
+	}
+	return 0;
+}
@@ -24,12 +24,14 @@
 
 
 
-/*
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <string>
 #include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <csignal>
 
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
@@ -39,14 +41,23 @@
 
 #include "MPHR.h"
 #include "KneserNeyWrapper.h"
+#include "QueryServer.h"
+#include "SharedModel.h"
+#include "ModelWarmup.h"
+#include "DeltaMerger.h"
 
 
 void null_deleter(void const*){}
 
+static QueryServer *server=NULL;
+void stop_server(int){
+	if (server) server->stop();
+}
+
 
 void print_usage(const char *prg_name){
 	
-	cerr<< "\nUsage: " << prg_name <<" [-h] [-l inputBaseFileName ] [-g outputBaseFileName] [-f bits_per_fp] [-b bits_per_rank] [-k] [-q queryfile] keyTABvalueFile"
+	cerr<< "\nUsage: " << prg_name <<" [-h] [-l inputBaseFileName ] [-g outputBaseFileName [-z level]] [--compressed-runs] [-f bits_per_fp] [-v value_store] [-b bits_per_rank] [-k] [-q queryfile] [-s|--stats] [-m text|json] [-P profile.json] [-H hot_keys [-Q querylog]] [-S socket|tcp:port [-w workers] [-B batch_keys]] [--shm name] [--shm-remove name] [--huge-pages] [--numa local|interleave|replicate] [--warmup [--warmup-status file]] [--delta logfile [--delta-merge-keys keys]] keyTABvalueFile"
 		<< "\n\n\tThis program creates a storage sturcture that stores all the keys and values in the keyTABvalueFile so that they can be looked up quickly. This structure can be saved to disk with the \"-g\" option.  And then loaded later with the \"-l\" option \n\n"
 		<< "\tkeyTABvalueFile: this file is used to read keys and values.\n"
 		<< "\t\t-This file should be pre-sorted by VALUE (Values should be ascending. So one counts first!)\n"
@@ -56,11 +67,60 @@ void print_usage(const char *prg_name){
 		<< "\t-h print this help\n"
 		<< "\t-g write all files needed for MPHR structure to disk using the filename prefix specified\n"
 		<< "\t\t2 files will be written using the basename prefix specified and ending in .hash and .fp_values\n"
+		<< "\t-z, --compression the zlib level (0 to 9) of the .fp_values file written with -g, default is 6.  0 stores it\n"
+		<< "\t\twithout compressing it, which is the largest but the quickest to load.  The file is written and read as\n"
+		<< "\t\tchunks that are compressed with a thread for every cpu, and files that were written gzipped can still be loaded\n"
+		<< "\t--compressed-runs keep the sorted runs of ranks made while building the structure in zlib compressed memory\n"
+		<< "\t\tinstead of in temporary files next to the -g files (or in TMPDIR), for machines with no disk to spare\n"
 		<< "\t-l load the MPHR structure using the filename prefix specified\n"
 		<< "\t\t.hash, and .fp_values files must exist with the given prefix\n"
 		<< "\t-f number of bits to use for each fingerprint, default is 12\n"
-		<< "\t-b number of bits to use for each rank, default is 20\n"
-		<< "\tThe -b and -f options have no effect if loading a structure with the -l option\n"
+		<< "\t-v the structure used to store the rank of every ngram, default is elias\n"
+		<< "\t\telias: smallest, gamma codes indexed with elias fano\n"
+		<< "\t\tsarray: gamma codes indexed with an sarray\n"
+		<< "\t\trank9: gamma codes indexed with rank9sel, larger but quicker than elias\n"
+		<< "\t\tcompact: every rank uses the same number of bits, the largest but the fastest\n"
+		<< "\t\tfibonacci: fibonacci codes, usually smaller than elias when most ranks are small\n"
+		<< "\t\ttiered: a few bits for every rank with the large ranks escaped to a second array, nearly as fast as compact\n"
+		<< "\t-b number of bits to use for each rank with -v compact, default is as few as are needed\n"
+		<< "\t\tor for each rank in the first array with -v tiered, default is the number that makes the store smallest\n"
+		<< "\tThe -v, -b and -f options have no effect if loading a structure with the -l option\n"
+		<< "\t-s, --stats print the memory used by every part of the structure and the bits it takes per key\n"
+		<< "\t\tIf no query file is given with -s then nothing is read from stdin\n"
+		<< "\t-m print the query metrics (hit rate, fingerprint rejects, queries per second and latency histograms)\n"
+		<< "\t\tto stderr as text or json when the queries are finished, and every time the program is sent SIGUSR1\n"
+		<< "\t-P write the wall time, cpu time, keys/sec and peak memory of every phase of building, loading\n"
+		<< "\t\tand writing the structure to the file given as JSON (use - for stderr)\n"
+		<< "\t-H build a hot tier of this many keys that is looked in before the full store.  The keys with the largest\n"
+		<< "\t\tvalues are used unless -Q is given.  The hot tier uses compact ranks and 8 more fingerprint bits (up to 30)\n"
+		<< "\t\tthan -f.  It is written and loaded with the rest of the structure (as files ending .hot.hash, .hot.fp_values and .hot.slots)\n"
+		<< "\t-Q use the keys queried most often in this query log (one ngram per line) for the hot tier\n"
+		<< "\t-S, --serve serve lookups on this Unix socket path, or on a port of 127.0.0.1 given as tcp:PORT, until\n"
+		<< "\t\tSIGINT or SIGTERM.  -S can be given more than once.  A request is a little endian uint32 number of keys\n"
+		<< "\t\tfollowed by a uint32 length and the bytes of every key, the reply is a uint32 number of values and a\n"
+		<< "\t\tuint64 value (0 if not found) for every key\n"
+		<< "\t-w, --workers number of threads looking up the keys of requests with -S, default is the number of cpus\n"
+		<< "\t-B, --batch the most keys a worker takes from the waiting requests at once with -S, default is 4096\n"
+		<< "\t--shm with -l, use the structure from the POSIX shared memory of this name, loading it there first if no\n"
+		<< "\t\tother process has.  Every process that uses the same name shares one read only copy.  A name with a\n"
+		<< "\t\tdirectory in it is a file that is mapped instead, such as a file on a hugetlbfs mount.  The copy is made\n"
+		<< "\t\tagain if the files it was loaded from have changed.  It can't be used with -g or -H\n"
+		<< "\t--shm-remove remove the shared memory of this name, the processes using it keep it until they exit\n"
+		<< "\t--huge-pages move the big arrays of the structure to memory on 2MB pages once it is built or loaded, using\n"
+		<< "\t\treserved huge pages if there are any and transparent huge pages if not.  With --shm the shared memory\n"
+		<< "\t\tasks for transparent huge pages when it is made\n"
+		<< "\t--numa where the pages of the big arrays go on a machine with more than one NUMA node: local (the default,\n"
+		<< "\t\twhere the kernel puts them), interleave (spread over every node) or replicate (a copy of the structure on\n"
+		<< "\t\tevery node, and every query reads the copy on the node of the cpu it runs on).  replicate can't be used with --shm\n"
+		<< "\t--warmup fault in every page of the mapped arrays of the structure (--shm, --huge-pages or --numa) with a thread for\n"
+		<< "\t\tevery cpu, while queries are already being answered.  The hash function and the select inventories go first\n"
+		<< "\t--warmup-status write the progress of --warmup to this file as JSON every second, with \"ready\":true once it is done\n"
+		<< "\t--delta add the counts in this log (lines of NGRAM\\tCOUNT, in the format of the keyTABvalueFile) to the values\n"
+		<< "\t\tof the structure, following the lines that are appended to it while the program runs.  The log is read\n"
+		<< "\t\tfrom the offset in the file logfile.merged, which is what has already been merged into the structure\n"
+		<< "\t--delta-merge-keys once counts have been added to this many keys merge the delta log into a new structure\n"
+		<< "\t\tin the background, replacing the keyTABvalueFile, the structure files (of -l or -g) and logfile.merged.\n"
+		<< "\t\tQueries are answered by the old structure until the new one is ready.  It can't be used with --shm\n"
 		<< "\t-k **Compute Kneser Ney perplexity on query file.  In this case query file should be a text file.\n"
 		<< "\t\t**This option requires you to have stored special counts needed for KN in your language model."
 		<< "\n\n"
@@ -68,6 +128,9 @@ void print_usage(const char *prg_name){
 		<< "Example 1 (store): " << prg_name <<" -g 3gmstore sample_ngram_file.txt\n"
 		<< "Example 2 (query): " << prg_name <<" -l 3gmstore -q sample_ngram_file.txt\n"
 		<< "Example 3 (query): cat sample_ngram_file.txt | ./" << prg_name <<" -l 3gmstore\n"
+		<< "Example 4 (memory): " << prg_name <<" -l 3gmstore --stats\n"
+		<< "Example 5 (server): " << prg_name <<" -l 3gmstore -S /tmp/3gmstore.sock\n"
+		<< "Example 6 (shared): " << prg_name <<" -l 3gmstore --shm /3gmstore -q sample_ngram_file.txt\n"
 		<< "\n"
 		<< "Type: 'man " << prg_name <<"' for more information.\n"
 		<<endl;
@@ -83,14 +146,55 @@ int main(int argc, char **argv){
 	bool writeToDiskFlag=false;
 	bool loadFromDiskFlag=false;
 	bool kneserNeyOptionFlag=false;
+	bool statsFlag=false;
+	bool metricsFlag=false;
+	QueryMetrics::Format metricsFormat=QueryMetrics::TEXT;
+	const char *profileFileName=NULL;
+	uint64_t hot_keys=0;
+	const char *queryLogFileName=NULL;
+	std::vector<std::string> serveAddresses;
+	long workers=sysconf(_SC_NPROCESSORS_ONLN);
+	size_t batch_keys=4096;
 	char * mphrLoadFromBaseFilename=NULL;
 	char * mphrSaveToBaseFilename=NULL;
+	const char *sharedMemoryName=NULL;
+	bool hugePagesFlag=false;
+	NumaPlacement numaPlacement=NUMA_LOCAL;
+	bool warmupFlag=false;
+	const char *warmupStatusFileName="";
+	const char *deltaLogFileName=NULL;
+	uint64_t delta_merge_keys=0;
+	int compression_level=CHUNKED_FILE_DEFAULT_LEVEL;
+	bool compressedRunsFlag=false;
 	unsigned bits_per_fingerprint=12;
-	unsigned bits_per_rank=20;
+	unsigned bits_per_rank=0;
+	ValueStoreType value_store_type=VALUE_STORE_ELIAS;
 	size_t unique_bigrams=0;
     
+	static struct option long_options[] = {
+		{"stats", no_argument, 0, 's'},
+		{"help", no_argument, 0, 'h'},
+		{"metrics", required_argument, 0, 'm'},
+		{"profile", required_argument, 0, 'P'},
+		{"hot", required_argument, 0, 'H'},
+		{"query-log", required_argument, 0, 'Q'},
+		{"serve", required_argument, 0, 'S'},
+		{"workers", required_argument, 0, 'w'},
+		{"batch", required_argument, 0, 'B'},
+		{"shm", required_argument, 0, 'M'},
+		{"shm-remove", required_argument, 0, 'R'},
+		{"huge-pages", no_argument, 0, 'U'},
+		{"numa", required_argument, 0, 'N'},
+		{"warmup", no_argument, 0, 'W'},
+		{"warmup-status", required_argument, 0, 'Y'},
+		{"delta", required_argument, 0, 'D'},
+		{"delta-merge-keys", required_argument, 0, 'X'},
+		{"compression", required_argument, 0, 'z'},
+		{"compressed-runs", no_argument, 0, 'C'},
+		{0, 0, 0, 0}
+	};
 	char c;
-	while ((c = getopt (argc, argv, "hk:b:f:q:l:g:")) != -1){
+	while ((c = getopt_long (argc, argv, "hsk:b:f:v:q:l:g:m:P:H:Q:S:w:B:z:", long_options, NULL)) != -1){
 		switch (c){
 			case 'h':
 				print_usage(argv[0]);
@@ -109,6 +213,13 @@ int main(int argc, char **argv){
 			case 'b':
 				bits_per_rank= atoi(optarg);
 				break;
+			case 'v':
+				if (!value_store_type_from_name(optarg,value_store_type)){
+					cerr << "\nError: "<<optarg<<" is not a value store.  Use one of elias, sarray, rank9, compact, fibonacci or tiered\n";
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
 			case 'k':
 				kneserNeyOptionFlag= true;
 				unique_bigrams=atoi(optarg);
@@ -116,6 +227,76 @@ int main(int argc, char **argv){
 			case 'q':
 				queryFileName= optarg;
 				break;
+			case 's':
+				statsFlag= true;
+				break;
+			case 'H':
+				hot_keys= strtoull(optarg,NULL,10);
+				break;
+			case 'Q':
+				queryLogFileName= optarg;
+				break;
+			case 'P':
+				profileFileName= optarg;
+				BuildProfiler::enable();
+				break;
+			case 'S':
+				serveAddresses.push_back(optarg);
+				break;
+			case 'w':
+				workers= atol(optarg);
+				break;
+			case 'B':
+				batch_keys= strtoull(optarg,NULL,10);
+				break;
+			case 'M':
+				sharedMemoryName= optarg;
+				break;
+			case 'R':
+				SharedModel::remove(optarg);
+				return 0;
+			case 'U':
+				hugePagesFlag= true;
+				break;
+			case 'W':
+				warmupFlag= true;
+				break;
+			case 'Y':
+				warmupStatusFileName= optarg;
+				break;
+			case 'D':
+				deltaLogFileName= optarg;
+				break;
+			case 'X':
+				delta_merge_keys= strtoull(optarg,NULL,10);
+				break;
+			case 'C':
+				compressedRunsFlag=true;
+				break;
+			case 'z':
+				compression_level= atoi(optarg);
+				if (compression_level<0 || compression_level>9 || !isdigit(optarg[0])){
+					cerr << "\nError: the compression level must be from 0 (none) to 9\n";
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'N':
+				if (!numa_placement_from_name(optarg,numaPlacement)){
+					cerr << "\nError: "<<optarg<<" is not a NUMA placement.  Use local, interleave or replicate\n";
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'm':
+				metricsFlag= true;
+				if (strcmp(optarg,"json")==0) metricsFormat=QueryMetrics::JSON;
+				else if (strcmp(optarg,"text")!=0){
+					cerr << "\nError: "<<optarg<<" is not a metrics format.  Use text or json\n";
+					print_usage(argv[0]);
+					return 1;
+				}
+				break;
 			default:
 				cerr << " That is not a valid option to the program\n\n";
 				print_usage(argv[0]);
@@ -127,6 +308,21 @@ int main(int argc, char **argv){
 	//non getopt arg is key filename
 	const char *keyFileName=NULL;
 	if(optind < argc) keyFileName=argv[optind];
+	if (hot_keys && loadFromDiskFlag && keyFileName==NULL && queryLogFileName==NULL){
+		cerr << "\nError: The hot tier of a loaded structure needs either the key file or a query log (-Q) to choose its keys from." <<endl;
+		print_usage(argv[0]);
+		exit(1);
+	}
+	if (sharedMemoryName && (!loadFromDiskFlag || writeToDiskFlag || hot_keys)){
+		cerr << "\nError: --shm shares a structure that is loaded with -l, and it can't be written (-g) or given a hot tier (-H)." <<endl;
+		print_usage(argv[0]);
+		exit(1);
+	}
+	if (delta_merge_keys && (deltaLogFileName==NULL || sharedMemoryName || keyFileName==NULL || (!loadFromDiskFlag && !writeToDiskFlag))){
+		cerr << "\nError: --delta-merge-keys merges the --delta log into the keyTABvalueFile and the structure files given with -l or -g, and can't be used with --shm." <<endl;
+		print_usage(argv[0]);
+		exit(1);
+	}
 	if(keyFileName==NULL && !loadFromDiskFlag){
 		cerr << "\nError: No key file specified to create hash! Either use -l option or specify a file." <<endl;
 		print_usage(argv[0]);
@@ -136,23 +332,82 @@ int main(int argc, char **argv){
 	//if(optind < argc) queryFileName=argv[optind];
 
 	
+	//this has to be done before any other thread is started
+	if (metricsFlag) QueryMetrics::dumpOnSignal(metricsFormat);
+	
 	boost::shared_ptr<MPHR> pMPHR;
 	
-	if (loadFromDiskFlag){
+	if (sharedMemoryName){
+		pMPHR=SharedModel::open(sharedMemoryName,mphrLoadFromBaseFilename,hugePagesFlag,numaPlacement);
+	}else if (loadFromDiskFlag){
 		pMPHR.reset(new MPHR(mphrLoadFromBaseFilename));
 	}else {
-		pMPHR.reset(new MPHR(keyFileName,bits_per_fingerprint,bits_per_rank,mphrSaveToBaseFilename));
+		pMPHR.reset(new MPHR(keyFileName,bits_per_fingerprint,bits_per_rank,mphrSaveToBaseFilename,value_store_type,compressedRunsFlag));
 	}
 
 	
+	if (hot_keys){
+		pMPHR->buildHotTier(keyFileName,hot_keys,queryLogFileName,std::min(bits_per_fingerprint+8,30u),mphrSaveToBaseFilename);
+	}
+	
 	if (writeToDiskFlag){
-		pMPHR->writeMPHRToFilesWithBaseName(mphrSaveToBaseFilename);
+		pMPHR->writeMPHRToFilesWithBaseName(mphrSaveToBaseFilename,compression_level);
+	}
+	
+	//after writing, as the model can't be written once its arrays have moved
+	if (!sharedMemoryName && (hugePagesFlag || numaPlacement!=NUMA_LOCAL)){
+		pMPHR->placeArrays(hugePagesFlag,numaPlacement);
 	}
 
 	
 	
 
 	
+	if (profileFileName){
+		if (strcmp(profileFileName,"-")==0) BuildProfiler::instance().print_json(cerr);
+		else {
+			std::ofstream profile(profileFileName);
+			if (!profile) {
+				cerr << "Error: can't write the build profile to: "<<profileFileName<<endl;
+				exit(1);
+			}
+			BuildProfiler::instance().print_json(profile);
+		}
+	}
+	
+	if (statsFlag){
+		MemoryUsage usage=pMPHR->memory_usage();
+		cout << "Memory used by the "<<value_store_name(pMPHR->valueStoreType())<<" MPHR for "<<pMPHR->size()<<" keys\n";
+		usage.print(cout,pMPHR->size());
+		if (!kneserNeyOptionFlag && !queryFileName) return 0;
+	}
+	
+	//destroyed before the model, which the warmup threads read
+	boost::shared_ptr<ModelWarmup> warmup;
+	if (warmupFlag){
+		warmup.reset(new ModelWarmup(*pMPHR,sysconf(_SC_NPROCESSORS_ONLN),warmupStatusFileName));
+	}
+	
+	//destroyed before the warmup, which it asks whether the arrays of the model are still being read
+	boost::shared_ptr<DeltaMerger> deltaMerger;
+	if (deltaLogFileName){
+		deltaMerger.reset(new DeltaMerger(pMPHR,deltaLogFileName,delta_merge_keys,keyFileName,loadFromDiskFlag?mphrLoadFromBaseFilename:mphrSaveToBaseFilename,
+										  !sharedMemoryName && hugePagesFlag,sharedMemoryName?NUMA_LOCAL:numaPlacement,warmup.get()));
+	}
+	
+	if (!serveAddresses.empty()){
+		QueryServer queryServer(*pMPHR,workers>0?workers:1,batch_keys);
+		for (size_t i=0; i<serveAddresses.size(); ++i) queryServer.listen(serveAddresses[i]);
+		server=&queryServer;
+		signal(SIGINT,stop_server);
+		signal(SIGTERM,stop_server);
+		queryServer.run();
+		server=NULL;
+		cerr << "Stopped serving queries"<<endl;
+		if (metricsFlag) QueryMetrics::dump(cerr,metricsFormat);
+		return 0;
+	}
+	
 	if (!loadFromDiskFlag && !kneserNeyOptionFlag && !queryFileName){
 		//the user has not asked to query anything so we are done
 		return 0;
@@ -241,7 +496,8 @@ int main(int argc, char **argv){
 	}
 	 qin.pop();
 	
+	if (metricsFlag) QueryMetrics::dump(cerr,metricsFormat);
+	
 
     return 0;
-}
-*/
\ No newline at end of file
+}
\ No newline at end of file
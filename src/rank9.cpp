@@ -66,4 +66,10 @@ uint64_t rank9::bit_count() {
 	return num_counts * 64;
 }
 
+MemoryUsage rank9::memory_usage() const {
+	MemoryUsage usage;
+	usage.add("counts",( num_counts + 1 ) * sizeof(uint64_t));
+	return usage;
+}
+
 void rank9::print_counts() {}
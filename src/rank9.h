@@ -23,6 +23,7 @@
 #define rank9_h
 #include <stdint.h>
 #include "macros.h"
+#include "MemoryUsage.h"
 
 class rank9 {
 private:
@@ -46,6 +47,7 @@ public:
 	// Just for analysis purposes
 	void print_counts();
 	uint64_t bit_count();
+	MemoryUsage memory_usage() const;
 };
 
 #endif
@@ -347,6 +347,14 @@ uint64_t rank9sel::bit_count() {
 	return ( num_counts + inventory_size + num_words / 4 ) * 64;
 }
 
+MemoryUsage rank9sel::memory_usage() const {
+	MemoryUsage usage;
+	usage.add("counts",( num_counts + 1 ) * sizeof(uint64_t));
+	usage.add("inventory",( inventory_size + 1 ) * sizeof(uint64_t));
+	usage.add("subinventory",( num_words + 3 ) / 4 * sizeof(uint64_t));
+	return usage;
+}
+
 void rank9sel::print_counts() {
 #ifdef COUNTS
 	fprintf(stderr, "single:\t%lld\none level:\t%lld\ntwo levels:\t%lld\nshorts:\t%lld\nlongs:\t%lld\nlonglongs:\t%lld\n", single, one_level, two_levels, shorts, longs, longlongs );
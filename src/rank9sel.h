@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include "popcount.h"
 #include "macros.h"
+#include "MemoryUsage.h"
 
 
 class rank9sel {
@@ -85,6 +86,7 @@ public:
 	// Just for analysis purposes
 	void print_counts();
 	uint64_t bit_count();
+	MemoryUsage memory_usage() const;
 };
 
 #endif
@@ -0,0 +1,188 @@
+/*
+ *  shefLM.cpp
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+//libshefLM, the C interface in shefLM.h over MPHR.  The store classes define their members in their headers, so
+//this is the one file of the library that includes them, as main.cpp is for shefLMStore.
+//No C++ exception is let out of a function of the interface, and a model that can't be read is thrown to here as
+//a ModelError (see ModelReport.h) rather than ending the process.
+
+#include <string>
+#include <iostream>
+#include <cmath>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/shared_ptr.hpp>
+
+#include "MPHR.h"
+#include "SharedModel.h"
+#include "KneserNeyWrapper.h"
+#include "ModelReport.h"
+#include "shefLM.h"
+
+
+struct shef_lm {
+	boost::shared_ptr<MPHR> model;
+};
+
+//the files MPHR exits on if they are missing, checked first so a bad path is an error the caller can handle
+static bool model_files_readable(const std::string &basefilename){
+	const std::string names[2]={basefilename+HASH_FILENAME_SUFIX,basefilename+FP_VALUE_FILENAME_SUFIX};
+	for (unsigned i=0; i<2; ++i) {
+		const int fd=open(names[i].c_str(),O_RDONLY);
+		if (fd<0) return false;
+		close(fd);
+	}
+	return true;
+}
+
+//whether loading says what it loads on stderr, set by shef_lm_set_verbose
+static bool verbose_loading=false;
+
+static void start_loading(){
+	ModelReport::setThrowing(true);
+	ModelReport::setVerbose(verbose_loading);
+}
+
+static void loading_failed(const char *message, const int &error){
+	if (verbose_loading) std::cerr << "Error: "<<message<<std::endl;
+	errno=error;
+}
+
+
+const char *shef_lm_version(void){
+	return "1.0";
+}
+
+void shef_lm_set_verbose(int verbose){
+	verbose_loading=verbose!=0;
+}
+
+shef_lm *shef_lm_open(const char *basefilename){
+	if (basefilename==NULL) {
+		errno=EINVAL;
+		return NULL;
+	}
+	try {
+		if (!model_files_readable(basefilename)) return NULL;
+		start_loading();
+		boost::shared_ptr<MPHR> model(new MPHR(string(basefilename)));
+		shef_lm *lm=new shef_lm;
+		lm->model=model;
+		return lm;
+	}
+	catch (std::bad_alloc &e) {
+		loading_failed(e.what(),ENOMEM);
+	}
+	catch (std::exception &e) {
+		loading_failed(e.what(),EIO);
+	}
+	catch (...) {
+		errno=EIO;
+	}
+	return NULL;
+}
+
+shef_lm *shef_lm_open_shared(const char *shm_name, const char *basefilename){
+	if (shm_name==NULL || basefilename==NULL) {
+		errno=EINVAL;
+		return NULL;
+	}
+	try {
+		if (!model_files_readable(basefilename)) return NULL;
+		start_loading();
+		boost::shared_ptr<MPHR> model=SharedModel::open(shm_name,basefilename);
+		shef_lm *lm=new shef_lm;
+		lm->model=model;
+		return lm;
+	}
+	catch (std::bad_alloc &e) {
+		loading_failed(e.what(),ENOMEM);
+	}
+	catch (std::exception &e) {
+		loading_failed(e.what(),EIO);
+	}
+	catch (...) {
+		errno=EIO;
+	}
+	return NULL;
+}
+
+uint64_t shef_lm_query(const shef_lm *lm, const char *ngram, size_t length){
+	try {
+		return lm->model->query(string(ngram,length));
+	}
+	catch (...) {
+		return 0;
+	}
+}
+
+void shef_lm_query_batch(const shef_lm *lm, const char *const *ngrams, const size_t *lengths, size_t count, uint64_t *values){
+	try {
+		string key;
+		for (size_t i=0; i<count; ++i) {
+			key.assign(ngrams[i],lengths[i]);
+			values[i]=lm->model->query(key);
+		}
+	}
+	catch (...) {
+		for (size_t i=0; i<count; ++i) values[i]=0;
+	}
+}
+
+double shef_lm_score_sentence(const shef_lm *lm, const char *sentence, uint64_t unique_bigrams, size_t *words){
+	if (words) *words=0;
+	try {
+		KneserNeyWrapper kn(lm->model,unique_bigrams);
+		double sumlogprob=0.0;
+		size_t n=0;
+		//the same context as shefLMStore -k starts its input with
+		string w1="<NA>", w2="<NA>";
+		const char *p=sentence;
+		while (*p) {
+			while (*p==' ' || *p=='\t' || *p=='\n') ++p;
+			const char *start=p;
+			while (*p && *p!=' ' && *p!='\t' && *p!='\n') ++p;
+			if (p==start) break;
+			const string w3(start,p-start);
+			sumlogprob+=log2(kn.prob(w1,w2,w3));
+			++n;
+			w1=w2;
+			w2=w3;
+		}
+		if (words) *words=n;
+		return sumlogprob;
+	}
+	catch (...) {
+		return 0.0;
+	}
+}
+
+uint64_t shef_lm_size(const shef_lm *lm){
+	return lm->model->size();
+}
+
+void shef_lm_close(shef_lm *lm){
+	delete lm;
+}
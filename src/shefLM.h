@@ -0,0 +1,84 @@
+/*
+ *  shefLM.h
+ *  ShefLMStore
+ *
+ *  Created by David Guthrie on 19/10/2026.
+ *  Copyright 2009-2010 David Guthrie. All rights reserved.
+ *
+ * This file is part of ShefLMStore.
+ *
+ * ShefLMStore is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * ShefLMStore is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with ShefLMStore.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* The C interface of libshefLM, for programs that look up ngrams in a model written by shefLMStore -g without
+ * going through the text pipe of the shefLMStore program.  It is plain C so it can be used from C, from C++ built
+ * with any compiler or standard library, and from other languages, and only these functions are exported by the
+ * shared library (with the symbol version SHEFLM_1.0, see shefLM.map).  A handle is read only once it is open
+ * so any number of threads can query it at the same time.
+ * Opening a model that is missing or damaged returns NULL with errno set, it does not end the process, and
+ * nothing is printed on stderr unless shef_lm_set_verbose has been called. */
+
+#ifndef SHEF_LM_H
+#define SHEF_LM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SHEF_LM_API_VERSION 1
+
+typedef struct shef_lm shef_lm;
+
+/* the version of the library, such as "1.0" */
+const char *shef_lm_version(void);
+
+/* prints what loading a model does, and why it failed, on stderr as shefLMStore does if verbose is not 0.
+ * The library is quiet until it is called. */
+void shef_lm_set_verbose(int verbose);
+
+/* loads the model written with the base file name basefilename (basefilename.hash, basefilename.fp_values and
+ * the hot tier if there is one), or returns NULL with errno set if its files can't be opened (the errno of open),
+ * are damaged (EIO) or need more memory than there is (ENOMEM) */
+shef_lm *shef_lm_open(const char *basefilename);
+
+/* attaches to the model in the shared memory segment shm_name, or loads basefilename into it first if no process
+ * has, as shefLMStore --shm does, so every process using the model shares one copy of its arrays.  It fails
+ * as shef_lm_open does, or with EIO if the segment can't be opened or made */
+shef_lm *shef_lm_open_shared(const char *shm_name, const char *basefilename);
+
+/* the value of the ngram (its words separated by single spaces), 0 if it is not in the model */
+uint64_t shef_lm_query(const shef_lm *lm, const char *ngram, size_t length);
+
+/* the values of count ngrams at once, which saves a call per ngram */
+void shef_lm_query_batch(const shef_lm *lm, const char *const *ngrams, const size_t *lengths, size_t count, uint64_t *values);
+
+/* the sum of the log2 interpolated Kneser-Ney trigram probabilities of the space separated words of sentence,
+ * as shefLMStore -k computes them for its input.  The number of words scored is put in words if it is not NULL. */
+double shef_lm_score_sentence(const shef_lm *lm, const char *sentence, uint64_t unique_bigrams, size_t *words);
+
+/* the number of ngrams in the model */
+uint64_t shef_lm_size(const shef_lm *lm);
+
+/* frees the model, lm can be NULL */
+void shef_lm_close(shef_lm *lm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
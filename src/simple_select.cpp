@@ -28,8 +28,15 @@
 #include "simple_select.h"
 #include "rank9.h"
 
-#define MAX_ONES_PER_INVENTORY (8192)
-#define MAX_LOG2_LONGWORDS_PER_SUBINVENTORY (3)
+//Both can be overridden from CPPFLAGS (e.g. -DSIMPLE_SELECT_MAX_ONES_PER_INVENTORY=4096) when tuning with shefLMBench -m select
+#ifndef SIMPLE_SELECT_MAX_ONES_PER_INVENTORY
+#define SIMPLE_SELECT_MAX_ONES_PER_INVENTORY (8192)
+#endif
+#ifndef SIMPLE_SELECT_MAX_LOG2_LONGWORDS_PER_SUBINVENTORY
+#define SIMPLE_SELECT_MAX_LOG2_LONGWORDS_PER_SUBINVENTORY (3)
+#endif
+#define MAX_ONES_PER_INVENTORY SIMPLE_SELECT_MAX_ONES_PER_INVENTORY
+#define MAX_LOG2_LONGWORDS_PER_SUBINVENTORY SIMPLE_SELECT_MAX_LOG2_LONGWORDS_PER_SUBINVENTORY
 
 simple_select::simple_select() {}
 
@@ -290,4 +297,12 @@ uint64_t simple_select::bit_count() {
 	return ( inventory_size + 1 + subinventory_size + exact_spill_size ) * 64;
 }
 
+MemoryUsage simple_select::memory_usage() const {
+	MemoryUsage usage;
+	usage.add("inventory",( inventory_size + 1 ) * sizeof(int64_t));
+	usage.add("subinventory",subinventory_size * sizeof(uint64_t));
+	usage.add("exact_spill",exact_spill_size * sizeof(uint64_t));
+	return usage;
+}
+
 void simple_select::print_counts() {}
@@ -25,6 +25,7 @@
 
 #include <stdint.h>
 #include "macros.h"
+#include "MemoryUsage.h"
 
 class simple_select {
 private:
@@ -85,6 +86,7 @@ public:
 	// Just for analysis purposes
 	void print_counts();
 	uint64_t bit_count();
+	MemoryUsage memory_usage() const;
 private:
 	simple_select(const simple_select&); //disallow copy
 	void operator=(const simple_select&); //disallow assignment
@@ -19,19 +19,32 @@
  *
  */
 
+//for PRIu64 in C++
+#ifndef __STDC_FORMAT_MACROS
+#define __STDC_FORMAT_MACROS
+#endif
 #include <iostream>
 #include <cstdio>
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <inttypes.h>
 #include "simple_select11.h"
 #include "rank9.h"
 
-#define MAX_ONES_PER_INVENTORY (8192)
-#define MAX_LOG2_LONGWORDS_PER_SUBINVENTORY (4)
+//Both can be overridden from CPPFLAGS (e.g. -DSIMPLE_SELECT11_MAX_ONES_PER_INVENTORY=4096) when tuning with shefLMBench -m select
+#ifndef SIMPLE_SELECT11_MAX_ONES_PER_INVENTORY
+#define SIMPLE_SELECT11_MAX_ONES_PER_INVENTORY (8192)
+#endif
+#ifndef SIMPLE_SELECT11_MAX_LOG2_LONGWORDS_PER_SUBINVENTORY
+#define SIMPLE_SELECT11_MAX_LOG2_LONGWORDS_PER_SUBINVENTORY (4)
+#endif
+#define MAX_ONES_PER_INVENTORY SIMPLE_SELECT11_MAX_ONES_PER_INVENTORY
+#define MAX_LOG2_LONGWORDS_PER_SUBINVENTORY SIMPLE_SELECT11_MAX_LOG2_LONGWORDS_PER_SUBINVENTORY
 
 
+//The "11"s are found a word at a time with double_ones, and the positions recorded are those of the second one of each pair
 simple_select11::simple_select11( boost::shared_ptr< vector<uint64_t> > bits, const uint64_t num_bits,uint64_t num_double_ones)
 :bits(bits),num_ones(num_double_ones){
 	num_words = ( num_bits + 63 ) / 64;
@@ -48,30 +61,27 @@ simple_select11::simple_select11( boost::shared_ptr< vector<uint64_t> > bits, co
 
 	fprintf(stderr,"Number of ones: %lld Number of ones per inventory item: %d\n", c, ones_per_inventory );	
 
+	//the bits past num_bits in the last word are ignored
+	const uint64_t last_word_mask = ( num_bits & 63 ) ? ( 1ULL << ( num_bits & 63 ) ) - 1 : -1ULL;
 	
     inventory.resize(inventory_size+1);
 	uint64_t d = 0;
+	uint64_t carry;
 
 	// First phase: we build an inventory for each one out of ones_per_inventory.
-    bool firstone=false;
-	for( uint64_t i = 0; i < num_words; i++ )
-		for( int j = 0; j < 64; j++ ) {
-			if ( i * 64 + j >= num_bits ) break;
-            //  fprintf(stderr,"--->%d\n",((*bits)[ i ] & 1ULL << j)!=0);
-			if ( (*bits)[ i ] & 1ULL << j ) {
-                //saw a one
-                if (!firstone) firstone=true;
-                else{
-                    //two ones in a row
-                    if ( ( d & ones_per_inventory_mask ) == 0 ) inventory[ d >> log2_ones_per_inventory ] = i * 64 + j;
-                    //        fprintf(stderr,"Increasing D, j is %d and i is %llu\n",j,i);
-                    d++;       
-                    firstone=false;
-                }
-            }else{firstone=false;}
+	carry = 0;
+	for( uint64_t i = 0; i < num_words; i++ ) {
+		const uint64_t word = i + 1 < num_words ? (*bits)[ i ] : (*bits)[ i ] & last_word_mask;
+		for( uint64_t pairs = double_ones( word, carry ); pairs != 0; pairs &= pairs - 1 ) {
+			if ( ( d & ones_per_inventory_mask ) == 0 ) inventory[ d >> log2_ones_per_inventory ] = i * 64 + __builtin_ctzll( pairs );
+			d++;
 		}
+	}
 
-	assert( c == d );
+	if ( c != d ) {
+		fprintf(stderr,"Error: expected %" PRIu64 " double ones but found %" PRIu64 "\n", c, d );
+		exit(1);
+	}
 	inventory[ inventory_size ] = num_bits;
 
 	fprintf(stderr,"Inventory entries filled: %lld\n", inventory_size + 1 );
@@ -92,34 +102,22 @@ simple_select11::simple_select11( boost::shared_ptr< vector<uint64_t> > bits, co
 		int ones;
 		uint64_t spilled = 0, diff16 = 0, exact = 0, start, span, inventory_index;
 
-        firstone=false;
-		for( uint64_t i = 0; i < num_words; i++ )
-			// We estimate the subinventory and exact spill size
-			for( int j = 0; j < 64; j++ ) {
-				if ( i * 64 + j >= num_bits ) break;
-				if ( (*bits)[ i ] & 1ULL << j ) {
-                    if (!firstone) firstone=true;
-                    else{
-                        if ( ( d & ones_per_inventory_mask ) == 0 ) {
-                            inventory_index = d >> log2_ones_per_inventory;
-                            start = inventory[ inventory_index ];
-                            span = inventory[ inventory_index + 1 ] - start;
-                            ones = std::min( c - d, (uint64_t)ones_per_inventory );
-
-                            // We must always count (possibly unused) diff16's. And we cannot store less then 4 diff16.
-                            diff16 += std::max( 4, ( ones + ones_per_sub16 - 1 ) >> log2_ones_per_sub16 );
-
-                            // We accumulate space for exact pointers ONLY if necessary.
-                            if ( span >= (1<<16) ) {
-                                exact += ones;
-                                if ( ones_per_sub64 > 1 ) spilled += ones;
-                            }
-                        }
-                        d++;
-                        firstone=false;
-                    }
-				}else{firstone=false;}
+		// We estimate the subinventory and exact spill size.  This only depends on the inventory.
+		for( d = 0; d < c; d += ones_per_inventory ) {
+			inventory_index = d >> log2_ones_per_inventory;
+			start = inventory[ inventory_index ];
+			span = inventory[ inventory_index + 1 ] - start;
+			ones = std::min( c - d, (uint64_t)ones_per_inventory );
+
+			// We must always count (possibly unused) diff16's. And we cannot store less then 4 diff16.
+			diff16 += std::max( 4, ( ones + ones_per_sub16 - 1 ) >> log2_ones_per_sub16 );
+
+			// We accumulate space for exact pointers ONLY if necessary.
+			if ( span >= (1<<16) ) {
+				exact += ones;
+				if ( ones_per_sub64 > 1 ) spilled += ones;
 			}
+		}
 
 		fprintf(stderr,"Spilled entries: %lld exact: %lld diff16: %lld subinventory size: %lld\n", spilled, exact, diff16 - ( exact - spilled ) * 4, ( diff16 + 3 ) / 4 );
 
@@ -134,57 +132,66 @@ simple_select11::simple_select11( boost::shared_ptr< vector<uint64_t> > bits, co
 		spilled = 0;
 		d = 0;
         
-        firstone=false;
+		carry = 0;
 		for( uint64_t i = 0; i < num_words; i++ ){
-			for( int j = 0; j < 64; j++ ) {
-				if ( i * 64 + j >= num_bits ) break;
-				if ( (*bits)[ i ] & 1ULL << j ) {
-                    if (!firstone) firstone=true;
-                    else{
-                        if ( ( d & ones_per_inventory_mask ) == 0 ) {
-                            inventory_index = d >> log2_ones_per_inventory;
-                            start = inventory[ inventory_index ];
-                            span = inventory[ inventory_index + 1 ] - start;
-                            p16 = (uint16_t *)&subinventory[ inventory_index << log2_longwords_per_subinventory ];
-                            p64 = &subinventory[ inventory_index << log2_longwords_per_subinventory ];
-                            offset = 0;
-                        }
-
-                        if ( span < (1<<16) ) {
-                            assert( i * 64 + j - start <= (1<<16) );
-                            if ( ( d & ones_per_sub16_mask ) == 0 ) {
-                                assert( offset < longwords_per_subinventory * 4 );
-                                p16[ offset++ ] = i * 64 + j - start;
-                            }
-                        }
-                        else {
-                            if ( ones_per_sub64 == 1 ) {
-                                p64[ offset++ ] = i * 64 + j;
-                            }
-                            else {
-                                if ( ( d & ones_per_inventory_mask ) == 0 ) {
-                                    inventory[ inventory_index ] |= 1ULL << 63;
-                                    p64[ 0 ] = spilled;
-                                }
-                                assert( spilled < exact_spill_size );
-                                assert( exact_spill[ spilled ] == 0 );
-                                exact_spill[ spilled++ ] = i * 64 + j;
-                            }
-                        }
-                        d++;
-                        firstone=false;
-                    }
-				}else{firstone=false;}
+			const uint64_t word = i + 1 < num_words ? (*bits)[ i ] : (*bits)[ i ] & last_word_mask;
+			for( uint64_t pairs = double_ones( word, carry ); pairs != 0; pairs &= pairs - 1 ) {
+				const uint64_t pos = i * 64 + __builtin_ctzll( pairs );
+				if ( ( d & ones_per_inventory_mask ) == 0 ) {
+					inventory_index = d >> log2_ones_per_inventory;
+					start = inventory[ inventory_index ];
+					span = inventory[ inventory_index + 1 ] - start;
+					p16 = (uint16_t *)&subinventory[ inventory_index << log2_longwords_per_subinventory ];
+					p64 = &subinventory[ inventory_index << log2_longwords_per_subinventory ];
+					offset = 0;
+				}
+
+				if ( span < (1<<16) ) {
+					assert( pos - start <= (1<<16) );
+					if ( ( d & ones_per_sub16_mask ) == 0 ) {
+						assert( offset < longwords_per_subinventory * 4 );
+						p16[ offset++ ] = pos - start;
+					}
+				}
+				else {
+					if ( ones_per_sub64 == 1 ) {
+						p64[ offset++ ] = pos;
+					}
+					else {
+						if ( ( d & ones_per_inventory_mask ) == 0 ) {
+							inventory[ inventory_index ] |= 1ULL << 63;
+							p64[ 0 ] = spilled;
+						}
+						assert( spilled < exact_spill_size );
+						assert( exact_spill[ spilled ] == 0 );
+						exact_spill[ spilled++ ] = pos;
+					}
+				}
+				d++;
 			}
-        }
+		}
 
 
 	fprintf(stderr,"First inventories: %lld %lld %lld %lld\n", inventory[ 0 ], inventory[ 1 ], inventory[ 2 ], inventory[ 3 ] );
 	if ( subinventory_size > 0 ) fprintf(stderr,"First subinventories: %016llx %016llx %016llx %016llx\n", subinventory[ 0 ], subinventory[ 1 ], subinventory[ 2 ], subinventory[ 3 ] );
 	if ( exact_spill_size > 0 ) fprintf(stderr,"First spilled entries: %016llx %016llx %016llx %016llx\n", exact_spill[ 0 ], exact_spill[ 1 ], exact_spill[ 2 ], exact_spill[ 3 ] );
 
+	set_views();
+
+}
 
+void simple_select11::set_views() {
+	bits_data = bits && !bits->empty() ? &(*bits)[0] : NULL;
+	inventory_data = inventory.empty() ? NULL : &inventory[0];
+	subinventory_data = subinventory.empty() ? NULL : &subinventory[0];
+	exact_spill_data = exact_spill.empty() ? NULL : &exact_spill[0];
+}
 
+void simple_select11::share( SharedArrays &arrays, const uint64_t *shared_bits ) {
+	arrays.share( inventory, inventory_data );
+	arrays.share( subinventory, subinventory_data );
+	arrays.share( exact_spill, exact_spill_data );
+	if ( arrays.mode() != SharedArrays::MEASURE ) bits_data = shared_bits;
 }
 
 
@@ -199,7 +206,7 @@ uint64_t simple_select11::select11( const uint64_t rankToFind ) {
 	const uint64_t inventory_index = rank >> log2_ones_per_inventory;
 	assert( inventory_index < inventory_size );
 
-	const int64_t inventory_rank = inventory[ inventory_index ];
+	const int64_t inventory_rank = inventory_data[ inventory_index ];
 	const int subrank = rank & ones_per_inventory_mask;
 #ifdef DEBUG
 	fprintf(stderr, "Rank: %lld inventory index: %lld inventory rank: %lld subrank: %d\n", rank, inventory_index, inventory_rank, subrank );
@@ -212,14 +219,14 @@ uint64_t simple_select11::select11( const uint64_t rankToFind ) {
 	register int residual;
 
 	if ( inventory_rank >= 0 ) {
-		start = 1+inventory_rank + ((uint16_t *)( &subinventory[0] + ( inventory_index << log2_longwords_per_subinventory )))[ subrank >> log2_ones_per_sub16 ];
+		start = 1+inventory_rank + ((const uint16_t *)( subinventory_data + ( inventory_index << log2_longwords_per_subinventory )))[ subrank >> log2_ones_per_sub16 ];
 		residual = subrank & ones_per_sub16_mask;
 	}
 	else {
         //std::cout<<"SPILL!"<<std::endl;
-		if ( ones_per_sub64 == 1 ) return 1+subinventory[ ( inventory_index << log2_longwords_per_subinventory ) + subrank ];
-		assert( subinventory[ inventory_index << log2_longwords_per_subinventory ] + subrank < exact_spill_size );
-		return 1+exact_spill[ subinventory[ inventory_index << log2_longwords_per_subinventory ] + subrank ];
+		if ( ones_per_sub64 == 1 ) return 1+subinventory_data[ ( inventory_index << log2_longwords_per_subinventory ) + subrank ];
+		assert( subinventory_data[ inventory_index << log2_longwords_per_subinventory ] + subrank < exact_spill_size );
+		return 1+exact_spill_data[ subinventory_data[ inventory_index << log2_longwords_per_subinventory ] + subrank ];
 	}
 
 	//fprintf(stderr, "Differential; start: %lld residual: %d\n", start, residual );
@@ -227,40 +234,32 @@ uint64_t simple_select11::select11( const uint64_t rankToFind ) {
 
 	if ( residual == 0 ) return start;
 
-	register uint64_t word_index = (start / 64);
-    register bool firstone=false;
-    register uint64_t place=start & 63;
-    register uint64_t word = (*bits)[ word_index ] & -1ULL << start;
-
-    for(;;){
-        //std::cerr <<"word is:"<<word<<std::endl;        
-        for( int j = place; j < 64; j++ ) {
-            //std::cerr <<"j is:"<<j<<"and bit is:"<<((word & (1ULL << j))!=0) <<std::endl;
-            ++place;
-            if ( word & (1ULL << j) ) {
-                if (!firstone) firstone=true;
-                else{
-                    --residual;
-                    if (residual==0) break;
-                    firstone=false;
-                }
-            }else{
-                firstone=false;
-            }
-            
-        }
-        if(residual>0){
-            ++word_index;
-            place=0;
-            word = (*bits)[ word_index ];
-        }else break;
-    }
-    // std::cerr <<"place is:"<<place<<std::endl;
-	return word_index*64 + place;
+	// start is just after the end of a pair so no one is carried into the first word.
+	// The bits before start are cleared so they can not pair with the bit at start.
+	register uint64_t word_index = start / 64;
+	uint64_t carry = 0;
+	register uint64_t pairs = double_ones( bits_data[ word_index ] & -1ULL << start % 64, carry );
+	register int pair_count;
+
+	// we want the residual-th pair after start, so residual-1 pairs are skipped
+	residual--;
+	while ( residual >= ( pair_count = count( pairs ) ) ) {
+		residual -= pair_count;
+		pairs = double_ones( bits_data[ ++word_index ], carry );
+	}
+	return word_index * 64 + select_in_word( pairs, residual ) + 1;
 }
 
 uint64_t simple_select11::bit_count() {
 	return ( inventory_size + 1 + subinventory_size + exact_spill_size ) * 64;
 }
 
+MemoryUsage simple_select11::memory_usage() const {
+	MemoryUsage usage;
+	usage.add("inventory",vector_bytes(inventory));
+	usage.add("subinventory",vector_bytes(subinventory));
+	usage.add("exact_spill",vector_bytes(exact_spill));
+	return usage;
+}
+
 void simple_select11::print_counts() {}
@@ -34,6 +34,8 @@
 #include <vector>
 #include <stdint.h>
 #include "macros.h"
+#include "MemoryUsage.h"
+#include "SharedArrays.h"
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/utility.hpp>
@@ -48,12 +50,64 @@ private:
 	vector<int64_t> inventory;
 	vector<uint64_t> subinventory;
     vector<uint64_t> exact_spill;
+	// What select11() reads: the vectors, or their copies in shared memory
+	const uint64_t *bits_data;
+	const int64_t *inventory_data;
+	const uint64_t *subinventory_data, *exact_spill_data;
+	void set_views();
 	int log2_ones_per_inventory, log2_ones_per_sub16, log2_ones_per_sub64, log2_longwords_per_subinventory,
 		ones_per_inventory, ones_per_sub16, ones_per_sub64, longwords_per_subinventory,
 		ones_per_inventory_mask, ones_per_sub16_mask, ones_per_sub64_mask;
 
 	uint64_t num_words, inventory_size, subinventory_size, exact_spill_size, num_ones;
 
+	/** Counts the number of bits in x. */
+	__inline static int count( const uint64_t x ) {
+		register uint64_t byte_sums = x - ( ( x & 0xa * ONES_STEP_4 ) >> 1 );
+		byte_sums = ( byte_sums & 3 * ONES_STEP_4 ) + ( ( byte_sums >> 2 ) & 3 * ONES_STEP_4 );
+		byte_sums = ( byte_sums + ( byte_sums >> 4 ) ) & 0x0f * ONES_STEP_8;
+		return byte_sums * ONES_STEP_8 >> 56;
+	}
+
+	/* Selects the k-th (k>=0) bit in x.  k must be less than count( x ). */
+	__inline static int select_in_word( const uint64_t x, const int k ) {
+		// Phase 1: sums by byte
+		register uint64_t byte_sums = x - ( ( x & 0xa * ONES_STEP_4 ) >> 1 );
+		byte_sums = ( byte_sums & 3 * ONES_STEP_4 ) + ( ( byte_sums >> 2 ) & 3 * ONES_STEP_4 );
+		byte_sums = ( byte_sums + ( byte_sums >> 4 ) ) & 0x0f * ONES_STEP_8;
+		byte_sums *= ONES_STEP_8;
+
+		// Phase 2: compare each byte sum with k
+		const uint64_t k_step_8 = k * ONES_STEP_8;
+		const uint64_t place = ( LEQ_STEP_8( byte_sums, k_step_8 ) * ONES_STEP_8 >> 53 ) & ~0x7;
+
+		// Phase 3: Locate the relevant byte and make 8 copies with incrental masks
+		const int byte_rank = k - ( ( ( byte_sums << 8 ) >> place ) & 0xFF );
+
+		const uint64_t spread_bits = ( x >> place & 0xFF ) * ONES_STEP_8 & INCR_STEP_8;
+		const uint64_t bit_sums = ZCOMPARE_STEP_8( spread_bits ) * ONES_STEP_8;
+
+		// Compute the inside-byte location and return the sum
+		const uint64_t byte_rank_step_8 = byte_rank * ONES_STEP_8;
+
+		return place + ( LEQ_STEP_8( bit_sums, byte_rank_step_8 ) * ONES_STEP_8 >> 56 );
+	}
+
+	/* Marks the second one of every "11" in x.  The ones are paired up greedily from the start of each run
+		so "111" holds one pair and a spare one, which is how the fibonacci codes are ended (x & x >> 1 alone
+		would count two).  carry is 1 if the last one of the previous word was not paired, and is set the
+		same way for the next word. */
+	__inline static uint64_t double_ones( const uint64_t x, uint64_t &carry ) {
+		const uint64_t EVEN = 0x5555555555555555ULL;
+		// The ones that start a run (a run carried in from the last word starts at bit -1, which is odd)
+		const uint64_t starts = x & ~( x << 1 | carry );
+		// Adding one at the start of a run clears the whole run, which picks out the runs that start on an even bit
+		const uint64_t even_runs = x & ~( x + ( starts & EVEN ) );
+		const uint64_t odd_runs = x & ~even_runs;
+		const uint64_t pairs = ( even_runs & ~EVEN ) | ( odd_runs & EVEN );
+		carry = ( x & ~pairs ) >> 63;
+		return pairs;
+	}
 
 
 	__inline static int msb( uint64_t x ) {
@@ -89,16 +143,46 @@ private:
 
 
 public:
-	simple_select11(){}
+	simple_select11():bits_data(NULL),inventory_data(NULL),subinventory_data(NULL),exact_spill_data(NULL){}
 	simple_select11(boost::shared_ptr< vector<uint64_t> > bits, const uint64_t num_bits,uint64_t num_double_ones);
 	~simple_select11(){}
 	uint64_t select11( const uint64_t rank );
 	// Just for analysis purposes
 	void print_counts();
 	uint64_t bit_count();
+	MemoryUsage memory_usage() const;
+	// The bits belong to the caller, which shares them first and passes where they are now
+	void share( SharedArrays &arrays, const uint64_t *shared_bits );
 private:
 	simple_select11(const simple_select11&); //disallow copy
 	void operator=(const simple_select11&); //disallow assignment
+
+	friend class boost::serialization::access;
+	template<class Archive>
+	void serialize(Archive & ar, const unsigned int version)
+	{
+		ar & bits;
+		ar & inventory;
+		ar & subinventory;
+		ar & exact_spill;
+		ar & log2_ones_per_inventory;
+		ar & log2_ones_per_sub16;
+		ar & log2_ones_per_sub64;
+		ar & log2_longwords_per_subinventory;
+		ar & ones_per_inventory;
+		ar & ones_per_sub16;
+		ar & ones_per_sub64;
+		ar & longwords_per_subinventory;
+		ar & ones_per_inventory_mask;
+		ar & ones_per_sub16_mask;
+		ar & ones_per_sub64_mask;
+		ar & num_words;
+		ar & inventory_size;
+		ar & subinventory_size;
+		ar & exact_spill_size;
+		ar & num_ones;
+		set_views();
+	}
 };
 
 #endif
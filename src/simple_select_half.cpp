@@ -43,7 +43,7 @@
 
 
 simple_select_half::simple_select_half( boost::shared_ptr< vector<uint64_t> > bits, const uint64_t num_bits)
-:bits(bits){
+:bits(bits),num_bits(num_bits),ones_added(0){
 	
 	num_words = ( num_bits + 63 ) / 64;
 	
@@ -62,69 +62,71 @@ simple_select_half::simple_select_half( boost::shared_ptr< vector<uint64_t> > bi
 
 	inventory.resize(inventory_size+1);
 	subinventory.resize(inventory_size * LONGWORDS_PER_SUBINVENTORY);
-	
-	uint64_t d = 0;
-	const uint64_t mask = ONES_PER_INVENTORY - 1;
 
-	// First phase: we build an inventory for each one out of ONES_PER_INVENTORY.
+	// A single pass over the words, jumping straight to each one.
 	for( uint64_t i = 0; i < num_words; i++ )
-		for( int j = 0; j < 64; j++ )
-			if ( (*bits)[ i ] & 1ULL << j ) {
-				if ( ( d & mask ) == 0 ) inventory[ d >> LOG2_ONES_PER_INVENTORY ] = i * 64 + j;
-				d++;
-			}
-
-	assert( c == d );
-	inventory[ inventory_size ] = num_bits;
+		for( uint64_t word = (*bits)[ i ]; word != 0; word &= word - 1 )
+			add( i * 64 + __builtin_ctzll( word ) );
 
-	fprintf(stderr,"Inventory entries filled: %lld\n", inventory_size + 1 );
+	finish();
+}
 
+simple_select_half::simple_select_half( boost::shared_ptr< vector<uint64_t> > bits, const uint64_t num_bits, const uint64_t num_ones)
+:bits(bits),num_ones(num_ones),num_bits(num_bits),ones_added(0){
+	num_words = ( num_bits + 63 ) / 64;
+	inventory_size = ( num_ones + ONES_PER_INVENTORY - 1 ) / ONES_PER_INVENTORY;
+	inventory.resize(inventory_size+1);
+	subinventory.resize(inventory_size * LONGWORDS_PER_SUBINVENTORY);
+	block_samples.reserve(ONES_PER_INVENTORY / ONES_PER_SUB16);
+}
 
-	uint16_t *p16;
-	uint64_t *p64;
+// Every ONES_PER_INVENTORY ones we start a new inventory block.  The offsets of the sampled ones inside a
+// block can only be written once we know where the next block starts (the span decides 16 or 64 bit entries).
+void simple_select_half::add( const uint64_t pos ) {
+	assert( ones_added < num_ones );
+	if ( ( ones_added & ONES_PER_INVENTORY_MASK ) == 0 ) {
+		if ( ones_added != 0 ) close_block( pos );
+		inventory[ ones_added >> LOG2_ONES_PER_INVENTORY ] = pos;
+	}
+	if ( ( ones_added & ONES_PER_SUB16_MASK ) == 0 ) block_samples.push_back( pos );
+	ones_added++;
+}
 
-	d = 0;
-	uint64_t exact = 0, diff16 = 0, start, span, inventory_index;
-	int offset;
+void simple_select_half::close_block( const uint64_t next_block_start ) {
+	const uint64_t inventory_index = ( ones_added - 1 ) >> LOG2_ONES_PER_INVENTORY;
+	const uint64_t start = inventory[ inventory_index ];
+	const uint64_t span = next_block_start - start;
 
-	for( uint64_t i = 0; i < num_words; i++ )
-		for( int j = 0; j < 64; j++ ) {
-			if ( i * 64 + j >= num_bits ) break;
-			if ( (*bits)[ i ] & 1ULL << j ) {
-				if ( ( d & mask ) == 0 ) {
-					inventory_index = d >> LOG2_ONES_PER_INVENTORY;
-					start = inventory[ inventory_index ];
-					span = inventory[ inventory_index + 1 ] - start;
-					if ( span > (1<<16) ) inventory[ inventory_index ] = -inventory[ inventory_index ] - 1;
-					offset = 0;
-					p16 = (uint16_t *)&subinventory[ inventory_index * LONGWORDS_PER_SUBINVENTORY ];
-					p64 = &subinventory[ inventory_index * LONGWORDS_PER_SUBINVENTORY ];
-				}
-
-				if ( span < (1<<16) ) {
-					assert( i * 64 + j - start <= (1<<16) );
-					if ( ( d & ONES_PER_SUB16_MASK ) == 0 ) {
-						assert( offset < LONGWORDS_PER_SUBINVENTORY * 4 );
-						p16[ offset++ ] = i * 64 + j - start;
-						diff16++;
-					}
-				}
-				else {
-					if ( ( d & ONES_PER_SUB64_MASK ) == 0 ) {
-						assert( offset < LONGWORDS_PER_SUBINVENTORY );
-						p64[ offset ] = i * 64 + j - start;
-						exact++;
-					}
-				}
-
-				d++;
-			}
-		}
-
-	fprintf(stderr,"Exact entries: %lld Diff16: %lld\n", exact, diff16 );
+	if ( span < (1<<16) ) {
+		uint16_t *p16 = (uint16_t *)&subinventory[ inventory_index * LONGWORDS_PER_SUBINVENTORY ];
+		for( size_t k = 0; k < block_samples.size(); k++ ) p16[ k ] = block_samples[ k ] - start;
+	}
+	else {
+		inventory[ inventory_index ] = -inventory[ inventory_index ] - 1;
+		uint64_t *p64 = &subinventory[ inventory_index * LONGWORDS_PER_SUBINVENTORY ];
+		for( size_t k = 0; k < block_samples.size(); k += ONES_PER_SUB64 / ONES_PER_SUB16 ) p64[ k / ( ONES_PER_SUB64 / ONES_PER_SUB16 ) ] = block_samples[ k ] - start;
+	}
+	block_samples.clear();
+}
 
+void simple_select_half::finish() {
+	assert( ones_added == num_ones );
+	if ( ones_added != 0 ) close_block( num_bits );
+	inventory[ inventory_size ] = num_bits;
+	vector<uint64_t>().swap( block_samples );
+	set_views();
+}
 
+void simple_select_half::set_views() {
+	bits_data = bits && !bits->empty() ? &(*bits)[0] : NULL;
+	inventory_data = inventory.empty() ? NULL : &inventory[0];
+	subinventory_data = subinventory.empty() ? NULL : &subinventory[0];
+}
 
+void simple_select_half::share( SharedArrays &arrays, const uint64_t *shared_bits ) {
+	arrays.share( inventory, inventory_data );
+	arrays.share( subinventory, subinventory_data );
+	if ( arrays.mode() != SharedArrays::MEASURE ) bits_data = shared_bits;
 }
 
 
@@ -138,7 +140,7 @@ uint64_t simple_select_half::select( const uint64_t rank ) {
 	const uint64_t inventory_index = rank >> LOG2_ONES_PER_INVENTORY;
 	assert( inventory_index < inventory_size );
 
-	const int64_t inventory_rank = inventory[ inventory_index ];
+	const int64_t inventory_rank = inventory_data[ inventory_index ];
 	const int subrank = rank & ONES_PER_INVENTORY_MASK;
 #ifdef DEBUG
 	fprintf(stderr, "Rank: %lld inventory index: %lld inventory rank: %lld subrank: %d\n", rank, inventory_index, inventory_rank, subrank );
@@ -149,11 +151,11 @@ uint64_t simple_select_half::select( const uint64_t rank ) {
 	int residual;
 
 	if ( inventory_rank >= 0 ) {
-		start = inventory_rank + ((uint16_t *)&subinventory[0])[ ( inventory_index << LOG2_LONGWORDS_PER_SUBINVENTORY + 2 ) + ( subrank >> LOG2_ONES_PER_SUB16 ) ];
+		start = inventory_rank + ((const uint16_t *)subinventory_data)[ ( inventory_index << LOG2_LONGWORDS_PER_SUBINVENTORY + 2 ) + ( subrank >> LOG2_ONES_PER_SUB16 ) ];
 		residual = subrank & ONES_PER_SUB16_MASK;
 	}
 	else {
-		start = - inventory_rank - 1 + subinventory[ ( inventory_index << LOG2_LONGWORDS_PER_SUBINVENTORY ) + ( subrank >> LOG2_ONES_PER_SUB64 ) ];
+		start = - inventory_rank - 1 + subinventory_data[ ( inventory_index << LOG2_LONGWORDS_PER_SUBINVENTORY ) + ( subrank >> LOG2_ONES_PER_SUB64 ) ];
 		residual = subrank & ONES_PER_SUB64_MASK;
 	}
 
@@ -165,7 +167,7 @@ uint64_t simple_select_half::select( const uint64_t rank ) {
 	if ( residual == 0 ) return start;
 
 	uint64_t word_index = start / 64;
-	register uint64_t word = (*bits)[ word_index ] & -1ULL << start;
+	register uint64_t word = bits_data[ word_index ] & -1ULL << start;
 	register uint64_t byte_sums;
 
 	for(;;) {
@@ -178,7 +180,7 @@ uint64_t simple_select_half::select( const uint64_t rank ) {
 		const int bit_count = byte_sums >> 56;
 		if ( residual < bit_count ) break;
 
-		word = (*bits)[ ++word_index ];
+		word = bits_data[ ++word_index ];
 		residual -= bit_count;
 	} 
 
@@ -202,4 +204,11 @@ uint64_t simple_select_half::bit_count() {
 	return ( inventory_size + 1 ) * 64 + inventory_size * LONGWORDS_PER_SUBINVENTORY * 64;
 }
 
+MemoryUsage simple_select_half::memory_usage() const {
+	MemoryUsage usage;
+	usage.add("inventory",vector_bytes(inventory));
+	usage.add("subinventory",vector_bytes(subinventory));
+	return usage;
+}
+
 void simple_select_half::print_counts() {}
@@ -26,6 +26,8 @@
 #include <vector>
 #include <stdint.h>
 #include "macros.h"
+#include "MemoryUsage.h"
+#include "SharedArrays.h"
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/utility.hpp>
@@ -40,9 +42,19 @@ private:
 	boost::shared_ptr< vector<uint64_t> > bits;
 	vector<int64_t> inventory;
 	vector<uint64_t> subinventory;
+	// What select() reads: the vectors, or their copies in shared memory
+	const uint64_t *bits_data;
+	const int64_t *inventory_data;
+	const uint64_t *subinventory_data;
+	void set_views();
 
 	uint64_t num_words, inventory_size, subinventory_size, num_ones;
 
+	//only used while the inventory is being built incrementally
+	uint64_t num_bits, ones_added;
+	vector<uint64_t> block_samples;
+	void close_block( const uint64_t next_block_start );
+
 	/** Counts the number of bits in x. */
 	__inline static int count( const uint64_t x ) {
 		register uint64_t byte_sums = x - ( ( x & 0xa * ONES_STEP_4 ) >> 1 );
@@ -114,13 +126,21 @@ private:
 
 
 public:
-	simple_select_half( ){}
+	simple_select_half( ):bits_data(NULL),inventory_data(NULL),subinventory_data(NULL){}
 	simple_select_half(  boost::shared_ptr< vector<uint64_t> > bits, const uint64_t num_bits);
+	// Incremental construction: pass the number of ones that will be set, then call add() with the position
+	// of every one in increasing order and finish() once they have all been added.
+	simple_select_half(  boost::shared_ptr< vector<uint64_t> > bits, const uint64_t num_bits, const uint64_t num_ones);
+	void add( const uint64_t pos );
+	void finish();
 	~simple_select_half(){}
 	uint64_t select( const uint64_t rank );
 	// Just for analysis purposes
 	void print_counts();
 	uint64_t bit_count();
+	MemoryUsage memory_usage() const;
+	// The bits belong to the caller, which shares them first and passes where they are now
+	void share( SharedArrays &arrays, const uint64_t *shared_bits );
 	
 
 private:
@@ -138,6 +158,7 @@ private:
 		ar & inventory;
 		ar & subinventory;
 		ar & bits;
+		set_views();
 	}
 };
 
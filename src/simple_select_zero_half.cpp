@@ -60,7 +60,7 @@ if ( num_bits % 64 != 0 ) c -= 64 - num_bits % 64;
 
 	fprintf(stderr,"Ones per inventory: %d Ones per sub 64: %d sub 16: %d\n", ONES_PER_INVENTORY, ONES_PER_SUB64, ONES_PER_SUB16 );	
 
-	inventory.resize(inventory_size);
+	inventory.resize(inventory_size+1);
 	subinventory.resize(inventory_size * LONGWORDS_PER_SUBINVENTORY);
 
 	uint64_t d = 0;
@@ -113,7 +113,7 @@ if ( num_bits % 64 != 0 ) d -= 64 - num_bits % 64;
 				else {
 					if ( ( d & ONES_PER_SUB64_MASK ) == 0 ) {
 						assert( offset < LONGWORDS_PER_SUBINVENTORY );
-						p64[ offset ] = i * 64 + j - start;
+						p64[ offset++ ] = i * 64 + j - start;
 						exact++;
 					}
 				}
@@ -234,4 +234,11 @@ uint64_t simple_select_zero_half::bit_count() {
 	return ( inventory_size + 1 ) * 64 + inventory_size * LONGWORDS_PER_SUBINVENTORY * 64;
 }
 
+MemoryUsage simple_select_zero_half::memory_usage() const {
+	MemoryUsage usage;
+	usage.add("inventory",vector_bytes(inventory));
+	usage.add("subinventory",vector_bytes(subinventory));
+	return usage;
+}
+
 void simple_select_zero_half::print_counts() {}
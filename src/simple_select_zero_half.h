@@ -26,6 +26,7 @@
 #include <vector>
 #include <stdint.h>
 #include "macros.h"
+#include "MemoryUsage.h"
 #include <boost/shared_ptr.hpp>
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/vector.hpp>
@@ -124,6 +125,7 @@ public:
 	// Just for analysis purposes
 	void print_counts();
 	uint64_t bit_count();
+	MemoryUsage memory_usage() const;
 
 private:	
 	friend class boost::serialization::access;